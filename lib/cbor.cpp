@@ -23,26 +23,53 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <new>
+#if !defined(CBOR_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define CBOR_SIMD_SSE2
+#endif
+#if defined(CBOR_SIMD_SSE2) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
 #include "cbor.h"
 
 /* Generic functions
  */
 
-uint8_t* cbor_get_number(uint8_t* in, uint8_t const* in_max, int64_t* val)
+/* Load 8 bytes in network order, from any alignment */
+static inline uint64_t cbor_load_be64(uint8_t const* in)
+{
+    uint64_t x;
+
+    memcpy(&x, in, 8);
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ != __ORDER_BIG_ENDIAN__
+#ifdef _MSC_VER
+    x = _byteswap_uint64(x);
+#else
+    x = __builtin_bswap64(x);
+#endif
+#endif
+    return x;
+}
+
+/* The argument on 1, 2, 4 or 8 bytes is read with a single 8 byte load,
+ * shifted according to the additional information. Near the end of the
+ * input, the bytes are read one at a time. */
+uint8_t const* cbor_get_number(uint8_t const* in, uint8_t const* in_max, int64_t* val)
 {
     int64_t v = (*in++) & 0x1F;
 
-    if (v == 0x1F) {
-        v = CBOR_END_OF_ARRAY;
+    if (v < 24) {
+        /* Immediate value */
     }
-    else if (v > 27) {
-        /* illegal value */
-        v = CBOR_ILLEGAL_VALUE;
-        in = NULL;
-    }
-    else if (v >= 24) {
+    else if (v < 28) {
         size_t l = ((size_t)1) << (v - 24);
-        if (in + l > in_max) {
+
+        if (in_max - in >= 8) {
+            v = (int64_t)(cbor_load_be64(in) >> (64 - 8 * l));
+            in += l;
+        }
+        else if ((size_t)(in_max - in) < l) {
             /* Malformed value */
             v = CBOR_MALFORMED_VALUE;
             in = NULL;
@@ -56,11 +83,142 @@ uint8_t* cbor_get_number(uint8_t* in, uint8_t const* in_max, int64_t* val)
             }
         }
     }
+    else if (v == 0x1F) {
+        v = CBOR_END_OF_ARRAY;
+    }
+    else {
+        /* illegal value */
+        v = CBOR_ILLEGAL_VALUE;
+        in = NULL;
+    }
 
     *val = v;
     return in;
 }
 
+/* Decode the integers found at in, up to nb_max. The run ends without error
+ * at the first item that is not an integer, or a negative integer if
+ * is_signed is not set; the caller then parses or skips that item. */
+uint8_t const* cbor_parse_int64_run(uint8_t const* in, uint8_t const* in_max, int64_t* v, size_t nb_max, size_t* nb_parsed, int is_signed, int* err)
+{
+    size_t n = 0;
+    uint8_t max_header = (is_signed) ? 0x3b : 0x1b;
+
+    while (n < nb_max && in < in_max && *in <= max_header && (*in & 0x1f) < 28) {
+        int is_negative = (*in & 0x20) != 0;
+        int64_t val;
+
+        if ((*in & 0x1f) < 24) {
+            val = *in++ & 0x1f;
+        }
+        else if ((in = cbor_get_number(in, in_max, &val)) == NULL || val < 0) {
+            *err = CBOR_MALFORMED_VALUE;
+            in = NULL;
+            break;
+        }
+        v[n++] = (is_negative) ? -1 - val : val;
+    }
+    *nb_parsed = n;
+
+    return in;
+}
+
+#ifdef CBOR_SIMD_SSE2
+/* Number of consecutive bits set in the 16 bit mask, starting from bit 0 */
+static inline size_t cbor_run_length16(uint32_t mask)
+{
+    uint32_t stop = (~mask) | 0x10000;
+#ifdef _MSC_VER
+    unsigned long rank;
+
+    _BitScanForward(&rank, stop);
+    return (size_t)rank;
+#else
+    return (size_t)__builtin_ctz(stop);
+#endif
+}
+
+/* Decode the run of immediate values, or the run of values with a 1 byte
+ * argument, found at the start of the 16 byte window. Up to 16 values are
+ * written to v, the first *nb of which are decoded. Returns the number of
+ * bytes consumed, 0 if the window starts with another item. This only uses
+ * SSE2, which is also available in AVX2 builds. */
+static inline size_t cbor_int_run_window(uint8_t const* in, int* v, size_t* nb)
+{
+    __m128i b = _mm_loadu_si128((__m128i const*)in);
+    __m128i zero = _mm_setzero_si128();
+    uint32_t immediate = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(b, _mm_set1_epi8(0x17)), b));
+    size_t consumed = 0;
+
+    *nb = 0;
+    if ((immediate & 1) != 0) {
+        __m128i lo = _mm_unpacklo_epi8(b, zero);
+        __m128i hi = _mm_unpackhi_epi8(b, zero);
+
+        _mm_storeu_si128((__m128i*)v, _mm_unpacklo_epi16(lo, zero));
+        _mm_storeu_si128((__m128i*)(v + 4), _mm_unpackhi_epi16(lo, zero));
+        _mm_storeu_si128((__m128i*)(v + 8), _mm_unpacklo_epi16(hi, zero));
+        _mm_storeu_si128((__m128i*)(v + 12), _mm_unpackhi_epi16(hi, zero));
+        consumed = cbor_run_length16(immediate);
+        *nb = consumed;
+    }
+    else {
+        /* Headers 0x18 at the even positions, arguments at the odd ones */
+        uint32_t pairs = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(b, _mm_set1_epi8(0x18))) | 0xaaaa;
+
+        if ((pairs & 1) != 0) {
+            __m128i args = _mm_srli_epi16(b, 8);
+
+            _mm_storeu_si128((__m128i*)v, _mm_unpacklo_epi16(args, zero));
+            _mm_storeu_si128((__m128i*)(v + 4), _mm_unpackhi_epi16(args, zero));
+            consumed = cbor_run_length16(pairs);
+            *nb = consumed / 2;
+        }
+    }
+
+    return consumed;
+}
+#endif
+
+/* Decode the unsigned integers found at in, up to nb_max, as cbor_parse_int
+ * would. The run ends without error at the first item that is not an
+ * unsigned integer. Arrays of indexes are mostly made of immediate values
+ * and of values with a 1 byte argument; with SIMD, these are widened 16 or
+ * 8 at a time when v has room for 16 more values. */
+uint8_t const* cbor_parse_int_run(uint8_t const* in, uint8_t const* in_max, int* v, size_t nb_max, size_t* nb_parsed, int* err)
+{
+    size_t n = 0;
+
+    while (n < nb_max && in < in_max && *in <= 0x1b) {
+        size_t nb = 0;
+
+#ifdef CBOR_SIMD_SSE2
+        if (in_max - in >= 16 && nb_max - n >= 16) {
+            in += cbor_int_run_window(in, v + n, &nb);
+            n += nb;
+        }
+#endif
+        if (nb == 0) {
+            if (*in < 0x18) {
+                v[n++] = *in++;
+            }
+            else {
+                int64_t val;
+
+                if ((in = cbor_get_number(in, in_max, &val)) == NULL || val < 0) {
+                    *err = CBOR_MALFORMED_VALUE;
+                    in = NULL;
+                    break;
+                }
+                v[n++] = (int)val;
+            }
+        }
+    }
+    *nb_parsed = n;
+
+    return in;
+}
+
 /* CBOR to text functions, mostly for debug purpose.
  */
 
@@ -89,7 +247,7 @@ char* cbor_print_int(char* out, char const* out_max, int64_t val, int is_negativ
     return out;
 }
 
-char* cbor_print_text_part(char* out, char const* out_max, uint8_t* in, int64_t val)
+char* cbor_print_text_part(char* out, char const* out_max, uint8_t const* in, int64_t val)
 {
     for (int64_t i = 0; i < val && out < out_max; i++) {
         int c = in[i];
@@ -129,7 +287,7 @@ static int hex_to_char(int x)
     return ((x < 10) ? '0' + x : 'a' - 10 + x);
 }
 
-char* cbor_print_bytes_part(char* out, char const* out_max, uint8_t* in, int64_t val)
+char* cbor_print_bytes_part(char* out, char const* out_max, uint8_t const* in, int64_t val)
 {
     for (int64_t i = 0; i < val && out + 1 < out_max; i++) {
         int c = in[i];
@@ -140,7 +298,7 @@ char* cbor_print_bytes_part(char* out, char const* out_max, uint8_t* in, int64_t
     return out;
 }
 
-uint8_t* cbor_text_to_text(uint8_t* in, uint8_t const* in_max, char** p_out, char const* out_max, int64_t val, int* err)
+uint8_t const* cbor_text_to_text(uint8_t const* in, uint8_t const* in_max, char** p_out, char const* out_max, int64_t val, int* err)
 {
     char* out = *p_out;
     if (out < out_max) {
@@ -189,7 +347,7 @@ uint8_t* cbor_text_to_text(uint8_t* in, uint8_t const* in_max, char** p_out, cha
     return in;
 }
 
-uint8_t* cbor_bytes_to_text(uint8_t* in, uint8_t const* in_max, char** p_out, char const* out_max, int64_t val, int* err)
+uint8_t const* cbor_bytes_to_text(uint8_t const* in, uint8_t const* in_max, char** p_out, char const* out_max, int64_t val, int* err)
 {
     char* out = *p_out;
     if (out + 2 < out_max) {
@@ -252,7 +410,7 @@ uint8_t* cbor_bytes_to_text(uint8_t* in, uint8_t const* in_max, char** p_out, ch
  * 31          -- "break" stop code for indefinite-length items
  */
 
-uint8_t* cbor_float_to_text(uint8_t* in, uint8_t const* in_max, char** p_out, char const* out_max, int64_t val, int* err)
+uint8_t const* cbor_float_to_text(uint8_t const* in, uint8_t const* in_max, char** p_out, char const* out_max, int64_t val, int* err)
 {
     char* out = *p_out;
 
@@ -306,7 +464,7 @@ uint8_t* cbor_float_to_text(uint8_t* in, uint8_t const* in_max, char** p_out, ch
     return in;
 }
 
-uint8_t* cbor_to_text(uint8_t* in, uint8_t const* in_max, char** p_out, char const* out_max, int* err)
+uint8_t const* cbor_to_text(uint8_t const* in, uint8_t const* in_max, char** p_out, char const* out_max, int* err)
 {
     char* out = *p_out;
 
@@ -387,7 +545,7 @@ uint8_t* cbor_to_text(uint8_t* in, uint8_t const* in_max, char** p_out, char con
     return in;
 }
 
-uint8_t* cbor_array_to_text(uint8_t* in, uint8_t const* in_max, char** p_out, char const* out_max, int64_t val, int is_map, int* err)
+uint8_t const* cbor_array_to_text(uint8_t const* in, uint8_t const* in_max, char** p_out, char const* out_max, int64_t val, int is_map, int* err)
 {
     int not_first = 0;
     int is_undef = 0;
@@ -454,7 +612,7 @@ uint8_t* cbor_array_to_text(uint8_t* in, uint8_t const* in_max, char** p_out, ch
  /* CBOR to text functions, mostly for debug purpose.
  */
 
-uint8_t* cbor_text_skip(uint8_t* in, uint8_t const* in_max, int64_t val, int* err)
+uint8_t const* cbor_text_skip(uint8_t const* in, uint8_t const* in_max, int64_t val, int* err)
 {
     if (val == CBOR_END_OF_ARRAY) {
         while (in < in_max && in != NULL) {
@@ -493,7 +651,7 @@ uint8_t* cbor_text_skip(uint8_t* in, uint8_t const* in_max, int64_t val, int* er
     return in;
 }
 
-uint8_t* cbor_bytes_skip(uint8_t* in, uint8_t const* in_max, int64_t val, int* err)
+uint8_t const* cbor_bytes_skip(uint8_t const* in, uint8_t const* in_max, int64_t val, int* err)
 {
     if (val == CBOR_END_OF_ARRAY) {
         while (in < in_max && in != NULL) {
@@ -535,7 +693,7 @@ uint8_t* cbor_bytes_skip(uint8_t* in, uint8_t const* in_max, int64_t val, int* e
 /* Only considering legit values (20 to 24) for now.
  */
 
-uint8_t* cbor_float_skip(uint8_t* in, uint8_t const* in_max, int64_t val, int* err)
+uint8_t const* cbor_float_skip(uint8_t const* in, uint8_t const* in_max, int64_t val, int* err)
 {
     if (val < 20 || val > 27) {
         in = NULL;
@@ -559,94 +717,164 @@ uint8_t* cbor_float_skip(uint8_t* in, uint8_t const* in_max, int64_t val, int* e
     return in;
 }
 
-uint8_t* cbor_array_skip(uint8_t* in, uint8_t const* in_max, int64_t val, int is_map, int* err)
+/* Skip a run of integers below 24, positive or negative, which are coded
+ * on a single byte, starting with the one at in. These are most of the content of the C-DNS index lists.
+ * Eight bytes are tested at a time: the major type shall be 0 or 1, and the
+ * additional information shall be below 24, so that adding 8 does not set
+ * bit 5. */
+static int64_t cbor_skip_small_ints(uint8_t const* in, uint8_t const* in_max, int64_t max_items)
 {
-    int is_undef = 0;
+    int64_t n = 1;
 
-    if (val == CBOR_END_OF_ARRAY) {
-        is_undef = 1;
-        val = 0xffffffff;
-    }
-    else if (is_map != 0) {
-        val *= 2;
-    }
+    in++;
+    while (max_items - n >= 8 && in_max - in >= 8) {
+        uint64_t w;
 
-    while (val > 0 && in != NULL) {
-        if (in >= in_max) {
-            *err = CBOR_MALFORMED_VALUE;
-            in = NULL;
-        }
-        else if (*in == CBOR_END_MARK) {
-            if (is_undef) {
-                in++;
-                break;
-            }
-            else {
-                *err = CBOR_MALFORMED_VALUE;
-                in = NULL;
-            }
-        }
-        else {
-            val--;
-            in = cbor_skip(in, in_max, err);
+        memcpy(&w, in, 8);
+        if ((w & 0xC0C0C0C0C0C0C0C0ull) != 0 ||
+            (((w & 0x1F1F1F1F1F1F1F1Full) + 0x0808080808080808ull) & 0x2020202020202020ull) != 0) {
+            break;
         }
+        in += 8;
+        n += 8;
     }
 
-    if (is_map != 0 && is_undef != 0 && in != NULL) {
-        int64_t nb_pairs = ((int64_t)0xffffffff) - val;
+    while (n < max_items && in < in_max && (*in & 0xdf) < 24) {
+        in++;
+        n++;
+    }
 
-        if ((nb_pairs & 1) != 0) {
-            *err = CBOR_MALFORMED_VALUE;
-            in = NULL;
+    return n;
+}
+
+/* An array or map being skipped. Definite length containers count the items
+ * remaining, indefinite length ones count the items found, so that maps can
+ * be checked for complete pairs. */
+typedef struct st_cbor_skip_frame_t {
+    int64_t nb_items;
+    int is_undef;
+    int is_map;
+} cbor_skip_frame_t;
+
+#define CBOR_SKIP_STACK 16
+
+/* Move the stack to the heap, or double its size, within max_depth. Returns
+ * false if the memory cannot be allocated. */
+static bool cbor_skip_grow(cbor_skip_frame_t** stack, cbor_skip_frame_t** large_stack, int* stack_size, int depth, int max_depth)
+{
+    int new_size = (*stack_size > max_depth / 2) ? max_depth : 2 * (*stack_size);
+    cbor_skip_frame_t* new_stack = new (std::nothrow) cbor_skip_frame_t[new_size];
+    bool ret = (new_stack != NULL);
+
+    if (ret) {
+        cbor_skip_frame_t* old_stack = *large_stack;
+
+        memcpy(new_stack, *stack, depth * sizeof(cbor_skip_frame_t));
+        if (old_stack != NULL) {
+            delete[] old_stack;
         }
+        *large_stack = new_stack;
+        *stack = new_stack;
+        *stack_size = new_size;
     }
 
-    return in;
+    return ret;
 }
 
-uint8_t* cbor_skip(uint8_t* in, uint8_t const* in_max, int* err)
+uint8_t const* cbor_skip(uint8_t const* in, uint8_t const* in_max, int* err)
 {
-    if (in != NULL && in < in_max) {
-        int cbor_class = CBOR_CLASS(*in);
-        int64_t val;
+    return cbor_skip_depth(in, in_max, CBOR_MAX_DEPTH, err);
+}
 
-        in = cbor_get_number(in, in_max, &val);
+/* Skip a data item, without recursion. The open arrays and maps are held in
+ * an explicit stack, on the heap beyond CBOR_SKIP_STACK levels, doubling as
+ * needed. Nesting more than max_depth containers is an error, and so is a
+ * failure to grow the stack.
+ * As with the recursive version, nothing is skipped at the end of the input.
+ */
+uint8_t const* cbor_skip_depth(uint8_t const* in, uint8_t const* in_max, int max_depth, int* err)
+{
+    cbor_skip_frame_t local_stack[CBOR_SKIP_STACK];
+    cbor_skip_frame_t* large_stack = NULL;
+    cbor_skip_frame_t* stack = local_stack;
+    int stack_size = CBOR_SKIP_STACK;
+    int depth = 0;
+    int is_started = 0;
+
+    if (in == NULL || in >= in_max) {
+        return in;
+    }
 
-        if (in == NULL) {
-            *err = (int)val;
+    for (;;) {
+        int cbor_class;
+        int64_t val;
+        int64_t nb_items;
+        int is_undef;
+
+        while (depth > 0 && !stack[depth - 1].is_undef && stack[depth - 1].nb_items == 0) {
+            depth--;
         }
-        else if (val == CBOR_END_OF_ARRAY) {
-            switch (cbor_class) {
-            case CBOR_T_UINT: /* unsigned integer */
-            case CBOR_T_NINT: /* negative integer */
-            case CBOR_T_FLOAT:
-                in = NULL;
+        if (in == NULL || (depth == 0 && is_started)) {
+            break;
+        }
+        is_started = 1;
+
+        if (depth > 0) {
+            cbor_skip_frame_t* top = &stack[depth - 1];
+            int64_t nb_small;
+
+            if (in >= in_max) {
                 *err = CBOR_MALFORMED_VALUE;
+                in = NULL;
                 break;
-            case CBOR_T_BYTES:
-                in = cbor_bytes_skip(in, in_max, val, err);
-                break;
-            case CBOR_T_TEXT:
-                in = cbor_text_skip(in, in_max, val, err);
-                break;
-            case CBOR_T_ARRAY:
-                in = cbor_array_skip(in, in_max, val, 0, err);
-                break;
-            case CBOR_T_MAP:
-                in = cbor_array_skip(in, in_max, val, 1, err);
-                break;
-            case CBOR_T_TAGGED:
-                /* TODO: manage these types */
+            }
+            if (*in == CBOR_END_MARK) {
+                if (top->is_undef && (!top->is_map || (top->nb_items & 1) == 0)) {
+                    in++;
+                    depth--;
+                    continue;
+                }
+                *err = CBOR_MALFORMED_VALUE;
                 in = NULL;
-                *err = CBOR_NOT_IMPLEMENTED;
                 break;
             }
+            if (*in < 0x40 && (*in & 0x1f) < 27) {
+                /* Integers are skipped without decoding the value, and the
+                 * runs of single byte integers several at a time. The 8 byte
+                 * integers are decoded, because the value -1 is an error. */
+                if ((*in & 0x1f) < 24) {
+                    nb_small = cbor_skip_small_ints(in, in_max, (top->is_undef) ? INT64_MAX : top->nb_items);
+                    in += nb_small;
+                }
+                else if (in_max - in > (1 << ((*in & 0x1f) - 24))) {
+                    in += 1 + (1 << ((*in & 0x1f) - 24));
+                    nb_small = 1;
+                }
+                else {
+                    *err = CBOR_MALFORMED_VALUE;
+                    in = NULL;
+                    break;
+                }
+                top->nb_items += (top->is_undef) ? nb_small : -nb_small;
+                continue;
+            }
+            top->nb_items += (top->is_undef) ? 1 : -1;
+        }
+
+        cbor_class = CBOR_CLASS(*in);
+        in = cbor_get_number(in, in_max, &val);
+
+        if (in == NULL) {
+            *err = (int)val;
         }
         else {
             switch (cbor_class) {
             case CBOR_T_UINT: /* unsigned integer */
-                break;
             case CBOR_T_NINT: /* negative integer */
+                if (val == CBOR_END_OF_ARRAY) {
+                    in = NULL;
+                    *err = CBOR_MALFORMED_VALUE;
+                }
                 break;
             case CBOR_T_BYTES:
                 in = cbor_bytes_skip(in, in_max, val, err);
@@ -655,10 +883,29 @@ uint8_t* cbor_skip(uint8_t* in, uint8_t const* in_max, int* err)
                 in = cbor_text_skip(in, in_max, val, err);
                 break;
             case CBOR_T_ARRAY:
-                in = cbor_array_skip(in, in_max, val, 0, err);
-                break;
             case CBOR_T_MAP:
-                in = cbor_array_skip(in, in_max, val, 1, err);
+                /* As in the recursive version, a count that wraps is not an error */
+                is_undef = (val == CBOR_END_OF_ARRAY);
+                nb_items = (is_undef) ? 0 : ((cbor_class == CBOR_T_MAP) ? (int64_t)((uint64_t)val * 2) : val);
+
+                if (!is_undef && nb_items <= 0) {
+                    /* Empty */
+                }
+                else if (depth >= max_depth) {
+                    in = NULL;
+                    *err = CBOR_DEPTH_EXCEEDED;
+                }
+                else if (depth == stack_size && !cbor_skip_grow(&stack, &large_stack, &stack_size, depth, max_depth)) {
+                    /* Deep nesting is rare, the stack moves to the heap and grows on demand */
+                    in = NULL;
+                    *err = CBOR_MALFORMED_VALUE;
+                }
+                else {
+                    stack[depth].is_map = (cbor_class == CBOR_T_MAP);
+                    stack[depth].is_undef = is_undef;
+                    stack[depth].nb_items = nb_items;
+                    depth++;
+                }
                 break;
             case CBOR_T_TAGGED:
                 /* TODO: manage these types */
@@ -666,17 +913,26 @@ uint8_t* cbor_skip(uint8_t* in, uint8_t const* in_max, int* err)
                 *err = CBOR_NOT_IMPLEMENTED;
                 break;
             case CBOR_T_FLOAT:
-                /* TODO: manage these types */
-                in = cbor_float_skip(in, in_max, val, err);
+                if (val == CBOR_END_OF_ARRAY) {
+                    in = NULL;
+                    *err = CBOR_MALFORMED_VALUE;
+                }
+                else {
+                    in = cbor_float_skip(in, in_max, val, err);
+                }
                 break;
             }
         }
     }
 
+    if (large_stack != NULL) {
+        delete[] large_stack;
+    }
+
     return in;
 }
 
-uint8_t* cbor_parse_int(uint8_t* in, uint8_t const* in_max, int* v, int is_signed, int* err)
+uint8_t const* cbor_parse_int(uint8_t const* in, uint8_t const* in_max, int* v, int is_signed, int* err)
 {
     int64_t val = 0;
 
@@ -687,7 +943,7 @@ uint8_t* cbor_parse_int(uint8_t* in, uint8_t const* in_max, int* v, int is_signe
     return in;
 }
 
-uint8_t* cbor_parse_int64(uint8_t* in, uint8_t const* in_max, int64_t* v, int is_signed, int* err)
+uint8_t const* cbor_parse_int64(uint8_t const* in, uint8_t const* in_max, int64_t* v, int is_signed, int* err)
 {
     int64_t val;
     int outer_type = CBOR_CLASS(*in);
@@ -713,7 +969,7 @@ uint8_t* cbor_parse_int64(uint8_t* in, uint8_t const* in_max, int64_t* v, int is
 }
 
 /* Boolean type is encoded as a subset of the "single value type", looking only at "true" or "false" values */
-uint8_t* cbor_parse_boolean(uint8_t* in, uint8_t const* in_max, bool* v, int* err)
+uint8_t const* cbor_parse_boolean(uint8_t const* in, uint8_t const* in_max, bool* v, int* err)
 {
     int64_t val;
     int outer_type = CBOR_CLASS(*in);
@@ -735,13 +991,15 @@ uint8_t* cbor_parse_boolean(uint8_t* in, uint8_t const* in_max, bool* v, int* er
 
 cbor_bytes::cbor_bytes() :
     v(NULL),
-    l(0)
+    l(0),
+    allocated(0)
 {
 }
 
 cbor_bytes::cbor_bytes(const cbor_bytes& other)
 {
     l = other.l;
+    allocated = l;
     if (l > 0) {
         v = new uint8_t[l];
         memcpy(v, other.v, l);
@@ -751,6 +1009,16 @@ cbor_bytes::cbor_bytes(const cbor_bytes& other)
     }
 }
 
+cbor_bytes::cbor_bytes(cbor_bytes&& other) noexcept :
+    v(other.v),
+    l(other.l),
+    allocated(other.allocated)
+{
+    other.v = NULL;
+    other.l = 0;
+    other.allocated = 0;
+}
+
 cbor_bytes::~cbor_bytes()
 {
     if (v != NULL) {
@@ -759,15 +1027,64 @@ cbor_bytes::~cbor_bytes()
     }
 
     l = 0;
+    allocated = 0;
+}
+
+/* Make sure that the buffer can hold the specified length. The
+ * buffer is only reallocated if it is too small. */
+static uint8_t* cbor_buffer_reserve(uint8_t* v, size_t* allocated, size_t length)
+{
+    if (length > *allocated || v == NULL) {
+        if (v != NULL) {
+            delete[] v;
+        }
+        v = new uint8_t[length];
+        *allocated = (v == NULL) ? 0 : length;
+    }
+
+    return v;
 }
 
-uint8_t* cbor_bytes::parse(uint8_t* in, uint8_t const* in_max, int* err)
+cbor_bytes& cbor_bytes::operator=(const cbor_bytes& other)
 {
-    uint8_t* first = in;
+    if (this != &other) {
+        l = 0;
+        if (other.l > 0) {
+            v = cbor_buffer_reserve(v, &allocated, other.l);
+            if (v != NULL) {
+                memcpy(v, other.v, other.l);
+                l = other.l;
+            }
+        }
+    }
 
-    if (v != NULL || l != 0 || in == NULL) {
+    return *this;
+}
+
+cbor_bytes& cbor_bytes::operator=(cbor_bytes&& other) noexcept
+{
+    if (this != &other) {
+        if (v != NULL) {
+            delete[] v;
+        }
+        v = other.v;
+        l = other.l;
+        allocated = other.allocated;
+        other.v = NULL;
+        other.l = 0;
+        other.allocated = 0;
+    }
+
+    return *this;
+}
+
+uint8_t const* cbor_bytes::parse(uint8_t const* in, uint8_t const* in_max, int* err)
+{
+    uint8_t const* first = in;
+
+    l = 0;
+    if (in == NULL) {
         *err = CBOR_UNEXPECTED;
-        in = NULL;
     }
     else {
         int outer_type = CBOR_CLASS(*in);
@@ -781,14 +1098,13 @@ uint8_t* cbor_bytes::parse(uint8_t* in, uint8_t const* in_max, int* err)
         }
         else  if (val == CBOR_END_OF_ARRAY) {
             /* Need to allocate enough bytes to hold the content. */
-            uint8_t* last = cbor_skip(first, in_max, err);
+            uint8_t const* last = cbor_skip(first, in_max, err);
 
             if (last == NULL) {
                 in = NULL;
             }
             else {
-                size_t allocated = last - first;
-                v = new uint8_t[allocated];
+                v = cbor_buffer_reserve(v, &allocated, last - first);
 
                 if (v == NULL) {
                     in = NULL;
@@ -828,7 +1144,7 @@ uint8_t* cbor_bytes::parse(uint8_t* in, uint8_t const* in_max, int* err)
                 in = NULL;
             }
             else if (val > 0) {
-                v = new uint8_t[(size_t)val];
+                v = cbor_buffer_reserve(v, &allocated, (size_t)val);
                 if (v == NULL) {
                     in = NULL;
                     *err = CBOR_MEMORY;
@@ -845,7 +1161,210 @@ uint8_t* cbor_bytes::parse(uint8_t* in, uint8_t const* in_max, int* err)
     return in;
 }
 
-uint8_t* cbor_object_parse(uint8_t* in, uint8_t const* in_max, int* v, int* err)
+#define CBOR_ARENA_CHUNK_SIZE 0x10000
+
+cbor_arena::cbor_arena() :
+    copy_all(false),
+    current(0),
+    used(0)
+{
+}
+
+cbor_arena::~cbor_arena()
+{
+    for (size_t i = 0; i < chunks.size(); i++) {
+        delete[] chunks[i];
+    }
+}
+
+uint8_t* cbor_arena::alloc(size_t length)
+{
+    return alloc_aligned(length, 1);
+}
+
+/* The alignment must be a power of 2. The chunks are allocated with new[],
+ * which provides the alignment required by any standard type. */
+uint8_t* cbor_arena::alloc_aligned(size_t length, size_t alignment)
+{
+    uint8_t* p = NULL;
+    size_t start = 0;
+
+    /* Skip the chunks that are too small */
+    while (current < chunks.size()) {
+        start = (used + alignment - 1) & ~(alignment - 1);
+        if (start <= chunk_sizes[current] && length <= chunk_sizes[current] - start) {
+            break;
+        }
+        current++;
+        used = 0;
+    }
+
+    if (current >= chunks.size()) {
+        size_t chunk_size = (length > CBOR_ARENA_CHUNK_SIZE) ? length : CBOR_ARENA_CHUNK_SIZE;
+        uint8_t* chunk = new uint8_t[chunk_size];
+
+        if (chunk != NULL) {
+            chunks.push_back(chunk);
+            chunk_sizes.push_back(chunk_size);
+            current = chunks.size() - 1;
+            start = 0;
+        }
+    }
+
+    if (current < chunks.size()) {
+        p = chunks[current] + start;
+        used = start + length;
+    }
+
+    return p;
+}
+
+void cbor_arena::reset()
+{
+    if (chunks.size() > 1) {
+        /* Merge the chunks, so that the same content fits in a single chunk
+         * the next time, and the memory does not grow with each reset. */
+        size_t total = capacity();
+        uint8_t* chunk;
+
+        for (size_t i = 0; i < chunks.size(); i++) {
+            delete[] chunks[i];
+        }
+        chunks.clear();
+        chunk_sizes.clear();
+        chunk = new uint8_t[total];
+        if (chunk != NULL) {
+            chunks.push_back(chunk);
+            chunk_sizes.push_back(total);
+        }
+    }
+    current = 0;
+    used = 0;
+}
+
+size_t cbor_arena::capacity() const
+{
+    size_t total = 0;
+
+    for (size_t i = 0; i < chunk_sizes.size(); i++) {
+        total += chunk_sizes[i];
+    }
+
+    return total;
+}
+
+void cbor_arena::swap(cbor_arena* other)
+{
+    bool c = copy_all;
+    size_t x = current;
+    size_t u = used;
+
+    copy_all = other->copy_all;
+    other->copy_all = c;
+    current = other->current;
+    other->current = x;
+    used = other->used;
+    other->used = u;
+    chunks.swap(other->chunks);
+    chunk_sizes.swap(other->chunk_sizes);
+}
+
+cbor_bytes_view::cbor_bytes_view() :
+    v(NULL),
+    l(0)
+{
+}
+
+cbor_bytes_view::~cbor_bytes_view()
+{
+}
+
+uint8_t const* cbor_bytes_view::parse(uint8_t const* in, uint8_t const* in_max, int* err, cbor_arena* arena)
+{
+    uint8_t const* first = in;
+    int outer_type = CBOR_CLASS(*in);
+    int64_t val;
+
+    v = NULL;
+    l = 0;
+    in = cbor_get_number(in, in_max, &val);
+
+    if (in == NULL || outer_type != CBOR_T_BYTES) {
+        *err = CBOR_MALFORMED_VALUE;
+        in = NULL;
+    }
+    else if (val == CBOR_END_OF_ARRAY) {
+        /* The chunks are copied into the arena. The skipped length is an
+         * upper bound of the content length. */
+        uint8_t const* last = cbor_skip(first, in_max, err);
+        uint8_t* copy = NULL;
+
+        if (last == NULL) {
+            in = NULL;
+        }
+        else if ((copy = arena->alloc(last - first)) == NULL) {
+            *err = CBOR_MEMORY;
+            in = NULL;
+        }
+        else {
+            v = copy;
+        }
+
+        while (in != NULL && in < in_max) {
+            if (*in == CBOR_END_MARK) {
+                in++;
+                break;
+            }
+            else {
+                int cbor_class = CBOR_CLASS(*in);
+
+                in = cbor_get_number(in, in_max, &val);
+
+                if (in == NULL) {
+                    *err = CBOR_MALFORMED_VALUE;
+                }
+                else if (val < 0 || in + val > in_max || cbor_class != CBOR_T_BYTES) {
+                    *err = CBOR_MALFORMED_VALUE;
+                    in = NULL;
+                }
+                else if (val > 0) {
+                    memcpy(copy + l, in, (size_t)val);
+                    l += (size_t)val;
+                    in += val;
+                }
+            }
+        }
+    }
+    else if (val < 0 || in + val > in_max) {
+        *err = CBOR_MALFORMED_VALUE;
+        in = NULL;
+    }
+    else {
+        if (val > 0 && arena->copy_all) {
+            uint8_t* copy = arena->alloc((size_t)val);
+
+            if (copy == NULL) {
+                *err = CBOR_MEMORY;
+                in = NULL;
+            }
+            else {
+                memcpy(copy, in, (size_t)val);
+                v = copy;
+            }
+        }
+        else {
+            v = in;
+        }
+        if (in != NULL) {
+            l = (size_t)val;
+            in += val;
+        }
+    }
+
+    return in;
+}
+
+uint8_t const* cbor_object_parse(uint8_t const* in, uint8_t const* in_max, int* v, int* err)
 {
     in = cbor_parse_int(in, in_max, v, 0, err);
     return in;
@@ -853,19 +1372,22 @@ uint8_t* cbor_object_parse(uint8_t* in, uint8_t const* in_max, int* v, int* err)
 
 cbor_text::cbor_text():
     v(NULL),
-    l(0)
+    l(0),
+    allocated(0)
 {
 }
 
 cbor_text::cbor_text(const cbor_text& other)
 {
     l = other.l;
+    allocated = 0;
     if (l > 0) {
         v = new char[l+1];
         if (v == NULL) {
             l = 0;
         }
         else {
+            allocated = l + 1;
             memcpy(v, other.v, l);
             v[l] = 0;
         }
@@ -875,6 +1397,16 @@ cbor_text::cbor_text(const cbor_text& other)
     }
 }
 
+cbor_text::cbor_text(cbor_text&& other) noexcept :
+    v(other.v),
+    l(other.l),
+    allocated(other.allocated)
+{
+    other.v = NULL;
+    other.l = 0;
+    other.allocated = 0;
+}
+
 cbor_text::~cbor_text()
 {
     if (v != NULL) {
@@ -883,15 +1415,56 @@ cbor_text::~cbor_text()
     }
 
     l = 0;
+    allocated = 0;
 }
 
-uint8_t* cbor_text::parse(uint8_t* in, uint8_t const* in_max, int* err)
+cbor_text& cbor_text::operator=(const cbor_text& other)
 {
-    uint8_t* first = in;
+    if (this != &other) {
+        l = 0;
+        if (other.l > 0) {
+            v = (char*)cbor_buffer_reserve((uint8_t*)v, &allocated, other.l + 1);
+            if (v != NULL) {
+                memcpy(v, other.v, other.l);
+                l = other.l;
+                v[l] = 0;
+            }
+        }
+        else if (v != NULL) {
+            v[0] = 0;
+        }
+    }
+
+    return *this;
+}
 
-    if (v != NULL || l != 0 || in == NULL) {
+cbor_text& cbor_text::operator=(cbor_text&& other) noexcept
+{
+    if (this != &other) {
+        if (v != NULL) {
+            delete[] v;
+        }
+        v = other.v;
+        l = other.l;
+        allocated = other.allocated;
+        other.v = NULL;
+        other.l = 0;
+        other.allocated = 0;
+    }
+
+    return *this;
+}
+
+uint8_t const* cbor_text::parse(uint8_t const* in, uint8_t const* in_max, int* err)
+{
+    uint8_t const* first = in;
+
+    l = 0;
+    if (v != NULL) {
+        v[0] = 0;
+    }
+    if (in == NULL) {
         *err = CBOR_UNEXPECTED;
-        in = NULL;
     }
     else {
         int outer_type = CBOR_CLASS(*in);
@@ -905,14 +1478,13 @@ uint8_t* cbor_text::parse(uint8_t* in, uint8_t const* in_max, int* err)
         }
         else if (val == CBOR_END_OF_ARRAY) {
             /* Need to allocate enough bytes to hold the content. */
-            uint8_t* last = cbor_skip(first, in_max, err);
+            uint8_t const* last = cbor_skip(first, in_max, err);
 
             if (last == NULL) {
                 in = NULL;
             }
             else {
-                size_t allocated = (last - first) + 1;
-                v = new char[allocated];
+                v = (char*)cbor_buffer_reserve((uint8_t*)v, &allocated, (last - first) + 1);
 
                 if (v == NULL) {
                     in = NULL;
@@ -953,7 +1525,7 @@ uint8_t* cbor_text::parse(uint8_t* in, uint8_t const* in_max, int* err)
                 in = NULL;
             }
             else if (val > 0) {
-                v = new char[(size_t)(val+1)];
+                v = (char*)cbor_buffer_reserve((uint8_t*)v, &allocated, (size_t)(val + 1));
                 if (v == NULL) {
                     in = NULL;
                     *err = CBOR_MEMORY;
@@ -23,6 +23,8 @@
 #define CBOR_H
 
 #include <vector>
+#include <new>
+#include <type_traits>
 
 #define CBOR_CLASS(x) (((x)>>5)&7)
 #define CBOR_T_UINT 0
@@ -40,73 +42,203 @@
 #define CBOR_NOT_IMPLEMENTED -4
 #define CBOR_UNEXPECTED -5
 #define CBOR_MEMORY -6
+#define CBOR_DEPTH_EXCEEDED -7
+
+#define CBOR_MAX_DEPTH 64 /* Nesting limit of cbor_skip */
+#define CBOR_ARRAY_PRESIZE_MAX 0x100000 /* Largest element count sized from an untrusted array header */
 
 #define CBOR_END_MARK 0xff
 
 
-uint8_t* cbor_get_number(uint8_t* in, uint8_t const* in_max, int64_t* val);
+uint8_t const* cbor_get_number(uint8_t const* in, uint8_t const* in_max, int64_t* val);
 char* cbor_print_int(char* out, char const* out_max, int64_t val, int is_negative);
-char* cbor_print_text_part(char* out, char const* out_max, uint8_t* in, int64_t val);
-char* cbor_print_bytes_part(char* out, char const* out_max, uint8_t* in, int64_t val);
-uint8_t* cbor_text_to_text(uint8_t* in, uint8_t const* in_max, char** p_out, char const* out_max, int64_t val, int* err);
-uint8_t* cbor_bytes_to_text(uint8_t* in, uint8_t const* in_max, char** p_out, char const* out_max, int64_t val, int* err);
-uint8_t* cbor_float_to_text(uint8_t* in, uint8_t const* in_max, char** p_out, char const* out_max, int64_t val, int* err);
-uint8_t* cbor_array_to_text(uint8_t* in, uint8_t const* in_max, char** p_out, char const* out_max, int64_t val, int is_map, int* err);
-uint8_t* cbor_to_text(uint8_t* in, uint8_t const* in_max, char** p_out, char const* out_max, int* err);
-
-uint8_t* cbor_skip(uint8_t* in, uint8_t const* in_max, int* err);
-
-uint8_t* cbor_parse_int(uint8_t* in, uint8_t const* in_max, int* v, int is_signed, int* err);
-uint8_t* cbor_parse_int64(uint8_t* in, uint8_t const* in_max, int64_t* v, int is_signed, int* err);
-uint8_t* cbor_parse_boolean(uint8_t* in, uint8_t const* in_max, bool *v, int* err);
-
+char* cbor_print_text_part(char* out, char const* out_max, uint8_t const* in, int64_t val);
+char* cbor_print_bytes_part(char* out, char const* out_max, uint8_t const* in, int64_t val);
+uint8_t const* cbor_text_to_text(uint8_t const* in, uint8_t const* in_max, char** p_out, char const* out_max, int64_t val, int* err);
+uint8_t const* cbor_bytes_to_text(uint8_t const* in, uint8_t const* in_max, char** p_out, char const* out_max, int64_t val, int* err);
+uint8_t const* cbor_float_to_text(uint8_t const* in, uint8_t const* in_max, char** p_out, char const* out_max, int64_t val, int* err);
+uint8_t const* cbor_array_to_text(uint8_t const* in, uint8_t const* in_max, char** p_out, char const* out_max, int64_t val, int is_map, int* err);
+uint8_t const* cbor_to_text(uint8_t const* in, uint8_t const* in_max, char** p_out, char const* out_max, int* err);
+
+uint8_t const* cbor_skip(uint8_t const* in, uint8_t const* in_max, int* err);
+uint8_t const* cbor_skip_depth(uint8_t const* in, uint8_t const* in_max, int max_depth, int* err);
+
+uint8_t const* cbor_parse_int(uint8_t const* in, uint8_t const* in_max, int* v, int is_signed, int* err);
+uint8_t const* cbor_parse_int64(uint8_t const* in, uint8_t const* in_max, int64_t* v, int is_signed, int* err);
+uint8_t const* cbor_parse_int64_run(uint8_t const* in, uint8_t const* in_max, int64_t* v, size_t nb_max, size_t* nb_parsed, int is_signed, int* err);
+uint8_t const* cbor_parse_int_run(uint8_t const* in, uint8_t const* in_max, int* v, size_t nb_max, size_t* nb_parsed, int* err);
+uint8_t const* cbor_parse_boolean(uint8_t const* in, uint8_t const* in_max, bool *v, int* err);
+
+/* The byte and text parsers reuse the buffer from a previous parse if it is
+ * large enough, so parsing in place does not allocate memory. Moves transfer
+ * the buffer, so growing a vector of strings does not copy them. */
 class cbor_bytes {
 public:
     cbor_bytes();
     cbor_bytes(const cbor_bytes &other);
+    cbor_bytes(cbor_bytes&& other) noexcept;
     ~cbor_bytes();
 
-    uint8_t* parse(uint8_t* in, uint8_t const* in_max, int* err);
+    cbor_bytes& operator=(const cbor_bytes& other);
+    cbor_bytes& operator=(cbor_bytes&& other) noexcept;
+
+    uint8_t const* parse(uint8_t const* in, uint8_t const* in_max, int* err);
 
     uint8_t* v;
     size_t l;
+    size_t allocated;
 };
 
 class cbor_text {
 public:
     cbor_text();
     cbor_text(const cbor_text& other);
+    cbor_text(cbor_text&& other) noexcept;
     ~cbor_text();
 
-    uint8_t* parse(uint8_t* in, uint8_t const* in_max, int* err);
+    cbor_text& operator=(const cbor_text& other);
+    cbor_text& operator=(cbor_text&& other) noexcept;
+
+    uint8_t const* parse(uint8_t const* in, uint8_t const* in_max, int* err);
 
     char* v;
     size_t l;
+    size_t allocated;
+};
+
+/* Monotonic arena. Memory is allocated from large chunks, and released all at
+ * once by reset(), which keeps the chunks for reuse. If more than one chunk
+ * was needed, reset() merges them into a single chunk of the total size. */
+class cbor_arena {
+public:
+    cbor_arena();
+    ~cbor_arena();
+
+    uint8_t* alloc(size_t length);
+    uint8_t* alloc_aligned(size_t length, size_t alignment);
+    void reset();
+    void swap(cbor_arena* other);
+    size_t capacity() const;
+
+    bool copy_all; /* Set if the input buffer may move, e.g. a sliding window */
+
+private:
+    cbor_arena(const cbor_arena& other);
+    cbor_arena& operator=(const cbor_arena& other);
+
+    std::vector<uint8_t*> chunks;
+    std::vector<size_t> chunk_sizes;
+    size_t current;
+    size_t used;
+};
+
+/* Byte string view. Definite-length strings point directly into the input
+ * buffer, without copying. Indefinite-length strings are made of several
+ * chunks, which are copied into the arena, as are all strings if the arena
+ * has copy_all set. */
+class cbor_bytes_view {
+public:
+    cbor_bytes_view();
+    ~cbor_bytes_view();
+
+    uint8_t const* parse(uint8_t const* in, uint8_t const* in_max, int* err, cbor_arena* arena);
+
+    uint8_t const* v;
+    size_t l;
 };
 
-template <class ParsedClass> uint8_t* cbor_object_parse(uint8_t* in, uint8_t const* in_max, ParsedClass* v, int* err)
+/* Allocator for the standard containers, backed by an arena. Deallocation
+ * does nothing, the memory is recovered when the arena is reset. The
+ * allocator follows the storage when containers are moved or swapped, but
+ * copies of a container use the heap, so they can outlive the arena.
+ * Without an arena, the allocator uses the heap. */
+template <class T> class cbor_arena_allocator {
+public:
+    typedef T value_type;
+    typedef std::false_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    cbor_arena_allocator() : arena(NULL) {}
+    explicit cbor_arena_allocator(cbor_arena* arena) : arena(arena) {}
+    template <class U> cbor_arena_allocator(const cbor_arena_allocator<U>& other) : arena(other.arena) {}
+
+    cbor_arena_allocator select_on_container_copy_construction() const
+    {
+        return cbor_arena_allocator();
+    }
+
+    T* allocate(size_t n)
+    {
+        void* p;
+
+        if (arena == NULL) {
+            p = ::operator new(n * sizeof(T));
+        }
+        else if ((p = arena->alloc_aligned(n * sizeof(T), alignof(T))) == NULL) {
+            throw std::bad_alloc();
+        }
+
+        return static_cast<T*>(p);
+    }
+
+    void deallocate(T* p, size_t n)
+    {
+        (void)n;
+        if (arena == NULL) {
+            ::operator delete(p);
+        }
+    }
+
+    cbor_arena* arena;
+};
+
+template <class T, class U> bool operator==(const cbor_arena_allocator<T>& a, const cbor_arena_allocator<U>& b)
+{
+    return a.arena == b.arena;
+}
+
+template <class T, class U> bool operator!=(const cbor_arena_allocator<T>& a, const cbor_arena_allocator<U>& b)
+{
+    return a.arena != b.arena;
+}
+
+template <class T> using cbor_arena_vector = std::vector<T, cbor_arena_allocator<T> >;
+
+/* Drop the content and storage of a vector, and bind it to the arena. The
+ * storage is not freed, it will be recovered when the arena is reset. */
+template <class T> void cbor_arena_vector_release(cbor_arena_vector<T>* v, cbor_arena* arena)
+{
+    cbor_arena_vector<T> empty((cbor_arena_allocator<T>(arena)));
+
+    v->swap(empty);
+}
+
+template <class ParsedClass> uint8_t const* cbor_object_parse(uint8_t const* in, uint8_t const* in_max, ParsedClass* v, int* err)
 {
     in = v->parse(in, in_max, err);
     return in;
 }
 
-template <class ParsedClass, class CtxClass> uint8_t* cbor_object_ctx_parse(uint8_t* in, uint8_t const* in_max, ParsedClass* v, int* err, CtxClass* ctx)
+template <class ParsedClass, class CtxClass> uint8_t const* cbor_object_ctx_parse(uint8_t const* in, uint8_t const* in_max, ParsedClass* v, int* err, CtxClass* ctx)
 {
     in = v->parse(in, in_max, err, ctx);
     return in;
 }
 
-uint8_t* cbor_object_parse(uint8_t* in, uint8_t const* in_max, int* v, int* err);
+uint8_t const* cbor_object_parse(uint8_t const* in, uint8_t const* in_max, int* v, int* err);
 
 /* cbor_array_parse:
    Parse a CBOR input into an array of InnerType.
-   This construct assumes that the Inner Class is copy insertable, i.e. has copy constructor,
-   and that it can be parsed using cbor_objest_parse.
+   This construct assumes that the Inner Class is move insertable, i.e. has a move or copy
+   constructor, and that it can be parsed using cbor_objest_parse.
+   The previous content of the vector is cleared. A definite length array is sized
+   once from its length header.
    If the generic cbor_object_parse<InnerClass> does not work, the implementation
    must supply a specific function, as in the integer example above.
    */
-template <class InnerClass>
-uint8_t* cbor_array_parse(uint8_t* in, uint8_t const* in_max, std::vector<InnerClass> * v, int* err)
+template <class InnerClass, class Alloc>
+uint8_t const* cbor_array_parse(uint8_t const* in, uint8_t const* in_max, std::vector<InnerClass, Alloc> * v, int* err)
 {
     int64_t val;
     int outer_type = CBOR_CLASS(*in);
@@ -119,13 +251,25 @@ uint8_t* cbor_array_parse(uint8_t* in, uint8_t const* in_max, std::vector<InnerC
         in = NULL;
     }
     else {
-        int rank = 0;
+        size_t rank = 0;
+
+        v->clear();
         if (val == CBOR_END_OF_ARRAY) {
             is_undef = 1;
             val = 0xffffffff;
         }
+        else if (val > in_max - in) {
+            /* Each element takes at least one byte */
+            *err = CBOR_MALFORMED_VALUE;
+            in = NULL;
+        }
+        else {
+            /* Size the array once, from the length header. Larger arrays
+             * grow as their elements are parsed. */
+            v->resize((size_t)((val < CBOR_ARRAY_PRESIZE_MAX) ? val : CBOR_ARRAY_PRESIZE_MAX));
+        }
         
-        while (rank < val && in != NULL && in < in_max) {
+        while ((int64_t)rank < val && in != NULL && in < in_max) {
             if (*in == 0xff) {
                 if (is_undef) {
                     in++;
@@ -137,21 +281,102 @@ uint8_t* cbor_array_parse(uint8_t* in, uint8_t const* in_max, std::vector<InnerC
                 break;
             }
             else {
-                v->resize((size_t)rank + 1); 
+                if (rank >= v->size()) {
+                    v->resize(rank + 1);
+                }
                 in = cbor_object_parse(in, in_max, &(*v)[rank], err);
                 rank++;
             }
         }
+
+        if (in != NULL && rank < v->size()) {
+            v->resize(rank);
+        }
     }
 
     return in;
 }
 
+/* cbor_int_array_append:
+   Parse a CBOR array of unsigned integers, and append the values to the vector.
+   Definite length arrays are sized once from the header, indefinite length
+   arrays by chunks of CBOR_INT_RUN_CHUNK, and the values are decoded in runs
+   by cbor_parse_int_run.
+   */
+#define CBOR_INT_RUN_CHUNK 64
+
+template <class Alloc>
+uint8_t const* cbor_int_array_append(uint8_t const* in, uint8_t const* in_max, std::vector<int, Alloc>* v, int* err)
+{
+    int64_t val;
+    int outer_type = CBOR_CLASS(*in);
+
+    in = cbor_get_number(in, in_max, &val);
+
+    if (in == NULL || outer_type != CBOR_T_ARRAY) {
+        *err = CBOR_MALFORMED_VALUE;
+        in = NULL;
+    }
+    else if (val == CBOR_END_OF_ARRAY) {
+        while (in != NULL && in < in_max && *in != 0xff) {
+            size_t start = v->size();
+            size_t chunk = (size_t)(in_max - in);
+            size_t nb_parsed = 0;
+
+            if (chunk > CBOR_INT_RUN_CHUNK) {
+                chunk = CBOR_INT_RUN_CHUNK;
+            }
+            v->resize(start + chunk);
+            in = cbor_parse_int_run(in, in_max, v->data() + start, chunk, &nb_parsed, err);
+            v->resize(start + nb_parsed);
+            if (in != NULL && nb_parsed == 0) {
+                /* Not an unsigned integer */
+                *err = CBOR_MALFORMED_VALUE;
+                in = NULL;
+            }
+        }
+        if (in != NULL && in < in_max) {
+            in++;
+        }
+        else {
+            *err = CBOR_MALFORMED_VALUE;
+            in = NULL;
+        }
+    }
+    else if (val > in_max - in) {
+        /* Each element takes at least one byte */
+        *err = CBOR_MALFORMED_VALUE;
+        in = NULL;
+    }
+    else {
+        size_t start = v->size();
+        size_t nb_parsed = 0;
+
+        v->resize(start + (size_t)val);
+        in = cbor_parse_int_run(in, in_max, v->data() + start, (size_t)val, &nb_parsed, err);
+        if (in != NULL && nb_parsed < (size_t)val) {
+            *err = CBOR_MALFORMED_VALUE;
+            in = NULL;
+        }
+    }
+
+    return in;
+}
+
+/* Arrays of integers do not need the per element reset and parse of the
+   generic version. */
+template <class Alloc>
+uint8_t const* cbor_array_parse(uint8_t const* in, uint8_t const* in_max, std::vector<int, Alloc>* v, int* err)
+{
+    v->clear();
+    return cbor_int_array_append(in, in_max, v, err);
+}
+
 /* cbor_ctx_array_parse:
    same as cbor_array_parse, but also pass an additional context parameter
    */
-template <class InnerClass, class CtxClass>
-uint8_t* cbor_ctx_array_parse(uint8_t* in, uint8_t const* in_max, std::vector<InnerClass>* v, int* err, CtxClass* ctx)
+template <class InnerClass, class Alloc, class CtxClass>
+uint8_t const* cbor_ctx_array_parse(uint8_t const* in, uint8_t const* in_max, std::vector<InnerClass, Alloc>* v, int* err, CtxClass* ctx)
 {
     int64_t val;
     int outer_type = CBOR_CLASS(*in);
@@ -164,13 +389,25 @@ uint8_t* cbor_ctx_array_parse(uint8_t* in, uint8_t const* in_max, std::vector<In
         in = NULL;
     }
     else {
-        int rank = 0;
+        size_t rank = 0;
+
+        v->clear();
         if (val == CBOR_END_OF_ARRAY) {
             is_undef = 1;
             val = 0xffffffff;
         }
+        else if (val > in_max - in) {
+            /* Each element takes at least one byte */
+            *err = CBOR_MALFORMED_VALUE;
+            in = NULL;
+        }
+        else {
+            /* Size the array once, from the length header. Larger arrays
+             * grow as their elements are parsed. */
+            v->resize((size_t)((val < CBOR_ARRAY_PRESIZE_MAX) ? val : CBOR_ARRAY_PRESIZE_MAX));
+        }
 
-        while (rank < val && in != NULL && in < in_max) {
+        while ((int64_t)rank < val && in != NULL && in < in_max) {
             if (*in == 0xff) {
                 if (is_undef) {
                     in++;
@@ -182,25 +419,224 @@ uint8_t* cbor_ctx_array_parse(uint8_t* in, uint8_t const* in_max, std::vector<In
                 break;
             }
             else {
-                v->resize((size_t)rank + 1);
+                if (rank >= v->size()) {
+                    v->resize(rank + 1);
+                }
                 in = cbor_object_ctx_parse(in, in_max, &(*v)[rank], err, ctx);
                 rank++;
             }
         }
+
+        if (in != NULL && rank < v->size()) {
+            v->resize(rank);
+        }
     }
 
     return in;
 }
 
-/* cbor_map_parse: 
+/* cbor_ctx_array_append:
+   Parse the elements of an array one at a time into a scratch object of
+   InnerClass, and append each of them to the target, which may store them
+   differently, e.g., one column per field. The target class provides
+   reserve(size_t), called with the array length if known, and
+   append(InnerClass const*).
+   */
+template <class InnerClass, class TargetClass, class CtxClass>
+uint8_t const* cbor_ctx_array_append(uint8_t const* in, uint8_t const* in_max, TargetClass* target, int* err, CtxClass* ctx)
+{
+    int64_t val;
+    int outer_type = CBOR_CLASS(*in);
+    int is_undef = 0;
+
+    in = cbor_get_number(in, in_max, &val);
+
+    if (in == NULL || outer_type != CBOR_T_ARRAY) {
+        *err = CBOR_MALFORMED_VALUE;
+        in = NULL;
+    }
+    else {
+        InnerClass scratch;
+        int64_t rank = 0;
+
+        if (val == CBOR_END_OF_ARRAY) {
+            is_undef = 1;
+            val = 0xffffffff;
+        }
+        else if (val > in_max - in) {
+            *err = CBOR_MALFORMED_VALUE;
+            in = NULL;
+        }
+        else {
+            target->reserve((size_t)((val < CBOR_ARRAY_PRESIZE_MAX) ? val : CBOR_ARRAY_PRESIZE_MAX));
+        }
+
+        while (rank < val && in != NULL && in < in_max) {
+            if (*in == 0xff) {
+                if (is_undef) {
+                    in++;
+                }
+                else {
+                    *err = CBOR_MALFORMED_VALUE;
+                    in = NULL;
+                }
+                break;
+            }
+            else {
+                if (rank > 0) {
+                    scratch = InnerClass();
+                }
+                in = cbor_object_ctx_parse(in, in_max, &scratch, err, ctx);
+                if (in != NULL) {
+                    target->append(&scratch);
+                }
+                rank++;
+            }
+        }
+    }
+
+    return in;
+}
+
+/* Field descriptor, mapping the key of a map item to a member of the class.
+ * Integer members are designated by a pointer to member, of type int or
+ * int64_t, and parsed as signed or unsigned. Other members are parsed by
+ * a specific function. Descriptor tables are built at compile time with
+ * the cbor_int_field, cbor_int64_field and cbor_custom_field functions. */
+template <class C> class cbor_field {
+public:
+    int64_t key;
+    int C::* v_int;
+    int64_t C::* v_int64;
+    uint8_t const* (*v_parse)(uint8_t const* in, uint8_t const* in_max, C* v, int* err);
+    int is_signed;
+};
+
+template <class C> constexpr cbor_field<C> cbor_int_field(int64_t key, int C::* v, int is_signed)
+{
+    return cbor_field<C>{ key, v, NULL, NULL, is_signed };
+}
+
+template <class C> constexpr cbor_field<C> cbor_int64_field(int64_t key, int64_t C::* v, int is_signed)
+{
+    return cbor_field<C>{ key, NULL, v, NULL, is_signed };
+}
+
+template <class C> constexpr cbor_field<C> cbor_custom_field(int64_t key,
+    uint8_t const* (*v_parse)(uint8_t const* in, uint8_t const* in_max, C* v, int* err))
+{
+    return cbor_field<C>{ key, NULL, NULL, v_parse, 0 };
+}
+
+#define CBOR_NB_FIELDS(fields) (sizeof(fields) / sizeof(fields[0]))
+
+/* cbor_fields_parse:
+   Parse the map item of the specified key into the member of v found in
+   the descriptor table. If the keys of the table are 0, 1, 2..., as in most
+   tables, the descriptor is found by direct indexing, otherwise by a linear
+   search. Items that are not described are skipped.
+   */
+template <class C>
+uint8_t const* cbor_fields_parse(uint8_t const* in, uint8_t const* in_max, C* v, int64_t key,
+    cbor_field<C> const* fields, size_t nb_fields, int* err)
+{
+    cbor_field<C> const* f = NULL;
+
+    if (key >= 0 && (uint64_t)key < nb_fields && fields[key].key == key) {
+        f = &fields[key];
+    }
+    else {
+        for (size_t i = 0; i < nb_fields; i++) {
+            if (fields[i].key == key) {
+                f = &fields[i];
+                break;
+            }
+        }
+    }
+
+    if (f == NULL) {
+        in = cbor_skip(in, in_max, err);
+    }
+    else if (f->v_int != NULL) {
+        in = cbor_parse_int(in, in_max, &(v->*(f->v_int)), f->is_signed, err);
+    }
+    else if (f->v_int64 != NULL) {
+        in = cbor_parse_int64(in, in_max, &(v->*(f->v_int64)), f->is_signed, err);
+    }
+    else {
+        in = f->v_parse(in, in_max, v, err);
+    }
+
+    return in;
+}
+
+/* cbor_map_parse_with:
    Parse a CBOR input into a map element, in which each index is an integer.
-   This construct assumes that the InnerClass has a method:
-   uint8_t * parse_map_item(uint8_t *in, uint8_t const* in_max, int64_t index, int * err);
-   The method is called for each index that is present, and shall parse the
-   corresponding index.
+   The method ParseItem of the InnerClass is called for each index that is
+   present, and shall parse the corresponding index. The method is a template
+   parameter, so that the call is resolved at compile time.
 */
-template <class InnerClass>
-uint8_t* cbor_map_parse(uint8_t* in, uint8_t const* in_max, InnerClass * v, int* err)
+template <class InnerClass, uint8_t const* (InnerClass::*ParseItem)(uint8_t const*, uint8_t const*, int64_t, int*)>
+uint8_t const* cbor_map_parse_with(uint8_t const* in, uint8_t const* in_max, InnerClass * v, int* err)
+{
+
+    int outer_type = CBOR_CLASS(*in);
+    int64_t val;
+    int is_undef = 0;
+
+    in = cbor_get_number(in, in_max, &val);
+
+    if (in == NULL || outer_type != CBOR_T_MAP) {
+        *err = CBOR_MALFORMED_VALUE;
+        in = NULL;
+    }
+    else {
+        if (val == CBOR_END_OF_ARRAY) {
+            is_undef = 1;
+            val = 0xffffffff;
+        }
+
+        while (val > 0 && in != NULL && in < in_max) {
+            if (*in == 0xff) {
+                if (is_undef) {
+                    in++;
+                }
+                else {
+                    *err = CBOR_MALFORMED_VALUE;
+                    in = NULL;
+                }
+                break;
+            }
+            else {
+                /* There should be two elements for each map item */
+                int inner_type = CBOR_CLASS(*in);
+                int64_t inner_val;
+
+                in = cbor_get_number(in, in_max, &inner_val);
+                if (in == NULL || (inner_type != CBOR_T_UINT && inner_type != CBOR_T_NINT)) {
+                    *err = CBOR_MALFORMED_VALUE;
+                    in = NULL;
+                }
+                else {
+                    if (inner_type == CBOR_T_NINT) {
+                        inner_val = -(inner_val + 1);
+                    }
+                    in = (v->*ParseItem)(in, in_max, inner_val, err);
+                    val--;
+                }
+            }
+        }
+    }
+
+    return in;
+}
+
+/* cbor_map_ctx_parse_with:
+   same as cbor_map_parse_with, but also pass an additional context parameter
+   to the method that parses each item.
+*/
+template <class InnerClass, class CtxClass, uint8_t const* (InnerClass::*ParseItem)(uint8_t const*, uint8_t const*, int64_t, int*, CtxClass*)>
+uint8_t const* cbor_map_ctx_parse_with(uint8_t const* in, uint8_t const* in_max, InnerClass* v, int* err, CtxClass* ctx)
 {
 
     int outer_type = CBOR_CLASS(*in);
@@ -244,7 +680,7 @@ uint8_t* cbor_map_parse(uint8_t* in, uint8_t const* in_max, InnerClass * v, int*
                     if (inner_type == CBOR_T_NINT) {
                         inner_val = -(inner_val + 1);
                     }
-                    in = v->parse_map_item(in, in_max, inner_val, err);
+                    in = (v->*ParseItem)(in, in_max, inner_val, err, ctx);
                     val--;
                 }
             }
@@ -254,4 +690,17 @@ uint8_t* cbor_map_parse(uint8_t* in, uint8_t const* in_max, InnerClass * v, int*
     return in;
 }
 
+/* cbor_map_parse: 
+   Parse a CBOR input into a map element, in which each index is an integer.
+   This construct assumes that the InnerClass has a method:
+   uint8_t const* parse_map_item(uint8_t const* in, uint8_t const* in_max, int64_t index, int * err);
+   The method is called for each index that is present, and shall parse the
+   corresponding index.
+*/
+template <class InnerClass>
+uint8_t const* cbor_map_parse(uint8_t const* in, uint8_t const* in_max, InnerClass * v, int* err)
+{
+    return cbor_map_parse_with<InnerClass, &InnerClass::parse_map_item>(in, in_max, v, err);
+}
+
 #endif
@@ -23,8 +23,30 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <inttypes.h>
+#ifdef _WINDOWS
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 #include "cbor.h"
 #include "cdns.h"
+#include "cdns_decompress.h"
+#include "cdns_parallel.h"
+
+#if defined(__GNUC__) || defined(__clang__)
+#define CDNS_PREFETCH(p) __builtin_prefetch(p)
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <xmmintrin.h>
+#define CDNS_PREFETCH(p) _mm_prefetch((char const*)(p), _MM_HINT_T0)
+#else
+#define CDNS_PREFETCH(p) ((void)(p))
+#endif
+#define CDNS_PREFETCH_ROWS 16 /* Distance, in queries, of the table rows prefetch */
+#define CDNS_PREFETCH_DATA 8 /* Distance of the prefetch of the data that the rows point to */
 
 cdns::cdns():
     first_block_start_us(0),
@@ -32,20 +54,63 @@ cdns::cdns():
     buf(NULL),
     buf_size(0),
     buf_read(0),
+    buf_alloc(NULL),
+    buf_mapped(false),
+    F_stream(NULL),
+    buf_offset(0),
+    decompressor(NULL),
+    source_checked(false),
+    source_error(false),
     buf_parsed(0),
     end_of_file(false),
     preamble_parsed(false),
     file_head_undef(false),
     block_list_undef(false),
     nb_blocks_present(0),
-    nb_blocks_read(0)
+    nb_blocks_read(0),
+    nb_blocks_parsed(0),
+    block_list_end_found(false),
+    first_block_offset(0),
+    next_block(NULL),
+    prefetch_thread(NULL),
+    prefetch_requested(false),
+    prefetch_stopping(false),
+    prefetch_pending(false),
+    block_pool(NULL),
+    next_ret(false),
+    next_err(0),
+    layout(cdns_layout_records),
+    projection(CDNS_PROJECT_ALL),
+    lazy(false),
+    prefetch_buf_parsed(0),
+    prefetch_nb_blocks_parsed(0),
+    prefetch_end_found(false),
+    next_ready(false)
 {
 }
 
 cdns::~cdns()
 {
-    if (buf != NULL) {
-        delete[] buf;
+    if (block_pool != NULL) {
+        delete block_pool;
+    }
+    prefetch_stop();
+    if (next_block != NULL) {
+        delete next_block;
+    }
+#ifndef _WINDOWS
+    if (buf_mapped) {
+        (void)munmap((void*)buf, buf_size);
+    }
+#endif
+    if (buf_alloc != NULL) {
+        delete[] buf_alloc;
+    }
+    if (F_stream != NULL) {
+        (void)fclose(F_stream);
+    }
+    if (decompressor != NULL) {
+        delete decompressor;
     }
 }
 
@@ -83,20 +148,312 @@ bool cdns::open(char const* file_name)
     return ret;
 }
 
+/* Map the whole file in memory instead of copying it in a heap buffer.
+ * The blocks are then parsed directly from the page cache, and the
+ * memory footprint does not depend on the file size. On Windows, we
+ * fall back to reading the entire file.
+ */
+bool cdns::open_mapped(char const* file_name)
+{
+    bool ret = false;
+
+#ifdef _WINDOWS
+    ret = open(file_name);
+#else
+    if (buf == NULL) {
+        int fd = ::open(file_name, O_RDONLY);
+
+        if (fd >= 0) {
+            struct stat st;
+
+            if (fstat(fd, &st) == 0 && st.st_size > 0 && (uint64_t)st.st_size <= (uint64_t)SIZE_MAX) {
+                void* mapped = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+                if (mapped != MAP_FAILED) {
+                    (void)madvise(mapped, (size_t)st.st_size, MADV_SEQUENTIAL);
+                    buf = (uint8_t const*)mapped;
+                    buf_size = (size_t)st.st_size;
+                    buf_read = buf_size;
+                    buf_mapped = true;
+                    end_of_file = true;
+                    ret = true;
+                }
+            }
+            (void)close(fd);
+        }
+    }
+#endif
+
+    return ret;
+}
+
+/* Open the file in streaming mode. Instead of loading the entire file,
+ * the buffer holds a sliding window starting at the first byte not yet
+ * parsed. The window is refilled before parsing each block, and grows
+ * only if a single block does not fit, so the memory footprint is about
+ * the size of the largest block.
+ */
+bool cdns::open_stream(char const* file_name)
+{
+    bool ret = false;
+
+    if (buf == NULL) {
+        F_stream = cnds_file_open(file_name, "rb");
+        if (F_stream != NULL) {
+            ret = stream_start();
+        }
+    }
+
+    return ret;
+}
+
+/* Parse a C-DNS file already loaded in memory. The buffer is borrowed,
+ * not copied: it must remain valid and unchanged until the cdns object
+ * is deleted. Compressed content is not supported in that mode.
+ */
+bool cdns::open_buffer(uint8_t const* in, size_t in_length)
+{
+    bool ret = false;
+
+    if (buf == NULL && in != NULL && in_length > 0) {
+        cdns_compression_enum compression = cdns_decompressor::detect(in, in_length);
+
+        if (compression != cdns_compression_none) {
+            fprintf(stderr, "Compression format %d is not supported for memory buffers.\n", (int)compression);
+        }
+        else {
+            buf = in;
+            buf_size = in_length;
+            buf_read = in_length;
+            end_of_file = true;
+            ret = true;
+        }
+    }
+
+    return ret;
+}
+
+/* Read from an already open file descriptor, such as a pipe or stdin.
+ * The descriptor is duplicated, so the caller remains responsible for
+ * closing it. The data is read in streaming mode, as in open_stream,
+ * since the size of a pipe is not known in advance.
+ */
+bool cdns::open_fd(int fd)
+{
+    bool ret = false;
+
+    if (buf == NULL && fd >= 0) {
+#ifdef _WINDOWS
+        int fd_dup = _dup(fd);
+#else
+        int fd_dup = dup(fd);
+#endif
+        if (fd_dup >= 0) {
+#ifdef _WINDOWS
+            F_stream = _fdopen(fd_dup, "rb");
+#else
+            F_stream = fdopen(fd_dup, "rb");
+#endif
+            if (F_stream == NULL) {
+#ifdef _WINDOWS
+                (void)_close(fd_dup);
+#else
+                (void)close(fd_dup);
+#endif
+            }
+            else {
+                ret = stream_start();
+            }
+        }
+    }
+
+    return ret;
+}
+
+/* Allocate the streaming window and load the first bytes. */
+bool cdns::stream_start()
+{
+    bool ret = false;
+
+    buf_size = 0x20000;
+    buf_alloc = new uint8_t[buf_size];
+    if (buf_alloc == NULL) {
+        buf_size = 0;
+    }
+    else {
+        buf = buf_alloc;
+        ret = stream_read_more() && !source_error;
+    }
+
+    return ret;
+}
+
+/* Discard the bytes already parsed, then read as much as fits in the buffer.
+ * The buffer size is doubled if it is already full.
+ */
+bool cdns::stream_read_more()
+{
+    bool ret = true;
+
+    if (buf_parsed > 0) {
+        if (buf_read > buf_parsed) {
+            memmove(buf_alloc, buf_alloc + buf_parsed, buf_read - buf_parsed);
+        }
+        buf_offset += buf_parsed;
+        buf_read -= buf_parsed;
+        buf_parsed = 0;
+    }
+
+    if (buf_read == buf_size) {
+        size_t new_size = 2 * buf_size;
+        uint8_t* new_buf = new uint8_t[new_size];
+
+        if (new_buf == NULL) {
+            ret = false;
+        }
+        else {
+            memcpy(new_buf, buf_alloc, buf_read);
+            delete[] buf_alloc;
+            buf_alloc = new_buf;
+            buf = buf_alloc;
+            buf_size = new_size;
+        }
+    }
+
+    if (ret) {
+        size_t asked = buf_size - buf_read;
+        size_t n_bytes = source_read(F_stream, buf_alloc + buf_read, asked);
+
+        end_of_file = (n_bytes < asked);
+        buf_read += n_bytes;
+        ret = (n_bytes > 0);
+    }
+
+    return ret;
+}
+
+/* Read from the file, or from the decompressor if the file is compressed.
+ * The compression format is detected from the magic bytes at the beginning
+ * of the file, on the first read. If the format is not supported in this
+ * build, source_error is set.
+ */
+size_t cdns::source_read(FILE* F, uint8_t* dst, size_t asked)
+{
+    size_t n_bytes;
+
+    if (decompressor != NULL) {
+        n_bytes = decompressor->read(F, dst, asked);
+        source_error |= decompressor->has_error;
+    }
+    else {
+        n_bytes = fread(dst, 1, asked, F);
+
+        if (!source_checked) {
+            cdns_compression_enum compression = cdns_decompressor::detect(dst, n_bytes);
+
+            source_checked = true;
+            if (compression != cdns_compression_none) {
+                decompressor = cdns_decompressor::create(compression);
+                if (decompressor == NULL || !decompressor->set_input(dst, n_bytes)) {
+                    fprintf(stderr, "Compression format %d is not supported.\n", (int)compression);
+                    source_error = true;
+                    n_bytes = 0;
+                }
+                else {
+                    n_bytes = decompressor->read(F, dst, asked);
+                    source_error |= decompressor->has_error;
+                }
+            }
+        }
+    }
+
+    return n_bytes;
+}
+
+/* Skip the file header: start of the file array, file type, file preamble,
+ * and start of the block array. */
+static uint8_t const* cdns_file_head_skip(uint8_t const* in, uint8_t const* in_max, int* err)
+{
+    int64_t val;
+
+    if (in < in_max) {
+        in = cbor_get_number(in, in_max, &val);
+    }
+    else {
+        in = NULL;
+    }
+
+    for (int i = 0; i < 2 && in != NULL; i++) {
+        if (in < in_max && *in != CBOR_END_MARK) {
+            in = cbor_skip(in, in_max, err);
+        }
+        else {
+            in = NULL;
+        }
+    }
+
+    if (in != NULL && in < in_max) {
+        in = cbor_get_number(in, in_max, &val);
+    }
+    else {
+        in = NULL;
+    }
+
+    if (in == NULL && *err == 0) {
+        *err = CBOR_MALFORMED_VALUE;
+    }
+
+    return in;
+}
+
+/* In streaming mode, make sure that the buffer holds the complete item
+ * starting at buf_parsed, or the complete file header if is_file_head
+ * is set. */
+bool cdns::stream_load(bool is_file_head, int* err)
+{
+    bool ret = true;
+
+    while (ret) {
+        uint8_t const* in = buf + buf_parsed;
+        uint8_t const* in_max = buf + buf_read;
+        int skip_err = 0;
+
+        if (in < in_max) {
+            if (is_file_head) {
+                in = cdns_file_head_skip(in, in_max, &skip_err);
+            }
+            else if (*in != CBOR_END_MARK) {
+                in = cbor_skip(in, in_max, &skip_err);
+            }
+            if (in != NULL) {
+                break;
+            }
+        }
+
+        if (end_of_file || !stream_read_more()) {
+            *err = CBOR_MALFORMED_VALUE;
+            ret = false;
+        }
+    }
+
+    return ret;
+}
+
 bool cdns::dump(char const* file_out)
 {
     FILE * F_out = cnds_file_open(file_out, "w");
     size_t out_size = 10 * buf_size;
     char* out_buf = new char[out_size];
-    bool ret = (F_out != NULL && out_buf != NULL);
+    /* Dumping requires the entire file, which is not available in streaming mode */
+    bool ret = (F_out != NULL && out_buf != NULL && F_stream == NULL);
     int cdns_version = 0;
 
     if (ret) {
         int err = 0;
         char* p_out;
         int64_t val;
-        uint8_t* in = buf;
-        uint8_t* in_max = in + buf_read;
+        uint8_t const* in = buf;
+        uint8_t const* in_max = in + buf_read;
         int outer_type = CBOR_CLASS(*in);
         int is_undef = 0;
 
@@ -176,20 +533,129 @@ bool cdns::open_block(int* err)
         ret = read_preamble(err);
     }
 
-    if (ret && nb_blocks_read >= nb_blocks_present) {
+    if (ret) {
+        if (block_pool != NULL) {
+            ret = block_pool->get_block((size_t)nb_blocks_read, &block, err);
+            if (ret) {
+                nb_blocks_parsed = nb_blocks_read + 1;
+                buf_parsed = (size_t)(block_index[(size_t)nb_blocks_read].offset + block_index[(size_t)nb_blocks_read].length);
+            }
+        }
+        else if (next_block != NULL) {
+            /* The worker is signalled on the first call, then after each swap */
+            if (!prefetch_pending && !next_ready) {
+                prefetch_start();
+            }
+            prefetch_wait();
+            next_ready = false;
+            *err = next_err;
+            ret = next_ret;
+            if (ret) {
+                block.swap(next_block);
+            }
+        }
+        else {
+            ret = parse_next_block(&block, err);
+        }
+    }
+
+    /* The counters visible to the application are only updated here,
+     * never by the worker thread. */
+    if (ret) {
+        nb_blocks_read++;
+        if (first_block_start_us == 0) {
+            first_block_start_us = block.block_start_us;
+        }
+        if (next_block != NULL && block_pool == NULL) {
+            prefetch_start();
+        }
+    }
+    else if (block_list_end_found) {
+        nb_blocks_present = nb_blocks_read;
+    }
+
+    return ret;
+}
+
+/* The visitor receives the queries while the block is parsed. This is only
+ * possible with the sequential parser, in the default layout, without the
+ * lazy mode. */
+bool cdns::visit_block(cdns_visitor* visitor, int* err)
+{
+    bool ret = (next_block == NULL && block_pool == NULL && !lazy && layout == cdns_layout_records);
+
+    if (!ret) {
+        *err = CBOR_NOT_IMPLEMENTED;
+    }
+    else {
+        block.visitor = visitor;
+        ret = open_block(err);
+        block.visitor = NULL;
+    }
+
+    return ret;
+}
+
+bool cdns::open_block(int* err, uint32_t projection)
+{
+    if (projection != this->projection) {
+        set_projection(projection);
+    }
+
+    return open_block(err);
+}
+
+/* The blocks parsed ahead of time with the previous mask are dropped, and
+ * parsed again. This is not possible in streaming mode, because the buffer
+ * has moved: the block already prefetched keeps the previous mask, which
+ * the application can check in block.projection. */
+void cdns::set_projection(uint32_t new_projection)
+{
+    if (block_pool != NULL) {
+        block_pool->discard();
+    }
+    else if (prefetch_pending) {
+        prefetch_stop();
+        if (is_buffer_stable()) {
+            buf_parsed = prefetch_buf_parsed;
+            nb_blocks_parsed = prefetch_nb_blocks_parsed;
+            block_list_end_found = prefetch_end_found;
+        }
+        else {
+            /* Deliver the prefetched block as is */
+            next_ready = true;
+        }
+    }
+    projection = new_projection;
+}
+
+/* Parse the block starting at buf_parsed into the target. In prefetch mode,
+ * this runs in the worker thread, and must only modify the parsing state:
+ * buffer, buf_parsed, nb_blocks_parsed and block_list_end_found.
+ */
+bool cdns::parse_next_block(cdnsBlock* target, int* err)
+{
+    bool ret = true;
+
+    *err = 0;
+    if (nb_blocks_parsed >= nb_blocks_present || block_list_end_found) {
         *err = CBOR_END_OF_ARRAY;
         ret = false;
     }
 
+    if (ret && F_stream != NULL) {
+        ret = stream_load(false, err);
+    }
+
     if (ret){
-        uint8_t* in = buf + buf_parsed;
-        uint8_t* in_max = buf + buf_read;
+        uint8_t const* in = buf + buf_parsed;
+        uint8_t const* in_max = buf + buf_read;
 
         if (*in == CBOR_END_MARK) {
             in++;
             buf_parsed = in - buf;
             if (block_list_undef) {
-                nb_blocks_present = nb_blocks_read;
+                block_list_end_found = true;
                 *err = CBOR_END_OF_ARRAY;
             }
             else {
@@ -198,17 +664,17 @@ bool cdns::open_block(int* err)
             ret = false;
         }
         else {
-            uint8_t* old_in = in;
+            uint8_t const* old_in = in;
 
-            in = block.parse(old_in, in_max, err, this);
+            in = target->parse(old_in, in_max, err, this);
 
             if (in != NULL) {
-                nb_blocks_read++;
+                nb_blocks_parsed++;
                 buf_parsed = in - buf;
             }
             else {
-                fprintf(stderr, "\nBlock parsing error %d after %d blocks at position %lld.\n", *err, (int)(nb_blocks_read+1),
-                    (unsigned long long)(old_in - buf));
+                fprintf(stderr, "\nBlock parsing error %d after %d blocks at position %lld.\n", *err, (int)(nb_blocks_parsed+1),
+                    (unsigned long long)(buf_offset + (old_in - buf)));
 
                 fprintf(stderr, "\n");
 
@@ -217,67 +683,466 @@ bool cdns::open_block(int* err)
         }
     }
 
-    if (ret && first_block_start_us == 0) {
-        first_block_start_us = block.block_start_us;
-    }
-
     return ret;
 }
 
-int64_t cdns::get_ticks_per_second(int64_t block_id)
+/* Prefetch mode uses two blocks. A worker thread parses the next block
+ * while the application processes the current one, and open_block swaps
+ * them. The worker is created once, and waits for the request that
+ * open_block makes after each swap. The application must not access the
+ * buffer while the worker runs.
+ */
+bool cdns::enable_prefetch()
 {
-    int64_t tps = 1000000; /* Microseconds by default */
-    if (preamble_parsed && preamble.cdns_version_major > 0 &&
-        block_id > 0 && block_id < (int64_t) preamble.block_parameters.size()) {
-        tps = preamble.block_parameters[block_id].storage.ticks_per_second;
+    if (next_block == NULL) {
+        next_block = new cdnsBlock();
     }
 
-    return tps;
+    if (next_block != NULL && prefetch_thread == NULL) {
+        prefetch_stopping = false;
+        prefetch_thread = new std::thread(&cdns::prefetch_run, this);
+    }
+
+    return (next_block != NULL);
 }
 
-int64_t cdns::ticks_to_microseconds(int64_t ticks, int64_t block_id)
+void cdns::prefetch_start()
 {
-    int64_t tps = get_ticks_per_second(block_id);
-
-    if (tps != 1000000) {
-        ticks *= tps;
-        ticks /= 1000000;
+    prefetch_buf_parsed = buf_parsed;
+    prefetch_nb_blocks_parsed = nb_blocks_parsed;
+    prefetch_end_found = block_list_end_found;
+    if (prefetch_thread == NULL) {
+        /* Restart after a seek or a change of projection */
+        prefetch_stopping = false;
+        prefetch_thread = new std::thread(&cdns::prefetch_run, this);
+    }
+    {
+        std::unique_lock<std::mutex> guard(prefetch_lock);
+        prefetch_requested = true;
     }
+    prefetch_changed.notify_all();
+    prefetch_pending = true;
+}
 
-    return ticks;
+void cdns::prefetch_run()
+{
+    std::unique_lock<std::mutex> guard(prefetch_lock);
+
+    while (!prefetch_stopping) {
+        if (!prefetch_requested) {
+            prefetch_changed.wait(guard);
+        }
+        else {
+            guard.unlock();
+            next_ret = parse_next_block(next_block, &next_err);
+            guard.lock();
+            prefetch_requested = false;
+            prefetch_changed.notify_all();
+        }
+    }
 }
 
-int cdns::get_dns_flags(int q_dns_flags, bool is_response)
+/* Wait until the requested block is parsed. The worker keeps running. */
+void cdns::prefetch_wait()
 {
-    int flags = 0;
+    if (prefetch_pending) {
+        std::unique_lock<std::mutex> guard(prefetch_lock);
 
-    if (is_response) {
-        flags = (q_dns_flags >> 8) & 0x7E;
+        while (prefetch_requested) {
+            prefetch_changed.wait(guard);
+        }
+        prefetch_pending = false;
     }
-    else {
-        flags = q_dns_flags & 0x7C;
+}
+
+void cdns::prefetch_stop()
+{
+    prefetch_wait();
+    if (prefetch_thread != NULL) {
+        {
+            std::unique_lock<std::mutex> guard(prefetch_lock);
+            prefetch_stopping = true;
+        }
+        prefetch_changed.notify_all();
+        prefetch_thread->join();
+        delete prefetch_thread;
+        prefetch_thread = NULL;
     }
+}
 
-    return flags;
+/* In columnar mode, the queries and the query signatures are parsed in
+ * the columns of the block and of the tables, instead of the arrays of
+ * records. The layout shall be set before reading the first block.
+ */
+bool cdns::enable_columns()
+{
+    return set_layout(cdns_layout_columns);
 }
 
-int cdns::get_edns_flags(int q_dns_flags)
+/* In compact mode, the queries and query signatures are parsed in records
+ * with smaller fields, which reduces the memory used
+ * when many blocks are kept. */
+bool cdns::enable_compact()
 {
-    return (q_dns_flags << 8) & (1<<15);
+    return set_layout(cdns_layout_compact);
 }
 
-bool cdns::read_entire_file(FILE * FD)
+/* In lazy mode, parsing a block only locates the tables, the queries and the
+ * address events, which are decoded when the application calls
+ * block.materialize. Applications that skip most blocks only pay for
+ * skipping these parts. The mode shall be set before reading the first block.
+ */
+bool cdns::enable_lazy()
 {
-    bool ret = true;
-    do {
-        if (buf == NULL) {
-            /* Initialize to a small size, so we make sure that the reallocation code is well tested */
-            buf_size = 0x20000;
-            buf = new uint8_t[buf_size];
-            if (buf == NULL) {
-                ret = false;
-                buf_size = 0;
-            }
+    bool ret = (nb_blocks_read == 0 && block_pool == NULL);
+
+    if (ret) {
+        lazy = true;
+    }
+
+    return ret;
+}
+
+bool cdns::set_layout(cdns_layout_enum new_layout)
+{
+    bool ret = (nb_blocks_read == 0 && block_pool == NULL);
+
+    if (ret) {
+        layout = new_layout;
+    }
+
+    return ret;
+}
+
+/* In parallel mode, the block boundaries are found first by building the
+ * block index. The blocks are then decoded by a pool of worker threads,
+ * and open_block delivers them in file order. This requires the whole file
+ * in memory or mapped, and takes precedence over the prefetch mode.
+ */
+bool cdns::enable_parallel(int nb_threads, int* err)
+{
+    bool ret = true;
+
+    *err = 0;
+    if (block_pool == NULL) {
+        if (block_index.size() == 0) {
+            ret = build_block_index(err);
+        }
+        else if (F_stream != NULL) {
+            *err = CBOR_ILLEGAL_VALUE;
+            ret = false;
+        }
+
+        if (ret) {
+            prefetch_stop();
+            if (block_list_undef) {
+                nb_blocks_present = (int64_t)block_index.size();
+            }
+            block_pool = new cdns_block_pool(this, nb_threads);
+            ret = (block_pool != NULL);
+        }
+    }
+
+    return ret;
+}
+
+/* The block scanner only parses the block preamble, and skips the
+ * other items of the block map. */
+class cdns_block_scanner
+{
+public:
+    cdns_block_scanner(cdns* current_cdns)
+    {
+        block.current_cdns = current_cdns;
+    }
+
+    uint8_t const* parse(uint8_t const* in, uint8_t const* in_max, int* err)
+    {
+        block.preamble.clear();
+        return cbor_map_parse(in, in_max, this, err);
+    }
+
+    uint8_t const* parse_map_item(uint8_t const* in, uint8_t const* in_max, int64_t val, int* err)
+    {
+        if (val == 0) {
+            in = block.preamble.parse(in, in_max, err, &block);
+        }
+        else {
+            in = cbor_skip(in, in_max, err);
+        }
+        return in;
+    }
+
+    cdnsBlock block;
+};
+
+bool cdns::build_block_index(int* err)
+{
+    bool ret = true;
+
+    *err = 0;
+    if (!preamble_parsed) {
+        ret = read_preamble(err);
+    }
+
+    if (ret && F_stream != NULL) {
+        *err = CBOR_ILLEGAL_VALUE;
+        ret = false;
+    }
+
+    if (ret) {
+        cdns_block_scanner scanner(this);
+        uint8_t const* in = buf + first_block_offset;
+        uint8_t const* in_max = buf + buf_read;
+
+        block_index.clear();
+        while (in != NULL && in < in_max && *in != CBOR_END_MARK &&
+            (int64_t)block_index.size() < nb_blocks_present) {
+            cdns_block_index_entry entry;
+            uint8_t const* block_end = scanner.parse(in, in_max, err);
+
+            if (block_end == NULL) {
+                fprintf(stderr, "\nBlock scanning error %d after %d blocks at position %lld.\n", *err, (int)block_index.size(),
+                    (unsigned long long)(in - buf));
+                ret = false;
+                in = NULL;
+            }
+            else {
+                entry.offset = in - buf;
+                entry.length = block_end - in;
+                if (scanner.block.preamble.is_filled) {
+                    entry.block_start_us = scanner.block.preamble.earliest_time_sec;
+                    entry.block_start_us *= 1000000;
+                    entry.block_start_us += scanner.block.preamble.earliest_time_usec;
+                }
+                block_index.push_back(entry);
+                in = block_end;
+            }
+        }
+
+        if (ret && !block_list_undef && (int64_t)block_index.size() != nb_blocks_present) {
+            *err = CBOR_MALFORMED_VALUE;
+            ret = false;
+        }
+
+        if (!ret) {
+            block_index.clear();
+        }
+    }
+
+    return ret;
+}
+
+/* The index is saved as text. The first line holds the file size, so that
+ * an index that does not match the file can be detected. Each of the
+ * following lines holds offset, length and block start time of a block.
+ */
+bool cdns::save_block_index(char const* index_file_name)
+{
+    bool ret = false;
+    FILE* F = cnds_file_open(index_file_name, "w");
+
+    if (F != NULL) {
+        ret = fprintf(F, "CDNS-BLOCK-INDEX 1 %" PRIu64 " %zu\n", (uint64_t)buf_read, block_index.size()) > 0;
+        for (size_t i = 0; ret && i < block_index.size(); i++) {
+            ret = fprintf(F, "%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n",
+                block_index[i].offset, block_index[i].length, block_index[i].block_start_us) > 0;
+        }
+        ret &= (fclose(F) == 0);
+    }
+
+    return ret;
+}
+
+bool cdns::load_block_index(char const* index_file_name)
+{
+    bool ret = false;
+    int err = 0;
+    FILE* F = NULL;
+
+    if (F_stream == NULL && (preamble_parsed || read_preamble(&err))) {
+        F = cnds_file_open(index_file_name, "r");
+    }
+
+    if (F != NULL) {
+        char line[256];
+        uint64_t file_size = 0;
+        size_t nb_entries = 0;
+
+        if (fgets(line, sizeof(line), F) != NULL &&
+            sscanf(line, "CDNS-BLOCK-INDEX 1 %" SCNu64 " %zu", &file_size, &nb_entries) == 2 &&
+            file_size == (uint64_t)buf_read && (block_list_undef || (int64_t)nb_entries == nb_blocks_present) &&
+            nb_entries <= buf_read - first_block_offset) {
+            /* Each block takes at least one byte, which bounds the reserve when the count is not checked */
+            uint64_t next_offset = first_block_offset;
+
+            ret = true;
+            block_index.clear();
+            block_index.reserve(nb_entries);
+            for (size_t i = 0; ret && i < nb_entries; i++) {
+                cdns_block_index_entry entry;
+
+                ret = fgets(line, sizeof(line), F) != NULL &&
+                    sscanf(line, "%" SCNu64 ",%" SCNu64 ",%" SCNu64, &entry.offset, &entry.length, &entry.block_start_us) == 3 &&
+                    entry.offset == next_offset && entry.length > 0 && entry.length <= file_size - entry.offset;
+                if (ret) {
+                    next_offset = entry.offset + entry.length;
+                    block_index.push_back(entry);
+                }
+            }
+
+            if (!ret) {
+                block_index.clear();
+            }
+        }
+        fclose(F);
+    }
+
+    return ret;
+}
+
+bool cdns::use_block_index(char const* index_file_name, int* err)
+{
+    bool ret = true;
+
+    *err = 0;
+    if (!load_block_index(index_file_name)) {
+        ret = build_block_index(err);
+        if (ret && !save_block_index(index_file_name)) {
+            fprintf(stderr, "Cannot save the block index in %s\n", index_file_name);
+        }
+    }
+
+    return ret;
+}
+
+/* Position the parser at the start of the specified block, then parse it.
+ * The next call to open_block will return the following block. */
+bool cdns::open_block_at(size_t block_number, int* err)
+{
+    return seek_block(block_number, err) && open_block(err);
+}
+
+/* Blocks cover the time from their start to the start of the next block,
+ * so the block covering a time is the last one starting before it. */
+size_t cdns::block_number_at_time(uint64_t time_us)
+{
+    size_t low = 0;
+    size_t high = block_index.size();
+
+    /* Find the first block starting after time_us */
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+
+        if (block_index[middle].block_start_us <= time_us) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+
+    return (low > 0) ? low - 1 : 0;
+}
+
+bool cdns::seek_time(uint64_t time_us, int* err)
+{
+    bool ret = true;
+
+    *err = 0;
+    if (block_index.size() == 0) {
+        ret = build_block_index(err);
+    }
+
+    if (ret) {
+        ret = seek_block(block_number_at_time(time_us), err);
+    }
+
+    return ret;
+}
+
+bool cdns::seek_block(size_t block_number, int* err)
+{
+    bool ret = true;
+
+    *err = 0;
+    prefetch_stop();
+
+    if (block_number >= block_index.size()) {
+        *err = CBOR_END_OF_ARRAY;
+        ret = false;
+    }
+    else if (F_stream != NULL) {
+        *err = CBOR_ILLEGAL_VALUE;
+        ret = false;
+    }
+    else {
+        buf_parsed = (size_t)block_index[block_number].offset;
+        nb_blocks_parsed = (int64_t)block_number;
+        nb_blocks_read = (int64_t)block_number;
+        block_list_end_found = false;
+        if (block_list_undef) {
+            nb_blocks_present = (int64_t)block_index.size();
+        }
+    }
+
+    return ret;
+}
+
+int64_t cdns::get_ticks_per_second(int64_t block_id)
+{
+    int64_t tps = 1000000; /* Microseconds by default */
+    if (preamble_parsed && preamble.cdns_version_major > 0 &&
+        block_id > 0 && block_id < (int64_t) preamble.block_parameters.size()) {
+        tps = preamble.block_parameters[block_id].storage.ticks_per_second;
+    }
+
+    return tps;
+}
+
+int64_t cdns::ticks_to_microseconds(int64_t ticks, int64_t block_id)
+{
+    int64_t tps = get_ticks_per_second(block_id);
+
+    if (tps != 1000000) {
+        ticks *= tps;
+        ticks /= 1000000;
+    }
+
+    return ticks;
+}
+
+int cdns::get_dns_flags(int q_dns_flags, bool is_response)
+{
+    int flags = 0;
+
+    if (is_response) {
+        flags = (q_dns_flags >> 8) & 0x7E;
+    }
+    else {
+        flags = q_dns_flags & 0x7C;
+    }
+
+    return flags;
+}
+
+int cdns::get_edns_flags(int q_dns_flags)
+{
+    return (q_dns_flags << 8) & (1<<15);
+}
+
+bool cdns::read_entire_file(FILE * FD)
+{
+    bool ret = true;
+    do {
+        if (buf_alloc == NULL) {
+            /* Initialize to a small size, so we make sure that the reallocation code is well tested */
+            buf_size = 0x20000;
+            buf_alloc = new uint8_t[buf_size];
+            if (buf_alloc == NULL) {
+                ret = false;
+                buf_size = 0;
+            }
         } else if (buf_read > 0 && buf_read == buf_size) {
             uint8_t* new_buf;
             size_t new_size = 4 * buf_size;
@@ -286,20 +1151,23 @@ bool cdns::read_entire_file(FILE * FD)
                 ret = false;
             }
             else {
-                memcpy(new_buf, buf, buf_read);
-                delete[] buf;
-                buf = new_buf;
+                memcpy(new_buf, buf_alloc, buf_read);
+                delete[] buf_alloc;
+                buf_alloc = new_buf;
                 buf_size = new_size;
             }
         }
         else {
             size_t asked = buf_size - buf_read;
-            size_t n_bytes = fread(buf + buf_read, 1, asked, FD);
+            size_t n_bytes = source_read(FD, buf_alloc + buf_read, asked);
             end_of_file = (n_bytes < asked);
             buf_read += n_bytes;
         }
     } while (ret && !end_of_file);
 
+    buf = buf_alloc;
+    ret &= !source_error;
+
     return (ret);
 }
 
@@ -307,15 +1175,25 @@ bool cdns::read_preamble(int * err)
 {
     bool ret = true;
     int64_t val;
-    uint8_t * in = buf;
-    uint8_t * in_max = in + buf_read;
-    int outer_type = CBOR_CLASS(*in);
-    in = cbor_get_number(in, in_max, &val);
+    uint8_t const* in;
+    uint8_t const* in_max;
+    int outer_type;
 
     if (preamble_parsed) {
         return true;
     }
 
+    if (F_stream != NULL && !stream_load(true, err)) {
+        preamble_parsed = true;
+        nb_blocks_present = 0;
+        return false;
+    }
+
+    in = buf;
+    in_max = in + buf_read;
+    outer_type = CBOR_CLASS(*in);
+    in = cbor_get_number(in, in_max, &val);
+
     if (in == NULL || outer_type != CBOR_T_ARRAY) {
         *err = CBOR_MALFORMED_VALUE;
         in = NULL;
@@ -361,9 +1239,10 @@ bool cdns::read_preamble(int * err)
                         nb_blocks_present = 0xffffffff;
                     }
                     else {
-                        nb_blocks_present = val;
+                        nb_blocks_present = nb_blocks;
                     }
                     buf_parsed = in - buf;
+                    first_block_offset = buf_parsed;
                 }
             }
         }
@@ -384,7 +1263,7 @@ bool cdns::read_preamble(int * err)
     return ret;
 }
 
-uint8_t* cdns::dump_preamble(uint8_t* in, uint8_t* in_max, char* out_buf, char* out_max, int* cdns_version, int* err, FILE* F_out)
+uint8_t const* cdns::dump_preamble(uint8_t const* in, uint8_t const* in_max, char* out_buf, char* out_max, int* cdns_version, int* err, FILE* F_out)
 {
     char* p_out;
     int64_t val;
@@ -484,7 +1363,7 @@ uint8_t* cdns::dump_preamble(uint8_t* in, uint8_t* in_max, char* out_buf, char*
     return in;
 }
 
-uint8_t* cdns::dump_block_parameters(uint8_t* in, uint8_t* in_max, char* out_buf, char* out_max, int cdns_version, int* err, FILE* F_out)
+uint8_t const* cdns::dump_block_parameters(uint8_t const* in, uint8_t const* in_max, char* out_buf, char* out_max, int cdns_version, int* err, FILE* F_out)
 {
     char* p_out;
     int64_t val;
@@ -633,7 +1512,7 @@ uint8_t* cdns::dump_block_parameters(uint8_t* in, uint8_t* in_max, char* out_buf
     return in;
 }
 
-uint8_t* cdns::dump_block_parameters_rfc(uint8_t* in, uint8_t* in_max, char* out_buf, char* out_max, int* err, FILE* F_out)
+uint8_t const* cdns::dump_block_parameters_rfc(uint8_t const* in, uint8_t const* in_max, char* out_buf, char* out_max, int* err, FILE* F_out)
 {
     char* p_out;
     int64_t val;
@@ -718,7 +1597,7 @@ uint8_t* cdns::dump_block_parameters_rfc(uint8_t* in, uint8_t* in_max, char* out
 }
 
 
-uint8_t* cdns::dump_block_parameters_storage(uint8_t* in, uint8_t* in_max, char* out_buf, char* out_max, int* err, FILE* F_out)
+uint8_t const* cdns::dump_block_parameters_storage(uint8_t const* in, uint8_t const* in_max, char* out_buf, char* out_max, int* err, FILE* F_out)
 {
     char* p_out;
     int64_t val;
@@ -789,7 +1668,7 @@ uint8_t* cdns::dump_block_parameters_storage(uint8_t* in, uint8_t* in_max, char*
     return in;
 }
 
-uint8_t* cdns::dump_block_parameters_collection(uint8_t* in, uint8_t* in_max, char* out_buf, char* out_max, int* err, FILE* F_out)
+uint8_t const* cdns::dump_block_parameters_collection(uint8_t const* in, uint8_t const* in_max, char* out_buf, char* out_max, int* err, FILE* F_out)
 {
     char* p_out;
     int64_t val;
@@ -860,7 +1739,7 @@ uint8_t* cdns::dump_block_parameters_collection(uint8_t* in, uint8_t* in_max, ch
     return in;
 }
 
-uint8_t* cdns::dump_block(uint8_t* in, uint8_t* in_max, char* out_buf, char* out_max, int cdns_version, int* err, FILE* F_out)
+uint8_t const* cdns::dump_block(uint8_t const* in, uint8_t const* in_max, char* out_buf, char* out_max, int cdns_version, int* err, FILE* F_out)
 {
     char* p_out;
     int64_t val;
@@ -924,7 +1803,7 @@ uint8_t* cdns::dump_block(uint8_t* in, uint8_t* in_max, char* out_buf, char* out
     return in;
 }
 
-uint8_t* cdns::dump_block_properties(uint8_t* in, uint8_t* in_max, char* out_buf, char* out_max, int cdns_version, int* err, FILE* F_out)
+uint8_t const* cdns::dump_block_properties(uint8_t const* in, uint8_t const* in_max, char* out_buf, char* out_max, int cdns_version, int* err, FILE* F_out)
 {
     char* p_out;
     int64_t val;
@@ -1007,7 +1886,7 @@ uint8_t* cdns::dump_block_properties(uint8_t* in, uint8_t* in_max, char* out_buf
     return in;
 }
 
-uint8_t* cdns::dump_block_tables(uint8_t* in, uint8_t* in_max, char* out_buf, char* out_max, int cdns_version, int* err, FILE* F_out)
+uint8_t const* cdns::dump_block_tables(uint8_t const* in, uint8_t const* in_max, char* out_buf, char* out_max, int cdns_version, int* err, FILE* F_out)
 {
     char* p_out;
     int64_t val;
@@ -1118,7 +1997,7 @@ uint8_t* cdns::dump_block_tables(uint8_t* in, uint8_t* in_max, char* out_buf, ch
     return in;
 }
 
-uint8_t* cdns::dump_queries(uint8_t* in, uint8_t* in_max, char* out_buf, char* out_max, int cdns_version, int* err, FILE* F_out)
+uint8_t const* cdns::dump_queries(uint8_t const* in, uint8_t const* in_max, char* out_buf, char* out_max, int cdns_version, int* err, FILE* F_out)
 {
     int64_t val;
     int outer_type = CBOR_CLASS(*in);
@@ -1176,7 +2055,7 @@ uint8_t* cdns::dump_queries(uint8_t* in, uint8_t* in_max, char* out_buf, char* o
     return in;
 }
 
-uint8_t* cdns::dump_query(uint8_t* in, const uint8_t* in_max, char* out_buf, char* out_max, int cdns_version, int* err, FILE* F_out)
+uint8_t const* cdns::dump_query(uint8_t const* in, uint8_t const* in_max, char* out_buf, char* out_max, int cdns_version, int* err, FILE* F_out)
 {
     char* p_out;
     int64_t val;
@@ -1330,7 +2209,7 @@ uint8_t* cdns::dump_query(uint8_t* in, const uint8_t* in_max, char* out_buf, cha
     return in;
 }
 
-uint8_t* cdns::dump_class_types(uint8_t* in, uint8_t* in_max, char* out_buf, char* out_max, int* err, FILE* F_out)
+uint8_t const* cdns::dump_class_types(uint8_t const* in, uint8_t const* in_max, char* out_buf, char* out_max, int* err, FILE* F_out)
 {
     int64_t val;
     int outer_type = CBOR_CLASS(*in);
@@ -1388,7 +2267,7 @@ uint8_t* cdns::dump_class_types(uint8_t* in, uint8_t* in_max, char* out_buf, cha
     return in;
 }
 
-uint8_t* cdns::dump_class_type(uint8_t* in, uint8_t* in_max, char* out_buf, char* out_max, int* err, FILE* F_out)
+uint8_t const* cdns::dump_class_type(uint8_t const* in, uint8_t const* in_max, char* out_buf, char* out_max, int* err, FILE* F_out)
 {
     char* p_out;
     int64_t val;
@@ -1463,7 +2342,7 @@ uint8_t* cdns::dump_class_type(uint8_t* in, uint8_t* in_max, char* out_buf, char
     return in;
 }
 
-uint8_t* cdns::dump_qr_sigs(uint8_t* in, uint8_t* in_max, char* out_buf, char* out_max, int cdns_version, int* err, FILE* F_out)
+uint8_t const* cdns::dump_qr_sigs(uint8_t const* in, uint8_t const* in_max, char* out_buf, char* out_max, int cdns_version, int* err, FILE* F_out)
 {
     int64_t val;
     int outer_type = CBOR_CLASS(*in);
@@ -1521,7 +2400,7 @@ uint8_t* cdns::dump_qr_sigs(uint8_t* in, uint8_t* in_max, char* out_buf, char* o
     return in;
 }
 
-uint8_t* cdns::dump_qr_sig(uint8_t* in, uint8_t* in_max, char* out_buf, char* out_max, int cdns_version, int* err, FILE* F_out)
+uint8_t const* cdns::dump_qr_sig(uint8_t const* in, uint8_t const* in_max, char* out_buf, char* out_max, int cdns_version, int* err, FILE* F_out)
 {
     char* p_out;
     int64_t val;
@@ -1693,7 +2572,7 @@ uint8_t* cdns::dump_qr_sig(uint8_t* in, uint8_t* in_max, char* out_buf, char* ou
     return in;
 }
 
-uint8_t* cdns::dump_list(uint8_t* in, uint8_t* in_max, char* out_buf, char* out_max, char const * indent, char const * list_name, int* err, FILE* F_out)
+uint8_t const* cdns::dump_list(uint8_t const* in, uint8_t const* in_max, char* out_buf, char* out_max, char const * indent, char const * list_name, int* err, FILE* F_out)
 {
     char* p_out;
     int64_t val;
@@ -1754,65 +2633,298 @@ uint8_t* cdns::dump_list(uint8_t* in, uint8_t* in_max, char* out_buf, char* out_
     return in;
 }
 
+cdns_block_index_entry::cdns_block_index_entry() :
+    offset(0),
+    length(0),
+    block_start_us(0)
+{
+}
+
+cdns_block_index_entry::~cdns_block_index_entry()
+{
+}
+
 cdnsBlock::cdnsBlock():
     current_cdns(NULL),
+    arena(new cbor_arena()),
     is_filled(false),
-    block_start_us(0)
+    block_start_us(0),
+    projection(CDNS_PROJECT_ALL),
+    lazy_mask(0),
+    visitor(NULL)
 {
+    release();
 }
 
 cdnsBlock::~cdnsBlock()
 {
+    /* The elements are in the arena, they must be destroyed first */
+    tables.release(arena);
+    cbor_arena_vector_release(&queries, arena);
+    cbor_arena_vector_release(&address_events, arena);
+    query_columns.release(arena);
+    compact_queries.release(arena);
+    delete arena;
 }
 
-uint8_t * cdnsBlock::parse(uint8_t* in, uint8_t const* in_max, int* err, cdns * current_cdns)
+uint8_t const* cdnsBlock::parse(uint8_t const* in, uint8_t const* in_max, int* err, cdns * current_cdns)
 {
-    /* Records are held in a map */
-    clear();
+    /* Records are held in a map. The content of the previous block is
+     * released at once, and the new content is allocated from the arena. */
+    preamble.clear();
+    statistics.clear();
+    block_start_us = 0;
+    release();
+    arena->copy_all = !current_cdns->is_buffer_stable();
     this->current_cdns = current_cdns;
+    projection = current_cdns->get_projection();
+    tables.is_filled = false;
     is_filled = 1;
     in = cbor_map_parse(in, in_max, this, err);
 
-    if (preamble.is_filled) {
-        block_start_us = preamble.earliest_time_sec;
-        block_start_us *= 1000000;
-        block_start_us += preamble.earliest_time_usec;
+    if (in != NULL && visitor != NULL) {
+        /* Queries found before the tables were deferred */
+        if (!materialize(CDNS_PROJECT_QUERIES, err)) {
+            in = NULL;
+        }
+        else {
+            visitor->on_block_end(this);
+        }
     }
 
     return in;
 }
 
-uint8_t* cdnsBlock::parse_map_item(uint8_t* in, uint8_t const* in_max, int64_t val, int* err)
-{
-    switch (val) {
-    case 0: /* Block preamble */
-        in = preamble.parse(in, in_max, err, this);
-        break;
-    case 1: /* Block statistics */
-        in = statistics.parse(in, in_max, err, this);
-        break;
-    case 2: /* Block Tables */
-        in = tables.parse(in, in_max, err, this);
-        break;
-    case 3: /* Block Queries */
-        in = cbor_ctx_array_parse(in, in_max, &queries, err, this);
-        break;
-    case 4: /* Address event counts */
-        in = cbor_ctx_array_parse(in, in_max, &address_events, err, this);
-        break;
-    default:
-         in = cbor_skip(in, in_max, err);
-        break;
+/* Target of cbor_ctx_array_append in visitor mode. The queries are copied in
+ * a batch allocated from the block arena, and passed to the visitor when the
+ * batch is full, and at the end of the array. */
+class cdns_visit_batch {
+public:
+    explicit cdns_visit_batch(cdnsBlock* block) :
+        block(block),
+        queries(CDNS_VISIT_BATCH, cdns_query(), cbor_arena_allocator<cdns_query>(block->arena)),
+        resolved(CDNS_VISIT_BATCH, cdns_resolved_query(), cbor_arena_allocator<cdns_resolved_query>(block->arena)),
+        nb_queries(0)
+    {
     }
 
-    if (in == NULL) {
-        char const* e[] = { "preamble", "statistics", "tables", "queries", "address_events" };
-        int nb_e = (int)sizeof(e) / sizeof(char const*);
+    void reserve(size_t n)
+    {
+        (void)n;
+    }
 
-        fprintf(stderr, "Cannot parse block element %d (%s), err=%d\n", (int)val, (val >= 0 && val < nb_e) ? e[val] : "unknown", *err);
+    void append(cdns_query const* q)
+    {
+        queries[nb_queries++] = *q;
+        if (nb_queries == CDNS_VISIT_BATCH) {
+            flush();
+        }
     }
-    return in;
-}
+
+    void flush()
+    {
+        if (nb_queries > 0) {
+            for (size_t i = 0; i < nb_queries; i++) {
+                resolved[i].resolve(block, &queries[i]);
+            }
+            block->visitor->on_queries(block, resolved.data(), nb_queries);
+            nb_queries = 0;
+        }
+    }
+
+    cdnsBlock* block;
+    cbor_arena_vector<cdns_query> queries;
+    cbor_arena_vector<cdns_resolved_query> resolved;
+    size_t nb_queries;
+};
+
+template <bool is_old> static uint8_t const* cdns_visit_queries(uint8_t const* in, uint8_t const* in_max, int* err, cdnsBlock* block)
+{
+    cdns_format_ctx<is_old> ctx(block);
+    cdns_visit_batch batch(block);
+
+    in = cbor_ctx_array_append<cdns_query>(in, in_max, &batch, err, &ctx);
+    if (in != NULL) {
+        batch.flush();
+    }
+
+    return in;
+}
+
+/* The format is chosen once for the whole array of queries, so that the
+ * parsers of the queries are specialized for it and do not check the
+ * version for each item. */
+template <bool is_old> static uint8_t const* cdns_parse_queries(uint8_t const* in, uint8_t const* in_max, int* err, cdnsBlock* block)
+{
+    cdns_format_ctx<is_old> ctx(block);
+
+    if (block->current_cdns->is_columnar()) {
+        in = cbor_ctx_array_append<cdns_query>(in, in_max, &block->query_columns, err, &ctx);
+    }
+    else if (block->current_cdns->is_compact()) {
+        in = cbor_ctx_array_append<cdns_query>(in, in_max, &block->compact_queries, err, &ctx);
+    }
+    else {
+        in = cbor_ctx_array_parse(in, in_max, &block->queries, err, &ctx);
+    }
+
+    return in;
+}
+
+uint8_t const* cdnsBlock::parse_map_item(uint8_t const* in, uint8_t const* in_max, int64_t val, int* err)
+{
+    switch (val) {
+    case 0: /* Block preamble */
+        in = preamble.parse(in, in_max, err, this);
+        if (in != NULL && preamble.is_filled) {
+            /* Set before the queries are parsed, for the visitor */
+            block_start_us = preamble.earliest_time_sec;
+            block_start_us *= 1000000;
+            block_start_us += preamble.earliest_time_usec;
+        }
+        break;
+    case 1: /* Block statistics */
+        in = statistics.parse(in, in_max, err, this);
+        break;
+    case 2: /* Block Tables */
+        in = tables.parse(in, in_max, err, this);
+        break;
+    case 3: /* Block Queries */
+    case 4: /* Address event counts */
+        if ((projection & (CDNS_PROJECT_QUERIES << (val - 3))) == 0) {
+            in = cbor_skip(in, in_max, err);
+        }
+        else if (current_cdns->is_lazy() || (val == 3 && visitor != NULL && !tables.is_filled)) {
+            in = defer_part((int)val + 5, in, in_max, err);
+        }
+        else {
+            in = parse_part((int)val + 5, in, in_max, err);
+        }
+        break;
+    default:
+         in = cbor_skip(in, in_max, err);
+        break;
+    }
+
+    if (in == NULL) {
+        char const* e[] = { "preamble", "statistics", "tables", "queries", "address_events" };
+        int nb_e = (int)sizeof(e) / sizeof(char const*);
+
+        fprintf(stderr, "Cannot parse block element %d (%s), err=%d\n", (int)val, (val >= 0 && val < nb_e) ? e[val] : "unknown", *err);
+    }
+    return in;
+}
+
+/* The parts are numbered as the projection bits: the block tables first,
+ * then the queries and the address events. */
+uint8_t const* cdnsBlock::parse_part(int part, uint8_t const* in, uint8_t const* in_max, int* err)
+{
+    if (part < 8) {
+        in = tables.parse_table(in, in_max, part, err);
+    }
+    else if (part == 8 && visitor != NULL) {
+        if (current_cdns->is_old_version()) {
+            in = cdns_visit_queries<true>(in, in_max, err, this);
+        }
+        else {
+            in = cdns_visit_queries<false>(in, in_max, err, this);
+        }
+    }
+    else if (part == 8) {
+        reserve_queries();
+        if (current_cdns->is_old_version()) {
+            in = cdns_parse_queries<true>(in, in_max, err, this);
+        }
+        else {
+            in = cdns_parse_queries<false>(in, in_max, err, this);
+        }
+    }
+    else if (current_cdns->is_old_version()) {
+        cdns_draft_ctx ctx(this);
+        in = cbor_ctx_array_parse(in, in_max, &address_events, err, &ctx);
+    }
+    else {
+        cdns_rfc_ctx ctx(this);
+        in = cbor_ctx_array_parse(in, in_max, &address_events, err, &ctx);
+    }
+
+    return in;
+}
+
+/* Record the location of the part. If the buffer may move, the encoded
+ * part is copied to the arena. */
+uint8_t const* cdnsBlock::defer_part(int part, uint8_t const* in, uint8_t const* in_max, int* err)
+{
+    uint8_t const* start = in;
+
+    in = cbor_skip(in, in_max, err);
+    if (in != NULL && arena->copy_all) {
+        uint8_t* copy = arena->alloc(in - start);
+
+        if (copy == NULL) {
+            *err = CBOR_MEMORY;
+            in = NULL;
+        }
+        else {
+            memcpy(copy, start, in - start);
+            lazy_parts[part].v = copy;
+        }
+    }
+    else {
+        lazy_parts[part].v = start;
+    }
+
+    if (in != NULL) {
+        lazy_parts[part].l = in - start;
+        lazy_mask |= (1u << part);
+    }
+
+    return in;
+}
+
+bool cdnsBlock::materialize(uint32_t mask, int* err)
+{
+    bool ret = true;
+
+    *err = 0;
+    for (int part = 0; ret && part < CDNS_BLOCK_PARTS; part++) {
+        uint32_t bit = 1u << part;
+
+        if ((lazy_mask & mask & bit) != 0) {
+            uint8_t const* in = lazy_parts[part].v;
+
+            ret = (parse_part(part, in, in + lazy_parts[part].l, err) != NULL);
+            lazy_mask &= ~bit;
+        }
+    }
+
+    return ret;
+}
+
+/* Indefinite length arrays cannot be sized from their header. The storage
+ * parameters provide the maximum number of items in a block, which is used
+ * to size the query array before the first block is parsed. The storage
+ * hints are bit masks of the fields present, and do not help sizing. */
+void cdnsBlock::reserve_queries()
+{
+    if (current_cdns != NULL && !current_cdns->is_old_version() &&
+        preamble.block_parameter_index >= 0 &&
+        preamble.block_parameter_index < (int64_t)current_cdns->preamble.block_parameters.size()) {
+        int64_t max_items = current_cdns->preamble.block_parameters[(size_t)preamble.block_parameter_index].storage.max_block_items;
+
+        if (max_items > 0 && max_items <= CDNS_BLOCK_ITEMS_RESERVE_MAX) {
+            if (current_cdns->is_columnar()) {
+                query_columns.reserve((size_t)max_items);
+            }
+            else if (current_cdns->is_compact()) {
+                compact_queries.reserve((size_t)max_items);
+            }
+            else if (queries.capacity() < (size_t)max_items) {
+                queries.reserve((size_t)max_items);
+            }
+        }
+    }
+}
 
 void cdnsBlock::clear()
 {
@@ -1821,12 +2933,83 @@ void cdnsBlock::clear()
         preamble.clear();
         statistics.clear();
         tables.clear();
-        queries.clear();
-        address_events.clear();
+        release();
         is_filled = false;
         block_start_us = 0;
     }
 }
+
+/* All the vectors are allocated from the arena. They are emptied without
+ * freeing anything, then the arena is reset. The elements only hold
+ * arena memory, so their destructors do nothing. */
+void cdnsBlock::release()
+{
+    tables.release(arena);
+    cbor_arena_vector_release(&queries, arena);
+    cbor_arena_vector_release(&address_events, arena);
+    query_columns.release(arena);
+    compact_queries.release(arena);
+    arena->reset();
+    lazy_mask = 0;
+}
+
+void cdnsBlock::swap(cdnsBlock* other)
+{
+    cdnsBlock* blocks[2] = { this, other };
+    cdns_block_preamble p = preamble;
+    cdns_block_statistics st = statistics;
+    cdns* c = current_cdns;
+    cbor_arena* a = arena;
+    int f = is_filled;
+    uint64_t t = block_start_us;
+    uint32_t m = projection;
+    uint32_t lm = lazy_mask;
+
+    preamble = other->preamble;
+    other->preamble = p;
+    statistics = other->statistics;
+    other->statistics = st;
+    current_cdns = other->current_cdns;
+    other->current_cdns = c;
+    is_filled = other->is_filled;
+    other->is_filled = f;
+    block_start_us = other->block_start_us;
+    other->block_start_us = t;
+    projection = other->projection;
+    other->projection = m;
+    lazy_mask = other->lazy_mask;
+    other->lazy_mask = lm;
+    for (int i = 0; i < CDNS_BLOCK_PARTS; i++) {
+        cbor_bytes_view v = lazy_parts[i];
+        lazy_parts[i] = other->lazy_parts[i];
+        other->lazy_parts[i] = v;
+    }
+    /* The vectors carry their allocator, and thus keep using the same arena */
+    tables.swap(&other->tables);
+    arena = other->arena;
+    other->arena = a;
+    queries.swap(other->queries);
+    address_events.swap(other->address_events);
+    query_columns.swap(&other->query_columns);
+    compact_queries.swap(&other->compact_queries);
+
+    /* Only the preamble, statistics and tables point back to their block.
+     * The queries, signatures and address events do not, so the cost of the
+     * swap does not depend on the size of the blocks. */
+    for (int b = 0; b < 2; b++) {
+        cdnsBlock* x = blocks[b];
+
+        if (x->preamble.current_block != NULL) {
+            x->preamble.current_block = x;
+        }
+        if (x->statistics.current_block != NULL) {
+            x->statistics.current_block = x;
+        }
+        if (x->tables.current_block != NULL) {
+            x->tables.current_block = x;
+        }
+    }
+}
    
 cdns_class_id::cdns_class_id() :
     rr_type(0),
@@ -1838,24 +3021,25 @@ cdns_class_id::~cdns_class_id()
 {
 }
 
-uint8_t * cdns_class_id::parse(uint8_t* in, uint8_t const* in_max, int* err)
+uint8_t const* cdns_class_id::parse(uint8_t const* in, uint8_t const* in_max, int* err)
 {
     return cbor_map_parse(in, in_max, this, err);
 }
 
-uint8_t* cdns_class_id::parse_map_item(uint8_t* in, uint8_t const * in_max, int64_t val, int* err)
+static constexpr cbor_field<cdns_class_id> cdns_class_id_fields[] = {
+    cbor_int_field(0, &cdns_class_id::rr_type, 0),
+    cbor_int_field(1, &cdns_class_id::rr_class, 0)
+};
+
+uint8_t const* cdns_class_id::parse_map_item(uint8_t const* in, uint8_t const * in_max, int64_t val, int* err)
 {
-    switch (val) {
-    case 0:
-        in = cbor_parse_int(in, in_max, &rr_type, 0, err);
-        break;
-    case 1:
-        in = cbor_parse_int(in, in_max, &rr_class, 0, err);
-        break;
-    default:
+    if (val < 0 || val >= (int64_t)CBOR_NB_FIELDS(cdns_class_id_fields)) {
+        /* Unlike other maps, unknown keys are errors */
         in = NULL;
         *err = CBOR_ILLEGAL_VALUE;
-        break;
+    }
+    else {
+        in = cbor_fields_parse(in, in_max, this, val, cdns_class_id_fields, CBOR_NB_FIELDS(cdns_class_id_fields), err);
     }
     return in;
 }
@@ -1870,41 +3054,97 @@ cdnsBlockTables::~cdnsBlockTables()
 {
 }
 
-uint8_t* cdnsBlockTables::parse(uint8_t* in, uint8_t const* in_max, int* err, cdnsBlock * current_block)
+uint8_t const* cdnsBlockTables::parse(uint8_t const* in, uint8_t const* in_max, int* err, cdnsBlock * current_block)
 {
-    if (is_filled) {
-        clear();
-    }
+    /* The tables were released with the block, and are allocated from the block arena */
     this->current_block = current_block;
     is_filled = true;
-    return cbor_map_parse(in, in_max, this, err);
+    in = cbor_map_parse(in, in_max, this, err);
+
+    return in;
+}
+
+template <bool is_old> static uint8_t const* cdns_parse_q_sigs(uint8_t const* in, uint8_t const* in_max, int* err, cdnsBlockTables* tables)
+{
+    cdns_format_ctx<is_old> ctx(tables->current_block);
+
+    if (tables->current_block->current_cdns->is_columnar()) {
+        in = cbor_ctx_array_append<cdns_query_signature>(in, in_max, &tables->q_sig_columns, err, &ctx);
+    }
+    else if (tables->current_block->current_cdns->is_compact()) {
+        in = cbor_ctx_array_append<cdns_query_signature>(in, in_max, &tables->compact_q_sigs, err, &ctx);
+    }
+    else {
+        in = cbor_ctx_array_parse(in, in_max, &tables->q_sigs, err, &ctx);
+    }
+
+    return in;
 }
 
-uint8_t* cdnsBlockTables::parse_map_item(uint8_t* old_in, uint8_t const* in_max, int64_t val, int* err)
+uint8_t const* cdnsBlockTables::parse_map_item(uint8_t const* old_in, uint8_t const* in_max, int64_t val, int* err)
 {
-    uint8_t * in = old_in;
+    uint8_t const* in = old_in;
+
+    if (val < 0 || val >= 8 || (current_block->projection & (1u << val)) == 0) {
+        /* Unknown, or not in the projection: the table stays empty */
+        in = cbor_skip(in, in_max, err);
+    }
+    else if (current_block->current_cdns->is_lazy()) {
+        in = current_block->defer_part((int)val, in, in_max, err);
+    }
+    else {
+        in = parse_table(in, in_max, val, err);
+        if (in != NULL && current_block->visitor != NULL) {
+            current_block->visitor->on_table(current_block, 1u << val);
+        }
+    }
+
+    if (in == NULL) {
+        char out_buf[1024];
+        char* p_out = out_buf;
+        int dump_err = 0;
+        char const* e[] = { "ip_address", "classtype", "name_rdata", "query_signature", "question_list", "question_rr", "rr_list", "rr" };
+        int nb_e = (int)sizeof(e) / sizeof(char const*);
+
+        fprintf(stderr, "Cannot parse block table item %d (%s), err: %d\n", (int)val,
+            (val >= 0 && val < nb_e) ? e[val] : "unknown", *err);
+
+        fprintf(stderr, "Error %d parsing %s:\n", *err, (val >= 0 && val < nb_e) ? e[val] : "unknown item");
+        (void)cbor_to_text(old_in, in_max, &p_out, out_buf + sizeof(out_buf), &dump_err);
+        fprintf(stderr, "%s\n", out_buf);
+    }
+
+    return in;
+}
 
+uint8_t const* cdnsBlockTables::parse_table(uint8_t const* in, uint8_t const* in_max, int64_t val, int* err)
+{
     switch (val) {
     case 0: // ip_address
-        in = cbor_array_parse(in, in_max, &addresses, err);
+        in = cbor_ctx_array_parse(in, in_max, &addresses, err, current_block->arena);
         break;
     case 1: // classtype
         in = cbor_array_parse(in, in_max, &class_ids, err);
         break;
     case 2: // name_rdata
-        in = cbor_array_parse(in, in_max, &name_rdata, err);
+        in = cbor_ctx_array_parse(in, in_max, &name_rdata, err, current_block->arena);
         break;
     case 3: // query_signature
-        in = cbor_ctx_array_parse(in, in_max, &q_sigs, err, current_block);
+        if (current_block->current_cdns->is_old_version()) {
+            in = cdns_parse_q_sigs<true>(in, in_max, err, this);
+        }
+        else {
+            in = cdns_parse_q_sigs<false>(in, in_max, err, this);
+        }
         break;
     case 4: // question_list,
-        in = cbor_array_parse(in, in_max, &question_list, err);
+        in = question_list.parse(in, in_max, err);
         break;
     case 5: // question_rr,
         in = cbor_array_parse(in, in_max, &qrr, err);
         break;
     case 6: // rr_list,
-        in = cbor_array_parse(in, in_max, &rr_list, err);
+        in = rr_list.parse(in, in_max, err);
         break;
     case 7: // rr,
         in = cbor_array_parse(in, in_max, &rrs, err);
@@ -1913,21 +3153,6 @@ uint8_t* cdnsBlockTables::parse_map_item(uint8_t* old_in, uint8_t const* in_max,
         in = cbor_skip(in, in_max, err);
     }
 
-    if (in == NULL) {
-        char out_buf[1024];
-        char* p_out = out_buf;
-        int dump_err = 0;
-        char const* e[] = { "ip_address", "classtype", "name_rdata", "query_signature", "question_list", "question_rr", "rr_list", "rr" };
-        int nb_e = (int)sizeof(e) / sizeof(char const*);
-
-        fprintf(stderr, "Cannot parse block table item %d (%s), err: %d\n", (int)val,
-            (val >= 0 && val < nb_e) ? e[val] : "unknown", *err);
-
-        fprintf(stderr, "Error %d parsing %s:\n", *err, (val >= 0 && val < nb_e) ? e[val] : "unknown item");
-        (void)cbor_to_text(old_in, in_max, &p_out, out_buf + sizeof(out_buf), &dump_err);
-        fprintf(stderr, "%s\n", out_buf);
-    }
-
     return in;
 }
 
@@ -1945,8 +3170,116 @@ void cdnsBlockTables::clear()
     is_filled = false;
 }
 
+void cdnsBlockTables::release(cbor_arena* arena)
+{
+    cbor_arena_vector_release(&addresses, arena);
+    cbor_arena_vector_release(&class_ids, arena);
+    cbor_arena_vector_release(&name_rdata, arena);
+    cbor_arena_vector_release(&q_sigs, arena);
+    question_list.release(arena);
+    cbor_arena_vector_release(&qrr, arena);
+    rr_list.release(arena);
+    cbor_arena_vector_release(&rrs, arena);
+    q_sig_columns.release(arena);
+    compact_q_sigs.release(arena);
+}
+
+void cdnsBlockTables::swap(cdnsBlockTables* other)
+{
+    cdnsBlock* b = current_block;
+    bool f = is_filled;
+
+    current_block = other->current_block;
+    other->current_block = b;
+    is_filled = other->is_filled;
+    other->is_filled = f;
+    addresses.swap(other->addresses);
+    class_ids.swap(other->class_ids);
+    name_rdata.swap(other->name_rdata);
+    q_sigs.swap(other->q_sigs);
+    question_list.swap(&other->question_list);
+    qrr.swap(other->qrr);
+    rr_list.swap(&other->rr_list);
+    rrs.swap(other->rrs);
+    q_sig_columns.swap(&other->q_sig_columns);
+    compact_q_sigs.swap(&other->compact_q_sigs);
+}
+
+/* The list index is checked here, the indexes in the list are checked by
+ * cdns_list_view::at */
+template <class T> static cdns_list_view<T> cdns_list_get(cdns_list_table const* lists, cbor_arena_vector<T> const* table,
+    int list_index, int index_offset)
+{
+    int list = list_index - index_offset;
+
+    if (list >= 0 && (size_t)list < lists->size()) {
+        return cdns_list_view<T>(lists->list_items((size_t)list), lists->list_size((size_t)list), table, index_offset);
+    }
+
+    return cdns_list_view<T>();
+}
+
+cdns_list_view<cdns_question> cdnsBlockTables::get_questions(int question_list_index)
+{
+    if (current_block == NULL) {
+        return cdns_list_view<cdns_question>();
+    }
+    return cdns_list_get(&question_list, &qrr, question_list_index, current_block->current_cdns->index_offset);
+}
+
+cdns_list_view<cdns_rr_field> cdnsBlockTables::get_rrs(int rr_list_index)
+{
+    if (current_block == NULL) {
+        return cdns_list_view<cdns_rr_field>();
+    }
+    return cdns_list_get(&rr_list, &rrs, rr_list_index, current_block->current_cdns->index_offset);
+}
+
+cdns_resolved_query::cdns_resolved_query() :
+    query(NULL),
+    q_sig(NULL),
+    query_name(NULL),
+    query_class(NULL),
+    client_address(NULL),
+    server_address(NULL)
+{
+}
+
+cdns_resolved_query::~cdns_resolved_query()
+{
+}
+
+template <class T> static T const* cdns_table_entry(cbor_arena_vector<T> const* table, int index, int index_offset)
+{
+    T const* entry = NULL;
+
+    if (index >= index_offset && (size_t)(index - index_offset) < table->size()) {
+        entry = &(*table)[(size_t)(index - index_offset)];
+    }
+
+    return entry;
+}
+
+void cdns_resolved_query::resolve(cdnsBlock* block, cdns_query const* q)
+{
+    cdnsBlockTables const* tables = &block->tables;
+    int index_offset = block->current_cdns->index_offset;
+
+    query = q;
+    q_sig = cdns_table_entry(&tables->q_sigs, q->query_signature_index, index_offset);
+    query_name = cdns_table_entry(&tables->name_rdata, q->query_name_index, index_offset);
+    client_address = cdns_table_entry(&tables->addresses, q->client_address_index, index_offset);
+    if (q_sig != NULL) {
+        query_class = cdns_table_entry(&tables->class_ids, q_sig->query_classtype_index, index_offset);
+        server_address = cdns_table_entry(&tables->addresses, q_sig->server_address_index, index_offset);
+    }
+    else {
+        query_class = NULL;
+        server_address = NULL;
+    }
+}
+
 cdns_query::cdns_query():
-    current_block(NULL),
     time_offset_usec(0),
     client_address_index(-1),
     client_port(0),
@@ -1964,151 +3297,365 @@ cdns_query::~cdns_query()
 {
 }
 
-uint8_t* cdns_query::parse(uint8_t* in, uint8_t const* in_max, int* err, cdnsBlock* current_block)
+uint8_t const* cdns_query::parse(uint8_t const* in, uint8_t const* in_max, int* err, cdnsBlock* current_block)
 {
-    this->current_block = current_block;
-    in = cbor_map_parse(in, in_max, this, err);
-    if (!current_block->current_cdns->is_old_version()) {
-        time_offset_usec = (int)current_block->current_cdns->ticks_to_microseconds(time_offset_usec, 
-            current_block->preamble.block_parameter_index);
+    if (current_block->current_cdns->is_old_version()) {
+        cdns_draft_ctx ctx(current_block);
+        in = parse(in, in_max, err, &ctx);
+    }
+    else {
+        cdns_rfc_ctx ctx(current_block);
+        in = parse(in, in_max, err, &ctx);
     }
     return in;
 }
 
-uint8_t* cdns_query::parse_map_item(uint8_t* old_in, uint8_t const* in_max, int64_t val, int* err)
+template <bool is_old> uint8_t const* cdns_query::parse(uint8_t const* in, uint8_t const* in_max, int* err, cdns_format_ctx<is_old>* ctx)
 {
-    uint8_t* in = old_in;
-
-    if (current_block->current_cdns->is_old_version()) {
-        in = parse_map_item_old(in, in_max, val, err);
+    in = cbor_map_ctx_parse_with<cdns_query, cdns_format_ctx<is_old>, &cdns_query::parse_map_item<is_old> >(in, in_max, this, err, ctx);
+    if (!is_old) {
+        time_offset_usec = (int)ctx->ticks_to_microseconds(time_offset_usec);
     }
-    else {
-        switch (val) {
-        case 0: // time_useconds
-            in = cbor_parse_int(in, in_max, &time_offset_usec, 1, err);
-            break;
-        case 1: // client_address_index
-            in = cbor_parse_int(in, in_max, &client_address_index, 0, err);
-            break;
-        case 2: // client_port,
-            in = cbor_parse_int(in, in_max, &client_port, 0, err);
-            break;
-        case 3: // transaction_id
-            in = cbor_parse_int(in, in_max, &transaction_id, 0, err);
-            break;
-        case 4: // query_signature_index
-            in = cbor_parse_int(in, in_max, &query_signature_index, 0, err);
-            break;
-        case 5: // client_hoplimit
-            in = cbor_parse_int(in, in_max, &client_hoplimit, 0, err);
-            break;
-        case 6: // delay_useconds
-            in = cbor_parse_int(in, in_max, &delay_useconds, 1, err);
-            break;
-        case 7: // query_name_index
-            in = cbor_parse_int(in, in_max, &query_name_index, 0, err);
-            break;
-        case 8: // query_size
-            in = cbor_parse_int(in, in_max, &query_size, 0, err);
-            break;
-        case 9: // response_size
-            in = cbor_parse_int(in, in_max, &response_size, 0, err);
-            break;
-        case 10: // ResponseProcessingData
-            in = rpd.parse(in, in_max, err);
-            break;
-        case 11: // query_extended
-            in = q_extended.parse(in, in_max, err);
-            break;
-        case 12: // response_extended,\n");
-            in = r_extended.parse(in, in_max, err);
-            break;
-        default:
-            /* TODO: something */
-            in = cbor_skip(in, in_max, err);
-            break;
-        }
+    return in;
+}
 
-        if (in == NULL) {
-            fprintf(stderr, "\nError %d parsing query field type %d\n", *err, (int)val);
-        }
-    }
+static uint8_t const* cdns_query_parse_rpd(uint8_t const* in, uint8_t const* in_max, cdns_query* q, int* err)
+{
+    return q->rpd.parse(in, in_max, err);
+}
+
+static uint8_t const* cdns_query_parse_q_extended(uint8_t const* in, uint8_t const* in_max, cdns_query* q, int* err)
+{
+    return q->q_extended.parse(in, in_max, err);
+}
+
+static uint8_t const* cdns_query_parse_r_extended(uint8_t const* in, uint8_t const* in_max, cdns_query* q, int* err)
+{
+    return q->r_extended.parse(in, in_max, err);
+}
 
+static uint8_t const* cdns_query_parse_time_pseconds(uint8_t const* in, uint8_t const* in_max, cdns_query* q, int* err)
+{
+    int64_t t = 0;
+
+    in = cbor_parse_int64(in, in_max, &t, 1, err);
+    if (in != NULL) {
+        t /= 1000000;
+        q->time_offset_usec = (int)t;
+    }
     return in;
 }
 
-uint8_t* cdns_query::parse_map_item_old(uint8_t* old_in, uint8_t const* in_max, int64_t val, int* err)
+static uint8_t const* cdns_query_parse_delay_pseconds(uint8_t const* in, uint8_t const* in_max, cdns_query* q, int* err)
 {
-    uint8_t* in = old_in;
-    switch (val) {
-    case 0: // time_useconds
-        in = cbor_parse_int(in, in_max, &time_offset_usec, 1, err);
-        break;
-    case 1: // time_pseconds
-    {
-        int64_t t = 0;
-        in = cbor_parse_int64(in, in_max, &t, 1, err);
-        if (in != NULL) {
-            t /= 1000000;
-            time_offset_usec = (int)t;
-        }
-        break;
+    int64_t t = 0;
+
+    in = cbor_parse_int64(in, in_max, &t, 0, err);
+    if (in != NULL) {
+        t /= 1000000;
+        q->delay_useconds = (int)t;
     }
-    case 2: // client_address_index
-        in = cbor_parse_int(in, in_max, &client_address_index, 0, err);
-        break;
-    case 3: // client_port,
-        in = cbor_parse_int(in, in_max, &client_port, 0, err);
-        break;
-    case 4: // transaction_id
-        in = cbor_parse_int(in, in_max, &transaction_id, 0, err);
-        break;
-    case 5: // query_signature_index
-        in = cbor_parse_int(in, in_max, &query_signature_index, 0, err);
-        break;
-    case 6: // client_hoplimit
-        in = cbor_parse_int(in, in_max, &client_hoplimit, 0, err);
-        break;
-    case 7: // delay_useconds
-        in = cbor_parse_int(in, in_max, &delay_useconds, 1, err);
-        break;
-    case 8: // delay_pseconds
-    {
-        int64_t t = 0;
-        in = cbor_parse_int64(in, in_max, &t, 0, err);
-        if (in != NULL) {
-            t /= 1000000;
-            delay_useconds = (int)t;
+    return in;
+}
+
+static constexpr cbor_field<cdns_query> cdns_query_fields_rfc[] = {
+    cbor_int_field(0, &cdns_query::time_offset_usec, 1),
+    cbor_int_field(1, &cdns_query::client_address_index, 0),
+    cbor_int_field(2, &cdns_query::client_port, 0),
+    cbor_int_field(3, &cdns_query::transaction_id, 0),
+    cbor_int_field(4, &cdns_query::query_signature_index, 0),
+    cbor_int_field(5, &cdns_query::client_hoplimit, 0),
+    cbor_int_field(6, &cdns_query::delay_useconds, 1),
+    cbor_int_field(7, &cdns_query::query_name_index, 0),
+    cbor_int_field(8, &cdns_query::query_size, 0),
+    cbor_int_field(9, &cdns_query::response_size, 0),
+    cbor_custom_field(10, cdns_query_parse_rpd),
+    cbor_custom_field(11, cdns_query_parse_q_extended),
+    cbor_custom_field(12, cdns_query_parse_r_extended)
+};
+
+static constexpr cbor_field<cdns_query> cdns_query_fields_old[] = {
+    cbor_int_field(0, &cdns_query::time_offset_usec, 1),
+    cbor_custom_field(1, cdns_query_parse_time_pseconds),
+    cbor_int_field(2, &cdns_query::client_address_index, 0),
+    cbor_int_field(3, &cdns_query::client_port, 0),
+    cbor_int_field(4, &cdns_query::transaction_id, 0),
+    cbor_int_field(5, &cdns_query::query_signature_index, 0),
+    cbor_int_field(6, &cdns_query::client_hoplimit, 0),
+    cbor_int_field(7, &cdns_query::delay_useconds, 1),
+    cbor_custom_field(8, cdns_query_parse_delay_pseconds),
+    cbor_int_field(9, &cdns_query::query_name_index, 0),
+    cbor_int_field(10, &cdns_query::query_size, 0),
+    cbor_int_field(11, &cdns_query::response_size, 0),
+    cbor_custom_field(12, cdns_query_parse_q_extended),
+    cbor_custom_field(13, cdns_query_parse_r_extended)
+};
+
+/* Projection bit of the query items that can be skipped, 0 for the others */
+template <bool is_old> static inline uint32_t cdns_query_item_projection(int64_t val)
+{
+    uint32_t bit = 0;
+
+    if (is_old) {
+        if (val == 12 || val == 13) {
+            bit = CDNS_PROJECT_QUERY_EXTENDED;
         }
-        break;
     }
-    case 9: // query_name_index
-        in = cbor_parse_int(in, in_max, &query_name_index, 0, err);
-        break;
-    case 10: // query_size
-        in = cbor_parse_int(in, in_max, &query_size, 0, err);
-        break;
-    case 11: // response_size
-        in = cbor_parse_int(in, in_max, &response_size, 0, err);
-        break;
-    case 12: // query_extended
-        in = q_extended.parse(in, in_max, err);
-        break;
-    case 13: // response_extended,\n");
-        in = r_extended.parse(in, in_max, err);
-        break;
-    default:
-        /* TODO: something */
+    else if (val == 10) {
+        bit = CDNS_PROJECT_QUERY_RPD;
+    }
+    else if (val == 11 || val == 12) {
+        bit = CDNS_PROJECT_QUERY_EXTENDED;
+    }
+
+    return bit;
+}
+
+/* The items outside the projection are skipped. The mask is copied in the
+ * format context once per block. */
+template <bool is_old> uint8_t const* cdns_query::parse_map_item(uint8_t const* in, uint8_t const* in_max, int64_t val, int* err, cdns_format_ctx<is_old>* ctx)
+{
+    uint32_t bit = cdns_query_item_projection<is_old>(val);
+
+    if (bit != 0 && (ctx->projection & bit) == 0) {
         in = cbor_skip(in, in_max, err);
-        break;
+    }
+    else if (is_old) {
+        in = parse_map_item_old(in, in_max, val, err);
+    }
+    else {
+        in = parse_map_item_rfc(in, in_max, val, err);
+    }
+
+    return in;
+}
+
+uint8_t const* cdns_query::parse_map_item_rfc(uint8_t const* in, uint8_t const* in_max, int64_t val, int* err)
+{
+    in = cbor_fields_parse(in, in_max, this, val, cdns_query_fields_rfc, CBOR_NB_FIELDS(cdns_query_fields_rfc), err);
+
+    if (in == NULL) {
+        fprintf(stderr, "\nError %d parsing query field type %d\n", *err, (int)val);
     }
 
+    return in;
+}
+
+uint8_t const* cdns_query::parse_map_item_old(uint8_t const* in, uint8_t const* in_max, int64_t val, int* err)
+{
+    in = cbor_fields_parse(in, in_max, this, val, cdns_query_fields_old, CBOR_NB_FIELDS(cdns_query_fields_old), err);
+
     if (in == NULL) {
         fprintf(stderr, "\nError %d parsing query field type %d\n", *err, (int)val);
     }
 
     return in;
 }
+
+cdns_query_compact::cdns_query_compact() :
+    time_offset_usec(0),
+    client_address_index(0),
+    query_signature_index(0),
+    query_name_index(0),
+    delay_useconds(0),
+    extension_index(0),
+    client_port(0),
+    transaction_id(0),
+    query_size(0),
+    response_size(0),
+    client_hoplimit(0),
+    present(0)
+{
+}
+
+cdns_query_compact::~cdns_query_compact()
+{
+}
+
+cdns_query_extension::cdns_query_extension()
+{
+}
+
+cdns_query_extension::~cdns_query_extension()
+{
+}
+
+cdns_query_compact_table::cdns_query_compact_table()
+{
+}
+
+cdns_query_compact_table::~cdns_query_compact_table()
+{
+}
+
+void cdns_query_compact_table::reserve(size_t n)
+{
+    records.reserve(n);
+}
+
+void cdns_query_compact_table::append(cdns_query const* q)
+{
+    cdns_query_compact c;
+
+    c.time_offset_usec = q->time_offset_usec;
+    if (q->client_address_index >= 0) {
+        c.client_address_index = (uint32_t)q->client_address_index;
+        c.present |= CDNS_QUERY_HAS_CLIENT_ADDRESS;
+    }
+    if (q->query_signature_index >= 0) {
+        c.query_signature_index = (uint32_t)q->query_signature_index;
+        c.present |= CDNS_QUERY_HAS_SIGNATURE;
+    }
+    if (q->query_name_index >= 0) {
+        c.query_name_index = (uint32_t)q->query_name_index;
+        c.present |= CDNS_QUERY_HAS_NAME;
+    }
+    c.delay_useconds = q->delay_useconds;
+    c.client_port = (uint16_t)q->client_port;
+    c.transaction_id = (uint16_t)q->transaction_id;
+    c.query_size = (uint16_t)q->query_size;
+    c.response_size = (uint16_t)q->response_size;
+    c.client_hoplimit = (uint8_t)q->client_hoplimit;
+    if (q->rpd.is_present || q->q_extended.is_filled || q->r_extended.is_filled) {
+        c.extension_index = (uint32_t)extensions.size();
+        c.present |= CDNS_QUERY_HAS_EXTENSION;
+        extensions.resize(extensions.size() + 1);
+        extensions.back().rpd = q->rpd;
+        extensions.back().q_extended = q->q_extended;
+        extensions.back().r_extended = q->r_extended;
+    }
+
+    records.push_back(c);
+}
+
+void cdns_query_compact_table::release(cbor_arena* arena)
+{
+    cbor_arena_vector_release(&records, arena);
+    cbor_arena_vector_release(&extensions, arena);
+}
+
+void cdns_query_compact_table::swap(cdns_query_compact_table* other)
+{
+    records.swap(other->records);
+    extensions.swap(other->extensions);
+}
+
+cdns_query_columns::cdns_query_columns()
+{
+}
+
+cdns_query_columns::~cdns_query_columns()
+{
+}
+
+void cdns_query_columns::reserve(size_t n)
+{
+    time_offset_usec.reserve(n);
+    client_address_index.reserve(n);
+    client_port.reserve(n);
+    transaction_id.reserve(n);
+    query_signature_index.reserve(n);
+    client_hoplimit.reserve(n);
+    delay_useconds.reserve(n);
+    query_name_index.reserve(n);
+    query_size.reserve(n);
+    response_size.reserve(n);
+    rpd_is_present.reserve(n);
+    rpd_bailiwick_index.reserve(n);
+    rpd_processing_flags.reserve(n);
+    q_extended_is_filled.reserve(n);
+    q_extended_question_index.reserve(n);
+    q_extended_answer_index.reserve(n);
+    q_extended_authority_index.reserve(n);
+    q_extended_additional_index.reserve(n);
+    r_extended_is_filled.reserve(n);
+    r_extended_question_index.reserve(n);
+    r_extended_answer_index.reserve(n);
+    r_extended_authority_index.reserve(n);
+    r_extended_additional_index.reserve(n);
+}
+
+void cdns_query_columns::append(cdns_query const* q)
+{
+    time_offset_usec.push_back(q->time_offset_usec);
+    client_address_index.push_back(q->client_address_index);
+    client_port.push_back(q->client_port);
+    transaction_id.push_back(q->transaction_id);
+    query_signature_index.push_back(q->query_signature_index);
+    client_hoplimit.push_back(q->client_hoplimit);
+    delay_useconds.push_back(q->delay_useconds);
+    query_name_index.push_back(q->query_name_index);
+    query_size.push_back(q->query_size);
+    response_size.push_back(q->response_size);
+    rpd_is_present.push_back((uint8_t)q->rpd.is_present);
+    rpd_bailiwick_index.push_back(q->rpd.bailiwick_index);
+    rpd_processing_flags.push_back(q->rpd.processing_flags);
+    q_extended_is_filled.push_back((uint8_t)q->q_extended.is_filled);
+    q_extended_question_index.push_back(q->q_extended.question_index);
+    q_extended_answer_index.push_back(q->q_extended.answer_index);
+    q_extended_authority_index.push_back(q->q_extended.authority_index);
+    q_extended_additional_index.push_back(q->q_extended.additional_index);
+    r_extended_is_filled.push_back((uint8_t)q->r_extended.is_filled);
+    r_extended_question_index.push_back(q->r_extended.question_index);
+    r_extended_answer_index.push_back(q->r_extended.answer_index);
+    r_extended_authority_index.push_back(q->r_extended.authority_index);
+    r_extended_additional_index.push_back(q->r_extended.additional_index);
+}
+
+void cdns_query_columns::release(cbor_arena* arena)
+{
+    cbor_arena_vector_release(&time_offset_usec, arena);
+    cbor_arena_vector_release(&client_address_index, arena);
+    cbor_arena_vector_release(&client_port, arena);
+    cbor_arena_vector_release(&transaction_id, arena);
+    cbor_arena_vector_release(&query_signature_index, arena);
+    cbor_arena_vector_release(&client_hoplimit, arena);
+    cbor_arena_vector_release(&delay_useconds, arena);
+    cbor_arena_vector_release(&query_name_index, arena);
+    cbor_arena_vector_release(&query_size, arena);
+    cbor_arena_vector_release(&response_size, arena);
+    cbor_arena_vector_release(&rpd_is_present, arena);
+    cbor_arena_vector_release(&rpd_bailiwick_index, arena);
+    cbor_arena_vector_release(&rpd_processing_flags, arena);
+    cbor_arena_vector_release(&q_extended_is_filled, arena);
+    cbor_arena_vector_release(&q_extended_question_index, arena);
+    cbor_arena_vector_release(&q_extended_answer_index, arena);
+    cbor_arena_vector_release(&q_extended_authority_index, arena);
+    cbor_arena_vector_release(&q_extended_additional_index, arena);
+    cbor_arena_vector_release(&r_extended_is_filled, arena);
+    cbor_arena_vector_release(&r_extended_question_index, arena);
+    cbor_arena_vector_release(&r_extended_answer_index, arena);
+    cbor_arena_vector_release(&r_extended_authority_index, arena);
+    cbor_arena_vector_release(&r_extended_additional_index, arena);
+}
+
+void cdns_query_columns::swap(cdns_query_columns* other)
+{
+    time_offset_usec.swap(other->time_offset_usec);
+    client_address_index.swap(other->client_address_index);
+    client_port.swap(other->client_port);
+    transaction_id.swap(other->transaction_id);
+    query_signature_index.swap(other->query_signature_index);
+    client_hoplimit.swap(other->client_hoplimit);
+    delay_useconds.swap(other->delay_useconds);
+    query_name_index.swap(other->query_name_index);
+    query_size.swap(other->query_size);
+    response_size.swap(other->response_size);
+    rpd_is_present.swap(other->rpd_is_present);
+    rpd_bailiwick_index.swap(other->rpd_bailiwick_index);
+    rpd_processing_flags.swap(other->rpd_processing_flags);
+    q_extended_is_filled.swap(other->q_extended_is_filled);
+    q_extended_question_index.swap(other->q_extended_question_index);
+    q_extended_answer_index.swap(other->q_extended_answer_index);
+    q_extended_authority_index.swap(other->q_extended_authority_index);
+    q_extended_additional_index.swap(other->q_extended_additional_index);
+    r_extended_is_filled.swap(other->r_extended_is_filled);
+    r_extended_question_index.swap(other->r_extended_question_index);
+    r_extended_answer_index.swap(other->r_extended_answer_index);
+    r_extended_authority_index.swap(other->r_extended_authority_index);
+    r_extended_additional_index.swap(other->r_extended_additional_index);
+}
+
 cdns_qr_extended::cdns_qr_extended():
     question_index(-1),
     answer_index(-1),
@@ -2122,7 +3669,7 @@ cdns_qr_extended::~cdns_qr_extended()
 {
 }
 
-uint8_t* cdns_qr_extended::parse(uint8_t* in, uint8_t const* in_max, int* err)
+uint8_t const* cdns_qr_extended::parse(uint8_t const* in, uint8_t const* in_max, int* err)
 {
     if (is_filled) {
         clear();
@@ -2132,27 +3679,16 @@ uint8_t* cdns_qr_extended::parse(uint8_t* in, uint8_t const* in_max, int* err)
     return cbor_map_parse(in, in_max, this, err);
 }
 
-uint8_t* cdns_qr_extended::parse_map_item(uint8_t* in, uint8_t const* in_max, int64_t val, int* err)
+static constexpr cbor_field<cdns_qr_extended> cdns_qr_extended_fields[] = {
+    cbor_int_field(0, &cdns_qr_extended::question_index, 0),
+    cbor_int_field(1, &cdns_qr_extended::answer_index, 0),
+    cbor_int_field(2, &cdns_qr_extended::authority_index, 0),
+    cbor_int_field(3, &cdns_qr_extended::additional_index, 0)
+};
+
+uint8_t const* cdns_qr_extended::parse_map_item(uint8_t const* in, uint8_t const* in_max, int64_t val, int* err)
 {
-    switch (val) {
-    case 0: // question_index
-        in = cbor_parse_int(in, in_max, &question_index, 0, err);
-        break;
-    case 1: // answer_index
-        in = cbor_parse_int(in, in_max, &answer_index, 0, err);
-        break;
-    case 2: // authority_index
-        in = cbor_parse_int(in, in_max, &authority_index, 0, err);
-        break;
-    case 3: // additional_index
-        in = cbor_parse_int(in, in_max, &additional_index, 0, err);
-        break;
-    default:
-        /* TODO: something */
-        in = cbor_skip(in, in_max, err);
-        break;
-    }
-    return in;
+    return cbor_fields_parse(in, in_max, this, val, cdns_qr_extended_fields, CBOR_NB_FIELDS(cdns_qr_extended_fields), err);
 }
 
 void cdns_qr_extended::clear()
@@ -2165,7 +3701,7 @@ void cdns_qr_extended::clear()
 }
 
 cdns_query_signature::cdns_query_signature() :
-    current_block(NULL),
+    is_old_format(false),
     server_address_index(-1),
     server_port(0),
     qr_transport_flags(0),
@@ -2190,9 +3726,9 @@ cdns_query_signature::~cdns_query_signature()
 {
 }
 
-cdns_ip_protocol_enum cdns_query_signature::ip_protocol()
+cdns_ip_protocol_enum cdns_query_signature::ip_protocol() const
 {
-    if (current_block->current_cdns->is_old_version()) {
+    if (is_old_format) {
         return (cdns_ip_protocol_enum)((qr_transport_flags>>1) & 1);
     }
     else {
@@ -2200,9 +3736,9 @@ cdns_ip_protocol_enum cdns_query_signature::ip_protocol()
     }
 }
 
-cdns_transport_protocol_enum cdns_query_signature::transport_protocol()
+cdns_transport_protocol_enum cdns_query_signature::transport_protocol() const
 {
-    if (current_block->current_cdns->is_old_version()) {
+    if (is_old_format) {
         return (cdns_transport_protocol_enum)(qr_transport_flags & 1);
     }
     else {
@@ -2212,7 +3748,7 @@ cdns_transport_protocol_enum cdns_query_signature::transport_protocol()
 
 bool cdns_query_signature::has_trailing_bytes()
 {
-    if (current_block->current_cdns->is_old_version()) {
+    if (is_old_format) {
         return ((qr_transport_flags & 4) != 0);
     }
     else {
@@ -2232,7 +3768,7 @@ bool cdns_query_signature::is_response_present()
 
 bool cdns_query_signature::is_query_present_with_OPT()
 {
-    if (current_block->current_cdns->is_old_version()) {
+    if (is_old_format) {
         return ((qr_sig_flags & 8) != 0);
     }
     else {
@@ -2240,164 +3776,287 @@ bool cdns_query_signature::is_query_present_with_OPT()
     }
 }
 
-bool cdns_query_signature::is_response_present_with_OPT()
+bool cdns_query_signature::is_response_present_with_OPT()
+{
+    if (is_old_format) {
+        return ((qr_sig_flags & 16) != 0);
+    }
+    else {
+        return ((qr_sig_flags & 8) != 0);
+    }
+}
+
+bool cdns_query_signature::is_query_present_with_no_question()
+{
+    if (is_old_format) {
+        /* This flag is not defined in the old version, so we just take a guess */
+        return is_response_present_with_no_question();
+    }
+    else {
+        return ((qr_sig_flags & 16) != 0);
+    }
+}
+
+bool cdns_query_signature::is_response_present_with_no_question()
+{
+    return ((qr_sig_flags & 32) != 0);
+}
+
+uint8_t const* cdns_query_signature::parse(uint8_t const* in, uint8_t const* in_max, int* err, cdnsBlock* current_block)
+{
+    if (current_block->current_cdns->is_old_version()) {
+        cdns_draft_ctx ctx(current_block);
+        in = parse(in, in_max, err, &ctx);
+    }
+    else {
+        cdns_rfc_ctx ctx(current_block);
+        in = parse(in, in_max, err, &ctx);
+    }
+    return in;
+    /* TODO: deal with index pointers changes between old and new. */
+}
+
+template <bool is_old> uint8_t const* cdns_query_signature::parse(uint8_t const* in, uint8_t const* in_max, int* err, cdns_format_ctx<is_old>* ctx)
+{
+    (void)ctx;
+    is_old_format = is_old;
+    if (is_old) {
+        in = cbor_map_parse_with<cdns_query_signature, &cdns_query_signature::parse_map_item_old>(in, in_max, this, err);
+    }
+    else {
+        in = cbor_map_parse_with<cdns_query_signature, &cdns_query_signature::parse_map_item_rfc>(in, in_max, this, err);
+    }
+    return in;
+}
+
+static constexpr cbor_field<cdns_query_signature> cdns_query_signature_fields_rfc[] = {
+    cbor_int_field(0, &cdns_query_signature::server_address_index, 0),
+    cbor_int_field(1, &cdns_query_signature::server_port, 0),
+    cbor_int_field(2, &cdns_query_signature::qr_transport_flags, 0),
+    cbor_int_field(3, &cdns_query_signature::qr_type, 0),
+    cbor_int_field(4, &cdns_query_signature::qr_sig_flags, 0),
+    cbor_int_field(5, &cdns_query_signature::query_opcode, 0),
+    cbor_int_field(6, &cdns_query_signature::qr_dns_flags, 0),
+    cbor_int_field(7, &cdns_query_signature::query_rcode, 0),
+    cbor_int_field(8, &cdns_query_signature::query_classtype_index, 0),
+    cbor_int_field(9, &cdns_query_signature::query_qd_count, 0),
+    cbor_int_field(10, &cdns_query_signature::query_an_count, 0),
+    cbor_int_field(11, &cdns_query_signature::query_ns_count, 0),
+    cbor_int_field(12, &cdns_query_signature::query_ar_count, 0),
+    cbor_int_field(13, &cdns_query_signature::edns_version, 0),
+    cbor_int_field(14, &cdns_query_signature::udp_buf_size, 0),
+    cbor_int_field(15, &cdns_query_signature::opt_rdata_index, 0),
+    cbor_int_field(16, &cdns_query_signature::response_rcode, 0)
+};
+
+static constexpr cbor_field<cdns_query_signature> cdns_query_signature_fields_old[] = {
+    cbor_int_field(0, &cdns_query_signature::server_address_index, 0),
+    cbor_int_field(1, &cdns_query_signature::server_port, 0),
+    cbor_int_field(2, &cdns_query_signature::qr_transport_flags, 0),
+    cbor_int_field(3, &cdns_query_signature::qr_sig_flags, 0),
+    cbor_int_field(4, &cdns_query_signature::query_opcode, 0),
+    cbor_int_field(5, &cdns_query_signature::qr_dns_flags, 0),
+    cbor_int_field(6, &cdns_query_signature::query_rcode, 0),
+    cbor_int_field(7, &cdns_query_signature::query_classtype_index, 0),
+    cbor_int_field(8, &cdns_query_signature::query_qd_count, 0),
+    cbor_int_field(9, &cdns_query_signature::query_an_count, 0),
+    cbor_int_field(10, &cdns_query_signature::query_ar_count, 0),
+    cbor_int_field(11, &cdns_query_signature::query_ns_count, 0),
+    cbor_int_field(12, &cdns_query_signature::edns_version, 0),
+    cbor_int_field(13, &cdns_query_signature::udp_buf_size, 0),
+    cbor_int_field(14, &cdns_query_signature::opt_rdata_index, 0),
+    cbor_int_field(15, &cdns_query_signature::response_rcode, 0)
+};
+
+uint8_t const* cdns_query_signature::parse_map_item_rfc(uint8_t const* in, uint8_t const* in_max, int64_t val, int* err)
+{
+    return cbor_fields_parse(in, in_max, this, val, cdns_query_signature_fields_rfc, CBOR_NB_FIELDS(cdns_query_signature_fields_rfc), err);
+}
+
+uint8_t const* cdns_query_signature::parse_map_item_old(uint8_t const* in, uint8_t const* in_max, int64_t val, int* err)
+{
+    return cbor_fields_parse(in, in_max, this, val, cdns_query_signature_fields_old, CBOR_NB_FIELDS(cdns_query_signature_fields_old), err);
+}
+
+
+cdns_query_signature_compact::cdns_query_signature_compact() :
+    server_address_index(0),
+    query_classtype_index(0),
+    opt_rdata_index(0),
+    server_port(0),
+    qr_dns_flags(0),
+    query_rcode(0),
+    response_rcode(0),
+    udp_buf_size(0),
+    query_qd_count(0),
+    query_an_count(0),
+    query_ar_count(0),
+    query_ns_count(0),
+    qr_transport_flags(0),
+    qr_type(0),
+    qr_sig_flags(0),
+    query_opcode(0),
+    edns_version(0),
+    present(0)
+{
+}
+
+cdns_query_signature_compact::~cdns_query_signature_compact()
 {
-    if (current_block->current_cdns->is_old_version()) {
-        return ((qr_sig_flags & 16) != 0);
-    }
-    else {
-        return ((qr_sig_flags & 8) != 0);
-    }
 }
 
-bool cdns_query_signature::is_query_present_with_no_question()
+cdns_query_signature_compact_table::cdns_query_signature_compact_table()
 {
-    if (current_block->current_cdns->is_old_version()) {
-        /* This flag is not defined in the old version, so we just take a guess */
-        return is_response_present_with_no_question();
-    }
-    else {
-        return ((qr_sig_flags & 16) != 0);
-    }
 }
 
-bool cdns_query_signature::is_response_present_with_no_question()
+cdns_query_signature_compact_table::~cdns_query_signature_compact_table()
 {
-    return ((qr_sig_flags & 32) != 0);
 }
 
-uint8_t* cdns_query_signature::parse(uint8_t* in, uint8_t const* in_max, int* err, cdnsBlock* current_block)
+void cdns_query_signature_compact_table::reserve(size_t n)
 {
-    this->current_block = current_block;
-    return cbor_map_parse(in, in_max, this, err);
-    /* TODO: deal with index pointers changes between old and new. */
+    records.reserve(n);
 }
 
-uint8_t* cdns_query_signature::parse_map_item(uint8_t* in, uint8_t const* in_max, int64_t val, int* err)
+void cdns_query_signature_compact_table::append(cdns_query_signature const* q_sig)
 {
-    if (current_block->current_cdns->is_old_version()) {
-        in = parse_map_item_old(in, in_max, val, err);
+    cdns_query_signature_compact c;
+
+    if (q_sig->server_address_index >= 0) {
+        c.server_address_index = (uint32_t)q_sig->server_address_index;
+        c.present |= CDNS_QUERY_SIGNATURE_HAS_SERVER_ADDRESS;
     }
-    else {
-        switch (val) {
-        case 0: /*  server_address_index */
-            in = cbor_parse_int(in, in_max, &server_address_index, 0, err);
-            break;
-        case 1: /*  server_port */
-            in = cbor_parse_int(in, in_max, &server_port, 0, err);
-            break;
-        case 2: /*  transport_flags */
-            in = cbor_parse_int(in, in_max, &qr_transport_flags, 0, err);
-            break;
-        case 3: /* qr type */
-            in = cbor_parse_int(in, in_max, &qr_type, 0, err);
-            break;
-        case 4: /*  qr_sig_flags */
-            in = cbor_parse_int(in, in_max, &qr_sig_flags, 0, err);
-            break;
-        case 5: /*  query_opcode */
-            in = cbor_parse_int(in, in_max, &query_opcode, 0, err);
-            break;
-        case 6: /*  qr_dns_flags */
-            in = cbor_parse_int(in, in_max, &qr_dns_flags, 0, err);
-            break;
-        case 7: /*  query_rcode */
-            in = cbor_parse_int(in, in_max, &query_rcode, 0, err);
-            break;
-        case 8: /*  query_classtype_index */
-            in = cbor_parse_int(in, in_max, &query_classtype_index, 0, err);
-            break;
-        case 9: /*  query_qd_count */
-            in = cbor_parse_int(in, in_max, &query_qd_count, 0, err);
-            break;
-        case 10: /*  query_an_count */
-            in = cbor_parse_int(in, in_max, &query_an_count, 0, err);
-            break;
-        case 11: /*  query_ns_count */
-            in = cbor_parse_int(in, in_max, &query_ns_count, 0, err);
-            break;
-        case 12: /*  query_ar_count */
-            in = cbor_parse_int(in, in_max, &query_ar_count, 0, err);
-            break;
-        case 13: /*  edns_version */
-            in = cbor_parse_int(in, in_max, &edns_version, 0, err);
-            break;
-        case 14: /*  udp_buf_size */
-            in = cbor_parse_int(in, in_max, &udp_buf_size, 0, err);
-            break;
-        case 15: /*  opt_rdata_index */
-            in = cbor_parse_int(in, in_max, &opt_rdata_index, 0, err);
-            break;
-        case 16: /*  response_rcode */
-            in = cbor_parse_int(in, in_max, &response_rcode, 0, err);
-            break;
-        default:
-            in = cbor_skip(in, in_max, err);
-            break;
-        }
+    if (q_sig->query_classtype_index >= 0) {
+        c.query_classtype_index = (uint32_t)q_sig->query_classtype_index;
+        c.present |= CDNS_QUERY_SIGNATURE_HAS_CLASSTYPE;
     }
-    return in;
-}
-
-uint8_t* cdns_query_signature::parse_map_item_old(uint8_t* in, uint8_t const* in_max, int64_t val, int* err)
-{
-    switch (val) {
-    case 0: /*  server_address_index */
-        in = cbor_parse_int(in, in_max, &server_address_index, 0, err);
-        break;
-    case 1: /*  server_port */
-        in = cbor_parse_int(in, in_max, &server_port, 0, err);
-        break;
-    case 2: /*  transport_flags */
-        in = cbor_parse_int(in, in_max, &qr_transport_flags, 0, err);
-        break;
-    case 3: /*  qr_sig_flags */
-        in = cbor_parse_int(in, in_max, &qr_sig_flags, 0, err);
-        break;
-    case 4: /*  query_opcode */
-        in = cbor_parse_int(in, in_max, &query_opcode, 0, err);
-        break;
-    case 5: /*  qr_dns_flags */
-        in = cbor_parse_int(in, in_max, &qr_dns_flags, 0, err);
-        break;
-    case 6: /*  query_rcode */
-        in = cbor_parse_int(in, in_max, &query_rcode, 0, err);
-        break;
-    case 7: /*  query_classtype_index */
-        in = cbor_parse_int(in, in_max, &query_classtype_index, 0, err);
-        break;
-    case 8: /*  query_qd_count */
-        in = cbor_parse_int(in, in_max, &query_qd_count, 0, err);
-        break;
-    case 9: /*  query_an_count */
-        in = cbor_parse_int(in, in_max, &query_an_count, 0, err);
-        break;
-    case 10: /*  query_ar_count */
-        in = cbor_parse_int(in, in_max, &query_ar_count, 0, err);
-        break;
-    case 11: /*  query_ns_count */
-        in = cbor_parse_int(in, in_max, &query_ns_count, 0, err);
-        break;
-    case 12: /*  edns_version */
-        in = cbor_parse_int(in, in_max, &edns_version, 0, err);
-        break;
-    case 13: /*  udp_buf_size */
-        in = cbor_parse_int(in, in_max, &udp_buf_size, 0, err);
-        break;
-    case 14: /*  opt_rdata_index */
-        in = cbor_parse_int(in, in_max, &opt_rdata_index, 0, err);
-        break;
-    case 15: /*  response_rcode */
-        in = cbor_parse_int(in, in_max, &response_rcode, 0, err);
-        break;
-    default:
-        in = cbor_skip(in, in_max, err);
-        break;
+    if (q_sig->opt_rdata_index >= 0) {
+        c.opt_rdata_index = (uint32_t)q_sig->opt_rdata_index;
+        c.present |= CDNS_QUERY_SIGNATURE_HAS_OPT_RDATA;
     }
-    return in;
+    if (q_sig->edns_version >= 0) {
+        c.edns_version = (uint8_t)q_sig->edns_version;
+        c.present |= CDNS_QUERY_SIGNATURE_HAS_EDNS_VERSION;
+    }
+    c.server_port = (uint16_t)q_sig->server_port;
+    c.qr_dns_flags = (uint16_t)q_sig->qr_dns_flags;
+    c.query_rcode = (uint16_t)q_sig->query_rcode;
+    c.response_rcode = (uint16_t)q_sig->response_rcode;
+    c.udp_buf_size = (uint16_t)q_sig->udp_buf_size;
+    c.query_qd_count = (uint16_t)q_sig->query_qd_count;
+    c.query_an_count = (uint16_t)q_sig->query_an_count;
+    c.query_ar_count = (uint16_t)q_sig->query_ar_count;
+    c.query_ns_count = (uint16_t)q_sig->query_ns_count;
+    c.qr_transport_flags = (uint8_t)q_sig->qr_transport_flags;
+    c.qr_type = (uint8_t)q_sig->qr_type;
+    c.qr_sig_flags = (uint8_t)q_sig->qr_sig_flags;
+    c.query_opcode = (uint8_t)q_sig->query_opcode;
+
+    records.push_back(c);
+}
+
+void cdns_query_signature_compact_table::release(cbor_arena* arena)
+{
+    cbor_arena_vector_release(&records, arena);
+}
+
+void cdns_query_signature_compact_table::swap(cdns_query_signature_compact_table* other)
+{
+    records.swap(other->records);
+}
+
+cdns_query_signature_columns::cdns_query_signature_columns()
+{
+}
+
+cdns_query_signature_columns::~cdns_query_signature_columns()
+{
+}
+
+void cdns_query_signature_columns::reserve(size_t n)
+{
+    server_address_index.reserve(n);
+    server_port.reserve(n);
+    qr_transport_flags.reserve(n);
+    qr_type.reserve(n);
+    qr_sig_flags.reserve(n);
+    query_opcode.reserve(n);
+    qr_dns_flags.reserve(n);
+    query_rcode.reserve(n);
+    query_classtype_index.reserve(n);
+    query_qd_count.reserve(n);
+    query_an_count.reserve(n);
+    query_ar_count.reserve(n);
+    query_ns_count.reserve(n);
+    edns_version.reserve(n);
+    udp_buf_size.reserve(n);
+    opt_rdata_index.reserve(n);
+    response_rcode.reserve(n);
+}
+
+void cdns_query_signature_columns::append(cdns_query_signature const* q_sig)
+{
+    server_address_index.push_back(q_sig->server_address_index);
+    server_port.push_back(q_sig->server_port);
+    qr_transport_flags.push_back(q_sig->qr_transport_flags);
+    qr_type.push_back(q_sig->qr_type);
+    qr_sig_flags.push_back(q_sig->qr_sig_flags);
+    query_opcode.push_back(q_sig->query_opcode);
+    qr_dns_flags.push_back(q_sig->qr_dns_flags);
+    query_rcode.push_back(q_sig->query_rcode);
+    query_classtype_index.push_back(q_sig->query_classtype_index);
+    query_qd_count.push_back(q_sig->query_qd_count);
+    query_an_count.push_back(q_sig->query_an_count);
+    query_ar_count.push_back(q_sig->query_ar_count);
+    query_ns_count.push_back(q_sig->query_ns_count);
+    edns_version.push_back(q_sig->edns_version);
+    udp_buf_size.push_back(q_sig->udp_buf_size);
+    opt_rdata_index.push_back(q_sig->opt_rdata_index);
+    response_rcode.push_back(q_sig->response_rcode);
+}
+
+void cdns_query_signature_columns::release(cbor_arena* arena)
+{
+    cbor_arena_vector_release(&server_address_index, arena);
+    cbor_arena_vector_release(&server_port, arena);
+    cbor_arena_vector_release(&qr_transport_flags, arena);
+    cbor_arena_vector_release(&qr_type, arena);
+    cbor_arena_vector_release(&qr_sig_flags, arena);
+    cbor_arena_vector_release(&query_opcode, arena);
+    cbor_arena_vector_release(&qr_dns_flags, arena);
+    cbor_arena_vector_release(&query_rcode, arena);
+    cbor_arena_vector_release(&query_classtype_index, arena);
+    cbor_arena_vector_release(&query_qd_count, arena);
+    cbor_arena_vector_release(&query_an_count, arena);
+    cbor_arena_vector_release(&query_ar_count, arena);
+    cbor_arena_vector_release(&query_ns_count, arena);
+    cbor_arena_vector_release(&edns_version, arena);
+    cbor_arena_vector_release(&udp_buf_size, arena);
+    cbor_arena_vector_release(&opt_rdata_index, arena);
+    cbor_arena_vector_release(&response_rcode, arena);
+}
+
+void cdns_query_signature_columns::swap(cdns_query_signature_columns* other)
+{
+    server_address_index.swap(other->server_address_index);
+    server_port.swap(other->server_port);
+    qr_transport_flags.swap(other->qr_transport_flags);
+    qr_type.swap(other->qr_type);
+    qr_sig_flags.swap(other->qr_sig_flags);
+    query_opcode.swap(other->query_opcode);
+    qr_dns_flags.swap(other->qr_dns_flags);
+    query_rcode.swap(other->query_rcode);
+    query_classtype_index.swap(other->query_classtype_index);
+    query_qd_count.swap(other->query_qd_count);
+    query_an_count.swap(other->query_an_count);
+    query_ar_count.swap(other->query_ar_count);
+    query_ns_count.swap(other->query_ns_count);
+    edns_version.swap(other->edns_version);
+    udp_buf_size.swap(other->udp_buf_size);
+    opt_rdata_index.swap(other->opt_rdata_index);
+    response_rcode.swap(other->response_rcode);
 }
 
-
 cdns_question::cdns_question():
     name_index(-1),
     classtype_index(-1)
@@ -2408,9 +4067,9 @@ cdns_question::~cdns_question()
 {
 }
 
-uint8_t* cdns_question::parse(uint8_t* in, uint8_t const* in_max, int* err)
+uint8_t const* cdns_question::parse(uint8_t const* in, uint8_t const* in_max, int* err)
 {
-    uint8_t * out = cbor_map_parse(in, in_max, this, err);
+    uint8_t const* out = cbor_map_parse(in, in_max, this, err);
 
     if (out == NULL) {
         char out_buf[1024];
@@ -2423,21 +4082,14 @@ uint8_t* cdns_question::parse(uint8_t* in, uint8_t const* in_max, int* err)
     return out;
 }
 
-uint8_t* cdns_question::parse_map_item(uint8_t* in, uint8_t const* in_max, int64_t val, int* err)
+static constexpr cbor_field<cdns_question> cdns_question_fields[] = {
+    cbor_int_field(0, &cdns_question::name_index, 0),
+    cbor_int_field(1, &cdns_question::classtype_index, 0)
+};
+
+uint8_t const* cdns_question::parse_map_item(uint8_t const* in, uint8_t const* in_max, int64_t val, int* err)
 {
-    switch (val) {
-    case 0: // name_index
-        in = cbor_parse_int(in, in_max, &name_index, 0, err);
-        break;
-    case 1: // classtype_index
-        in = cbor_parse_int(in, in_max, &classtype_index, 0, err);
-        break;
-    default:
-        /* TODO: something */
-        in = cbor_skip(in, in_max, err);
-        break;
-    }
-    return in;
+    return cbor_fields_parse(in, in_max, this, val, cdns_question_fields, CBOR_NB_FIELDS(cdns_question_fields), err);
 }
 
 cdns_rr_field::cdns_rr_field() :
@@ -2452,45 +4104,21 @@ cdns_rr_field::~cdns_rr_field()
 {
 }
 
-uint8_t* cdns_rr_field::parse(uint8_t* in, uint8_t const* in_max, int* err)
+uint8_t const* cdns_rr_field::parse(uint8_t const* in, uint8_t const* in_max, int* err)
 {
     return cbor_map_parse(in, in_max, this, err);
 }
 
-uint8_t* cdns_rr_field::parse_map_item(uint8_t* in, uint8_t const* in_max, int64_t val, int* err)
-{
-    switch (val) {
-    case 0: // name_index
-        in = cbor_parse_int(in, in_max, &name_index, 0, err);
-        break;
-    case 1: // classtype_index
-        in = cbor_parse_int(in, in_max, &classtype_index, 0, err);
-        break;
-    case 2: // ttl
-        in = cbor_parse_int(in, in_max, &ttl, 0, err);
-        break;
-    case 3: // rdata_index
-        in = cbor_parse_int(in, in_max, &rdata_index, 0, err);
-        break;
-    default:
-        /* TODO: something */
-        in = cbor_skip(in, in_max, err);
-        break;
-    }
-    return in;
-}
-
-cdns_rr_list::cdns_rr_list()
-{
-}
-
-cdns_rr_list::~cdns_rr_list()
-{
-}
+static constexpr cbor_field<cdns_rr_field> cdns_rr_field_fields[] = {
+    cbor_int_field(0, &cdns_rr_field::name_index, 0),
+    cbor_int_field(1, &cdns_rr_field::classtype_index, 0),
+    cbor_int_field(2, &cdns_rr_field::ttl, 0),
+    cbor_int_field(3, &cdns_rr_field::rdata_index, 0)
+};
 
-uint8_t* cdns_rr_list::parse(uint8_t* in, uint8_t const* in_max, int* err)
+uint8_t const* cdns_rr_field::parse_map_item(uint8_t const* in, uint8_t const* in_max, int64_t val, int* err)
 {
-    return cbor_array_parse(in, in_max, &rr_index, err);
+    return cbor_fields_parse(in, in_max, this, val, cdns_rr_field_fields, CBOR_NB_FIELDS(cdns_rr_field_fields), err);
 }
 
 cdns_block_statistics::cdns_block_statistics() :
@@ -2509,7 +4137,7 @@ cdns_block_statistics::~cdns_block_statistics()
 {
 }
 
-uint8_t* cdns_block_statistics::parse(uint8_t* in, uint8_t const* in_max, int* err, cdnsBlock* current_block)
+uint8_t const* cdns_block_statistics::parse(uint8_t const* in, uint8_t const* in_max, int* err, cdnsBlock* current_block)
 {
     clear();
     is_filled = true;
@@ -2517,40 +4145,31 @@ uint8_t* cdns_block_statistics::parse(uint8_t* in, uint8_t const* in_max, int* e
     return cbor_map_parse(in, in_max, this, err);
 }
 
-uint8_t* cdns_block_statistics::parse_map_item(uint8_t* in, uint8_t const* in_max, int64_t val, int* err)
-{
+static constexpr cbor_field<cdns_block_statistics> cdns_block_statistics_fields_rfc[] = {
+    cbor_int_field(0, &cdns_block_statistics::processed_messages, 0),
+    cbor_int_field(1, &cdns_block_statistics::qr_data_items, 0),
+    cbor_int_field(2, &cdns_block_statistics::unmatched_queries, 0),
+    cbor_int_field(3, &cdns_block_statistics::unmatched_responses, 0),
+    cbor_int_field(4, &cdns_block_statistics::discarded_opcode, 0)
+};
 
-    switch (val) {
-    case 0:
-        in = cbor_parse_int(in, in_max, &processed_messages, 0, err);
-        break;
-    case 1:
-        in = cbor_parse_int(in, in_max, &qr_data_items, 0, err);
-        break;
-    case 2: // unmatched_queries,
-        in = cbor_parse_int(in, in_max, &unmatched_queries, 0, err);
-        break;
-    case 3: // unmatched_responses,
-        in = cbor_parse_int(in, in_max, &unmatched_responses, 0, err);
-        break;
-    case 4: // discarded opcode (v1.0) or malformed_packets (v0.5)
-        if (current_block->current_cdns->is_old_version()) {
-            in = cbor_parse_int(in, in_max, &malformed_items, 0, err);
-        }
-        else {
-            in = cbor_parse_int(in, in_max, &discarded_opcode, 0, err);
-        }
-        break;
-    case 5: // partially_malformed_packets,
-        if (current_block->current_cdns->is_old_version()) {
-            in = cbor_parse_int(in, in_max, &malformed_items, 0, err);
-        }
-        else {
-            in = cbor_skip(in, in_max, err);
-        }
-        break;
-    default:
-        in = cbor_skip(in, in_max, err);
+/* The draft counts malformed packets (4) and partially malformed packets (5) together */
+static constexpr cbor_field<cdns_block_statistics> cdns_block_statistics_fields_old[] = {
+    cbor_int_field(0, &cdns_block_statistics::processed_messages, 0),
+    cbor_int_field(1, &cdns_block_statistics::qr_data_items, 0),
+    cbor_int_field(2, &cdns_block_statistics::unmatched_queries, 0),
+    cbor_int_field(3, &cdns_block_statistics::unmatched_responses, 0),
+    cbor_int_field(4, &cdns_block_statistics::malformed_items, 0),
+    cbor_int_field(5, &cdns_block_statistics::malformed_items, 0)
+};
+
+uint8_t const* cdns_block_statistics::parse_map_item(uint8_t const* in, uint8_t const* in_max, int64_t val, int* err)
+{
+    if (current_block->current_cdns->is_old_version()) {
+        in = cbor_fields_parse(in, in_max, this, val, cdns_block_statistics_fields_old, CBOR_NB_FIELDS(cdns_block_statistics_fields_old), err);
+    }
+    else {
+        in = cbor_fields_parse(in, in_max, this, val, cdns_block_statistics_fields_rfc, CBOR_NB_FIELDS(cdns_block_statistics_fields_rfc), err);
     }
 
     return in;
@@ -2582,30 +4201,36 @@ cdns_block_preamble_old::~cdns_block_preamble_old()
 }
 
 /* TODO: change this to define the new and old formats. */
-uint8_t* cdns_block_preamble_old::parse(uint8_t* in, uint8_t const* in_max, int* err)
+/* Time stamps are encoded as an array of two numbers, seconds and
+ * sub-second ticks. They are parsed directly as 64 bit numbers, without
+ * an intermediate vector, so seconds past 2^31 are preserved. */
+static uint8_t const* cdns_parse_time_pair(uint8_t const* in, uint8_t const* in_max, int64_t* t_sec, int64_t* t_sub, int* err)
 {
-    in = cbor_map_parse(in, in_max, this, err);
+    int outer_type = CBOR_CLASS(*in);
+    int64_t val;
 
-    if (!is_filled) {
+    in = cbor_get_number(in, in_max, &val);
+
+    if (in == NULL || outer_type != CBOR_T_ARRAY || (val != 2 && val != CBOR_END_OF_ARRAY)) {
         *err = CBOR_MALFORMED_VALUE;
         in = NULL;
     }
-    return(in);
-}
+    else {
+        int64_t t[2] = { 0, 0 };
 
-uint8_t* cdns_block_preamble_old::parse_map_item(uint8_t* in, uint8_t const* in_max, int64_t val, int* err)
-{
-    switch (val) {
-    case 1: // total_packets
-    {
-        std::vector<int> t;
-        in = cbor_array_parse(in, in_max, &t, err);
+        for (int i = 0; i < 2 && in != NULL; i++) {
+            if (in >= in_max || *in == CBOR_END_MARK) {
+                *err = CBOR_MALFORMED_VALUE;
+                in = NULL;
+            }
+            else {
+                in = cbor_parse_int64(in, in_max, &t[i], 0, err);
+            }
+        }
 
-        if (in != NULL) {
-            if (t.size() == 2) {
-                earliest_time_sec = t[0];
-                earliest_time_usec = t[1];
-                is_filled = true;
+        if (in != NULL && val == CBOR_END_OF_ARRAY) {
+            if (in < in_max && *in == CBOR_END_MARK) {
+                in++;
             }
             else {
                 *err = CBOR_MALFORMED_VALUE;
@@ -2613,16 +4238,43 @@ uint8_t* cdns_block_preamble_old::parse_map_item(uint8_t* in, uint8_t const* in_
             }
         }
 
-        break;
+        if (in != NULL) {
+            *t_sec = t[0];
+            *t_sub = t[1];
+        }
     }
-    default:
-        in = cbor_skip(in, in_max, err);
-        break;
+
+    return in;
+}
+
+uint8_t const* cdns_block_preamble_old::parse(uint8_t const* in, uint8_t const* in_max, int* err)
+{
+    in = cbor_map_parse(in, in_max, this, err);
+
+    if (!is_filled) {
+        *err = CBOR_MALFORMED_VALUE;
+        in = NULL;
     }
+    return(in);
+}
+
+static uint8_t const* cdns_block_preamble_old_parse_time(uint8_t const* in, uint8_t const* in_max, cdns_block_preamble_old* v, int* err)
+{
+    in = cdns_parse_time_pair(in, in_max, &v->earliest_time_sec, &v->earliest_time_usec, err);
+    v->is_filled = (in != NULL);
 
     return in;
 }
 
+static constexpr cbor_field<cdns_block_preamble_old> cdns_block_preamble_old_fields[] = {
+    cbor_custom_field(1, cdns_block_preamble_old_parse_time)
+};
+
+uint8_t const* cdns_block_preamble_old::parse_map_item(uint8_t const* in, uint8_t const* in_max, int64_t val, int* err)
+{
+    return cbor_fields_parse(in, in_max, this, val, cdns_block_preamble_old_fields, CBOR_NB_FIELDS(cdns_block_preamble_old_fields), err);
+}
+
 
 cdns_block_preamble::cdns_block_preamble():
     current_block(NULL),
@@ -2638,7 +4290,7 @@ cdns_block_preamble::~cdns_block_preamble()
 }
 
 
-uint8_t* cdns_block_preamble::parse(uint8_t* in, uint8_t const* in_max, int* err, cdnsBlock * current_block)
+uint8_t const* cdns_block_preamble::parse(uint8_t const* in, uint8_t const* in_max, int* err, cdnsBlock * current_block)
 {
     clear();
     this->current_block = current_block;
@@ -2667,39 +4319,25 @@ uint8_t* cdns_block_preamble::parse(uint8_t* in, uint8_t const* in_max, int* err
     return(in);
 }
 
-uint8_t* cdns_block_preamble::parse_map_item(uint8_t* in, uint8_t const* in_max, int64_t val, int* err)
+static uint8_t const* cdns_block_preamble_parse_time(uint8_t const* in, uint8_t const* in_max, cdns_block_preamble* v, int* err)
 {
-    switch (val) {
-    case 0:
-        in = parse_time_stamp(in, in_max, err);
-        break;
-    case 1:
-        in = cbor_parse_int64(in, in_max, &block_parameter_index, 0, err);
-        break;
-    default:
-        in = cbor_skip(in, in_max, err);
-        break;
-    }
-
-    return in;
+    return v->parse_time_stamp(in, in_max, err);
 }
 
-uint8_t* cdns_block_preamble::parse_time_stamp(uint8_t* in, uint8_t const* in_max, int* err)
+static constexpr cbor_field<cdns_block_preamble> cdns_block_preamble_fields[] = {
+    cbor_custom_field(0, cdns_block_preamble_parse_time),
+    cbor_int64_field(1, &cdns_block_preamble::block_parameter_index, 0)
+};
+
+uint8_t const* cdns_block_preamble::parse_map_item(uint8_t const* in, uint8_t const* in_max, int64_t val, int* err)
 {
-    std::vector<int> t;
-    in = cbor_array_parse(in, in_max, &t, err);
+    return cbor_fields_parse(in, in_max, this, val, cdns_block_preamble_fields, CBOR_NB_FIELDS(cdns_block_preamble_fields), err);
+}
 
-    if (in != NULL) {
-        if (t.size() == 2) {
-            earliest_time_sec = t[0];
-            earliest_time_usec = t[1];
-            is_filled = true;
-        }
-        else {
-            *err = CBOR_MALFORMED_VALUE;
-            in = NULL;
-        }
-    }
+uint8_t const* cdns_block_preamble::parse_time_stamp(uint8_t const* in, uint8_t const* in_max, int* err)
+{
+    in = cdns_parse_time_pair(in, in_max, &earliest_time_sec, &earliest_time_usec, err);
+    is_filled = (in != NULL);
 
     return in;
 }
@@ -2713,7 +4351,6 @@ void cdns_block_preamble::clear()
 }
 
 cdns_address_event_count::cdns_address_event_count():
-    current_block(NULL),
     ae_type(0),
     ae_code(0),
     ae_transport_flags(0),
@@ -2726,103 +4363,180 @@ cdns_address_event_count::~cdns_address_event_count()
 {
 }
 
-uint8_t* cdns_address_event_count::parse(uint8_t* in, uint8_t const* in_max, int* err, cdnsBlock* current_block)
+uint8_t const* cdns_address_event_count::parse(uint8_t const* in, uint8_t const* in_max, int* err, cdnsBlock* current_block)
 {
-    this->current_block = current_block;
-    return cbor_map_parse(in, in_max, this, err);
+    if (current_block->current_cdns->is_old_version()) {
+        cdns_draft_ctx ctx(current_block);
+        in = parse(in, in_max, err, &ctx);
+    }
+    else {
+        cdns_rfc_ctx ctx(current_block);
+        in = parse(in, in_max, err, &ctx);
+    }
+    return in;
 }
 
-uint8_t* cdns_address_event_count::parse_map_item(uint8_t* in, uint8_t const* in_max, int64_t val, int* err)
+template <bool is_old> uint8_t const* cdns_address_event_count::parse(uint8_t const* in, uint8_t const* in_max, int* err, cdns_format_ctx<is_old>* ctx)
 {
-    if (current_block->current_cdns->is_old_version()) {
-        in = parse_map_item_old(in, in_max, val, err);
+    (void)ctx;
+    if (is_old) {
+        in = cbor_map_parse_with<cdns_address_event_count, &cdns_address_event_count::parse_map_item_old>(in, in_max, this, err);
     }
     else {
-        switch (val) {
-        case 0: // ae_type
-            in = cbor_parse_int(in, in_max, &ae_type, 1, err);
-            break;
-        case 1: // ae_code,
-            in = cbor_parse_int(in, in_max, &ae_code, 1, err);
-            break;
-        case 2: // ae_transport_flags,
-            in = cbor_parse_int(in, in_max, &ae_transport_flags, 1, err);
-            break;
-        case 3: // ae_address_index,
-            in = cbor_parse_int(in, in_max, &ae_address_index, 1, err);
-            break;
-        case 4: // ae_count
-            in = cbor_parse_int(in, in_max, &ae_count, 1, err);
-            break;
-        default:
-            in = cbor_skip(in, in_max, err);
-        }
+        in = cbor_map_parse_with<cdns_address_event_count, &cdns_address_event_count::parse_map_item_rfc>(in, in_max, this, err);
     }
     return in;
 }
 
-uint8_t* cdns_address_event_count::parse_map_item_old(uint8_t* in, uint8_t const* in_max, int64_t val, int* err)
+static constexpr cbor_field<cdns_address_event_count> cdns_address_event_count_fields_rfc[] = {
+    cbor_int_field(0, &cdns_address_event_count::ae_type, 1),
+    cbor_int_field(1, &cdns_address_event_count::ae_code, 1),
+    cbor_int_field(2, &cdns_address_event_count::ae_transport_flags, 1),
+    cbor_int_field(3, &cdns_address_event_count::ae_address_index, 1),
+    cbor_int_field(4, &cdns_address_event_count::ae_count, 1)
+};
+
+static constexpr cbor_field<cdns_address_event_count> cdns_address_event_count_fields_old[] = {
+    cbor_int_field(0, &cdns_address_event_count::ae_type, 1),
+    cbor_int_field(1, &cdns_address_event_count::ae_code, 1),
+    cbor_int_field(2, &cdns_address_event_count::ae_address_index, 1),
+    cbor_int_field(3, &cdns_address_event_count::ae_count, 1)
+};
+
+uint8_t const* cdns_address_event_count::parse_map_item_rfc(uint8_t const* in, uint8_t const* in_max, int64_t val, int* err)
 {
-    switch (val) {
-    case 0: // ae_type
-        in = cbor_parse_int(in, in_max, &ae_type, 1, err);
-        break;
-    case 1: // ae_code,
-        in = cbor_parse_int(in, in_max, &ae_code, 1, err);
-        break;
-    case 2: // ae_address_index,
-        in = cbor_parse_int(in, in_max, &ae_address_index, 1, err);
-        break;
-    case 3: // ae_count
-        in = cbor_parse_int(in, in_max, &ae_count, 1, err);
-        break;
-    default:
-        in = cbor_skip(in, in_max, err);
+    return cbor_fields_parse(in, in_max, this, val, cdns_address_event_count_fields_rfc, CBOR_NB_FIELDS(cdns_address_event_count_fields_rfc), err);
+}
+
+uint8_t const* cdns_address_event_count::parse_map_item_old(uint8_t const* in, uint8_t const* in_max, int64_t val, int* err)
+{
+    return cbor_fields_parse(in, in_max, this, val, cdns_address_event_count_fields_old, CBOR_NB_FIELDS(cdns_address_event_count_fields_old), err);
+}
+
+
+cdns_list_table::cdns_list_table()
+{
+}
+
+cdns_list_table::~cdns_list_table()
+{
+}
+
+/* The table is an array of lists, each an array of unsigned indexes. The
+ * indexes are appended to the items, and the end of each list to the
+ * offsets. */
+uint8_t const* cdns_list_table::parse(uint8_t const* in, uint8_t const* in_max, int* err)
+{
+    int64_t val;
+    int outer_type = CBOR_CLASS(*in);
+    int is_undef = 0;
+
+    items.clear();
+    offsets.clear();
+    in = cbor_get_number(in, in_max, &val);
+
+    if (in == NULL || outer_type != CBOR_T_ARRAY) {
+        *err = CBOR_MALFORMED_VALUE;
+        in = NULL;
+    }
+    else {
+        int64_t rank = 0;
+
+        if (val == CBOR_END_OF_ARRAY) {
+            is_undef = 1;
+            val = 0xffffffff;
+        }
+        else if (val > in_max - in) {
+            /* Each list takes at least one byte */
+            *err = CBOR_MALFORMED_VALUE;
+            in = NULL;
+        }
+        else {
+            offsets.reserve((size_t)val + 1);
+        }
+        offsets.push_back(0);
+
+        while (rank < val && in != NULL && in < in_max) {
+            if (*in == 0xff) {
+                if (is_undef) {
+                    in++;
+                }
+                else {
+                    *err = CBOR_MALFORMED_VALUE;
+                    in = NULL;
+                }
+                break;
+            }
+            else {
+                in = parse_list(in, in_max, err);
+                rank++;
+            }
+        }
     }
 
     return in;
 }
 
+uint8_t const* cdns_list_table::parse_list(uint8_t const* in, uint8_t const* in_max, int* err)
+{
+    in = cbor_int_array_append(in, in_max, &items, err);
+
+    if (in != NULL) {
+        offsets.push_back((uint32_t)items.size());
+    }
+
+    return in;
+}
 
-cdns_question_list::cdns_question_list()
+void cdns_list_table::clear()
 {
+    items.clear();
+    offsets.clear();
 }
 
-cdns_question_list::~cdns_question_list()
+void cdns_list_table::release(cbor_arena* arena)
 {
+    cbor_arena_vector_release(&items, arena);
+    cbor_arena_vector_release(&offsets, arena);
 }
 
-uint8_t* cdns_question_list::parse(uint8_t* in, uint8_t const* in_max, int* err)
+void cdns_list_table::swap(cdns_list_table* other)
 {
-    return cbor_array_parse(in, in_max, &question_table_index, err);
+    items.swap(other->items);
+    offsets.swap(other->offsets);
 }
 
 cdnsBlockParameter::cdnsBlockParameter()
 {
 }
 
-cdnsBlockParameter::~cdnsBlockParameter()
+cdnsBlockParameter::~cdnsBlockParameter()
+{
+}
+
+uint8_t const* cdnsBlockParameter::parse(uint8_t const* in, uint8_t const* in_max, int* err)
+{
+    return cbor_map_parse(in, in_max, this, err);
+}
+
+static uint8_t const* cdnsBlockParameter_parse_storage(uint8_t const* in, uint8_t const* in_max, cdnsBlockParameter* v, int* err)
 {
+    return v->storage.parse(in, in_max, err);
 }
 
-uint8_t* cdnsBlockParameter::parse(uint8_t* in, uint8_t const* in_max, int* err)
+static uint8_t const* cdnsBlockParameter_parse_collection(uint8_t const* in, uint8_t const* in_max, cdnsBlockParameter* v, int* err)
 {
-    return cbor_map_parse(in, in_max, this, err);
+    return v->collection.parse(in, in_max, err);
 }
 
-uint8_t* cdnsBlockParameter::parse_map_item(uint8_t* in, uint8_t const* in_max, int64_t val, int* err)
+static constexpr cbor_field<cdnsBlockParameter> cdnsBlockParameter_fields[] = {
+    cbor_custom_field(0, cdnsBlockParameter_parse_storage),
+    cbor_custom_field(1, cdnsBlockParameter_parse_collection)
+};
+
+uint8_t const* cdnsBlockParameter::parse_map_item(uint8_t const* in, uint8_t const* in_max, int64_t val, int* err)
 {
-    switch (val) {
-    case 0: 
-        in = storage.parse(in, in_max, err);
-        break;
-    case 1: 
-        in = collection.parse(in, in_max, err);
-        break;
-    default:
-        in = cbor_skip(in, in_max, err);
-        break;
-    }
+    in = cbor_fields_parse(in, in_max, this, val, cdnsBlockParameter_fields, CBOR_NB_FIELDS(cdnsBlockParameter_fields), err);
 
     if (in == NULL) {
         char const* e[] = { "storage", "collection" };
@@ -2849,43 +4563,46 @@ cdnsPreamble::~cdnsPreamble()
 {
 }
 
-uint8_t* cdnsPreamble::parse(uint8_t* in, uint8_t const* in_max, int* err)
+uint8_t const* cdnsPreamble::parse(uint8_t const* in, uint8_t const* in_max, int* err)
 {
     return cbor_map_parse(in, in_max, this, err);
 }
 
-uint8_t* cdnsPreamble::parse_map_item(uint8_t* in, uint8_t const* in_max, int64_t val, int* err)
+static uint8_t const* cdnsPreamble_parse_block_parameters(uint8_t const* in, uint8_t const* in_max, cdnsPreamble* v, int* err)
 {
-    switch (val) {
-    case 0: /* Version Major */
-        in = cbor_parse_int64(in, in_max, &cdns_version_major, 0, err);
-        break;
-    case 1: /* Version Minor */
-        in = cbor_parse_int64(in, in_max, &cdns_version_minor, 0, err);
-        break;
-    case 2: /* Version Private */
-        in = cbor_parse_int64(in, in_max, &cdns_version_private, 0, err);
-        break;
-    case 3: /* Block Parameters */
-        if (this->cdns_version_major > 0) {
-            in = cbor_array_parse(in, in_max, &block_parameters, err);
-        }
-        else {
-            in = old_block_parameters.parse(in, in_max, err);
-        }
-        break;
-    case 4: /* generator-id  -- only present in draft version, part of
-             * block parameter collection data otherwise. */
-        in = old_generator_id.parse(in, in_max, err);
-        break;
-    case 5: /* host-id   -- only present in draft version, part of
-             * block parameter collection data otherwise. */
-        in = old_host_id.parse(in, in_max, err);
-        break;
-    default:
-        in = cbor_skip(in, in_max, err);
-        break;
+    if (v->cdns_version_major > 0) {
+        in = cbor_array_parse(in, in_max, &v->block_parameters, err);
+    }
+    else {
+        in = v->old_block_parameters.parse(in, in_max, err);
     }
+    return in;
+}
+
+/* generator-id and host-id are only present in the draft version, they are
+ * part of the block parameter collection data otherwise. */
+static uint8_t const* cdnsPreamble_parse_generator_id(uint8_t const* in, uint8_t const* in_max, cdnsPreamble* v, int* err)
+{
+    return v->old_generator_id.parse(in, in_max, err);
+}
+
+static uint8_t const* cdnsPreamble_parse_host_id(uint8_t const* in, uint8_t const* in_max, cdnsPreamble* v, int* err)
+{
+    return v->old_host_id.parse(in, in_max, err);
+}
+
+static constexpr cbor_field<cdnsPreamble> cdnsPreamble_fields[] = {
+    cbor_int64_field(0, &cdnsPreamble::cdns_version_major, 0),
+    cbor_int64_field(1, &cdnsPreamble::cdns_version_minor, 0),
+    cbor_int64_field(2, &cdnsPreamble::cdns_version_private, 0),
+    cbor_custom_field(3, cdnsPreamble_parse_block_parameters),
+    cbor_custom_field(4, cdnsPreamble_parse_generator_id),
+    cbor_custom_field(5, cdnsPreamble_parse_host_id)
+};
+
+uint8_t const* cdnsPreamble::parse_map_item(uint8_t const* in, uint8_t const* in_max, int64_t val, int* err)
+{
+    in = cbor_fields_parse(in, in_max, this, val, cdnsPreamble_fields, CBOR_NB_FIELDS(cdnsPreamble_fields), err);
 
     if (in == NULL) {
         char const* e[] = { "v_major", "v_minor", "v_private", "block_param", "generator_id", "host_id" };
@@ -2915,55 +4632,54 @@ cdnsStorageParameter::~cdnsStorageParameter()
 {
 }
 
-uint8_t* cdnsStorageParameter::parse(uint8_t* in, uint8_t const* in_max, int* err)
+uint8_t const* cdnsStorageParameter::parse(uint8_t const* in, uint8_t const* in_max, int* err)
 {
     return cbor_map_parse(in, in_max, this, err);
 }
 
-uint8_t* cdnsStorageParameter::parse_map_item(uint8_t* in, uint8_t const* in_max, int64_t val, int* err)
+static uint8_t const* cdnsStorageParameter_parse_hints(uint8_t const* in, uint8_t const* in_max, cdnsStorageParameter* v, int* err)
 {
-    switch (val) {
-    case 0:
-        in = cbor_parse_int64(in, in_max, &ticks_per_second, 0, err);
-        break;
-    case 1:
-        in = cbor_parse_int64(in, in_max, &max_block_items, 0, err);
-        break;
-    case 2:
-        in = storage_hints.parse(in, in_max, err);
-        break;
-    case 3:
-        in = cbor_array_parse(in, in_max, &opcodes, err);
-        break;
-    case 4:
-        in = cbor_array_parse(in, in_max, &rr_types, err);
-        break;
-    case 5:
-        in = cbor_parse_int64(in, in_max, &storage_flags, 0, err);
-        break;
-    case 6:
-        in = cbor_parse_int64(in, in_max, &client_address_prefix_ipv4, 0, err);
-        break;
-    case 7:
-        in = cbor_parse_int64(in, in_max, &client_address_prefix_ipv6, 0, err);
-        break;
-    case 8:
-        in = cbor_parse_int64(in, in_max, &server_address_prefix_ipv4, 0, err);
-        break;
-    case 9:
-        in = cbor_parse_int64(in, in_max, &server_address_prefix_ipv6, 0, err);
-        break;
-    case 10:
-        in = sampling_method.parse(in, in_max, err);
-        break;
-    case 11:
-        in = anonymization_method.parse(in, in_max, err);
-        break;
+    return v->storage_hints.parse(in, in_max, err);
+}
 
-    default:
-        in = cbor_skip(in, in_max, err);
-        break;
-    }
+static uint8_t const* cdnsStorageParameter_parse_opcodes(uint8_t const* in, uint8_t const* in_max, cdnsStorageParameter* v, int* err)
+{
+    return cbor_array_parse(in, in_max, &v->opcodes, err);
+}
+
+static uint8_t const* cdnsStorageParameter_parse_rr_types(uint8_t const* in, uint8_t const* in_max, cdnsStorageParameter* v, int* err)
+{
+    return cbor_array_parse(in, in_max, &v->rr_types, err);
+}
+
+static uint8_t const* cdnsStorageParameter_parse_sampling(uint8_t const* in, uint8_t const* in_max, cdnsStorageParameter* v, int* err)
+{
+    return v->sampling_method.parse(in, in_max, err);
+}
+
+static uint8_t const* cdnsStorageParameter_parse_anonymization(uint8_t const* in, uint8_t const* in_max, cdnsStorageParameter* v, int* err)
+{
+    return v->anonymization_method.parse(in, in_max, err);
+}
+
+static constexpr cbor_field<cdnsStorageParameter> cdnsStorageParameter_fields[] = {
+    cbor_int64_field(0, &cdnsStorageParameter::ticks_per_second, 0),
+    cbor_int64_field(1, &cdnsStorageParameter::max_block_items, 0),
+    cbor_custom_field(2, cdnsStorageParameter_parse_hints),
+    cbor_custom_field(3, cdnsStorageParameter_parse_opcodes),
+    cbor_custom_field(4, cdnsStorageParameter_parse_rr_types),
+    cbor_int64_field(5, &cdnsStorageParameter::storage_flags, 0),
+    cbor_int64_field(6, &cdnsStorageParameter::client_address_prefix_ipv4, 0),
+    cbor_int64_field(7, &cdnsStorageParameter::client_address_prefix_ipv6, 0),
+    cbor_int64_field(8, &cdnsStorageParameter::server_address_prefix_ipv4, 0),
+    cbor_int64_field(9, &cdnsStorageParameter::server_address_prefix_ipv6, 0),
+    cbor_custom_field(10, cdnsStorageParameter_parse_sampling),
+    cbor_custom_field(11, cdnsStorageParameter_parse_anonymization)
+};
+
+uint8_t const* cdnsStorageParameter::parse_map_item(uint8_t const* in, uint8_t const* in_max, int64_t val, int* err)
+{
+    in = cbor_fields_parse(in, in_max, this, val, cdnsStorageParameter_fields, CBOR_NB_FIELDS(cdnsStorageParameter_fields), err);
 
     if (in == NULL) {
         fprintf(stderr, "Cannot parse cdnsStorageParameters %d, err=%d\n", (int)val, *err);
@@ -2990,49 +4706,63 @@ cdnsCollectionParameters::~cdnsCollectionParameters()
 {
 }
 
-uint8_t* cdnsCollectionParameters::parse(uint8_t* in, uint8_t const* in_max, int* err)
+uint8_t const* cdnsCollectionParameters::parse(uint8_t const* in, uint8_t const* in_max, int* err)
 {
     return cbor_map_parse(in, in_max, this, err);
 }
 
-uint8_t* cdnsCollectionParameters::parse_map_item(uint8_t* in, uint8_t const* in_max, int64_t val, int* err)
+static uint8_t const* cdnsCollectionParameters_parse_promisc(uint8_t const* in, uint8_t const* in_max, cdnsCollectionParameters* v, int* err)
 {
-    switch (val) {
-    case 0:
-        in = cbor_parse_int64(in, in_max, &query_timeout, 0, err);
-        break;
-    case 1:
-        in = cbor_parse_int64(in, in_max, &skew_timeout, 0, err);
-        break;
-    case 2:
-        in = cbor_parse_int64(in, in_max, &snaplen, 0, err);
-        break;
-    case 3:
-        in = cbor_parse_boolean(in, in_max, &promisc, err); // Should be boolean 
-        break;
-    case 4:
-        in = cbor_array_parse(in, in_max, &interfaces, err);
-        break;
-    case 5:
-        in = cbor_array_parse(in, in_max, &server_addresses, err);
-        break;
-    case 6:
-        in = cbor_array_parse(in, in_max, &vlan_id, err);
-        break;
-    case 7:
-        in = filter.parse(in, in_max, err);
-        break;
-    case 8:
-        in = generator_id.parse(in, in_max, err);
-        break;
-    case 9:
-        in = host_id.parse(in, in_max, err);
-        break;
-    default:
-        in = cbor_skip(in, in_max, err);
-        break;
-    }
-    
+    return cbor_parse_boolean(in, in_max, &v->promisc, err);
+}
+
+static uint8_t const* cdnsCollectionParameters_parse_interfaces(uint8_t const* in, uint8_t const* in_max, cdnsCollectionParameters* v, int* err)
+{
+    return cbor_array_parse(in, in_max, &v->interfaces, err);
+}
+
+static uint8_t const* cdnsCollectionParameters_parse_server_addresses(uint8_t const* in, uint8_t const* in_max, cdnsCollectionParameters* v, int* err)
+{
+    return cbor_array_parse(in, in_max, &v->server_addresses, err);
+}
+
+static uint8_t const* cdnsCollectionParameters_parse_vlan_id(uint8_t const* in, uint8_t const* in_max, cdnsCollectionParameters* v, int* err)
+{
+    return cbor_array_parse(in, in_max, &v->vlan_id, err);
+}
+
+static uint8_t const* cdnsCollectionParameters_parse_filter(uint8_t const* in, uint8_t const* in_max, cdnsCollectionParameters* v, int* err)
+{
+    return v->filter.parse(in, in_max, err);
+}
+
+static uint8_t const* cdnsCollectionParameters_parse_generator_id(uint8_t const* in, uint8_t const* in_max, cdnsCollectionParameters* v, int* err)
+{
+    return v->generator_id.parse(in, in_max, err);
+}
+
+static uint8_t const* cdnsCollectionParameters_parse_host_id(uint8_t const* in, uint8_t const* in_max, cdnsCollectionParameters* v, int* err)
+{
+    return v->host_id.parse(in, in_max, err);
+}
+
+static constexpr cbor_field<cdnsCollectionParameters> cdnsCollectionParameters_fields[] = {
+    cbor_int64_field(0, &cdnsCollectionParameters::query_timeout, 0),
+    cbor_int64_field(1, &cdnsCollectionParameters::skew_timeout, 0),
+    cbor_int64_field(2, &cdnsCollectionParameters::snaplen, 0),
+    cbor_custom_field(3, cdnsCollectionParameters_parse_promisc),
+    cbor_custom_field(4, cdnsCollectionParameters_parse_interfaces),
+    cbor_custom_field(5, cdnsCollectionParameters_parse_server_addresses),
+    cbor_custom_field(6, cdnsCollectionParameters_parse_vlan_id),
+    cbor_custom_field(7, cdnsCollectionParameters_parse_filter),
+    cbor_custom_field(8, cdnsCollectionParameters_parse_generator_id),
+    cbor_custom_field(9, cdnsCollectionParameters_parse_host_id)
+};
+
+uint8_t const* cdnsCollectionParameters::parse_map_item(uint8_t const* in, uint8_t const* in_max, int64_t val, int* err)
+{
+    in = cbor_fields_parse(in, in_max, this, val, cdnsCollectionParameters_fields, CBOR_NB_FIELDS(cdnsCollectionParameters_fields), err);
+
     if (in == NULL) {
         fprintf(stderr, "Cannot parse cdnsCollectionParameters %d, err=%d\n", (int)val, *err);
     }
@@ -3059,60 +4789,56 @@ cdnsBlockParameterOld::~cdnsBlockParameterOld()
 {
 }
 
-uint8_t* cdnsBlockParameterOld::parse(uint8_t* in, uint8_t const* in_max, int* err)
+uint8_t const* cdnsBlockParameterOld::parse(uint8_t const* in, uint8_t const* in_max, int* err)
 {
     return cbor_map_parse(in, in_max, this, err);
 }
 
-uint8_t* cdnsBlockParameterOld::parse_map_item(uint8_t* in, uint8_t const* in_max, int64_t val, int* err)
+static uint8_t const* cdnsBlockParameterOld_parse_interfaces(uint8_t const* in, uint8_t const* in_max, cdnsBlockParameterOld* v, int* err)
 {
-    switch (val) {
-    case 0: 
-        in = cbor_parse_int64(in, in_max, &query_timeout, 0, err);
-        break;
-    case 1:
-        in = cbor_parse_int64(in, in_max, &skew_timeout, 0, err);
-        break;
-    case 2: 
-        in = cbor_parse_int64(in, in_max, &snaplen, 0, err);
-        break;
-    case 3:
-        in = cbor_parse_int64(in, in_max, &promisc, 0, err);
-        break;
-    case 4:
-        in = cbor_array_parse(in, in_max, &interfaces, err);
-        break;
-    case 5:
-        in = cbor_array_parse(in, in_max, &server_addresses, err);
-        break;
-    /*case 6:
-        in = cbor_array_parse(in, in_max, &vlan_id, err);
-        break; */
-    case 6:
-        in = filter.parse(in, in_max, err);
-        break;
-    case 7:
-        in = cbor_parse_int64(in, in_max, &query_options, 0, err);
-        break;
-    case 8:
-        in = cbor_parse_int64(in, in_max, &response_options, 0, err);
-        break;
-    case 9:
-        in = cbor_array_parse(in, in_max, &accept_rr_types, err);
-        break;
-    case 10:
-        in = cbor_array_parse(in, in_max, &ignore_rr_types, err);
-        break;
-    case 12:
-        in = cbor_parse_int64(in, in_max, &max_block_qr_items, 0, err);
-        break;
-    case 13:
-        in = cbor_parse_int64(in, in_max, &collect_malformed, 0, err);
-        break;
-    default:
-        in = cbor_skip(in, in_max, err);
-        break;
-    }
+    return cbor_array_parse(in, in_max, &v->interfaces, err);
+}
+
+static uint8_t const* cdnsBlockParameterOld_parse_server_addresses(uint8_t const* in, uint8_t const* in_max, cdnsBlockParameterOld* v, int* err)
+{
+    return cbor_array_parse(in, in_max, &v->server_addresses, err);
+}
+
+static uint8_t const* cdnsBlockParameterOld_parse_filter(uint8_t const* in, uint8_t const* in_max, cdnsBlockParameterOld* v, int* err)
+{
+    return v->filter.parse(in, in_max, err);
+}
+
+static uint8_t const* cdnsBlockParameterOld_parse_accept_rr_types(uint8_t const* in, uint8_t const* in_max, cdnsBlockParameterOld* v, int* err)
+{
+    return cbor_array_parse(in, in_max, &v->accept_rr_types, err);
+}
+
+static uint8_t const* cdnsBlockParameterOld_parse_ignore_rr_types(uint8_t const* in, uint8_t const* in_max, cdnsBlockParameterOld* v, int* err)
+{
+    return cbor_array_parse(in, in_max, &v->ignore_rr_types, err);
+}
+
+/* Key 11 is not decoded, the sparse keys fall back to a linear search */
+static constexpr cbor_field<cdnsBlockParameterOld> cdnsBlockParameterOld_fields[] = {
+    cbor_int64_field(0, &cdnsBlockParameterOld::query_timeout, 0),
+    cbor_int64_field(1, &cdnsBlockParameterOld::skew_timeout, 0),
+    cbor_int64_field(2, &cdnsBlockParameterOld::snaplen, 0),
+    cbor_int64_field(3, &cdnsBlockParameterOld::promisc, 0),
+    cbor_custom_field(4, cdnsBlockParameterOld_parse_interfaces),
+    cbor_custom_field(5, cdnsBlockParameterOld_parse_server_addresses),
+    cbor_custom_field(6, cdnsBlockParameterOld_parse_filter),
+    cbor_int64_field(7, &cdnsBlockParameterOld::query_options, 0),
+    cbor_int64_field(8, &cdnsBlockParameterOld::response_options, 0),
+    cbor_custom_field(9, cdnsBlockParameterOld_parse_accept_rr_types),
+    cbor_custom_field(10, cdnsBlockParameterOld_parse_ignore_rr_types),
+    cbor_int64_field(12, &cdnsBlockParameterOld::max_block_qr_items, 0),
+    cbor_int64_field(13, &cdnsBlockParameterOld::collect_malformed, 0)
+};
+
+uint8_t const* cdnsBlockParameterOld::parse_map_item(uint8_t const* in, uint8_t const* in_max, int64_t val, int* err)
+{
+    in = cbor_fields_parse(in, in_max, this, val, cdnsBlockParameterOld_fields, CBOR_NB_FIELDS(cdnsBlockParameterOld_fields), err);
     if (in == NULL) {
         fprintf(stderr, "Cannot parse cdnsBlockParameterOld %d, err=%d\n", (int)val, *err);
     }
@@ -3135,30 +4861,21 @@ cdnsStorageHints::~cdnsStorageHints()
 {
 }
 
-uint8_t* cdnsStorageHints::parse(uint8_t* in, uint8_t const* in_max, int* err)
+uint8_t const* cdnsStorageHints::parse(uint8_t const* in, uint8_t const* in_max, int* err)
 {
     return cbor_map_parse(in, in_max, this, err);
 }
 
-uint8_t* cdnsStorageHints::parse_map_item(uint8_t* in, uint8_t const* in_max, int64_t val, int* err)
+static constexpr cbor_field<cdnsStorageHints> cdnsStorageHints_fields[] = {
+    cbor_int64_field(0, &cdnsStorageHints::query_response_hints, 0),
+    cbor_int64_field(1, &cdnsStorageHints::query_response_signature_hints, 0),
+    cbor_int64_field(2, &cdnsStorageHints::rr_hints, 0),
+    cbor_int64_field(3, &cdnsStorageHints::other_data_hints, 0)
+};
+
+uint8_t const* cdnsStorageHints::parse_map_item(uint8_t const* in, uint8_t const* in_max, int64_t val, int* err)
 {
-    switch (val) {
-    case 0:
-        in = cbor_parse_int64(in, in_max, &query_response_hints, 0, err);
-        break;
-    case 1:
-        in = cbor_parse_int64(in, in_max, &query_response_signature_hints, 0, err);
-        break;
-    case 2:
-        in = cbor_parse_int64(in, in_max, &rr_hints, 0, err);
-        break;
-    case 3:
-        in = cbor_parse_int64(in, in_max, &other_data_hints, 0, err);
-        break;
-    default:
-        in = cbor_skip(in, in_max, err);
-        break;
-    }
+    in = cbor_fields_parse(in, in_max, this, val, cdnsStorageHints_fields, CBOR_NB_FIELDS(cdnsStorageHints_fields), err);
     if (in == NULL) {
         fprintf(stderr, "Cannot parse cdnsStorageHints %d, err=%d\n", (int)val, *err);
     }
@@ -3180,25 +4897,20 @@ cdns_response_processing_data::~cdns_response_processing_data()
 {
 }
 
-uint8_t* cdns_response_processing_data::parse(uint8_t* in, uint8_t const* in_max, int* err)
+uint8_t const* cdns_response_processing_data::parse(uint8_t const* in, uint8_t const* in_max, int* err)
 {
     is_present = true;
     return cbor_map_parse(in, in_max, this, err);
 }
 
-uint8_t* cdns_response_processing_data::parse_map_item(uint8_t* in, uint8_t const* in_max, int64_t val, int* err)
+static constexpr cbor_field<cdns_response_processing_data> cdns_response_processing_data_fields[] = {
+    cbor_int_field(0, &cdns_response_processing_data::bailiwick_index, 0),
+    cbor_int_field(1, &cdns_response_processing_data::processing_flags, 0)
+};
+
+uint8_t const* cdns_response_processing_data::parse_map_item(uint8_t const* in, uint8_t const* in_max, int64_t val, int* err)
 {
-    switch (val) {
-    case 0:
-        in = cbor_parse_int(in, in_max, &bailiwick_index, 0, err);
-        break;
-    case 1:
-        in = cbor_parse_int(in, in_max, &processing_flags, 0, err);
-        break;
-    default:
-        in = cbor_skip(in, in_max, err);
-        break;
-    }
+    in = cbor_fields_parse(in, in_max, this, val, cdns_response_processing_data_fields, CBOR_NB_FIELDS(cdns_response_processing_data_fields), err);
     if (in == NULL) {
         fprintf(stderr, "Cannot parse cdns_response_processing_data %d, err=%d\n", (int)val, *err);
     }
@@ -3211,3 +4923,233 @@ void cdns_response_processing_data::clear()
     bailiwick_index = 0;
     processing_flags = 0;
 }
+
+cdns_time_range::cdns_time_range(cdns* cdns_ctx, uint64_t start_us, uint64_t end_us) :
+    cdns_ctx(cdns_ctx),
+    start_us(start_us),
+    end_us(end_us),
+    is_started(false),
+    next_block_number(0)
+{
+}
+
+cdns_time_range::~cdns_time_range()
+{
+}
+
+bool cdns_time_range::next_block(int* err)
+{
+    bool ret = true;
+
+    *err = 0;
+    if (!is_started) {
+        ret = cdns_ctx->seek_time(start_us, err);
+        if (ret) {
+            next_block_number = cdns_ctx->block_number_at_time(start_us);
+            is_started = true;
+        }
+    }
+
+    if (ret && (next_block_number >= cdns_ctx->block_index.size() ||
+        cdns_ctx->block_index[next_block_number].block_start_us >= end_us)) {
+        *err = CBOR_END_OF_ARRAY;
+        ret = false;
+    }
+
+    if (ret) {
+        ret = cdns_ctx->open_block(err);
+        if (ret) {
+            next_block_number++;
+        }
+    }
+
+    return ret;
+}
+
+/* The time offset is read from the layout in which the queries are
+ * stored. Queries that are not stored, as in the visitor mode, or out of
+ * the block, are not in range. */
+bool cdns_time_range::is_query_in_range(size_t query_index)
+{
+    cdnsBlock* block = &cdns_ctx->block;
+    bool ret = false;
+    int time_offset_usec = 0;
+
+    if (cdns_ctx->is_columnar()) {
+        if (query_index < block->query_columns.size()) {
+            time_offset_usec = block->query_columns.time_offset_usec[query_index];
+            ret = true;
+        }
+    }
+    else if (cdns_ctx->is_compact()) {
+        if (query_index < block->compact_queries.size()) {
+            time_offset_usec = block->compact_queries.records[query_index].time_offset_usec;
+            ret = true;
+        }
+    }
+    else if (query_index < block->queries.size()) {
+        time_offset_usec = block->queries[query_index].time_offset_usec;
+        ret = true;
+    }
+
+    if (ret) {
+        uint64_t query_time_us = block->block_start_us + time_offset_usec;
+
+        ret = (query_time_us >= start_us && query_time_us < end_us);
+    }
+
+    return ret;
+}
+
+cdns_flat_query::cdns_flat_query() :
+    time_us(0),
+    rr_type(-1),
+    rr_class(-1),
+    opcode(-1),
+    query_rcode(-1),
+    response_rcode(-1),
+    qr_sig_flags(0),
+    qr_dns_flags(0),
+    transport(-1),
+    ip_protocol(-1),
+    client_port(0),
+    server_port(0),
+    query_size(0),
+    response_size(0),
+    query(NULL),
+    q_sig(NULL)
+{
+}
+
+cdns_flat_query::~cdns_flat_query()
+{
+}
+
+cdns_query_iterator::cdns_query_iterator(cdns* cdns_ctx) :
+    cdns_ctx(cdns_ctx),
+    is_started(false),
+    query_index(0)
+{
+}
+
+cdns_query_iterator::~cdns_query_iterator()
+{
+}
+
+/* The prefetch is done in two stages. The rows of the tables that the query
+ * references are requested first, and the data that these rows point to
+ * is requested later, when the rows are expected to be in the cache. The
+ * query is resolved at that second stage, once, and kept in the ring until
+ * next returns it. */
+void cdns_query_iterator::prefetch_rows(size_t index)
+{
+    cdnsBlock* block = &cdns_ctx->block;
+
+    if (index < block->queries.size()) {
+        cdns_query const* q = &block->queries[index];
+        int index_offset = cdns_ctx->index_offset;
+
+        CDNS_PREFETCH(cdns_table_entry(&block->tables.q_sigs, q->query_signature_index, index_offset));
+        CDNS_PREFETCH(cdns_table_entry(&block->tables.name_rdata, q->query_name_index, index_offset));
+        CDNS_PREFETCH(cdns_table_entry(&block->tables.addresses, q->client_address_index, index_offset));
+    }
+}
+
+void cdns_query_iterator::prefetch_data(size_t index)
+{
+    cdnsBlock* block = &cdns_ctx->block;
+
+    if (index < block->queries.size()) {
+        cdns_resolved_query* r = &resolved[index % CDNS_RESOLVED_RING];
+
+        r->resolve(block, &block->queries[index]);
+        if (r->query_name != NULL) {
+            CDNS_PREFETCH(r->query_name->v);
+        }
+        if (r->client_address != NULL) {
+            CDNS_PREFETCH(r->client_address->v);
+        }
+        if (r->query_class != NULL) {
+            CDNS_PREFETCH(r->query_class);
+        }
+        if (r->server_address != NULL) {
+            CDNS_PREFETCH(r->server_address->v);
+        }
+    }
+}
+
+bool cdns_query_iterator::next(cdns_flat_query* flat, int* err)
+{
+    bool ret = true;
+    cdnsBlock* block = &cdns_ctx->block;
+
+    *err = 0;
+    if (cdns_ctx->is_columnar() || cdns_ctx->is_compact()) {
+        *err = CBOR_NOT_IMPLEMENTED;
+        ret = false;
+    }
+
+    while (ret && (!is_started || query_index >= block->queries.size())) {
+        ret = cdns_ctx->open_block(err);
+        if (ret && cdns_ctx->is_lazy()) {
+            ret = block->materialize(CDNS_PROJECT_QUERIES | CDNS_PROJECT_Q_SIGS | CDNS_PROJECT_NAME_RDATA |
+                CDNS_PROJECT_CLASS_IDS | CDNS_PROJECT_ADDRESSES, err);
+        }
+        if (ret) {
+            is_started = true;
+            query_index = 0;
+            for (size_t i = 0; i < CDNS_PREFETCH_ROWS; i++) {
+                prefetch_rows(i);
+            }
+            for (size_t i = 0; i < CDNS_PREFETCH_DATA; i++) {
+                prefetch_data(i);
+            }
+        }
+    }
+
+    if (ret) {
+        cdns_resolved_query const& resolved = this->resolved[query_index % CDNS_RESOLVED_RING];
+        cdns_class_id const* class_id = NULL;
+
+        prefetch_rows(query_index + CDNS_PREFETCH_ROWS);
+        prefetch_data(query_index + CDNS_PREFETCH_DATA);
+
+        flat->query = resolved.query;
+        flat->q_sig = resolved.q_sig;
+        flat->time_us = block->block_start_us + resolved.query->time_offset_usec;
+        flat->query_name = (resolved.query_name != NULL) ? *resolved.query_name : cbor_bytes_view();
+        flat->client_address = (resolved.client_address != NULL) ? *resolved.client_address : cbor_bytes_view();
+        flat->server_address = (resolved.server_address != NULL) ? *resolved.server_address : cbor_bytes_view();
+        flat->client_port = resolved.query->client_port;
+        flat->query_size = resolved.query->query_size;
+        flat->response_size = resolved.query->response_size;
+        if (resolved.q_sig != NULL) {
+            cdns_query_signature const* q_sig = resolved.q_sig;
+
+            class_id = resolved.query_class;
+            flat->opcode = q_sig->query_opcode;
+            flat->query_rcode = q_sig->query_rcode;
+            flat->response_rcode = q_sig->response_rcode;
+            flat->qr_sig_flags = q_sig->qr_sig_flags;
+            flat->qr_dns_flags = q_sig->qr_dns_flags;
+            flat->transport = (int)q_sig->transport_protocol();
+            flat->ip_protocol = (int)q_sig->ip_protocol();
+            flat->server_port = q_sig->server_port;
+        }
+        else {
+            flat->opcode = -1;
+            flat->query_rcode = -1;
+            flat->response_rcode = -1;
+            flat->qr_sig_flags = 0;
+            flat->qr_dns_flags = 0;
+            flat->transport = -1;
+            flat->ip_protocol = -1;
+            flat->server_port = 0;
+        }
+        flat->rr_type = (class_id != NULL) ? class_id->rr_type : -1;
+        flat->rr_class = (class_id != NULL) ? class_id->rr_class : -1;
+        query_index++;
+    }
+
+    return ret;
+}
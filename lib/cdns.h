@@ -22,10 +22,54 @@
 #define CDNS_H
 
 #include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include "cbor.h"
 
+#define CDNS_BLOCK_ITEMS_RESERVE_MAX 0x100000
+
+/* Projection masks, passed to open_block. The tables, arrays and query fields
+ * that are not requested are skipped without being decoded, and stay empty.
+ * The table bits match the keys of the block tables map. */
+#define CDNS_PROJECT_ADDRESSES 0x01
+#define CDNS_PROJECT_CLASS_IDS 0x02
+#define CDNS_PROJECT_NAME_RDATA 0x04
+#define CDNS_PROJECT_Q_SIGS 0x08
+#define CDNS_PROJECT_QUESTION_LIST 0x10
+#define CDNS_PROJECT_QRR 0x20
+#define CDNS_PROJECT_RR_LIST 0x40
+#define CDNS_PROJECT_RRS 0x80
+#define CDNS_PROJECT_QUERIES 0x100
+#define CDNS_PROJECT_ADDRESS_EVENTS 0x200
+#define CDNS_PROJECT_QUERY_EXTENDED 0x400 /* q_extended and r_extended in each query */
+#define CDNS_PROJECT_QUERY_RPD 0x800 /* Response processing data in each query */
+#define CDNS_PROJECT_ALL 0xFFF
+#define CDNS_BLOCK_PARTS 10 /* Tables, queries and address events, numbered as the projection bits */
+#define CDNS_VISIT_BATCH 256 /* Maximum number of queries passed to cdns_visitor::on_queries */
+
 class cdns; /* Definition here allows for backpointers */
 class cdnsBlock;
+class cdns_decompressor;
+class cdns_block_pool;
+
+/* Parsing context for the records whose encoding differs between RFC 8618
+ * and the draft. The format is a template parameter: it is chosen once for
+ * each array of records, and the record parsers are specialized for it. */
+template <bool is_old> class cdns_format_ctx
+{
+public:
+    explicit cdns_format_ctx(cdnsBlock* block);
+
+    int64_t ticks_to_microseconds(int64_t ticks) const; /* Same as cdns::ticks_to_microseconds, for this block */
+
+    cdnsBlock* block;
+    uint32_t projection; /* Copy of the block projection, read once per block */
+    int64_t ticks_per_second; /* Of the block parameters, looked up once per block */
+};
+
+typedef cdns_format_ctx<false> cdns_rfc_ctx;
+typedef cdns_format_ctx<true> cdns_draft_ctx;
 
 class cdns_block_preamble_old
 {
@@ -33,9 +77,9 @@ public:
     cdns_block_preamble_old();
     ~cdns_block_preamble_old();
 
-    uint8_t* parse(uint8_t* in, uint8_t const* in_max, int* err);
+    uint8_t const* parse(uint8_t const* in, uint8_t const* in_max, int* err);
 
-    uint8_t* parse_map_item(uint8_t* in, uint8_t const* in_max, int64_t val, int* err);
+    uint8_t const* parse_map_item(uint8_t const* in, uint8_t const* in_max, int64_t val, int* err);
 
     int64_t earliest_time_sec;
     int64_t earliest_time_usec;
@@ -48,11 +92,11 @@ public:
     cdns_block_preamble();
     ~cdns_block_preamble();
 
-    uint8_t* parse(uint8_t* in, uint8_t const* in_max, int* err, cdnsBlock* current_block);
+    uint8_t const* parse(uint8_t const* in, uint8_t const* in_max, int* err, cdnsBlock* current_block);
 
-    uint8_t* parse_map_item(uint8_t* in, uint8_t const* in_max, int64_t val, int* err);
+    uint8_t const* parse_map_item(uint8_t const* in, uint8_t const* in_max, int64_t val, int* err);
 
-    uint8_t* parse_time_stamp(uint8_t* in, uint8_t const* in_max, int* err);
+    uint8_t const* parse_time_stamp(uint8_t const* in, uint8_t const* in_max, int* err);
 
     void clear();
 
@@ -69,9 +113,9 @@ public:
     cdns_block_statistics();
     ~cdns_block_statistics();
 
-    uint8_t* parse(uint8_t* in, uint8_t const* in_max, int* err, cdnsBlock* current_block);
+    uint8_t const* parse(uint8_t const* in, uint8_t const* in_max, int* err, cdnsBlock* current_block);
 
-    uint8_t* parse_map_item(uint8_t* in, uint8_t const* in_max, int64_t val, int* err);
+    uint8_t const* parse_map_item(uint8_t const* in, uint8_t const* in_max, int64_t val, int* err);
 
     void clear();
 
@@ -92,9 +136,9 @@ public:
     cdns_response_processing_data();
     ~cdns_response_processing_data();
 
-    uint8_t* parse(uint8_t* in, uint8_t const* in_max, int* err);
+    uint8_t const* parse(uint8_t const* in, uint8_t const* in_max, int* err);
 
-    uint8_t* parse_map_item(uint8_t* in, uint8_t const* in_max, int64_t val, int* err);
+    uint8_t const* parse_map_item(uint8_t const* in, uint8_t const* in_max, int64_t val, int* err);
 
     void clear();
 
@@ -108,9 +152,9 @@ public:
     cdns_qr_extended();
     ~cdns_qr_extended();
 
-    uint8_t* parse(uint8_t* in, uint8_t const* in_max, int* err);
+    uint8_t const* parse(uint8_t const* in, uint8_t const* in_max, int* err);
 
-    uint8_t* parse_map_item(uint8_t* in, uint8_t const* in_max, int64_t val, int* err);
+    uint8_t const* parse_map_item(uint8_t const* in, uint8_t const* in_max, int64_t val, int* err);
 
     void clear();
 
@@ -126,12 +170,13 @@ public:
     cdns_query();
     ~cdns_query();
 
-    uint8_t* parse(uint8_t* in, uint8_t const* in_max, int* err, cdnsBlock* current_block);
+    uint8_t const* parse(uint8_t const* in, uint8_t const* in_max, int* err, cdnsBlock* current_block);
+    template <bool is_old> uint8_t const* parse(uint8_t const* in, uint8_t const* in_max, int* err, cdns_format_ctx<is_old>* ctx);
 
-    uint8_t* parse_map_item(uint8_t* in, uint8_t const* in_max, int64_t val, int* err);
-    uint8_t* parse_map_item_old(uint8_t* in, uint8_t const* in_max, int64_t val, int* err);
+    uint8_t const* parse_map_item_rfc(uint8_t const* in, uint8_t const* in_max, int64_t val, int* err);
+    uint8_t const* parse_map_item_old(uint8_t const* in, uint8_t const* in_max, int64_t val, int* err);
+    template <bool is_old> uint8_t const* parse_map_item(uint8_t const* in, uint8_t const* in_max, int64_t val, int* err, cdns_format_ctx<is_old>* ctx);
 
-    cdnsBlock* current_block;
     int time_offset_usec;
     int client_address_index;
     int client_port;
@@ -147,18 +192,122 @@ public:
     cdns_qr_extended r_extended;
 };
 
+/* Compact layout of the queries. The fields are sized for the values
+ * that DNS allows. Index fields are only valid if the corresponding
+ * presence bit is set. The response processing data and the extended data
+ * are rarely present, and are kept in a separate table. */
+#define CDNS_QUERY_HAS_CLIENT_ADDRESS 0x01
+#define CDNS_QUERY_HAS_SIGNATURE 0x02
+#define CDNS_QUERY_HAS_NAME 0x04
+#define CDNS_QUERY_HAS_EXTENSION 0x08
+
+class cdns_query_compact {
+public:
+    cdns_query_compact();
+    ~cdns_query_compact();
+
+    bool is_present(uint8_t field_bit) const {
+        return (present & field_bit) != 0;
+    }
+
+    int32_t time_offset_usec;
+    uint32_t client_address_index;
+    uint32_t query_signature_index;
+    uint32_t query_name_index;
+    int32_t delay_useconds;
+    uint32_t extension_index; /* Index in the extensions table */
+    uint16_t client_port;
+    uint16_t transaction_id;
+    uint16_t query_size;
+    uint16_t response_size;
+    uint8_t client_hoplimit;
+    uint8_t present;
+};
+
+class cdns_query_extension {
+public:
+    cdns_query_extension();
+    ~cdns_query_extension();
+
+    cdns_response_processing_data rpd;
+    cdns_qr_extended q_extended;
+    cdns_qr_extended r_extended;
+};
+
+/* The compact queries of a block, filled by the parser when the compact
+ * mode is enabled. */
+class cdns_query_compact_table {
+public:
+    cdns_query_compact_table();
+    ~cdns_query_compact_table();
+
+    void reserve(size_t n);
+    void append(cdns_query const* q);
+    void release(cbor_arena* arena);
+    void swap(cdns_query_compact_table* other);
+
+    size_t size() {
+        return records.size();
+    }
+
+    cbor_arena_vector<cdns_query_compact> records;
+    cbor_arena_vector<cdns_query_extension> extensions;
+};
+
+/* Columnar layout of the queries, with one array per field, filled by
+ * the parser when the columnar mode is enabled. Scanning a single field
+ * does not bring the other fields in the cache. */
+class cdns_query_columns {
+public:
+    cdns_query_columns();
+    ~cdns_query_columns();
+
+    void reserve(size_t n);
+    void append(cdns_query const* q);
+    void release(cbor_arena* arena);
+    void swap(cdns_query_columns* other);
+
+    size_t size() {
+        return time_offset_usec.size();
+    }
+
+    cbor_arena_vector<int> time_offset_usec;
+    cbor_arena_vector<int> client_address_index;
+    cbor_arena_vector<int> client_port;
+    cbor_arena_vector<int> transaction_id;
+    cbor_arena_vector<int> query_signature_index;
+    cbor_arena_vector<int> client_hoplimit;
+    cbor_arena_vector<int> delay_useconds;
+    cbor_arena_vector<int> query_name_index;
+    cbor_arena_vector<int> query_size;
+    cbor_arena_vector<int> response_size;
+    cbor_arena_vector<uint8_t> rpd_is_present;
+    cbor_arena_vector<int> rpd_bailiwick_index;
+    cbor_arena_vector<int> rpd_processing_flags;
+    cbor_arena_vector<uint8_t> q_extended_is_filled;
+    cbor_arena_vector<int> q_extended_question_index;
+    cbor_arena_vector<int> q_extended_answer_index;
+    cbor_arena_vector<int> q_extended_authority_index;
+    cbor_arena_vector<int> q_extended_additional_index;
+    cbor_arena_vector<uint8_t> r_extended_is_filled;
+    cbor_arena_vector<int> r_extended_question_index;
+    cbor_arena_vector<int> r_extended_answer_index;
+    cbor_arena_vector<int> r_extended_authority_index;
+    cbor_arena_vector<int> r_extended_additional_index;
+};
+
 class cdns_address_event_count {
 public:
     cdns_address_event_count();
     ~cdns_address_event_count();
 
-    uint8_t* parse(uint8_t* in, uint8_t const* in_max, int* err, cdnsBlock* current_block);
+    uint8_t const* parse(uint8_t const* in, uint8_t const* in_max, int* err, cdnsBlock* current_block);
+    template <bool is_old> uint8_t const* parse(uint8_t const* in, uint8_t const* in_max, int* err, cdns_format_ctx<is_old>* ctx);
 
-    uint8_t* parse_map_item(uint8_t* in, uint8_t const* in_max, int64_t val, int* err);
+    uint8_t const* parse_map_item_rfc(uint8_t const* in, uint8_t const* in_max, int64_t val, int* err);
 
-    uint8_t* parse_map_item_old(uint8_t* in, uint8_t const* in_max, int64_t val, int* err);
+    uint8_t const* parse_map_item_old(uint8_t const* in, uint8_t const* in_max, int64_t val, int* err);
 
-    cdnsBlock* current_block;
     int ae_type;
     int ae_code;
     int ae_transport_flags;
@@ -172,9 +321,9 @@ public:
     cdns_class_id();
     ~cdns_class_id();
 
-    uint8_t * parse(uint8_t* in, uint8_t const* in_max, int* err);
+    uint8_t const* parse(uint8_t const* in, uint8_t const* in_max, int* err);
 
-    uint8_t* parse_map_item(uint8_t* in, uint8_t const * in_max, int64_t val, int* err);
+    uint8_t const* parse_map_item(uint8_t const* in, uint8_t const * in_max, int64_t val, int* err);
 
     int rr_type;
     int rr_class;
@@ -199,8 +348,8 @@ public:
     cdns_query_signature();
     ~cdns_query_signature();
 
-    cdns_ip_protocol_enum ip_protocol();
-    cdns_transport_protocol_enum transport_protocol();
+    cdns_ip_protocol_enum ip_protocol() const;
+    cdns_transport_protocol_enum transport_protocol() const;
     bool has_trailing_bytes();
 
     bool is_query_present();
@@ -210,12 +359,13 @@ public:
     bool is_query_present_with_no_question();
     bool is_response_present_with_no_question();
 
-    uint8_t* parse(uint8_t* in, uint8_t const* in_max, int* err, cdnsBlock* current_block);
+    uint8_t const* parse(uint8_t const* in, uint8_t const* in_max, int* err, cdnsBlock* current_block);
+    template <bool is_old> uint8_t const* parse(uint8_t const* in, uint8_t const* in_max, int* err, cdns_format_ctx<is_old>* ctx);
 
-    uint8_t* parse_map_item(uint8_t* in, uint8_t const* in_max, int64_t val, int* err);
-    uint8_t* parse_map_item_old(uint8_t* in, uint8_t const* in_max, int64_t val, int* err);
+    uint8_t const* parse_map_item_rfc(uint8_t const* in, uint8_t const* in_max, int64_t val, int* err);
+    uint8_t const* parse_map_item_old(uint8_t const* in, uint8_t const* in_max, int64_t val, int* err);
 
-    cdnsBlock* current_block;
+    bool is_old_format; /* Set by parse, the flags have different meanings in the draft */
     int server_address_index;
     int server_port;
     int qr_transport_flags;
@@ -235,15 +385,101 @@ public:
     int response_rcode;
 };
 
+/* Compact layout of the query signatures, see cdns_query_compact */
+#define CDNS_QUERY_SIGNATURE_HAS_SERVER_ADDRESS 0x01
+#define CDNS_QUERY_SIGNATURE_HAS_CLASSTYPE 0x02
+#define CDNS_QUERY_SIGNATURE_HAS_OPT_RDATA 0x04
+#define CDNS_QUERY_SIGNATURE_HAS_EDNS_VERSION 0x08
+
+class cdns_query_signature_compact {
+public:
+    cdns_query_signature_compact();
+    ~cdns_query_signature_compact();
+
+    bool is_present(uint8_t field_bit) const {
+        return (present & field_bit) != 0;
+    }
+
+    uint32_t server_address_index;
+    uint32_t query_classtype_index;
+    uint32_t opt_rdata_index;
+    uint16_t server_port;
+    uint16_t qr_dns_flags;
+    uint16_t query_rcode;
+    uint16_t response_rcode;
+    uint16_t udp_buf_size;
+    uint16_t query_qd_count;
+    uint16_t query_an_count;
+    uint16_t query_ar_count;
+    uint16_t query_ns_count;
+    uint8_t qr_transport_flags;
+    uint8_t qr_type;
+    uint8_t qr_sig_flags;
+    uint8_t query_opcode;
+    uint8_t edns_version;
+    uint8_t present;
+};
+
+class cdns_query_signature_compact_table {
+public:
+    cdns_query_signature_compact_table();
+    ~cdns_query_signature_compact_table();
+
+    void reserve(size_t n);
+    void append(cdns_query_signature const* q_sig);
+    void release(cbor_arena* arena);
+    void swap(cdns_query_signature_compact_table* other);
+
+    size_t size() {
+        return records.size();
+    }
+
+    cbor_arena_vector<cdns_query_signature_compact> records;
+};
+
+/* Columnar layout of the query signatures, one array per field */
+class cdns_query_signature_columns {
+public:
+    cdns_query_signature_columns();
+    ~cdns_query_signature_columns();
+
+    void reserve(size_t n);
+    void append(cdns_query_signature const* q_sig);
+    void release(cbor_arena* arena);
+    void swap(cdns_query_signature_columns* other);
+
+    size_t size() {
+        return server_address_index.size();
+    }
+
+    cbor_arena_vector<int> server_address_index;
+    cbor_arena_vector<int> server_port;
+    cbor_arena_vector<int> qr_transport_flags;
+    cbor_arena_vector<int> qr_type;
+    cbor_arena_vector<int> qr_sig_flags;
+    cbor_arena_vector<int> query_opcode;
+    cbor_arena_vector<int> qr_dns_flags;
+    cbor_arena_vector<int> query_rcode;
+    cbor_arena_vector<int> query_classtype_index;
+    cbor_arena_vector<int> query_qd_count;
+    cbor_arena_vector<int> query_an_count;
+    cbor_arena_vector<int> query_ar_count;
+    cbor_arena_vector<int> query_ns_count;
+    cbor_arena_vector<int> edns_version;
+    cbor_arena_vector<int> udp_buf_size;
+    cbor_arena_vector<int> opt_rdata_index;
+    cbor_arena_vector<int> response_rcode;
+};
+
 /* The cdns_question class describes the elements in the QRR table */
 class cdns_question {
 public:
     cdns_question();
     ~cdns_question();
 
-    uint8_t* parse(uint8_t* in, uint8_t const* in_max, int* err);
+    uint8_t const* parse(uint8_t const* in, uint8_t const* in_max, int* err);
 
-    uint8_t* parse_map_item(uint8_t* in, uint8_t const* in_max, int64_t val, int* err);
+    uint8_t const* parse_map_item(uint8_t const* in, uint8_t const* in_max, int64_t val, int* err);
 
     int name_index;
     int classtype_index;
@@ -255,9 +491,9 @@ public:
     cdns_rr_field();
     ~cdns_rr_field();
 
-    uint8_t* parse(uint8_t* in, uint8_t const* in_max, int* err);
+    uint8_t const* parse(uint8_t const* in, uint8_t const* in_max, int* err);
 
-    uint8_t* parse_map_item(uint8_t* in, uint8_t const* in_max, int64_t val, int* err);
+    uint8_t const* parse_map_item(uint8_t const* in, uint8_t const* in_max, int64_t val, int* err);
 
     int name_index;
     int classtype_index;
@@ -265,26 +501,61 @@ public:
     int rdata_index;
 };
 
-/* The RR list table */
-class cdns_rr_list{
+/* The RR list and question list tables, in compressed sparse row form. The
+ * indexes of all the lists are held in a single array, and the list i is
+ * items[offsets[i]] to items[offsets[i+1]]. */
+class cdns_list_table {
 public:
-    cdns_rr_list();
-    ~cdns_rr_list();
+    cdns_list_table();
+    ~cdns_list_table();
+
+    uint8_t const* parse(uint8_t const* in, uint8_t const* in_max, int* err);
+
+    void clear();
+    void release(cbor_arena* arena);
+    void swap(cdns_list_table* other);
+
+    size_t size() const {
+        return (offsets.size() > 0) ? offsets.size() - 1 : 0;
+    }
+
+    size_t list_size(size_t list) const {
+        return offsets[list + 1] - offsets[list];
+    }
 
-    uint8_t* parse(uint8_t* in, uint8_t const* in_max, int* err);
+    int const* list_items(size_t list) const {
+        return items.data() + offsets[list];
+    }
+
+    cbor_arena_vector<int> items;
+    cbor_arena_vector<uint32_t> offsets; /* One more than the number of lists */
 
-    std::vector<int> rr_index;
+private:
+    uint8_t const* parse_list(uint8_t const* in, uint8_t const* in_max, int* err);
 };
 
-/* The Question List table */
-class cdns_question_list {
+/* The entries of the qrr or rrs table designated by one list. The entries
+ * are found by indexing, and are NULL if the index is out of range. */
+template <class T> class cdns_list_view {
 public:
-    cdns_question_list();
-    ~cdns_question_list();
+    cdns_list_view() : first(NULL), nb_items(0), table(NULL), index_offset(0) {}
+    cdns_list_view(int const* first, size_t nb_items, cbor_arena_vector<T> const* table, int index_offset) :
+        first(first), nb_items(nb_items), table(table), index_offset(index_offset) {}
 
-    uint8_t* parse(uint8_t* in, uint8_t const* in_max, int* err);
+    size_t size() const {
+        return nb_items;
+    }
+
+    T const* at(size_t i) const {
+        int index = first[i] - index_offset;
 
-    std::vector<int> question_table_index;
+        return (index >= 0 && (size_t)index < table->size()) ? &(*table)[(size_t)index] : NULL;
+    }
+
+    int const* first;
+    size_t nb_items;
+    cbor_arena_vector<T> const* table;
+    int index_offset;
 };
 
 class cdnsBlockTables
@@ -294,25 +565,79 @@ public:
 
     ~cdnsBlockTables();
 
-    uint8_t* parse(uint8_t* in, uint8_t const* in_max, int* err, cdnsBlock* current_block);
+    uint8_t const* parse(uint8_t const* in, uint8_t const* in_max, int* err, cdnsBlock* current_block);
+
+    uint8_t const* parse_map_item(uint8_t const* in, uint8_t const* in_max, int64_t val, int* err);
 
-    uint8_t* parse_map_item(uint8_t* in, uint8_t const* in_max, int64_t val, int* err);
+    uint8_t const* parse_table(uint8_t const* in, uint8_t const* in_max, int64_t val, int* err);
 
     void clear();
 
+    void release(cbor_arena* arena);
+
+    void swap(cdnsBlockTables* other);
+
+    /* The questions or RRs designated by an index found in q_extended or
+     * r_extended, e.g. get_rrs(q->r_extended.answer_index). The view is
+     * empty if the index is absent or out of range. */
+    cdns_list_view<cdns_question> get_questions(int question_list_index);
+    cdns_list_view<cdns_rr_field> get_rrs(int rr_list_index);
+
     cdnsBlock* current_block;
-    std::vector<cbor_bytes> addresses;
-    std::vector<cdns_class_id> class_ids;
-    std::vector<cbor_bytes> name_rdata;
-    std::vector<cdns_query_signature> q_sigs;
-    std::vector<cdns_question_list> question_list; /* Indexes to question items in the qrr array */
-    std::vector<cdns_question> qrr; /* Individual questions -- index to name and class/type */
-    std::vector<cdns_rr_list> rr_list; /* Indexes to RR items in RR table */
-    std::vector<cdns_rr_field> rrs; /* List of individual RR */
+    cbor_arena_vector<cbor_bytes_view> addresses; /* Points into the file buffer or the block arena */
+    cbor_arena_vector<cdns_class_id> class_ids;
+    cbor_arena_vector<cbor_bytes_view> name_rdata; /* Points into the file buffer or the block arena */
+    cbor_arena_vector<cdns_query_signature> q_sigs;
+    cdns_list_table question_list; /* Indexes to question items in the qrr array */
+    cbor_arena_vector<cdns_question> qrr; /* Individual questions -- index to name and class/type */
+    cdns_list_table rr_list; /* Indexes to RR items in RR table */
+    cbor_arena_vector<cdns_rr_field> rrs; /* List of individual RR */
+    cdns_query_signature_columns q_sig_columns; /* Replaces q_sigs in columnar mode */
+    cdns_query_signature_compact_table compact_q_sigs; /* Replaces q_sigs in compact mode */
     /* TODO: track malformed record data if there is demand for it */
     bool is_filled;
 };
 
+/* A query, with the table entries that it references. The pointers are
+ * NULL if the index is absent or out of range, or if the table was not
+ * decoded. The signature is only resolved in the default layout. */
+class cdns_resolved_query {
+public:
+    cdns_resolved_query();
+    ~cdns_resolved_query();
+
+    void resolve(cdnsBlock* block, cdns_query const* q);
+
+    cdns_query const* query;
+    cdns_query_signature const* q_sig;
+    cbor_bytes_view const* query_name;
+    cdns_class_id const* query_class; /* Class and type of the question, from the signature */
+    cbor_bytes_view const* client_address;
+    cbor_bytes_view const* server_address;
+};
+
+/* Callbacks of cdns::visit_block. The tables are decoded in the block as
+ * usual, and each table is signalled when complete. The queries are not
+ * stored: they are decoded in batches of up to CDNS_VISIT_BATCH, which are
+ * only valid during the call. The statistics and the address events are
+ * available when the end of the block is signalled. */
+class cdns_visitor {
+public:
+    cdns_visitor() {}
+    virtual ~cdns_visitor() {}
+
+    virtual void on_table(cdnsBlock* block, uint32_t table) { /* table is one of the CDNS_PROJECT_* table bits */
+        (void)block;
+        (void)table;
+    }
+
+    virtual void on_queries(cdnsBlock* block, cdns_resolved_query const* queries, size_t nb_queries) = 0;
+
+    virtual void on_block_end(cdnsBlock* block) {
+        (void)block;
+    }
+};
+
 class cdnsBlock
 {
 public:
@@ -320,21 +645,63 @@ public:
 
     ~cdnsBlock();
 
-    uint8_t* parse(uint8_t* in, uint8_t const* in_max, int* err, cdns* current_cdns);
+    uint8_t const* parse(uint8_t const* in, uint8_t const* in_max, int* err, cdns* current_cdns);
 
-    uint8_t* parse_map_item(uint8_t* in, uint8_t const* in_max, int64_t val, int* err);
+    uint8_t const* parse_map_item(uint8_t const* in, uint8_t const* in_max, int64_t val, int* err);
 
     void clear();
 
+    void release(); /* Drop the parsed content, and recover its memory */
+
+    void swap(cdnsBlock* other); /* Exchange contents in constant time, the items do not point to the block */
+
+    void reserve_queries();
+
+    /* In lazy mode, the tables, queries and address events are only located
+     * when the block is parsed. They are decoded by materialize, once. */
+    bool materialize(uint32_t mask, int* err);
+
+    bool is_materialized(uint32_t mask) {
+        return (lazy_mask & mask) == 0;
+    }
+
+    uint8_t const* defer_part(int part, uint8_t const* in, uint8_t const* in_max, int* err);
+
+    uint8_t const* parse_part(int part, uint8_t const* in, uint8_t const* in_max, int* err);
+
     cdns * current_cdns;
+    cbor_arena* arena; /* Holds the tables, queries and lists, and the strings that cannot point into the file buffer */
     cdns_block_preamble preamble;
     cdns_block_statistics statistics;
     cdnsBlockTables tables;
-    std::vector<cdns_query> queries; /* TODO -- check difference between V0.5 and V1 */
-    std::vector<cdns_address_event_count> address_events; /* TODO -- check difference between V0.5 and V1 */
+    cbor_arena_vector<cdns_query> queries; /* TODO -- check difference between V0.5 and V1 */
+    cbor_arena_vector<cdns_address_event_count> address_events; /* TODO -- check difference between V0.5 and V1 */
+    cdns_query_columns query_columns; /* Replaces queries in columnar mode */
+    cdns_query_compact_table compact_queries; /* Replaces queries in compact mode */
 
     int is_filled;
     uint64_t block_start_us;
+    uint32_t projection; /* Mask used when parsing this block */
+    cbor_bytes_view lazy_parts[CDNS_BLOCK_PARTS]; /* Encoded parts, in the file buffer or the arena */
+    uint32_t lazy_mask; /* Parts located but not decoded yet */
+    cdns_visitor* visitor; /* Set by cdns::visit_block while the block is parsed */
+
+private:
+    cdnsBlock(const cdnsBlock& other);
+    cdnsBlock& operator=(const cdnsBlock& other);
+};
+
+/* Position and start time of a block, as found by the block index scan.
+ * The offset is counted from the beginning of the (decompressed) file. */
+class cdns_block_index_entry
+{
+public:
+    cdns_block_index_entry();
+    ~cdns_block_index_entry();
+
+    uint64_t offset;
+    uint64_t length;
+    uint64_t block_start_us;
 };
 
 class cdnsStorageHints
@@ -344,9 +711,9 @@ public:
 
     ~cdnsStorageHints();
 
-    uint8_t* parse(uint8_t* in, uint8_t const* in_max, int* err);
+    uint8_t const* parse(uint8_t const* in, uint8_t const* in_max, int* err);
 
-    uint8_t* parse_map_item(uint8_t* in, uint8_t const* in_max, int64_t val, int* err);
+    uint8_t const* parse_map_item(uint8_t const* in, uint8_t const* in_max, int64_t val, int* err);
 
     void clear();
 
@@ -356,6 +723,9 @@ public:
     int64_t other_data_hints;
 };
 
+/* The parameter classes declare their destructor, so the moves would not be
+ * generated implicitly. They are defaulted, and noexcept, so that vectors of
+ * parameters move their elements when they grow. */
 class cdnsStorageParameter
 {
 public:
@@ -363,8 +733,13 @@ public:
 
     ~cdnsStorageParameter();
 
-    uint8_t* parse(uint8_t* in, uint8_t const* in_max, int* err);
-    uint8_t* parse_map_item(uint8_t* in, uint8_t const* in_max, int64_t val, int* err);
+    cdnsStorageParameter(const cdnsStorageParameter& other) = default;
+    cdnsStorageParameter(cdnsStorageParameter&& other) noexcept = default;
+    cdnsStorageParameter& operator=(const cdnsStorageParameter& other) = default;
+    cdnsStorageParameter& operator=(cdnsStorageParameter&& other) noexcept = default;
+
+    uint8_t const* parse(uint8_t const* in, uint8_t const* in_max, int* err);
+    uint8_t const* parse_map_item(uint8_t const* in, uint8_t const* in_max, int64_t val, int* err);
 
     void clear();
 
@@ -389,8 +764,13 @@ public:
 
     ~cdnsCollectionParameters();
 
-    uint8_t* parse(uint8_t* in, uint8_t const* in_max, int* err);
-    uint8_t* parse_map_item(uint8_t* in, uint8_t const* in_max, int64_t val, int* err);
+    cdnsCollectionParameters(const cdnsCollectionParameters& other) = default;
+    cdnsCollectionParameters(cdnsCollectionParameters&& other) noexcept = default;
+    cdnsCollectionParameters& operator=(const cdnsCollectionParameters& other) = default;
+    cdnsCollectionParameters& operator=(cdnsCollectionParameters&& other) noexcept = default;
+
+    uint8_t const* parse(uint8_t const* in, uint8_t const* in_max, int* err);
+    uint8_t const* parse_map_item(uint8_t const* in, uint8_t const* in_max, int64_t val, int* err);
 
     void clear();
 
@@ -415,8 +795,13 @@ public:
 
     ~cdnsBlockParameter();
 
-    uint8_t* parse(uint8_t* in, uint8_t const* in_max, int* err);
-    uint8_t* parse_map_item(uint8_t* in, uint8_t const* in_max, int64_t val, int* err);
+    cdnsBlockParameter(const cdnsBlockParameter& other) = default;
+    cdnsBlockParameter(cdnsBlockParameter&& other) noexcept = default;
+    cdnsBlockParameter& operator=(const cdnsBlockParameter& other) = default;
+    cdnsBlockParameter& operator=(cdnsBlockParameter&& other) noexcept = default;
+
+    uint8_t const* parse(uint8_t const* in, uint8_t const* in_max, int* err);
+    uint8_t const* parse_map_item(uint8_t const* in, uint8_t const* in_max, int64_t val, int* err);
 
     void clear();
 
@@ -431,8 +816,13 @@ public:
 
     ~cdnsBlockParameterOld();
 
-    uint8_t* parse(uint8_t* in, uint8_t const* in_max, int* err);
-    uint8_t* parse_map_item(uint8_t* in, uint8_t const* in_max, int64_t val, int* err);
+    cdnsBlockParameterOld(const cdnsBlockParameterOld& other) = default;
+    cdnsBlockParameterOld(cdnsBlockParameterOld&& other) noexcept = default;
+    cdnsBlockParameterOld& operator=(const cdnsBlockParameterOld& other) = default;
+    cdnsBlockParameterOld& operator=(cdnsBlockParameterOld&& other) noexcept = default;
+
+    uint8_t const* parse(uint8_t const* in, uint8_t const* in_max, int* err);
+    uint8_t const* parse_map_item(uint8_t const* in, uint8_t const* in_max, int64_t val, int* err);
 
     void clear();
 
@@ -459,9 +849,14 @@ public:
 
     ~cdnsPreamble();
 
-    uint8_t* parse(uint8_t* in, uint8_t const* in_max, int* err);
+    cdnsPreamble(const cdnsPreamble& other) = default;
+    cdnsPreamble(cdnsPreamble&& other) noexcept = default;
+    cdnsPreamble& operator=(const cdnsPreamble& other) = default;
+    cdnsPreamble& operator=(cdnsPreamble&& other) noexcept = default;
+
+    uint8_t const* parse(uint8_t const* in, uint8_t const* in_max, int* err);
 
-    uint8_t* parse_map_item(uint8_t* in, uint8_t const* in_max, int64_t val, int* err);
+    uint8_t const* parse_map_item(uint8_t const* in, uint8_t const* in_max, int64_t val, int* err);
 
     void clear();
 
@@ -477,6 +872,13 @@ public:
 
 #define CNDS_INDEX_OFFSET 1
 
+/* Memory layout of the queries and query signatures of a block */
+typedef enum {
+    cdns_layout_records = 0,
+    cdns_layout_columns,
+    cdns_layout_compact
+} cdns_layout_enum;
+
 class cdns
 {
 public:
@@ -486,6 +888,14 @@ public:
 
     bool open(char const* file_name);
 
+    bool open_mapped(char const* file_name); /* Read-only memory map of the file, no copy */
+
+    bool open_stream(char const* file_name); /* Sliding window, only holds the current block */
+
+    bool open_buffer(uint8_t const* in, size_t in_length); /* Borrows the caller's memory, no copy */
+
+    bool open_fd(int fd); /* Streaming read from a pipe, stdin or any open descriptor */
+
     bool read_entire_file(FILE* FD);
 
     bool dump(char const* file_out);
@@ -494,6 +904,29 @@ public:
 
     bool open_block(int* err);
 
+    bool open_block(int* err, uint32_t projection); /* Only decode the parts selected by the CDNS_PROJECT_* mask */
+
+    bool visit_block(cdns_visitor* visitor, int* err); /* Parse the next block, passing the queries to the visitor instead of storing them */
+
+    bool enable_prefetch(); /* Parse the next block in a worker thread while the current one is processed */
+
+    bool enable_parallel(int nb_threads, int* err); /* Decode blocks on nb_threads workers, 0 for one per core */
+
+    bool enable_columns(); /* Fill query_columns and q_sig_columns instead of queries and q_sigs */
+
+    bool enable_compact(); /* Fill compact_queries and compact_q_sigs instead of queries and q_sigs */
+
+    bool enable_lazy(); /* Defer the decoding of tables, queries and address events to block.materialize */
+
+    /* Random access to blocks. These functions are not available in streaming mode. */
+    bool build_block_index(int* err); /* Skims the file, only parses the block preambles */
+    bool save_block_index(char const* index_file_name);
+    bool load_block_index(char const* index_file_name); /* Fails if the index does not match the file */
+    bool use_block_index(char const* index_file_name, int* err); /* Load the sidecar index, or build and save it */
+    bool open_block_at(size_t block_number, int* err);
+    size_t block_number_at_time(uint64_t time_us); /* Last block starting at or before time_us */
+    bool seek_time(uint64_t time_us, int* err); /* The next open_block returns the block covering time_us */
+
     bool is_first_block() {
         return nb_blocks_read == 1;
     }
@@ -506,6 +939,28 @@ public:
         return (preamble_parsed && preamble.cdns_version_major == 0);
     }
 
+    bool is_buffer_stable() { /* False if the buffer content moves as blocks are read */
+        return F_stream == NULL;
+    }
+
+    bool is_columnar() {
+        return layout == cdns_layout_columns;
+    }
+
+    bool is_compact() {
+        return layout == cdns_layout_compact;
+    }
+
+    uint32_t get_projection() {
+        return projection;
+    }
+
+    bool is_lazy() {
+        return lazy;
+    }
+
+    std::vector<cdns_block_index_entry> block_index;
+
     int64_t get_ticks_per_second(int64_t block_id);
 
     int64_t ticks_to_microseconds(int64_t ticks, int64_t block_id);
@@ -514,17 +969,24 @@ public:
     static int get_edns_flags(int q_dns_flags);
 
 
-    static uint8_t* dump_query(uint8_t* in, const uint8_t* in_max, char* out_buf, char* out_max, int cdns_version, int* err, FILE* F_out);
+    static uint8_t const* dump_query(uint8_t const* in, uint8_t const* in_max, char* out_buf, char* out_max, int cdns_version, int* err, FILE* F_out);
 
     cdnsPreamble preamble;
     cdnsBlock block; /* Current block */
     uint64_t first_block_start_us;
     int index_offset;
-    uint8_t* buf;
+    uint8_t const* buf;
     size_t buf_size;
     size_t buf_read;
 
 private:
+    uint8_t* buf_alloc;
+    bool buf_mapped;
+    FILE* F_stream;
+    uint64_t buf_offset; /* Position of buf[0] in the file, in streaming mode */
+    cdns_decompressor* decompressor; /* Set if the file is compressed */
+    bool source_checked;
+    bool source_error;
     size_t buf_parsed;
     bool end_of_file;
     bool preamble_parsed;
@@ -532,22 +994,152 @@ private:
     bool block_list_undef;
     int64_t nb_blocks_present;
     int64_t nb_blocks_read;
+    int64_t nb_blocks_parsed; /* Differs from nb_blocks_read when a block is prefetched */
+    bool block_list_end_found;
+    size_t first_block_offset;
+    cdnsBlock* next_block; /* Set in prefetch mode */
+    std::thread* prefetch_thread; /* Runs from the first prefetch until seek, projection change or delete */
+    std::mutex prefetch_lock;
+    std::condition_variable prefetch_changed;
+    bool prefetch_requested; /* Set by open_block, cleared by the worker when the block is parsed */
+    bool prefetch_stopping;
+    bool prefetch_pending; /* A block was requested, and not waited for */
+    cdns_block_pool* block_pool; /* Set in parallel mode */
+    bool next_ret;
+    int next_err;
+    cdns_layout_enum layout;
+    uint32_t projection;
+    bool lazy;
+    size_t prefetch_buf_parsed; /* Parsing state before the prefetch, to parse again with another mask */
+    int64_t prefetch_nb_blocks_parsed;
+    bool prefetch_end_found;
+    bool next_ready; /* The prefetched block is parsed, but not delivered yet */
+
+    bool set_layout(cdns_layout_enum new_layout);
+    bool seek_block(size_t block_number, int* err);
+    bool parse_next_block(cdnsBlock* target, int* err);
+    void prefetch_start();
+    void prefetch_run();
+    void prefetch_wait();
+    void prefetch_stop();
+    void set_projection(uint32_t new_projection);
+    bool stream_start();
+    bool stream_read_more();
+    size_t source_read(FILE* F, uint8_t* dst, size_t asked);
+    bool stream_load(bool is_file_head, int* err);
+    uint8_t const* dump_preamble(uint8_t const* in, uint8_t const* in_max, char* out_buf, char* out_max, int* cdns_version, int* err, FILE* F_out);
+    uint8_t const* dump_block_parameters(uint8_t const* in, uint8_t const* in_max, char* out_buf, char* out_max, int cdns_version, int* err, FILE* F_out);
+    uint8_t const* dump_block_parameters_rfc(uint8_t const* in, uint8_t const* in_max, char* out_buf, char* out_max, int* err, FILE* F_out);
+    uint8_t const* dump_block_parameters_storage(uint8_t const* in, uint8_t const* in_max, char* out_buf, char* out_max, int* err, FILE* F_out);
+    uint8_t const* dump_block_parameters_collection(uint8_t const* in, uint8_t const* in_max, char* out_buf, char* out_max, int* err, FILE* F_out);
+    uint8_t const* dump_block(uint8_t const* in, uint8_t const* in_max, char* out_buf, char* out_max, int cdns_version, int* err, FILE* F_out);
+    uint8_t const* dump_block_properties(uint8_t const* in, uint8_t const* in_max, char* out_buf, char* out_max, int cdns_version, int* err, FILE* F_out);
+    uint8_t const* dump_block_tables(uint8_t const* in, uint8_t const* in_max, char* out_buf, char* out_max, int cdns_version, int* err, FILE* F_out);
+    uint8_t const* dump_queries(uint8_t const* in, uint8_t const* in_max, char* out_buf, char* out_max, int cdns_version, int* err, FILE* F_out);
+    uint8_t const* dump_class_types(uint8_t const* in, uint8_t const* in_max, char* out_buf, char* out_max, int* err, FILE* F_out);
+    uint8_t const* dump_class_type(uint8_t const* in, uint8_t const* in_max, char* out_buf, char* out_max, int* err, FILE* F_out);
+    uint8_t const* dump_qr_sigs(uint8_t const* in, uint8_t const* in_max, char* out_buf, char* out_max, int cdns_version, int* err, FILE* F_out);
+    uint8_t const* dump_qr_sig(uint8_t const* in, uint8_t const* in_max, char* out_buf, char* out_max, int cdns_version, int* err, FILE* F_out);
+
+    uint8_t const* dump_list(uint8_t const* in, uint8_t const* in_max, char* out_buf, char* out_max, char const* indent, char const* list_name, int* err, FILE* F_out);
+};
+
+template <bool is_old> cdns_format_ctx<is_old>::cdns_format_ctx(cdnsBlock* block) :
+    block(block),
+    projection(block->projection),
+    ticks_per_second((is_old || block->current_cdns == NULL) ? 1000000 :
+        block->current_cdns->get_ticks_per_second(block->preamble.block_parameter_index))
+{
+}
+
+template <bool is_old> int64_t cdns_format_ctx<is_old>::ticks_to_microseconds(int64_t ticks) const
+{
+    if (ticks_per_second != 1000000) {
+        ticks *= ticks_per_second;
+        ticks /= 1000000;
+    }
+
+    return ticks;
+}
+
+/* A query joined with the table entries that it references, with the index
+ * offset applied and the time made absolute. The views are empty and the
+ * values are -1 if an entry is absent. The views and pointers are valid
+ * until the next block is read. */
+class cdns_flat_query
+{
+public:
+    cdns_flat_query();
+    ~cdns_flat_query();
+
+    uint64_t time_us;
+    cbor_bytes_view query_name;
+    int rr_type;
+    int rr_class;
+    int opcode;
+    int query_rcode;
+    int response_rcode;
+    int qr_sig_flags;
+    int qr_dns_flags;
+    int transport; /* cdns_transport_protocol_enum, or -1 */
+    int ip_protocol; /* cdns_ip_protocol_enum, or -1 */
+    cbor_bytes_view client_address;
+    cbor_bytes_view server_address;
+    int client_port;
+    int server_port;
+    int query_size;
+    int response_size;
+    cdns_query const* query;
+    cdns_query_signature const* q_sig;
+};
+
+/* Iterate over the queries of all the remaining blocks of the file. The
+ * blocks are read with open_block, so the prefetch, parallel and lazy modes
+ * can be used, but the layout shall be the default one. The table rows of
+ * the next queries are prefetched while the current one is returned. */
+#define CDNS_RESOLVED_RING 16 /* Power of 2, larger than the data prefetch distance */
+
+class cdns_query_iterator
+{
+public:
+    explicit cdns_query_iterator(cdns* cdns_ctx);
+    ~cdns_query_iterator();
+
+    bool next(cdns_flat_query* flat, int* err); /* Returns false with CBOR_END_OF_ARRAY after the last query */
+
+    cdns* cdns_ctx;
 
-    uint8_t* dump_preamble(uint8_t* in, uint8_t* in_max, char* out_buf, char* out_max, int* cdns_version, int* err, FILE* F_out);
-    uint8_t* dump_block_parameters(uint8_t* in, uint8_t* in_max, char* out_buf, char* out_max, int cdns_version, int* err, FILE* F_out);
-    uint8_t* dump_block_parameters_rfc(uint8_t* in, uint8_t* in_max, char* out_buf, char* out_max, int* err, FILE* F_out);
-    uint8_t* dump_block_parameters_storage(uint8_t* in, uint8_t* in_max, char* out_buf, char* out_max, int* err, FILE* F_out);
-    uint8_t* dump_block_parameters_collection(uint8_t* in, uint8_t* in_max, char* out_buf, char* out_max, int* err, FILE* F_out);
-    uint8_t* dump_block(uint8_t* in, uint8_t* in_max, char* out_buf, char* out_max, int cdns_version, int* err, FILE* F_out);
-    uint8_t* dump_block_properties(uint8_t* in, uint8_t* in_max, char* out_buf, char* out_max, int cdns_version, int* err, FILE* F_out);
-    uint8_t* dump_block_tables(uint8_t* in, uint8_t* in_max, char* out_buf, char* out_max, int cdns_version, int* err, FILE* F_out);
-    uint8_t* dump_queries(uint8_t* in, uint8_t* in_max, char* out_buf, char* out_max, int cdns_version, int* err, FILE* F_out);
-    uint8_t* dump_class_types(uint8_t* in, uint8_t* in_max, char* out_buf, char* out_max, int* err, FILE* F_out);
-    uint8_t* dump_class_type(uint8_t* in, uint8_t* in_max, char* out_buf, char* out_max, int* err, FILE* F_out);
-    uint8_t* dump_qr_sigs(uint8_t* in, uint8_t* in_max, char* out_buf, char* out_max, int cdns_version, int* err, FILE* F_out);
-    uint8_t* dump_qr_sig(uint8_t* in, uint8_t* in_max, char* out_buf, char* out_max, int cdns_version, int* err, FILE* F_out);
-
-    uint8_t* dump_list(uint8_t* in, uint8_t* in_max, char* out_buf, char* out_max, char const* indent, char const* list_name, int* err, FILE* F_out);
+private:
+    void prefetch_rows(size_t index);
+    void prefetch_data(size_t index);
+
+    bool is_started;
+    size_t query_index;
+    cdns_resolved_query resolved[CDNS_RESOLVED_RING]; /* Queries resolved ahead, by index modulo the ring size */
+};
+
+/* Iterate over the blocks that overlap the time range [start_us, end_us).
+ * The blocks are located with the block index, which is built if needed,
+ * so that the blocks outside the range are not parsed. Blocks are
+ * expected in chronological order.
+ */
+class cdns_time_range
+{
+public:
+    cdns_time_range(cdns* cdns_ctx, uint64_t start_us, uint64_t end_us);
+    ~cdns_time_range();
+
+    bool next_block(int* err); /* Returns false with CBOR_END_OF_ARRAY after the last block in range */
+
+    bool is_query_in_range(size_t query_index); /* Checks a query of the current block */
+
+    cdns* cdns_ctx;
+    uint64_t start_us;
+    uint64_t end_us;
+
+private:
+    bool is_started;
+    size_t next_block_number;
 };
 
 #endif
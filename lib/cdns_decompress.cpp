@@ -0,0 +1,355 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2019, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef CDNS_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef CDNS_HAVE_LZMA
+#include <lzma.h>
+#endif
+#ifdef CDNS_HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "cdns_decompress.h"
+
+#define CDNS_DECOMPRESS_INPUT_SIZE 0x10000
+
+cdns_decompressor::cdns_decompressor() :
+    has_error(false),
+    in_buf(NULL),
+    in_buf_size(0),
+    in_start(0),
+    in_end(0),
+    input_eof(false),
+    stream_end(false)
+{
+}
+
+cdns_decompressor::~cdns_decompressor()
+{
+    if (in_buf != NULL) {
+        delete[] in_buf;
+    }
+}
+
+cdns_compression_enum cdns_decompressor::detect(uint8_t const* in, size_t in_length)
+{
+    static const uint8_t gzip_magic[] = { 0x1f, 0x8b };
+    static const uint8_t xz_magic[] = { 0xfd, 0x37, 0x7a, 0x58, 0x5a, 0x00 };
+    static const uint8_t zstd_magic[] = { 0x28, 0xb5, 0x2f, 0xfd };
+    cdns_compression_enum compression = cdns_compression_none;
+
+    if (in_length >= sizeof(gzip_magic) && memcmp(in, gzip_magic, sizeof(gzip_magic)) == 0) {
+        compression = cdns_compression_gzip;
+    }
+    else if (in_length >= sizeof(xz_magic) && memcmp(in, xz_magic, sizeof(xz_magic)) == 0) {
+        compression = cdns_compression_xz;
+    }
+    else if (in_length >= sizeof(zstd_magic) && memcmp(in, zstd_magic, sizeof(zstd_magic)) == 0) {
+        compression = cdns_compression_zstd;
+    }
+
+    return compression;
+}
+
+bool cdns_decompressor::set_input(uint8_t const* in, size_t in_length)
+{
+    bool ret = true;
+
+    in_buf_size = (in_length > CDNS_DECOMPRESS_INPUT_SIZE) ? in_length : CDNS_DECOMPRESS_INPUT_SIZE;
+    in_buf = new uint8_t[in_buf_size];
+    if (in_buf == NULL) {
+        in_buf_size = 0;
+        has_error = true;
+        ret = false;
+    }
+    else {
+        memcpy(in_buf, in, in_length);
+        in_start = 0;
+        in_end = in_length;
+    }
+
+    return ret;
+}
+
+size_t cdns_decompressor::read(FILE* F, uint8_t* out, size_t asked)
+{
+    size_t produced = 0;
+    bool stalled = false;
+
+    while (produced < asked && !stream_end && !has_error) {
+        size_t old_start;
+        size_t n_out;
+
+        if (!input_eof && (in_start >= in_end || stalled)) {
+            if (in_start > 0) {
+                if (in_end > in_start) {
+                    memmove(in_buf, in_buf + in_start, in_end - in_start);
+                }
+                in_end -= in_start;
+                in_start = 0;
+            }
+            if (in_end < in_buf_size) {
+                size_t n_asked = in_buf_size - in_end;
+                size_t n_bytes = fread(in_buf + in_end, 1, n_asked, F);
+
+                input_eof = (n_bytes < n_asked);
+                in_end += n_bytes;
+            }
+            else {
+                has_error = true;
+                break;
+            }
+        }
+
+        old_start = in_start;
+        n_out = decompress(out + produced, asked - produced);
+        produced += n_out;
+        stalled = (n_out == 0 && in_start == old_start);
+
+        if (stalled && input_eof && !stream_end) {
+            /* The compressed data is truncated */
+            has_error = true;
+        }
+    }
+
+    return produced;
+}
+
+#ifdef CDNS_HAVE_ZLIB
+class cdns_decompressor_gzip : public cdns_decompressor
+{
+public:
+    cdns_decompressor_gzip() :
+        is_initialized(false),
+        member_end(false)
+    {
+        memset(&strm, 0, sizeof(strm));
+        /* 15 + 32: maximum window, automatic detection of gzip or zlib header */
+        if (inflateInit2(&strm, 15 + 32) == Z_OK) {
+            is_initialized = true;
+        }
+        else {
+            has_error = true;
+        }
+    }
+
+    ~cdns_decompressor_gzip()
+    {
+        if (is_initialized) {
+            (void)inflateEnd(&strm);
+        }
+    }
+
+protected:
+    size_t decompress(uint8_t* out, size_t asked) override
+    {
+        size_t n_out = 0;
+
+        if (member_end) {
+            /* Files may be made of several concatenated gzip members */
+            if (in_start < in_end) {
+                (void)inflateReset(&strm);
+                member_end = false;
+            }
+            else if (input_eof) {
+                stream_end = true;
+            }
+        }
+
+        if (!member_end && !stream_end) {
+            int z_ret;
+
+            if (asked > 0x40000000) {
+                /* The zlib counters are 32 bits */
+                asked = 0x40000000;
+            }
+
+            strm.next_in = in_buf + in_start;
+            strm.avail_in = (uInt)(in_end - in_start);
+            strm.next_out = out;
+            strm.avail_out = (uInt)asked;
+
+            z_ret = inflate(&strm, Z_NO_FLUSH);
+
+            n_out = asked - strm.avail_out;
+            in_start = in_end - strm.avail_in;
+
+            if (z_ret == Z_STREAM_END) {
+                member_end = true;
+            }
+            else if (z_ret != Z_OK && z_ret != Z_BUF_ERROR) {
+                has_error = true;
+            }
+        }
+
+        return n_out;
+    }
+
+    z_stream strm;
+    bool is_initialized;
+    bool member_end;
+};
+#endif
+
+#ifdef CDNS_HAVE_LZMA
+class cdns_decompressor_xz : public cdns_decompressor
+{
+public:
+    cdns_decompressor_xz() :
+        is_initialized(false)
+    {
+        lzma_stream init = LZMA_STREAM_INIT;
+        strm = init;
+        if (lzma_stream_decoder(&strm, UINT64_MAX, LZMA_CONCATENATED) == LZMA_OK) {
+            is_initialized = true;
+        }
+        else {
+            has_error = true;
+        }
+    }
+
+    ~cdns_decompressor_xz()
+    {
+        if (is_initialized) {
+            lzma_end(&strm);
+        }
+    }
+
+protected:
+    size_t decompress(uint8_t* out, size_t asked) override
+    {
+        lzma_ret l_ret;
+        size_t n_out;
+
+        strm.next_in = in_buf + in_start;
+        strm.avail_in = in_end - in_start;
+        strm.next_out = out;
+        strm.avail_out = asked;
+
+        l_ret = lzma_code(&strm, (input_eof) ? LZMA_FINISH : LZMA_RUN);
+
+        n_out = asked - strm.avail_out;
+        in_start = in_end - strm.avail_in;
+
+        if (l_ret == LZMA_STREAM_END) {
+            stream_end = true;
+        }
+        else if (l_ret != LZMA_OK && l_ret != LZMA_BUF_ERROR) {
+            has_error = true;
+        }
+
+        return n_out;
+    }
+
+    lzma_stream strm;
+    bool is_initialized;
+};
+#endif
+
+#ifdef CDNS_HAVE_ZSTD
+class cdns_decompressor_zstd : public cdns_decompressor
+{
+public:
+    cdns_decompressor_zstd() :
+        frame_end(true)
+    {
+        dctx = ZSTD_createDStream();
+        if (dctx == NULL || ZSTD_isError(ZSTD_initDStream(dctx))) {
+            has_error = true;
+        }
+    }
+
+    ~cdns_decompressor_zstd()
+    {
+        if (dctx != NULL) {
+            (void)ZSTD_freeDStream(dctx);
+        }
+    }
+
+protected:
+    size_t decompress(uint8_t* out, size_t asked) override
+    {
+        size_t n_out = 0;
+
+        if (in_start >= in_end && input_eof && frame_end) {
+            /* Frames may be concatenated. The stream ends with the input, but only
+             * if the last frame is complete. */
+            stream_end = true;
+        }
+        else {
+            ZSTD_inBuffer z_in = { in_buf + in_start, in_end - in_start, 0 };
+            ZSTD_outBuffer z_out = { out, asked, 0 };
+            size_t z_ret = ZSTD_decompressStream(dctx, &z_out, &z_in);
+
+            if (ZSTD_isError(z_ret)) {
+                has_error = true;
+            }
+            else {
+                frame_end = (z_ret == 0);
+                n_out = z_out.pos;
+                in_start += z_in.pos;
+            }
+        }
+
+        return n_out;
+    }
+
+    ZSTD_DStream* dctx;
+    bool frame_end;
+};
+#endif
+
+cdns_decompressor* cdns_decompressor::create(cdns_compression_enum compression)
+{
+    cdns_decompressor* decompressor = NULL;
+
+    switch (compression) {
+#ifdef CDNS_HAVE_ZLIB
+    case cdns_compression_gzip:
+        decompressor = new cdns_decompressor_gzip();
+        break;
+#endif
+#ifdef CDNS_HAVE_LZMA
+    case cdns_compression_xz:
+        decompressor = new cdns_decompressor_xz();
+        break;
+#endif
+#ifdef CDNS_HAVE_ZSTD
+    case cdns_compression_zstd:
+        decompressor = new cdns_decompressor_zstd();
+        break;
+#endif
+    default:
+        break;
+    }
+
+    if (decompressor != NULL && decompressor->has_error) {
+        delete decompressor;
+        decompressor = NULL;
+    }
+
+    return decompressor;
+}
@@ -0,0 +1,74 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2019, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef CDNS_DECOMPRESS_H
+#define CDNS_DECOMPRESS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+typedef enum {
+    cdns_compression_none = 0,
+    cdns_compression_gzip,
+    cdns_compression_xz,
+    cdns_compression_zstd
+} cdns_compression_enum;
+
+/* The decompressor reads compressed data from a file and produces
+ * the decompressed content incrementally. Support for each compression
+ * format depends on the libraries found at build time: CDNS_HAVE_ZLIB,
+ * CDNS_HAVE_LZMA and CDNS_HAVE_ZSTD.
+ */
+class cdns_decompressor
+{
+public:
+    cdns_decompressor();
+    virtual ~cdns_decompressor();
+
+    /* Check the magic bytes at the beginning of the file */
+    static cdns_compression_enum detect(uint8_t const* in, size_t in_length);
+
+    /* Returns NULL if the compression format is not supported in this build */
+    static cdns_decompressor* create(cdns_compression_enum compression);
+
+    /* Provide the bytes already read from the file before detection */
+    bool set_input(uint8_t const* in, size_t in_length);
+
+    /* Fill the output buffer. Returns less than asked only at the end of the
+     * decompressed stream, or in case of error. */
+    size_t read(FILE* F, uint8_t* out, size_t asked);
+
+    bool has_error;
+
+protected:
+    /* Decompress from in_buf[in_start..in_end] to out, updating in_start,
+     * and setting stream_end when the end of the compressed data is found. */
+    virtual size_t decompress(uint8_t* out, size_t asked) = 0;
+
+    uint8_t* in_buf;
+    size_t in_buf_size;
+    size_t in_start;
+    size_t in_end;
+    bool input_eof;
+    bool stream_end;
+};
+
+#endif
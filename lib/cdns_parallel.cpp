@@ -0,0 +1,176 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2019, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "cbor.h"
+#include "cdns.h"
+#include "cdns_parallel.h"
+
+cdns_block_slot::cdns_block_slot() :
+    is_ready(false),
+    ret(false),
+    err(0)
+{
+}
+
+cdns_block_slot::~cdns_block_slot()
+{
+}
+
+cdns_block_pool::cdns_block_pool(cdns* cdns_ctx, int nb_threads) :
+    cdns_ctx(cdns_ctx),
+    nb_threads(nb_threads),
+    next_to_parse(0),
+    next_to_deliver(0),
+    is_running(false),
+    is_stopping(false)
+{
+    if (this->nb_threads <= 0) {
+        this->nb_threads = (int)std::thread::hardware_concurrency();
+        if (this->nb_threads <= 0) {
+            this->nb_threads = 1;
+        }
+    }
+
+    /* Two slots per thread, so workers do not wait for each delivery */
+    for (int i = 0; i < 2 * this->nb_threads; i++) {
+        slots.push_back(new cdns_block_slot());
+    }
+}
+
+cdns_block_pool::~cdns_block_pool()
+{
+    stop();
+    for (size_t i = 0; i < slots.size(); i++) {
+        delete slots[i];
+    }
+}
+
+void cdns_block_pool::start(size_t first_block)
+{
+    next_to_parse = first_block;
+    next_to_deliver = first_block;
+    is_stopping = false;
+    is_running = true;
+    for (size_t i = 0; i < slots.size(); i++) {
+        slots[i]->is_ready = false;
+    }
+    for (int i = 0; i < nb_threads; i++) {
+        threads.push_back(new std::thread(&cdns_block_pool::worker, this));
+    }
+}
+
+void cdns_block_pool::stop()
+{
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        is_stopping = true;
+    }
+    slot_free.notify_all();
+
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i]->join();
+        delete threads[i];
+    }
+    threads.clear();
+    is_running = false;
+}
+
+void cdns_block_pool::discard()
+{
+    if (is_running) {
+        stop();
+    }
+}
+
+void cdns_block_pool::worker()
+{
+    std::unique_lock<std::mutex> guard(lock);
+
+    while (!is_stopping && next_to_parse < cdns_ctx->block_index.size()) {
+        if (next_to_parse >= next_to_deliver + slots.size()) {
+            /* The queue is full */
+            slot_free.wait(guard);
+        }
+        else {
+            size_t block_number = next_to_parse++;
+            cdns_block_slot* slot = slots[block_number % slots.size()];
+            uint8_t const* in = cdns_ctx->buf + cdns_ctx->block_index[block_number].offset;
+            uint8_t const* in_max = in + cdns_ctx->block_index[block_number].length;
+            int err = 0;
+
+            guard.unlock();
+            in = slot->block.parse(in, in_max, &err, cdns_ctx);
+            if (in == NULL) {
+                fprintf(stderr, "\nBlock parsing error %d in block %d at position %lld.\n", err, (int)(block_number + 1),
+                    (unsigned long long)cdns_ctx->block_index[block_number].offset);
+            }
+            guard.lock();
+
+            slot->ret = (in != NULL);
+            slot->err = err;
+            slot->is_ready = true;
+            slot_ready.notify_all();
+        }
+    }
+}
+
+bool cdns_block_pool::get_block(size_t block_number, cdnsBlock* target, int* err)
+{
+    bool ret = false;
+
+    *err = 0;
+    if (block_number >= cdns_ctx->block_index.size()) {
+        *err = CBOR_END_OF_ARRAY;
+    }
+    else {
+        if (!is_running || block_number != next_to_deliver) {
+            stop();
+            start(block_number);
+        }
+
+        {
+            cdns_block_slot* slot = slots[block_number % slots.size()];
+            std::unique_lock<std::mutex> guard(lock);
+
+            while (!slot->is_ready) {
+                slot_ready.wait(guard);
+            }
+
+            ret = slot->ret;
+            *err = slot->err;
+            if (ret) {
+                /* The previous content of the target is recycled by the workers */
+                target->swap(&slot->block);
+                slot->is_ready = false;
+                next_to_deliver++;
+            }
+        }
+
+        if (ret) {
+            slot_free.notify_all();
+        }
+    }
+
+    return ret;
+}
@@ -0,0 +1,82 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2019, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef CDNS_PARALLEL_H
+#define CDNS_PARALLEL_H
+
+#include <stdint.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "cdns.h"
+
+/* A slot of the delivery queue. Block number n is parsed in slot n % queue size. */
+class cdns_block_slot
+{
+public:
+    cdns_block_slot();
+    ~cdns_block_slot();
+
+    cdnsBlock block;
+    bool is_ready;
+    bool ret;
+    int err;
+};
+
+/* The block pool decodes blocks in parallel on several worker threads, using
+ * the block index to find the block boundaries. The blocks are delivered in
+ * file order. The queue is bounded: a worker only starts parsing block n
+ * after block n - queue_size has been delivered.
+ */
+class cdns_block_pool
+{
+public:
+    cdns_block_pool(cdns* cdns_ctx, int nb_threads);
+    ~cdns_block_pool();
+
+    /* Wait for the specified block, then swap it into the target. If the block
+     * is not the next one in the queue, the workers restart from that block. */
+    bool get_block(size_t block_number, cdnsBlock* target, int* err);
+
+    /* Stop the workers and drop the blocks parsed ahead, for example when the
+     * projection changes. The workers restart at the next get_block. */
+    void discard();
+
+private:
+    void start(size_t first_block);
+    void stop();
+    void worker();
+
+    cdns* cdns_ctx;
+    int nb_threads;
+    std::vector<std::thread*> threads;
+    std::vector<cdns_block_slot*> slots;
+    std::mutex lock;
+    std::condition_variable slot_ready;
+    std::condition_variable slot_free;
+    size_t next_to_parse;
+    size_t next_to_deliver;
+    bool is_running;
+    bool is_stopping;
+};
+
+#endif
@@ -0,0 +1,190 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2026, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#if !defined(CBOR_NO_SIMD) && defined(__AVX2__)
+#include <immintrin.h>
+#define CBOR_SCAN_AVX2
+#define CBOR_SCAN_WIDTH 32
+#elif !defined(CBOR_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define CBOR_SCAN_SSE2
+#define CBOR_SCAN_WIDTH 16
+#endif
+#include "cbor.h"
+#include "CborScan.h"
+
+/* Skip one token: the header of a data item, and the content of a string.
+ * The content of arrays, maps and tagged items are the next tokens. */
+static uint8_t const* cbor_scan_token(uint8_t const* in, uint8_t const* in_max, int* err)
+{
+    int cbor_class = CBOR_CLASS(*in);
+    int64_t val;
+
+    in = cbor_get_number(in, in_max, &val);
+
+    if (in == NULL) {
+        *err = (int)val;
+    }
+    else if (val == CBOR_END_OF_ARRAY) {
+        if (cbor_class == CBOR_T_UINT || cbor_class == CBOR_T_NINT || cbor_class == CBOR_T_TAGGED) {
+            *err = CBOR_MALFORMED_VALUE;
+            in = NULL;
+        }
+    }
+    else if (cbor_class == CBOR_T_BYTES || cbor_class == CBOR_T_TEXT) {
+        if (val > in_max - in) {
+            *err = CBOR_MALFORMED_VALUE;
+            in = NULL;
+        }
+        else {
+            in += val;
+        }
+    }
+
+    return in;
+}
+
+static uint8_t const* cbor_scan_start(uint8_t const* in, uint8_t const* in_max, uint8_t const* base, int* err)
+{
+    *err = 0;
+    if (in == NULL || in < base || (uint64_t)(in_max - base) > 0xffffffffull) {
+        *err = CBOR_ILLEGAL_VALUE;
+        in = NULL;
+    }
+
+    return in;
+}
+
+uint8_t const* cbor_scan_scalar(uint8_t const* in, uint8_t const* in_max, uint8_t const* base,
+    uint32_t* offsets, size_t* nb_offsets, size_t offsets_max, int* err)
+{
+    size_t n = *nb_offsets;
+
+    in = cbor_scan_start(in, in_max, base, err);
+    while (in != NULL && in < in_max && n < offsets_max) {
+        offsets[n++] = (uint32_t)(in - base);
+        in = cbor_scan_token(in, in_max, err);
+    }
+    *nb_offsets = n;
+
+    return in;
+}
+
+#ifdef CBOR_SCAN_WIDTH
+/* Compute the length of the token that would start at each byte of the
+ * window, from the additional information: 1 below 24, then 2, 3, 5 or 9.
+ * The returned mask flags the bytes that need the scalar parser: headers of
+ * strings, which have content, and additional information above 27, which
+ * is either indefinite length or illegal. */
+static inline uint64_t cbor_scan_classify(uint8_t const* in, uint8_t* lengths)
+{
+#ifdef CBOR_SCAN_AVX2
+    __m256i b = _mm256_loadu_si256((__m256i const*)in);
+    __m256i ai = _mm256_and_si256(b, _mm256_set1_epi8(0x1f));
+    __m256i ge24 = _mm256_cmpgt_epi8(ai, _mm256_set1_epi8(23));
+    __m256i ge25 = _mm256_cmpgt_epi8(ai, _mm256_set1_epi8(24));
+    __m256i ge26 = _mm256_cmpgt_epi8(ai, _mm256_set1_epi8(25));
+    __m256i ge27 = _mm256_cmpgt_epi8(ai, _mm256_set1_epi8(26));
+    __m256i ge28 = _mm256_cmpgt_epi8(ai, _mm256_set1_epi8(27));
+    __m256i is_string = _mm256_cmpeq_epi8(_mm256_and_si256(b, _mm256_set1_epi8((char)0xc0)), _mm256_set1_epi8(0x40));
+    __m256i len = _mm256_sub_epi8(_mm256_set1_epi8(1), _mm256_add_epi8(ge24, ge25));
+
+    ge27 = _mm256_add_epi8(ge27, ge27);
+    len = _mm256_sub_epi8(len, _mm256_add_epi8(_mm256_add_epi8(ge26, ge26), _mm256_add_epi8(ge27, ge27)));
+    _mm256_storeu_si256((__m256i*)lengths, len);
+
+    return (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(is_string, ge28));
+#else
+    __m128i b = _mm_loadu_si128((__m128i const*)in);
+    __m128i ai = _mm_and_si128(b, _mm_set1_epi8(0x1f));
+    __m128i ge24 = _mm_cmpgt_epi8(ai, _mm_set1_epi8(23));
+    __m128i ge25 = _mm_cmpgt_epi8(ai, _mm_set1_epi8(24));
+    __m128i ge26 = _mm_cmpgt_epi8(ai, _mm_set1_epi8(25));
+    __m128i ge27 = _mm_cmpgt_epi8(ai, _mm_set1_epi8(26));
+    __m128i ge28 = _mm_cmpgt_epi8(ai, _mm_set1_epi8(27));
+    __m128i is_string = _mm_cmpeq_epi8(_mm_and_si128(b, _mm_set1_epi8((char)0xc0)), _mm_set1_epi8(0x40));
+    __m128i len = _mm_sub_epi8(_mm_set1_epi8(1), _mm_add_epi8(ge24, ge25));
+
+    ge27 = _mm_add_epi8(ge27, ge27);
+    len = _mm_sub_epi8(len, _mm_add_epi8(_mm_add_epi8(ge26, ge26), _mm_add_epi8(ge27, ge27)));
+    _mm_storeu_si128((__m128i*)lengths, len);
+
+    return (uint32_t)_mm_movemask_epi8(_mm_or_si128(is_string, ge28));
+#endif
+}
+#endif
+
+/* Structural scanner, in the spirit of the first stage of simdjson. The
+ * offset from base of each token -- item header, with the string content --
+ * is appended to offsets, in file order, without tracking the nesting. The
+ * scan stops at in_max, when offsets_max tokens are found, or at the first
+ * error, and returns the position of the next token.
+ *
+ * With SSE2 or AVX2, the token lengths are computed for 16 or 32 bytes at a
+ * time, so that the scan of the window only follows the lengths. Strings and
+ * indefinite length items are left to the scalar parser.
+ */
+uint8_t const* cbor_scan(uint8_t const* in, uint8_t const* in_max, uint8_t const* base,
+    uint32_t* offsets, size_t* nb_offsets, size_t offsets_max, int* err)
+{
+#ifdef CBOR_SCAN_WIDTH
+    size_t n = *nb_offsets;
+
+    in = cbor_scan_start(in, in_max, base, err);
+    while (in != NULL && in < in_max && n < offsets_max) {
+        /* The tokens starting in the window end at most 8 bytes after it */
+        if (in_max - in >= CBOR_SCAN_WIDTH + 8 && offsets_max - n >= CBOR_SCAN_WIDTH) {
+            uint8_t lengths[CBOR_SCAN_WIDTH];
+            uint64_t special = cbor_scan_classify(in, lengths);
+            uint8_t const* window = in;
+            uint32_t offset = (uint32_t)(in - base);
+            size_t pos = 0;
+
+            while (pos < CBOR_SCAN_WIDTH) {
+                offsets[n++] = offset + (uint32_t)pos;
+                if (((special >> pos) & 1) == 0) {
+                    pos += lengths[pos];
+                }
+                else if ((in = cbor_scan_token(window + pos, in_max, err)) == NULL) {
+                    break;
+                }
+                else {
+                    pos = in - window;
+                }
+            }
+            if (in != NULL) {
+                in = window + pos;
+            }
+        }
+        else {
+            offsets[n++] = (uint32_t)(in - base);
+            in = cbor_scan_token(in, in_max, err);
+        }
+    }
+    *nb_offsets = n;
+
+    return in;
+#else
+    return cbor_scan_scalar(in, in_max, base, offsets, nb_offsets, offsets_max, err);
+#endif
+}
@@ -0,0 +1,40 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2026, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef CBOR_SCAN_H
+#define CBOR_SCAN_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Experimental structural scanner, kept with the tests and the benchmark.
+ * It records the offsets of the tokens found from in to in_max, relative to
+ * base. The buffer shall be less than 4GB. cbor_scan uses SSE2 or AVX2 if
+ * available, unless CBOR_NO_SIMD is defined; cbor_scan_scalar is the
+ * reference. Skipping items with the offsets needs a second pass to follow
+ * the nesting, which is slower than cbor_skip, so the library does not use
+ * the scanner. */
+uint8_t const* cbor_scan(uint8_t const* in, uint8_t const* in_max, uint8_t const* base,
+    uint32_t* offsets, size_t* nb_offsets, size_t offsets_max, int* err);
+uint8_t const* cbor_scan_scalar(uint8_t const* in, uint8_t const* in_max, uint8_t const* base,
+    uint32_t* offsets, size_t* nb_offsets, size_t offsets_max, int* err);
+
+#endif /* CBOR_SCAN_H */
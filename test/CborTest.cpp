@@ -23,7 +23,11 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <inttypes.h>
+#include <utility>
+#include <vector>
 #include "cbor.h"
+#include "CborScan.h"
 #include "CborTest.h"
 
 
@@ -211,7 +215,7 @@ bool CborTest::DoOneDumpTest(uint8_t* in, size_t in_length, char const* expected
     char buf[1024];
     int err = 0;
     char* p_buf;
-    uint8_t* last;
+    uint8_t const* last;
 
     p_buf = &buf[0];
 
@@ -263,7 +267,7 @@ bool CborTest::DoIntTest()
     size_t l = 0;
     bool ret = true;
     int err = 0;
-    uint8_t* last;
+    uint8_t const* last;
     std::vector<int> v;
 
     buf[0] = 0x9F;
@@ -328,7 +332,7 @@ bool CborTest::DoIntTest()
                 break;
             }
 
-            uint8_t* last = cbor_array_parse<int>(buf, buf + ll, &v, &err);
+            uint8_t const* last = cbor_array_parse<int>(buf, buf + ll, &v, &err);
             if (err != 0) {
                 TEST_LOG("Got error %d\n", err);
                 ret = false;
@@ -387,13 +391,53 @@ static cbor_bytes_test_desc_t bytes_tests[] = {
 
 static size_t nb_bytes_tests = sizeof(bytes_tests) / sizeof(cbor_bytes_test_desc_t);
 
+bool CborTest::DoBytesViewTest()
+{
+    bool ret = true;
+    cbor_arena arena;
+
+    for (int copy_all = 0; ret && copy_all < 2; copy_all++) {
+        arena.reset();
+        arena.copy_all = (copy_all != 0);
+
+        for (size_t i = 0; ret && i < nb_bytes_tests; i++) {
+            cbor_bytes_view v;
+            int err = 0;
+            uint8_t const* in = bytes_tests[i].in;
+            uint8_t const* in_max = in + bytes_tests[i].in_length;
+            uint8_t const* last = v.parse(in, in_max, &err, &arena);
+            bool is_in_input = (v.v >= in && v.v < in_max);
+
+            if (last != in_max || err != 0) {
+                TEST_LOG("Got error %d\n", err);
+                ret = false;
+            }
+            else if (v.l != bytes_tests[i].expected_length ||
+                (v.l != 0 && memcmp(bytes_tests[i].expected, v.v, v.l) != 0)) {
+                TEST_LOG("Decoded %d bytes do not match\n", (int)v.l);
+                ret = false;
+            }
+            else if (v.l != 0 && is_in_input != (copy_all == 0 && in[0] != 0x5f)) {
+                /* Only definite-length strings point into the input */
+                TEST_LOG("Unexpected copy: %d\n", (is_in_input) ? 0 : 1);
+                ret = false;
+            }
+            if (!ret) {
+                TEST_LOG("Bytes view test %d, copy all %d fails\n", (int)i, copy_all);
+            }
+        }
+    }
+
+    return ret;
+}
+
 bool CborTest::DoBytesTest()
 {
     uint8_t buf[256];
     size_t l = 0;
     bool ret = true;
     int err = 0;
-    uint8_t* last;
+    uint8_t const* last;
     std::vector<cbor_bytes> v;
 
     buf[0] = 0x9F;
@@ -463,7 +507,7 @@ bool CborTest::DoBytesTest()
                 break;
             }
 
-            uint8_t* last = cbor_array_parse<cbor_bytes>(buf, buf + ll, &v, &err);
+            uint8_t const* last = cbor_array_parse<cbor_bytes>(buf, buf + ll, &v, &err);
             if (err != 0) {
                 TEST_LOG("Got error %d\n", err);
                 ret = false;
@@ -521,12 +565,12 @@ public:
     ~cbor_map_test()
     {}
 
-    uint8_t * parse(uint8_t* in, uint8_t const* in_max, int* err)
+    uint8_t const* parse(uint8_t const* in, uint8_t const* in_max, int* err)
     {
         return cbor_map_parse(in, in_max, this, err);
     }
 
-    uint8_t* parse_map_item(uint8_t* in, uint8_t const* in_max, int64_t index, int* err)
+    uint8_t const* parse_map_item(uint8_t const* in, uint8_t const* in_max, int64_t index, int* err)
     {
         switch (index) {
         case 0:
@@ -579,7 +623,7 @@ bool CborTest::DoMapTest()
     size_t l = 0;
     bool ret = true;
     int err = 0;
-    uint8_t* last;
+    uint8_t const* last;
     std::vector<cbor_map_test> v;
 
     buf[0] = 0x9F;
@@ -650,7 +694,7 @@ bool CborTest::DoMapTest()
                 break;
             }
 
-            uint8_t* last = cbor_array_parse<cbor_map_test>(buf, buf + ll, &v, &err);
+            uint8_t const* last = cbor_array_parse<cbor_map_test>(buf, buf + ll, &v, &err);
             if (err != 0) {
                 TEST_LOG("Got error %d\n", err);
                 ret = false;
@@ -687,6 +731,359 @@ bool CborTest::DoMapTest()
     return ret;
 }
 
+class cbor_fields_test
+{
+public:
+    cbor_fields_test() :
+        a(0),
+        b(0),
+        c(0),
+        d(0)
+    {}
+
+    ~cbor_fields_test()
+    {}
+
+    uint8_t const* parse(uint8_t const* in, uint8_t const* in_max, int* err)
+    {
+        return cbor_map_parse(in, in_max, this, err);
+    }
+
+    uint8_t const* parse_map_item(uint8_t const* in, uint8_t const* in_max, int64_t index, int* err);
+
+    int a;
+    int64_t b;
+    int c;
+    int d;
+};
+
+static uint8_t const* cbor_fields_test_parse_c(uint8_t const* in, uint8_t const* in_max, cbor_fields_test* v, int* err)
+{
+    in = cbor_parse_int(in, in_max, &v->c, 0, err);
+    v->c *= 2;
+    return in;
+}
+
+/* Key 7 is not at its rank in the table, and key 9 is absent */
+static constexpr cbor_field<cbor_fields_test> cbor_fields_test_fields[] = {
+    cbor_int_field(0, &cbor_fields_test::a, 1),
+    cbor_int64_field(1, &cbor_fields_test::b, 0),
+    cbor_custom_field(2, cbor_fields_test_parse_c),
+    cbor_int_field(7, &cbor_fields_test::d, 0)
+};
+
+uint8_t const* cbor_fields_test::parse_map_item(uint8_t const* in, uint8_t const* in_max, int64_t index, int* err)
+{
+    return cbor_fields_parse(in, in_max, this, index, cbor_fields_test_fields, CBOR_NB_FIELDS(cbor_fields_test_fields), err);
+}
+
+static uint8_t fields_test_in[] = {
+    0xa5, 0x00, 0x22, 0x01, 0x1b, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
+    0x02, 0x05, 0x07, 0x04, 0x09, 0x61, 0x78 };
+
+bool CborTest::DoFieldsTest()
+{
+    bool ret = true;
+    int err = 0;
+    cbor_fields_test v;
+    uint8_t const* in_max = fields_test_in + sizeof(fields_test_in);
+    uint8_t const* last = cbor_object_parse(fields_test_in, in_max, &v, &err);
+
+    if (last != in_max || err != 0) {
+        TEST_LOG("Fields test, got error %d\n", err);
+        ret = false;
+    }
+    else if (v.a != -3 || v.b != 0x100000000ll || v.c != 10 || v.d != 4) {
+        TEST_LOG("Fields test, decoded (%d,%lld,%d,%d)\n", v.a, (long long)v.b, v.c, v.d);
+        ret = false;
+    }
+
+    return ret;
+}
+
+/* Values of each size, decoded with the 8 byte load in the middle of the
+ * buffer and byte by byte at the end, then as a run. */
+bool CborTest::DoNumberTest()
+{
+    static const uint64_t values[] = { 0, 23, 24, 0xff, 0x100, 0xffff, 0x10000, 0xffffffffull,
+        0x100000000ull, 0x7fffffffffffffffull };
+    size_t const nb_values = sizeof(values) / sizeof(uint64_t);
+    std::vector<uint8_t> buf;
+    std::vector<int64_t> run(2 * nb_values + 1);
+    bool ret = true;
+
+    for (int is_negative = 0; is_negative < 2; is_negative++) {
+        for (size_t i = 0; i < nb_values; i++) {
+            uint8_t major = (uint8_t)(is_negative << 5);
+
+            if (values[i] < 24) {
+                buf.push_back(major | (uint8_t)values[i]);
+            }
+            else {
+                int l = (values[i] <= 0xff) ? 1 : (values[i] <= 0xffff) ? 2 : (values[i] <= 0xffffffffull) ? 4 : 8;
+
+                buf.push_back(major | (uint8_t)((l == 1) ? 24 : (l == 2) ? 25 : (l == 4) ? 26 : 27));
+                for (int j = l - 1; j >= 0; j--) {
+                    buf.push_back((uint8_t)(values[i] >> (8 * j)));
+                }
+            }
+        }
+    }
+
+    for (size_t start = 0, i = 0; ret && start < buf.size(); i++) {
+        int64_t val = 0;
+        uint64_t expected = values[i % nb_values];
+        uint8_t const* next = cbor_get_number(buf.data() + start, buf.data() + buf.size(), &val);
+
+        if (next == NULL || (uint64_t)val != expected) {
+            TEST_LOG("Number %d decoded as %" PRId64 "\n", (int)i, val);
+            ret = false;
+        }
+        else {
+            /* The same, ending exactly after the number */
+            int64_t val_end = 0;
+            uint8_t const* next_end = cbor_get_number(buf.data() + start, next, &val_end);
+
+            if (next_end != next || val_end != val ||
+                ((size_t)(next - buf.data()) > start + 1 &&
+                    cbor_get_number(buf.data() + start, next - 1, &val_end) != NULL)) {
+                TEST_LOG("Number %d fails at the end of the buffer\n", (int)i);
+                ret = false;
+            }
+            start = next - buf.data();
+        }
+    }
+
+    if (ret) {
+        size_t nb_parsed = 0;
+        int err = 0;
+        uint8_t const* next;
+
+        buf.push_back(0x40);
+        next = cbor_parse_int64_run(buf.data(), buf.data() + buf.size(), run.data(), run.size(), &nb_parsed, 1, &err);
+        for (size_t i = 0; ret && i < nb_parsed; i++) {
+            int64_t expected = (int64_t)values[i % nb_values];
+
+            ret = (run[i] == ((i < nb_values) ? expected : -1 - expected));
+        }
+        if (!ret || next != buf.data() + buf.size() - 1 || nb_parsed != 2 * nb_values || err != 0) {
+            TEST_LOG("Signed run parsed %d numbers, err %d\n", (int)nb_parsed, err);
+            ret = false;
+        }
+        else {
+            next = cbor_parse_int64_run(buf.data(), buf.data() + buf.size(), run.data(), run.size(), &nb_parsed, 0, &err);
+            if (next != buf.data() + buf.size() / 2 || nb_parsed != nb_values || err != 0) {
+                TEST_LOG("Unsigned run parsed %d numbers, err %d\n", (int)nb_parsed, err);
+                ret = false;
+            }
+        }
+    }
+
+    return ret;
+}
+
+/* Arrays of unsigned integers mixing runs of immediate values, runs of
+ * 1 byte arguments and larger values, decoded with cbor_array_parse as
+ * definite and indefinite arrays, then with errors. */
+bool CborTest::DoIntArrayTest()
+{
+    std::vector<int> values;
+    std::vector<uint8_t> items;
+    std::vector<uint8_t> buf;
+    std::vector<int> parsed;
+    uint32_t seed = 12345;
+    bool ret = true;
+    int err = 0;
+
+    while (values.size() < 2000) {
+        int kind;
+        int nb;
+
+        seed = seed * 1103515245 + 12345;
+        kind = (seed >> 16) % 4;
+        nb = 1 + (int)((seed >> 20) % 40);
+        for (int i = 0; i < nb; i++) {
+            int v;
+
+            seed = seed * 1103515245 + 12345;
+            v = (int)(seed >> 8);
+            v = (kind == 0) ? v % 24 : (kind == 1) ? 24 + v % 232 : (kind == 2) ? v % 256 : v & 0x7fffffff;
+            values.push_back(v);
+            if (v < 24) {
+                items.push_back((uint8_t)v);
+            }
+            else if (v < 0x100) {
+                items.push_back(0x18);
+                items.push_back((uint8_t)v);
+            }
+            else if (v < 0x10000) {
+                items.push_back(0x19);
+                items.push_back((uint8_t)(v >> 8));
+                items.push_back((uint8_t)v);
+            }
+            else {
+                items.push_back(0x1a);
+                for (int j = 3; j >= 0; j--) {
+                    items.push_back((uint8_t)(v >> (8 * j)));
+                }
+            }
+        }
+    }
+
+    for (int is_undef = 0; ret && is_undef < 2; is_undef++) {
+        uint8_t const* next;
+
+        buf.clear();
+        if (is_undef) {
+            buf.push_back(0x9f);
+        }
+        else {
+            buf.push_back(0x99);
+            buf.push_back((uint8_t)(values.size() >> 8));
+            buf.push_back((uint8_t)values.size());
+        }
+        buf.insert(buf.end(), items.begin(), items.end());
+        if (is_undef) {
+            buf.push_back(0xff);
+        }
+
+        /* Parse in place over a larger array */
+        parsed.assign(values.size() + 10, -1);
+        next = cbor_array_parse(buf.data(), buf.data() + buf.size(), &parsed, &err);
+        if (next != buf.data() + buf.size() || parsed != values) {
+            TEST_LOG("Int array (undef: %d) parsed %d values, err %d\n", is_undef, (int)parsed.size(), err);
+            ret = false;
+        }
+    }
+
+    if (ret) {
+        /* The run stops before the negative integer */
+        std::vector<int> run(values.size());
+        size_t nb_parsed = 0;
+        uint8_t const* next;
+
+        buf.assign(items.begin(), items.end());
+        buf.push_back(0x20);
+        next = cbor_parse_int_run(buf.data(), buf.data() + buf.size(), run.data(), run.size() + 1, &nb_parsed, &err);
+        if (next != buf.data() + buf.size() - 1 || nb_parsed != values.size() || run != values) {
+            TEST_LOG("Int run parsed %d values\n", (int)nb_parsed);
+            ret = false;
+        }
+    }
+
+    if (ret) {
+        static const uint8_t bad_array[] = { 0x83, 0x01, 0x20, 0x02 };
+        static const uint8_t bad_item[] = { 0x9f, 0x01, 0x02, 0x41, 0x00, 0xff };
+        static const uint8_t no_end[] = { 0x9f, 0x01, 0x18, 0x20, 0x03 };
+        static const uint8_t truncated[] = { 0x82, 0x01, 0x19, 0x01 };
+        uint8_t const* bad[] = { bad_array, bad_item, no_end, truncated };
+        size_t bad_length[] = { sizeof(bad_array), sizeof(bad_item), sizeof(no_end), sizeof(truncated) };
+
+        for (size_t i = 0; ret && i < sizeof(bad) / sizeof(uint8_t const*); i++) {
+            err = 0;
+            if (cbor_array_parse(bad[i], bad[i] + bad_length[i], &parsed, &err) != NULL || err == 0) {
+                TEST_LOG("Malformed int array %d is accepted\n", (int)i);
+                ret = false;
+            }
+        }
+    }
+
+    return ret;
+}
+
+/* The length header of an array only sizes the vector up to
+ * CBOR_ARRAY_PRESIZE_MAX. Longer arrays grow as their elements are parsed,
+ * and a header larger than the actual array does not allocate for it. */
+bool CborTest::DoArrayHeaderTest()
+{
+    size_t const nb_items = 4 * CBOR_ARRAY_PRESIZE_MAX;
+    std::vector<uint8_t> buf(5 + nb_items, 0x40);
+    std::vector<cbor_bytes> v;
+    uint8_t const* next;
+    bool ret = true;
+    int err = 0;
+
+    buf[0] = 0x9a;
+    for (int i = 0; i < 4; i++) {
+        buf[1 + i] = (uint8_t)(nb_items >> (8 * (3 - i)));
+    }
+
+    next = cbor_array_parse(buf.data(), buf.data() + buf.size(), &v, &err);
+    if (next != buf.data() + buf.size() || v.size() != nb_items) {
+        TEST_LOG("Array of %d items parsed %d, err %d\n", (int)nb_items, (int)v.size(), err);
+        ret = false;
+    }
+
+    if (ret) {
+        std::vector<cbor_bytes> w;
+
+        /* Only 3 items, followed by an integer */
+        buf[8] = 0x00;
+        err = 0;
+        next = cbor_array_parse(buf.data(), buf.data() + buf.size(), &w, &err);
+        if (next != NULL || err == 0 || w.capacity() > CBOR_ARRAY_PRESIZE_MAX) {
+            TEST_LOG("Truncated array is accepted or sized from the header, capacity %d\n", (int)w.capacity());
+            ret = false;
+        }
+    }
+
+    return ret;
+}
+
+/* Moves transfer the buffers, so that vectors of strings can grow
+ * without copying them. */
+bool CborTest::DoMoveTest()
+{
+    bool ret = true;
+    std::vector<cbor_bytes> bytes(1);
+    std::vector<cbor_text> texts(1);
+    uint8_t const* first_bytes;
+    char const* first_text;
+
+    bytes[0].v = new uint8_t[4];
+    memcpy(bytes[0].v, "abcd", 4);
+    bytes[0].l = 4;
+    bytes[0].allocated = 4;
+    texts[0].v = new char[5];
+    memcpy(texts[0].v, "abcd", 5);
+    texts[0].l = 4;
+    texts[0].allocated = 5;
+    first_bytes = bytes[0].v;
+    first_text = texts[0].v;
+
+    for (int i = 0; i < 100; i++) {
+        bytes.push_back(cbor_bytes());
+        texts.push_back(cbor_text());
+    }
+
+    if (bytes[0].v != first_bytes || bytes[0].l != 4 || texts[0].v != first_text || texts[0].l != 4) {
+        TEST_LOG("Vector growth copied the strings\n");
+        ret = false;
+    }
+    else {
+        cbor_bytes b(std::move(bytes[0]));
+        cbor_text t;
+
+        t = std::move(texts[0]);
+        if (b.v != first_bytes || bytes[0].v != NULL || bytes[0].l != 0 || bytes[0].allocated != 0 ||
+            t.v != first_text || texts[0].v != NULL || texts[0].l != 0 || texts[0].allocated != 0) {
+            TEST_LOG("Move did not transfer the buffer\n");
+            ret = false;
+        }
+        else {
+            /* The moved from objects can be reused */
+            bytes[0] = b;
+            texts[0] = t;
+            if (bytes[0].v == b.v || memcmp(bytes[0].v, "abcd", 4) != 0 || strcmp(texts[0].v, "abcd") != 0) {
+                TEST_LOG("Copy after move failed\n");
+                ret = false;
+            }
+        }
+    }
+
+    return ret;
+}
+
 bool CborTest::DoTest()
 {
     bool ret = true;
@@ -716,6 +1113,13 @@ bool CborTest::DoTest()
         }
     }
 
+    if (ret) {
+        ret = DoBytesViewTest();
+        if (ret) {
+            TEST_LOG("All bytes view tests pass\n");
+        }
+    }
+
     if (ret) {
         ret = DoMapTest();
         if (ret) {
@@ -723,6 +1127,41 @@ bool CborTest::DoTest()
         }
     }
 
+    if (ret) {
+        ret = DoFieldsTest();
+        if (ret) {
+            TEST_LOG("All field descriptor tests pass\n");
+        }
+    }
+
+    if (ret) {
+        ret = DoNumberTest();
+        if (ret) {
+            TEST_LOG("All number decoding tests pass\n");
+        }
+    }
+
+    if (ret) {
+        ret = DoIntArrayTest();
+        if (ret) {
+            TEST_LOG("All int array tests pass\n");
+        }
+    }
+
+    if (ret) {
+        ret = DoArrayHeaderTest();
+        if (ret) {
+            TEST_LOG("All array header tests pass\n");
+        }
+    }
+
+    if (ret) {
+        ret = DoMoveTest();
+        if (ret) {
+            TEST_LOG("All move tests pass\n");
+        }
+    }
+
     return ret;
 }
 
@@ -739,7 +1178,7 @@ bool CborSkipTest::DoOneTest(uint8_t* in, size_t in_length)
 {
     bool ret = true;
     int err = 0;
-    uint8_t* last;
+    uint8_t const* last;
 
     last = cbor_skip(in, in + in_length, &err);
 
@@ -770,9 +1209,238 @@ bool CborSkipTest::DoTest()
         }
     }
 
+    if (ret) {
+        ret = DoDepthTest() && DoIntRunTest();
+    }
+
     if (ret) {
         TEST_LOG("All CBOR skip tests pass\n");
     }
 
     return ret;
 }
+
+/* Nested arrays, beyond the default depth limit: [[[...[0]...]]] */
+bool CborSkipTest::DoDepthTest()
+{
+    bool ret = true;
+    int const nb_levels = CBOR_MAX_DEPTH + 20;
+    std::vector<uint8_t> nested((size_t)nb_levels, 0x81);
+    uint8_t const* in_max;
+    uint8_t const* last;
+    int err = 0;
+
+    nested.push_back(0x00);
+    in_max = nested.data() + nested.size();
+
+    last = cbor_skip(nested.data(), in_max, &err);
+    if (last != NULL || err != CBOR_DEPTH_EXCEEDED) {
+        TEST_LOG("Skipping %d levels, expected error %d, got %d\n", nb_levels, CBOR_DEPTH_EXCEEDED, err);
+        ret = false;
+    }
+    else {
+        err = 0;
+        last = cbor_skip_depth(nested.data(), in_max, nb_levels, &err);
+        if (last != in_max || err != 0) {
+            TEST_LOG("Skipping %d levels with a larger limit fails, err %d\n", nb_levels, err);
+            ret = false;
+        }
+    }
+
+    if (ret) {
+        /* The stack grows with the nesting, not with the limit */
+        err = 0;
+        last = cbor_skip_depth(nested.data(), in_max, 0x7fffffff, &err);
+        if (last != in_max || err != 0) {
+            TEST_LOG("Skipping %d levels with the largest limit fails, err %d\n", nb_levels, err);
+            ret = false;
+        }
+    }
+
+    if (ret) {
+        /* Truncated at the deepest level */
+        err = 0;
+        last = cbor_skip_depth(nested.data(), in_max - 1, nb_levels, &err);
+        if (last != NULL || err != CBOR_MALFORMED_VALUE) {
+            TEST_LOG("Truncated nesting, expected error %d, got %d\n", CBOR_MALFORMED_VALUE, err);
+            ret = false;
+        }
+    }
+
+    return ret;
+}
+
+/* Long arrays of integers, mostly on a single byte, as in the index lists */
+bool CborSkipTest::DoIntRunTest()
+{
+    bool ret = true;
+
+    for (int is_undef = 0; ret && is_undef < 2; is_undef++) {
+        std::vector<uint8_t> v;
+        int const nb_items = 1000;
+        int err = 0;
+        uint8_t const* last;
+
+        v.push_back(0x82); /* [[ints], 0] */
+        if (is_undef) {
+            v.push_back(0x9f);
+        }
+        else {
+            v.push_back(0x99);
+            v.push_back((uint8_t)(nb_items >> 8));
+            v.push_back((uint8_t)(nb_items & 0xff));
+        }
+        for (int i = 0; i < nb_items; i++) {
+            if (i % 97 == 0) {
+                v.push_back(0x19);
+                v.push_back(0x12);
+                v.push_back(0x34);
+            }
+            else {
+                v.push_back((uint8_t)(((i % 11) == 0) ? 0x20 + i % 24 : i % 24));
+            }
+        }
+        if (is_undef) {
+            v.push_back(0xff);
+        }
+        v.push_back(0x00);
+
+        last = cbor_skip(v.data(), v.data() + v.size(), &err);
+        if (last != v.data() + v.size() || err != 0) {
+            TEST_LOG("Skip of %s integer array fails, err %d\n", (is_undef) ? "indefinite" : "definite", err);
+            ret = false;
+        }
+        else {
+            /* The last item of the outer array is missing */
+            last = cbor_skip(v.data(), v.data() + v.size() - 1, &err);
+            if (last != NULL || err != CBOR_MALFORMED_VALUE) {
+                TEST_LOG("Skip of truncated %s integer array, err %d\n", (is_undef) ? "indefinite" : "definite", err);
+                ret = false;
+            }
+        }
+    }
+
+    return ret;
+}
+
+CborScanTest::CborScanTest()
+{
+}
+
+CborScanTest::~CborScanTest()
+{
+}
+
+/* [1, 100, "ab", [_ -1, true], h'', {0: 1}], with tokens at the expected offsets */
+static uint8_t scan_test_in[] = { 0x86, 0x01, 0x18, 0x64, 0x62, 'a', 'b', 0x9f, 0x20, 0xf5, 0xff, 0x40, 0xa1, 0x00, 0x01 };
+static uint32_t scan_test_offsets[] = { 0, 1, 2, 4, 7, 8, 9, 10, 11, 12, 13, 14 };
+
+/* The vector scanner shall find the same tokens as the scalar one, also when
+ * the scan is resumed after the offsets array is full. */
+bool CborScanTest::DoOneTest(uint8_t const* in, size_t in_length, size_t offsets_max)
+{
+    bool ret = true;
+    std::vector<uint32_t> ref(in_length + 1);
+    std::vector<uint32_t> found(in_length + 1);
+    size_t nb_ref = 0;
+    size_t nb_found = 0;
+    int err_ref = 0;
+    int err = 0;
+    uint8_t const* last_ref = cbor_scan_scalar(in, in + in_length, in, ref.data(), &nb_ref, ref.size(), &err_ref);
+    uint8_t const* last = in;
+
+    while (last != NULL && last < in + in_length) {
+        size_t nb_max = nb_found + offsets_max;
+
+        if (nb_max > found.size()) {
+            nb_max = found.size();
+        }
+        last = cbor_scan(last, in + in_length, in, found.data(), &nb_found, nb_max, &err);
+    }
+
+    if (last != last_ref || err != err_ref || nb_found != nb_ref) {
+        ret = false;
+    }
+    for (size_t i = 0; ret && i < nb_ref; i++) {
+        ret = (found[i] == ref[i]);
+    }
+
+    return ret;
+}
+
+bool CborScanTest::DoTest()
+{
+    bool ret = true;
+    uint32_t offsets[32];
+    size_t nb_offsets = 0;
+    int err = 0;
+    uint8_t const* in_max = scan_test_in + sizeof(scan_test_in);
+    uint8_t const* last = cbor_scan(scan_test_in, in_max, scan_test_in, offsets, &nb_offsets, 32, &err);
+
+    if (last != in_max || err != 0 || nb_offsets != sizeof(scan_test_offsets) / sizeof(uint32_t) ||
+        memcmp(offsets, scan_test_offsets, sizeof(scan_test_offsets)) != 0) {
+        TEST_LOG("CBOR scan finds %d tokens, err %d\n", (int)nb_offsets, err);
+        ret = false;
+    }
+
+    for (size_t i = 0; ret && i < nb_cbor_tests; i++) {
+        if (!DoOneTest(cbor_tests[i].in, cbor_tests[i].in_length, 64)) {
+            TEST_LOG("CBOR scan test #%d fails\n", (int)i);
+            ret = false;
+        }
+    }
+
+    if (ret) {
+        /* Long runs of small integers, broken by larger values, strings and
+         * indefinite length arrays, then a truncated string at the end. */
+        std::vector<uint8_t> big;
+
+        for (int i = 0; i < 2000; i++) {
+            if (i % 37 == 0) {
+                big.push_back(0x19);
+                big.push_back(0x01);
+                big.push_back((uint8_t)i);
+            }
+            else if (i % 41 == 0) {
+                big.push_back(0x3b);
+                for (int j = 0; j < 8; j++) {
+                    big.push_back((uint8_t)(i + j));
+                }
+            }
+            else if (i % 29 == 0) {
+                big.push_back(0x9f);
+            }
+            else if (i % 53 == 0) {
+                big.push_back(0x63);
+                big.push_back('a');
+                big.push_back('b');
+                big.push_back('c');
+            }
+            else {
+                big.push_back((uint8_t)(i % 24));
+            }
+        }
+
+        for (size_t offsets_max = 1; ret && offsets_max < 100; offsets_max += 7) {
+            if (!DoOneTest(big.data(), big.size(), offsets_max)) {
+                TEST_LOG("CBOR scan of %d bytes fails, offsets_max %d\n", (int)big.size(), (int)offsets_max);
+                ret = false;
+            }
+        }
+
+        if (ret) {
+            big.push_back(0x65);
+            big.push_back('x');
+            ret = DoOneTest(big.data(), big.size(), 1000);
+            if (!ret) {
+                TEST_LOG("CBOR scan of truncated string fails\n");
+            }
+        }
+    }
+
+    if (ret) {
+        TEST_LOG("All CBOR scan tests pass\n");
+    }
+
+    return ret;
+}
@@ -36,7 +36,13 @@ private:
     bool DoOneDumpTest(uint8_t* in, size_t in_length, char const* expected);
     bool DoIntTest();
     bool DoBytesTest();
+    bool DoBytesViewTest();
     bool DoMapTest();
+    bool DoFieldsTest();
+    bool DoNumberTest();
+    bool DoIntArrayTest();
+    bool DoArrayHeaderTest();
+    bool DoMoveTest();
 };
 
 class CborSkipTest : public cdns_test_class
@@ -48,6 +54,19 @@ public:
     bool DoTest() override;
 private:
     static bool DoOneTest(uint8_t* in, size_t in_length);
+    static bool DoDepthTest();
+    static bool DoIntRunTest();
+};
+
+class CborScanTest : public cdns_test_class
+{
+public:
+    CborScanTest();
+    ~CborScanTest();
+
+    bool DoTest() override;
+private:
+    static bool DoOneTest(uint8_t const* in, size_t in_length, size_t offsets_max);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,455 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2017, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/* Micro benchmarks of the CBOR primitives and of the block parser, on a
+ * file loaded in memory.
+ * Usage: cdnsbench [file [iterations]]
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <chrono>
+#include <vector>
+#include "cbor.h"
+#include "cdns.h"
+#include "CborScan.h"
+
+static double bench_elapsed(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void bench_report(char const* name, size_t bytes, double best, size_t nb_items)
+{
+    printf("%-12s %8.3f ms %8.3f GB/s %10zu items\n", name, best * 1000.0,
+        (best > 0) ? ((double)bytes / best / 1e9) : 0.0, nb_items);
+}
+
+static bool bench_load(char const* file_name, std::vector<uint8_t>* buf)
+{
+    bool ret = false;
+    FILE* F = fopen(file_name, "rb");
+
+    if (F != NULL) {
+        uint8_t chunk[0x10000];
+        size_t n;
+
+        while ((n = fread(chunk, 1, sizeof(chunk), F)) > 0) {
+            buf->insert(buf->end(), chunk, chunk + n);
+        }
+        ret = (ferror(F) == 0 && buf->size() > 0);
+        fclose(F);
+    }
+
+    return ret;
+}
+
+/* The byte by byte decoder used before the 8 byte loads, as the reference */
+static uint8_t const* bench_get_number_bytewise(uint8_t const* in, uint8_t const* in_max, int64_t* val)
+{
+    int64_t v = (*in++) & 0x1F;
+
+    if (v == 0x1F) {
+        v = CBOR_END_OF_ARRAY;
+    }
+    else if (v > 27) {
+        v = CBOR_ILLEGAL_VALUE;
+        in = NULL;
+    }
+    else if (v >= 24) {
+        size_t l = ((size_t)1) << (v - 24);
+        if (in + l > in_max) {
+            v = CBOR_MALFORMED_VALUE;
+            in = NULL;
+        }
+        else {
+            v = 0;
+            while (l > 0) {
+                v <<= 8;
+                v |= (*in++);
+                l--;
+            }
+        }
+    }
+
+    *val = v;
+    return in;
+}
+
+typedef uint8_t const* (*bench_number_fn)(uint8_t const* in, uint8_t const* in_max, int64_t* val);
+
+/* Decode the integers at the given offsets, return the best time */
+static double bench_numbers(bench_number_fn get_number, std::vector<uint8_t> const& buf, std::vector<uint32_t> const& ints,
+    int nb_iterations, int64_t* sum)
+{
+    double best = 1e9;
+
+    for (int i = 0; i < nb_iterations; i++) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        uint8_t const* in_max = buf.data() + buf.size();
+        int64_t s = 0;
+        double t;
+
+        for (size_t j = 0; j < ints.size(); j++) {
+            int64_t val;
+
+            (void)get_number(buf.data() + ints[j], in_max, &val);
+            s += val;
+        }
+        t = bench_elapsed(start);
+        if (t < best) {
+            best = t;
+        }
+        *sum = s;
+    }
+
+    return best;
+}
+
+/* Decode a buffer that only contains integers, one at a time or as runs */
+static double bench_number_runs(std::vector<uint8_t> const& buf, size_t nb_ints, int use_run, int nb_iterations, int64_t* sum)
+{
+    double best = 1e9;
+    std::vector<int64_t> v(nb_ints);
+
+    for (int i = 0; i < nb_iterations; i++) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        uint8_t const* in = buf.data();
+        uint8_t const* in_max = buf.data() + buf.size();
+        int64_t s = 0;
+        size_t n = 0;
+        int err = 0;
+        double t;
+
+        if (use_run) {
+            in = cbor_parse_int64_run(in, in_max, v.data(), v.size(), &n, 1, &err);
+        }
+        else {
+            while (in != NULL && in < in_max) {
+                in = cbor_parse_int64(in, in_max, &v[n++], 1, &err);
+            }
+        }
+        for (size_t j = 0; j < n; j++) {
+            s += v[j];
+        }
+        t = bench_elapsed(start);
+        if (t < best) {
+            best = t;
+        }
+        *sum = s;
+    }
+
+    return best;
+}
+
+/* Decode a buffer of unsigned integers one at a time, as cbor_array_parse
+ * did, or with the SIMD run decoder */
+static double bench_int_runs(std::vector<uint8_t> const& buf, size_t nb_ints, int use_run, int nb_iterations, int64_t* sum)
+{
+    double best = 1e9;
+    std::vector<int> v(nb_ints);
+
+    for (int i = 0; i < nb_iterations; i++) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        uint8_t const* in = buf.data();
+        uint8_t const* in_max = buf.data() + buf.size();
+        int64_t s = 0;
+        size_t n = 0;
+        int err = 0;
+        double t;
+
+        if (use_run) {
+            in = cbor_parse_int_run(in, in_max, v.data(), v.size(), &n, &err);
+        }
+        else {
+            while (in != NULL && in < in_max) {
+                in = cbor_parse_int(in, in_max, &v[n++], 0, &err);
+            }
+        }
+        for (size_t j = 0; j < n; j++) {
+            s += v[j];
+        }
+        t = bench_elapsed(start);
+        if (t < best) {
+            best = t;
+        }
+        *sum = s;
+    }
+
+    return best;
+}
+
+typedef uint8_t const* (*bench_scan_fn)(uint8_t const* in, uint8_t const* in_max, uint8_t const* base,
+    uint32_t* offsets, size_t* nb_offsets, size_t offsets_max, int* err);
+
+static double bench_scan(bench_scan_fn scan, std::vector<uint8_t> const& buf, std::vector<uint32_t>* offsets,
+    int nb_iterations, size_t* nb_items, int* err)
+{
+    double best = 1e9;
+
+    for (int i = 0; i < nb_iterations; i++) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        size_t n = 0;
+        double t;
+
+        (void)scan(buf.data(), buf.data() + buf.size(), buf.data(), offsets->data(), &n, offsets->size(), err);
+        t = bench_elapsed(start);
+        if (t < best) {
+            best = t;
+        }
+        *nb_items = n;
+    }
+
+    return best;
+}
+
+/* The queries are resolved and summed, either from the block (mode 0), in
+ * the visitor callbacks (mode 1), or from the query iterator (mode 2). */
+static int64_t bench_sum_query(cdns_resolved_query const* resolved)
+{
+    return resolved->query->query_size + ((resolved->query_name != NULL) ? (int64_t)resolved->query_name->l : 0);
+}
+
+class bench_visitor : public cdns_visitor {
+public:
+    bench_visitor() : sum(0), nb_queries(0) {}
+
+    void on_queries(cdnsBlock* block, cdns_resolved_query const* queries, size_t nb) override
+    {
+        (void)block;
+        for (size_t i = 0; i < nb; i++) {
+            sum += bench_sum_query(&queries[i]);
+        }
+        nb_queries += nb;
+    }
+
+    int64_t sum;
+    size_t nb_queries;
+};
+
+static double bench_blocks(std::vector<uint8_t> const& buf, int mode, int nb_iterations, size_t* nb_queries, int64_t* sum)
+{
+    double best = 1e9;
+
+    for (int i = 0; i < nb_iterations; i++) {
+        cdns cdns_ctx;
+        bench_visitor visitor;
+        int err = 0;
+        std::chrono::steady_clock::time_point start;
+        double t;
+
+        if (!cdns_ctx.open_buffer(buf.data(), buf.size())) {
+            break;
+        }
+        start = std::chrono::steady_clock::now();
+        if (mode == 2) {
+            cdns_query_iterator iterator(&cdns_ctx);
+            cdns_flat_query flat;
+
+            while (iterator.next(&flat, &err)) {
+                visitor.sum += flat.query_size + (int64_t)flat.query_name.l;
+                visitor.nb_queries++;
+            }
+        }
+        else if (mode == 1) {
+            while (cdns_ctx.visit_block(&visitor, &err)) {
+            }
+        }
+        else {
+            while (cdns_ctx.open_block(&err)) {
+                for (size_t q = 0; q < cdns_ctx.block.queries.size(); q++) {
+                    cdns_resolved_query resolved;
+
+                    resolved.resolve(&cdns_ctx.block, &cdns_ctx.block.queries[q]);
+                    visitor.sum += bench_sum_query(&resolved);
+                    visitor.nb_queries++;
+                }
+            }
+        }
+        t = bench_elapsed(start);
+        if (t < best) {
+            best = t;
+        }
+        *nb_queries = visitor.nb_queries;
+        *sum = visitor.sum;
+    }
+
+    return best;
+}
+
+int main(int argc, char** argv)
+{
+#ifdef _WINDOWS
+    char const* file_name = "..\\test\\data\\cdns_test_file.cdns";
+#else
+    char const* file_name = "test/data/cdns_test_file.cdns";
+#endif
+    int nb_iterations = 200;
+    std::vector<uint8_t> buf;
+    int ret = 0;
+
+    if (argc > 1) {
+        file_name = argv[1];
+    }
+    if (argc > 2) {
+        nb_iterations = atoi(argv[2]);
+    }
+
+    if (nb_iterations <= 0 || !bench_load(file_name, &buf)) {
+        fprintf(stderr, "Usage: %s [file [iterations]]\nCannot load %s\n", argv[0], file_name);
+        ret = -1;
+    }
+    else {
+        std::vector<uint32_t> offsets(buf.size() + 1);
+        size_t nb_scalar = 0;
+        size_t nb_vector = 0;
+        int err_scalar = 0;
+        int err_vector = 0;
+        double best;
+
+        printf("%s: %zu bytes, best of %d runs\n", file_name, buf.size(), nb_iterations);
+
+        best = bench_scan(cbor_scan_scalar, buf, &offsets, nb_iterations, &nb_scalar, &err_scalar);
+        bench_report("scan_scalar", buf.size(), best, nb_scalar);
+        best = bench_scan(cbor_scan, buf, &offsets, nb_iterations, &nb_vector, &err_vector);
+        bench_report("scan", buf.size(), best, nb_vector);
+
+        best = 1e9;
+        for (int i = 0; i < nb_iterations; i++) {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            int err = 0;
+            uint8_t const* in = buf.data();
+            double t;
+
+            while (in != NULL && in < buf.data() + buf.size()) {
+                in = cbor_skip(in, buf.data() + buf.size(), &err);
+            }
+            t = bench_elapsed(start);
+            if (t < best) {
+                best = t;
+            }
+        }
+        bench_report("skip", buf.size(), best, 0);
+
+        /* Integer decoding, on the integers found by the scan, then on an
+         * array of integers of all sizes. */
+        {
+            std::vector<uint32_t> ints;
+            std::vector<uint8_t> int_buf;
+            size_t nb_ints = 0x100000;
+            int64_t sum_ref = 0;
+            int64_t sum = 0;
+
+            for (size_t i = 0; i < nb_vector; i++) {
+                uint8_t h = buf[offsets[i]];
+
+                if (h < 0x40 && (h & 0x1f) < 28) {
+                    ints.push_back(offsets[i]);
+                }
+            }
+            best = bench_numbers(bench_get_number_bytewise, buf, ints, nb_iterations, &sum_ref);
+            bench_report("num_bytes", buf.size(), best, ints.size());
+            best = bench_numbers(cbor_get_number, buf, ints, nb_iterations, &sum);
+            bench_report("num_load", buf.size(), best, ints.size());
+            if (sum != sum_ref) {
+                fprintf(stderr, "Number decoders differ\n");
+                ret = -1;
+            }
+
+            srand(1);
+            for (size_t i = 0; i < nb_ints; i++) {
+                int l = rand() % 5;
+                uint8_t major = (uint8_t)((rand() & 1) << 5);
+
+                int_buf.push_back((uint8_t)(major | ((l == 0) ? (rand() % 24) : 23 + l)));
+                for (int j = (l == 0) ? 0 : (1 << (l - 1)); j > 0; j--) {
+                    int_buf.push_back((uint8_t)((j == 8 && l == 4) ? (rand() & 0x7f) : rand()));
+                }
+            }
+            best = bench_number_runs(int_buf, nb_ints, 0, nb_iterations / 10 + 1, &sum_ref);
+            bench_report("int64", int_buf.size(), best, nb_ints);
+            best = bench_number_runs(int_buf, nb_ints, 1, nb_iterations / 10 + 1, &sum);
+            bench_report("int64_run", int_buf.size(), best, nb_ints);
+            if (sum != sum_ref) {
+                fprintf(stderr, "Integer runs differ\n");
+                ret = -1;
+            }
+
+            /* Table indexes: mostly immediate values and 1 byte arguments */
+            int_buf.clear();
+            for (size_t i = 0; i < nb_ints; i++) {
+                int r = rand() % 10;
+
+                if (r < 3) {
+                    int_buf.push_back((uint8_t)(rand() % 24));
+                }
+                else if (r < 9) {
+                    int_buf.push_back(0x18);
+                    int_buf.push_back((uint8_t)(24 + rand() % 232));
+                }
+                else {
+                    int_buf.push_back(0x19);
+                    int_buf.push_back((uint8_t)(1 + rand() % 255));
+                    int_buf.push_back((uint8_t)rand());
+                }
+            }
+            best = bench_int_runs(int_buf, nb_ints, 0, nb_iterations / 10 + 1, &sum_ref);
+            bench_report("int", int_buf.size(), best, nb_ints);
+            best = bench_int_runs(int_buf, nb_ints, 1, nb_iterations / 10 + 1, &sum);
+            bench_report("int_run", int_buf.size(), best, nb_ints);
+            if (sum != sum_ref) {
+                fprintf(stderr, "Integer index runs differ\n");
+                ret = -1;
+            }
+        }
+
+        /* Block parsing, storing the queries or passing them to a visitor */
+        {
+            size_t nb_queries = 0;
+            int64_t sum_ref = 0;
+            int64_t sum = 0;
+
+            best = bench_blocks(buf, 0, nb_iterations / 10 + 1, &nb_queries, &sum_ref);
+            bench_report("blocks", buf.size(), best, nb_queries);
+            best = bench_blocks(buf, 1, nb_iterations / 10 + 1, &nb_queries, &sum);
+            bench_report("visit", buf.size(), best, nb_queries);
+            if (sum != sum_ref) {
+                fprintf(stderr, "Visitor and block queries differ\n");
+                ret = -1;
+            }
+            best = bench_blocks(buf, 2, nb_iterations / 10 + 1, &nb_queries, &sum);
+            bench_report("iterate", buf.size(), best, nb_queries);
+            if (sum != sum_ref) {
+                fprintf(stderr, "Iterator and block queries differ\n");
+                ret = -1;
+            }
+        }
+
+        if (nb_scalar != nb_vector || err_scalar != err_vector) {
+            fprintf(stderr, "Scanners differ: %zu tokens, err %d vs %zu tokens, err %d\n",
+                nb_scalar, err_scalar, nb_vector, err_vector);
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
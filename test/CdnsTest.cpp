@@ -32,6 +32,8 @@
 #ifndef _WINDOWS64
 static char const* cbor_in = "..\\test\\data\\cdns_test_file.cbor";
 static char const* cdns_in = "..\\test\\data\\cdns_test_file.cdns";
+static char const* cdns_gz_in = "..\\test\\data\\cdns_test_file.cdns.gz";
+static char const* cdns_xz_in = "..\\test\\data\\cdns_test_file.cdns.xz";
 static char const* gold_in = "..\\test\\data\\gold.cbor";
 static char const* text_ref = "..\\test\\data\\cdns_test_ref.txt";
 static char const* text_ref_rfc = "..\\test\\data\\cdns_test_ref_rfc.txt";
@@ -39,6 +41,8 @@ static char const* text_ref_gold = "..\\test\\data\\cdns_test_ref_gold.txt";
 #else
 static char const* cbor_in = "..\\..\\test\\data\\cdns_test_file.cbor";
 static char const* cdns_in = "..\\..\\test\\data\\cdns_test_file.cdns";
+static char const* cdns_gz_in = "..\\..\\test\\data\\cdns_test_file.cdns.gz";
+static char const* cdns_xz_in = "..\\..\\test\\data\\cdns_test_file.cdns.xz";
 static char const* gold_in = "..\\..\\test\\data\\gold.cbor";
 static char const* text_ref = "..\\..\\test\\data\\cdns_test_ref.txt";
 static char const* text_ref_rfc = "..\\..\\test\\data\\cdns_test_ref_rfc.txt";
@@ -47,6 +51,8 @@ static char const* text_ref_gold = "..\\..\\test\\data\\cdns_test_ref_gold.txt";
 #else
 static char const* cbor_in = "test/data/cdns_test_file.cbor";
 static char const* cdns_in = "test/data/cdns_test_file.cdns";
+static char const* cdns_gz_in = "test/data/cdns_test_file.cdns.gz";
+static char const* cdns_xz_in = "test/data/cdns_test_file.cdns.xz";
 static char const* gold_in = "test/data/gold.cbor";
 static char const* text_ref = "test/data/cdns_test_ref.txt";
 static char const* text_ref_rfc = "test/data/cdns_test_ref_rfc.txt";
@@ -58,6 +64,37 @@ static char const* dump_gold_out = "gold_dump_file.txt";
 static char const* text_out = "cdns_test_file.txt";
 static char const* text_rfc_out = "cdns_test_rfc_file.txt";
 static char const* text_gold_out = "cdns_test_gold_file.txt";
+static char const* text_mapped_out = "cdns_test_mapped_file.txt";
+static char const* text_stream_out = "cdns_test_stream_file.txt";
+static char const* text_stream_rfc_out = "cdns_test_stream_rfc_file.txt";
+static char const* text_gz_out = "cdns_test_gz_file.txt";
+static char const* text_gz_stream_out = "cdns_test_gz_stream_file.txt";
+static char const* text_xz_stream_out = "cdns_test_xz_stream_file.txt";
+static char const* text_buffer_out = "cdns_test_buffer_file.txt";
+static char const* text_fd_out = "cdns_test_fd_file.txt";
+static char const* text_pipe_out = "cdns_test_pipe_file.txt";
+static char const* text_prefetch_out = "cdns_test_prefetch_file.txt";
+static char const* text_prefetch_rfc_out = "cdns_test_prefetch_rfc_file.txt";
+static char const* multi_block_in = "cdns_test_multi_block.cdns";
+static char const* text_multi_out = "cdns_test_multi_file.txt";
+static char const* text_multi_prefetch_out = "cdns_test_multi_prefetch_file.txt";
+static char const* index_multi_block_in = "cdns_test_index_multi_block.cdns";
+static char const* index_multi_block_idx = "cdns_test_index_multi_block.cdns.idx";
+static char const* index_undef_block_in = "cdns_test_index_undef_block.cdns";
+static char const* index_undef_block_idx = "cdns_test_index_undef_block.cdns.idx";
+static char const* text_index_seq_out = "cdns_test_index_seq_file.txt";
+static char const* text_index_at_out = "cdns_test_index_at_file.txt";
+static char const* time_multi_block_in = "cdns_test_time_multi_block.cdns";
+static char const* parallel_multi_block_in = "cdns_test_parallel_multi_block.cdns";
+static char const* text_parallel_out = "cdns_test_parallel_file.txt";
+static char const* text_parallel_rfc_out = "cdns_test_parallel_rfc_file.txt";
+static char const* text_parallel_seq_out = "cdns_test_parallel_seq_file.txt";
+static char const* text_parallel_multi_out = "cdns_test_parallel_multi_file.txt";
+static char const* text_reuse_out = "cdns_test_reuse_file.txt";
+static char const* text_reuse_gold_out = "cdns_test_reuse_gold_file.txt";
+static char const* projection_multi_block_in = "cdns_test_projection_multi_block.cdns";
+static char const* text_visitor_out = "cdns_test_visitor_file.txt";
+static char const* iterator_multi_block_in = "cdns_test_iterator_multi_block.cdns";
 
 
 CdnsDumpTest::CdnsDumpTest()
@@ -89,7 +126,7 @@ CdnsTest::~CdnsTest()
 {
 }
 
-void CdnsTest::NamePrint(uint8_t* q_name, size_t q_name_length, FILE* F)
+void CdnsTest::NamePrint(uint8_t const* q_name, size_t q_name_length, FILE* F)
 {
     size_t n_index = 0;
 
@@ -122,12 +159,16 @@ void CdnsTest::NamePrint(uint8_t* q_name, size_t q_name_length, FILE* F)
 
 void CdnsTest::SubmitQuery(cdns* cdns_ctx, size_t query_index, FILE * F)
 {
-    cdns_query* query = &cdns_ctx->block.queries[query_index];
-    cdns_query_signature* q_sig = NULL;
+    cdns_resolved_query resolved;
 
-    if (query->query_signature_index >= cdns_ctx->index_offset) {
-        q_sig = &cdns_ctx->block.tables.q_sigs[(size_t)query->query_signature_index - cdns_ctx->index_offset];
-    }
+    resolved.resolve(&cdns_ctx->block, &cdns_ctx->block.queries[query_index]);
+    SubmitResolvedQuery(cdns_ctx, &resolved, F);
+}
+
+void CdnsTest::SubmitResolvedQuery(cdns* cdns_ctx, cdns_resolved_query const* resolved, FILE* F)
+{
+    cdns_query const* query = resolved->query;
+    cdns_query_signature const* q_sig = resolved->q_sig;
 
     fprintf(F, "Qsize: %d, rsize:%d",
         query->query_size, query->response_size);
@@ -144,10 +185,9 @@ void CdnsTest::SubmitQuery(cdns* cdns_ctx, size_t query_index, FILE * F)
             fprintf(F, "t: %" PRIu64 ", op: %d, r: %d, flags: %x, ",
                 query_time_usec, q_sig->query_opcode, q_sig->query_rcode, q_sig->qr_dns_flags);
 
-            if (query->query_name_index >= cdns_ctx->index_offset) {
-                size_t nid = (size_t)query->query_name_index - cdns_ctx->index_offset;
-                uint8_t* q_name = cdns_ctx->block.tables.name_rdata[nid].v;
-                size_t q_name_length = cdns_ctx->block.tables.name_rdata[nid].l;
+            if (resolved->query_name != NULL) {
+                uint8_t const* q_name = resolved->query_name->v;
+                size_t q_name_length = resolved->query_name->l;
 
                 if (q_name_length > 0 && q_name_length < 256) {
                     NamePrint(q_name, q_name_length, F);
@@ -162,9 +202,8 @@ void CdnsTest::SubmitQuery(cdns* cdns_ctx, size_t query_index, FILE * F)
             else {
                 fprintf(F, "name_index %d", query->query_name_index);
             }
-            if (q_sig->query_classtype_index >= cdns_ctx->index_offset) {
-                size_t cid = (size_t)q_sig->query_classtype_index - cdns_ctx->index_offset;
-                fprintf(F, ", CL=%d, RR=%d", cdns_ctx->block.tables.class_ids[cid].rr_class, cdns_ctx->block.tables.class_ids[cid].rr_type);
+            if (resolved->query_class != NULL) {
+                fprintf(F, ", CL=%d, RR=%d", resolved->query_class->rr_class, resolved->query_class->rr_type);
             }
             else if (q_sig->query_classtype_index != cdns_ctx->index_offset) {
                 fprintf(F, ", classtype_index = %d", q_sig->query_classtype_index);
@@ -352,38 +391,45 @@ bool CdnsTest::FileCompare(char const* file_out, char const* file_ref)
 bool CdnsTest::DoTest(char const * test_in, char const* test_out, char const * test_ref)
 {
     cdns cdns_ctx;
-    int err;
-    int nb_calls = 0;
     bool ret = cdns_ctx.open(test_in);
 
     if (!ret) {
         TEST_LOG("Could not open file: %s\n", test_in);
     }
     else {
-        FILE* F_out = cnds_file_open(test_out, "w");
+        ret = DoTestCtx(&cdns_ctx, test_out, test_ref);
+    }
 
+    return ret;
+}
 
-        if (F_out == NULL) {
-            TEST_LOG("Could not open file: %s\n", test_out);
-            ret = false;
-        }
-        else {
-            ret = cdns_ctx.read_preamble(&err);
+bool CdnsTest::DoTestCtx(cdns* cdns_ctx, char const* test_out, char const* test_ref)
+{
+    int err;
+    int nb_calls = 0;
+    bool ret = true;
+    FILE* F_out = cnds_file_open(test_out, "w");
 
-            SubmitPreamble(F_out, &cdns_ctx);
+    if (F_out == NULL) {
+        TEST_LOG("Could not open file: %s\n", test_out);
+        ret = false;
+    }
+    else {
+        ret = cdns_ctx->read_preamble(&err);
 
-            fprintf(F_out, "Block start: %ld.%06ld\n",
-                (long)cdns_ctx.block.preamble.earliest_time_sec, (long)cdns_ctx.block.preamble.earliest_time_usec);
-            while (ret) {
-                nb_calls++;
-                ret = cdns_ctx.open_block(&err);
-                if (!ret) {
-                    break;
-                }
+        SubmitPreamble(F_out, cdns_ctx);
 
-                for (size_t i = 0; i < cdns_ctx.block.queries.size(); i++) {
-                    SubmitQuery(&cdns_ctx, i, F_out);
-                }
+        fprintf(F_out, "Block start: %ld.%06ld\n",
+            (long)cdns_ctx->block.preamble.earliest_time_sec, (long)cdns_ctx->block.preamble.earliest_time_usec);
+        while (ret) {
+            nb_calls++;
+            ret = cdns_ctx->open_block(&err);
+            if (!ret) {
+                break;
+            }
+
+            for (size_t i = 0; i < cdns_ctx->block.queries.size(); i++) {
+                SubmitQuery(cdns_ctx, i, F_out);
             }
         }
 
@@ -397,13 +443,114 @@ bool CdnsTest::DoTest(char const * test_in, char const* test_out, char const * t
         (void)fclose(F_out);
     }
 
-    if (ret) {
+    if (ret && test_ref != NULL) {
         ret = FileCompare(test_out, test_ref);
     }
 
     return ret;
 }
 
+/* The test files only contain one block. Build a test file with several
+ * blocks by repeating the block of the source file nb_blocks times. If
+ * time_step_sec is not zero, the start time of block i is incremented by
+ * i*time_step_sec seconds. */
+bool CdnsTest::MakeMultiBlockFile(char const* file_in, char const* file_out, int nb_blocks, uint32_t time_step_sec)
+{
+    bool ret = false;
+    cdns cdns_ctx;
+
+    if (nb_blocks < 24 && cdns_ctx.open(file_in)) {
+        uint8_t const* in = cdns_ctx.buf;
+        uint8_t const* in_max = in + cdns_ctx.buf_read;
+        uint8_t const* head_end = NULL;
+        uint8_t const* block_start = NULL;
+        uint8_t const* block_end = NULL;
+        size_t time_pos = 0;
+        int64_t val;
+        int err = 0;
+
+        /* Outer array, file type, file preamble, start of block array */
+        in = cbor_get_number(in, in_max, &val);
+        if (in != NULL) {
+            in = cbor_skip(in, in_max, &err);
+        }
+        if (in != NULL) {
+            in = cbor_skip(in, in_max, &err);
+        }
+        if (in != NULL) {
+            head_end = in;
+            block_start = cbor_get_number(in, in_max, &val);
+        }
+        if (block_start != NULL) {
+            block_end = cbor_skip(block_start, in_max, &err);
+        }
+        if (block_end != NULL) {
+            if (val == CBOR_END_OF_ARRAY && block_end < in_max && *block_end == CBOR_END_MARK) {
+                block_end++;
+            }
+            else if (val != 1) {
+                block_end = NULL;
+            }
+        }
+
+        if (block_end != NULL && time_step_sec != 0) {
+            /* Block map, preamble key, preamble map, time key, time array, seconds as uint32 */
+            uint8_t const* t = block_start;
+            int64_t key = -1;
+
+            t = cbor_get_number(t, in_max, &key);
+            for (int i = 0; t != NULL && i < 4; i++) {
+                t = cbor_get_number(t, in_max, &key);
+                if (t != NULL && (i & 1) == 0 && key != 0) {
+                    t = NULL;
+                }
+            }
+            if (t != NULL && t + 5 <= in_max && *t == 0x1a) {
+                time_pos = t + 1 - block_start;
+            }
+            else {
+                block_end = NULL;
+            }
+        }
+
+        if (block_end != NULL) {
+            FILE* F = cnds_file_open(file_out, "wb");
+
+            if (F != NULL) {
+                uint8_t blocks_head = (uint8_t)(0x80 + nb_blocks);
+                size_t block_length = (val == CBOR_END_OF_ARRAY) ? (block_end - block_start - 1) : (block_end - block_start);
+                std::vector<uint8_t> block_copy(block_start, block_start + block_length);
+                uint32_t start_sec = 0;
+
+                if (time_pos > 0) {
+                    for (int i = 0; i < 4; i++) {
+                        start_sec = (start_sec << 8) | block_copy[time_pos + i];
+                    }
+                }
+
+                ret = fwrite(cdns_ctx.buf, 1, head_end - cdns_ctx.buf, F) == (size_t)(head_end - cdns_ctx.buf) &&
+                    fwrite(&blocks_head, 1, 1, F) == 1;
+                for (int i = 0; ret && i < nb_blocks; i++) {
+                    if (time_pos > 0) {
+                        uint32_t sec = start_sec + i * time_step_sec;
+
+                        for (int j = 0; j < 4; j++) {
+                            block_copy[time_pos + j] = (uint8_t)(sec >> (8 * (3 - j)));
+                        }
+                    }
+                    ret = fwrite(&block_copy[0], 1, block_length, F) == block_length;
+                }
+                if (ret && block_end < in_max) {
+                    ret = fwrite(block_end, 1, in_max - block_end, F) == (size_t)(in_max - block_end);
+                }
+                fclose(F);
+            }
+        }
+    }
+
+    return ret;
+}
+
 void CdnsTest::PrintIntVector(FILE* F_out, std::vector<int>* v_int)
 {
     fprintf(F_out, "[");
@@ -558,3 +705,1677 @@ bool CdnsTestGold::DoTest()
 
     return ret;
 }
+
+CdnsTestMapped::CdnsTestMapped()
+{
+}
+
+CdnsTestMapped::~CdnsTestMapped()
+{
+}
+
+bool CdnsTestMapped::DoTest()
+{
+    cdns cdns_ctx;
+    bool ret = cdns_ctx.open_mapped(cdns_in);
+
+    if (!ret) {
+        TEST_LOG("Could not map file: %s\n", cdns_in);
+    }
+    else {
+        ret = CdnsTest::DoTestCtx(&cdns_ctx, text_mapped_out, text_ref_rfc);
+    }
+
+    return ret;
+}
+
+CdnsTestStream::CdnsTestStream()
+{
+}
+
+CdnsTestStream::~CdnsTestStream()
+{
+}
+
+bool CdnsTestStream::DoTest()
+{
+    char const* test_in[2] = { cbor_in, cdns_in };
+    char const* test_out[2] = { text_stream_out, text_stream_rfc_out };
+    char const* test_ref[2] = { text_ref, text_ref_rfc };
+    bool ret = true;
+
+    for (int i = 0; ret && i < 2; i++) {
+        cdns cdns_ctx;
+
+        ret = cdns_ctx.open_stream(test_in[i]);
+
+        if (!ret) {
+            TEST_LOG("Could not open stream: %s\n", test_in[i]);
+        }
+        else {
+            ret = CdnsTest::DoTestCtx(&cdns_ctx, test_out[i], test_ref[i]);
+        }
+    }
+
+    return ret;
+}
+
+CdnsTestCompressed::CdnsTestCompressed()
+{
+}
+
+CdnsTestCompressed::~CdnsTestCompressed()
+{
+}
+
+bool CdnsTestCompressed::DoTest()
+{
+    bool ret = true;
+#ifdef CDNS_HAVE_ZLIB
+    /* The gzip test file is made of two concatenated members */
+    if (ret) {
+        CdnsTest* test = new CdnsTest();
+
+        ret = (test != NULL && test->DoTest(cdns_gz_in, text_gz_out, text_ref_rfc));
+        if (test != NULL) {
+            delete test;
+        }
+    }
+
+    if (ret) {
+        cdns cdns_ctx;
+
+        ret = cdns_ctx.open_stream(cdns_gz_in) &&
+            CdnsTest::DoTestCtx(&cdns_ctx, text_gz_stream_out, text_ref_rfc);
+    }
+#else
+    (void)cdns_gz_in;
+    (void)text_gz_out;
+    (void)text_gz_stream_out;
+#endif
+#ifdef CDNS_HAVE_LZMA
+    if (ret) {
+        cdns cdns_ctx;
+
+        ret = cdns_ctx.open_stream(cdns_xz_in) &&
+            CdnsTest::DoTestCtx(&cdns_ctx, text_xz_stream_out, text_ref_rfc);
+    }
+#else
+    (void)cdns_xz_in;
+    (void)text_xz_stream_out;
+#endif
+
+    return ret;
+}
+
+CdnsTestBuffer::CdnsTestBuffer()
+{
+}
+
+CdnsTestBuffer::~CdnsTestBuffer()
+{
+}
+
+bool CdnsTestBuffer::DoTest()
+{
+    bool ret = false;
+    uint8_t* in_buf = NULL;
+    size_t in_length = 0;
+    FILE* F = cnds_file_open(cdns_in, "rb");
+
+    if (F == NULL) {
+        TEST_LOG("Could not open file: %s\n", cdns_in);
+    }
+    else {
+        if (fseek(F, 0, SEEK_END) == 0) {
+            long l = ftell(F);
+            if (l > 0 && fseek(F, 0, SEEK_SET) == 0) {
+                in_length = (size_t)l;
+                in_buf = new uint8_t[in_length];
+                if (in_buf != NULL && fread(in_buf, 1, in_length, F) == in_length) {
+                    ret = true;
+                }
+            }
+        }
+        fclose(F);
+    }
+
+    if (ret) {
+        cdns cdns_ctx;
+
+        ret = cdns_ctx.open_buffer(in_buf, in_length);
+        if (!ret) {
+            TEST_LOG("Could not open buffer, length %zu\n", in_length);
+        }
+        else {
+            ret = CdnsTest::DoTestCtx(&cdns_ctx, text_buffer_out, text_ref_rfc);
+            /* The buffer is borrowed, not copied */
+            if (ret && cdns_ctx.buf != in_buf) {
+                TEST_LOG("%s", "Buffer was copied\n");
+                ret = false;
+            }
+        }
+    }
+
+    if (in_buf != NULL) {
+        delete[] in_buf;
+    }
+
+    return ret;
+}
+
+CdnsTestFd::CdnsTestFd()
+{
+}
+
+CdnsTestFd::~CdnsTestFd()
+{
+}
+
+bool CdnsTestFd::DoTest()
+{
+    bool ret = false;
+    FILE* F = cnds_file_open(cdns_in, "rb");
+
+    if (F == NULL) {
+        TEST_LOG("Could not open file: %s\n", cdns_in);
+    }
+    else {
+        cdns cdns_ctx;
+
+#ifdef _WINDOWS
+        ret = cdns_ctx.open_fd(_fileno(F));
+#else
+        ret = cdns_ctx.open_fd(fileno(F));
+#endif
+        /* The descriptor is duplicated, the caller still owns it */
+        fclose(F);
+
+        if (!ret) {
+            TEST_LOG("Could not open descriptor for: %s\n", cdns_in);
+        }
+        else {
+            ret = CdnsTest::DoTestCtx(&cdns_ctx, text_fd_out, text_ref_rfc);
+        }
+    }
+
+#ifndef _WINDOWS
+    if (ret) {
+        /* Same test, reading from a pipe */
+        char command[512];
+        FILE* P;
+
+        (void)snprintf(command, sizeof(command), "cat \"%s\"", cdns_in);
+        P = popen(command, "r");
+        if (P == NULL) {
+            TEST_LOG("Could not open pipe: %s\n", command);
+            ret = false;
+        }
+        else {
+            cdns cdns_ctx;
+
+            ret = cdns_ctx.open_fd(fileno(P));
+            if (!ret) {
+                TEST_LOG("Could not open pipe descriptor: %s\n", command);
+            }
+            else {
+                ret = CdnsTest::DoTestCtx(&cdns_ctx, text_pipe_out, text_ref_rfc);
+            }
+            (void)pclose(P);
+        }
+    }
+#else
+    (void)text_pipe_out;
+#endif
+
+    return ret;
+}
+
+CdnsTestPrefetch::CdnsTestPrefetch()
+{
+}
+
+CdnsTestPrefetch::~CdnsTestPrefetch()
+{
+}
+
+bool CdnsTestPrefetch::DoTest()
+{
+    char const* test_in[2] = { cbor_in, cdns_in };
+    char const* test_out[2] = { text_prefetch_out, text_prefetch_rfc_out };
+    char const* test_ref[2] = { text_ref, text_ref_rfc };
+    bool ret = true;
+
+    for (int i = 0; ret && i < 2; i++) {
+        cdns cdns_ctx;
+
+        ret = cdns_ctx.open(test_in[i]) && cdns_ctx.enable_prefetch();
+
+        if (!ret) {
+            TEST_LOG("Could not open with prefetch: %s\n", test_in[i]);
+        }
+        else {
+            ret = CdnsTest::DoTestCtx(&cdns_ctx, test_out[i], test_ref[i]);
+        }
+    }
+
+    if (ret) {
+        /* Several blocks, in stream mode, with and without prefetch */
+        int const nb_blocks = 5;
+
+        ret = CdnsTest::MakeMultiBlockFile(cdns_in, multi_block_in, nb_blocks, 0);
+        if (!ret) {
+            TEST_LOG("Could not create: %s\n", multi_block_in);
+        }
+
+        for (int i = 0; ret && i < 2; i++) {
+            cdns cdns_ctx;
+            int err = 0;
+            int nb_read = 0;
+            FILE* F_out = NULL;
+
+            ret = cdns_ctx.open_stream(multi_block_in) && (i == 0 || cdns_ctx.enable_prefetch());
+            if (ret) {
+                F_out = cnds_file_open((i == 0) ? text_multi_out : text_multi_prefetch_out, "w");
+                ret = (F_out != NULL);
+            }
+
+            while (ret && cdns_ctx.open_block(&err)) {
+                nb_read++;
+                for (size_t q = 0; q < cdns_ctx.block.queries.size(); q++) {
+                    CdnsTest::SubmitQuery(&cdns_ctx, q, F_out);
+                }
+                if (cdns_ctx.is_last_block() != (nb_read == nb_blocks)) {
+                    TEST_LOG("Wrong last block indication at block %d\n", nb_read);
+                    ret = false;
+                }
+            }
+
+            if (F_out != NULL) {
+                fclose(F_out);
+            }
+
+            if (ret && (err != CBOR_END_OF_ARRAY || nb_read != nb_blocks)) {
+                TEST_LOG("Read %d blocks out of %d, err: %d\n", nb_read, nb_blocks, err);
+                ret = false;
+            }
+        }
+
+        if (ret) {
+            ret = CdnsTest::FileCompare(text_multi_prefetch_out, text_multi_out);
+        }
+    }
+
+    return ret;
+}
+
+CdnsTestBlockIndex::CdnsTestBlockIndex()
+{
+}
+
+CdnsTestBlockIndex::~CdnsTestBlockIndex()
+{
+}
+
+bool CdnsTestBlockIndex::DoTest()
+{
+    int const nb_blocks = 5;
+    size_t const target = 3;
+    bool ret = CdnsTest::MakeMultiBlockFile(cdns_in, index_multi_block_in, nb_blocks, 0);
+    int err = 0;
+
+    if (!ret) {
+        TEST_LOG("Could not create: %s\n", index_multi_block_in);
+    }
+    else {
+        /* Build the index and save it, then read the target block sequentially */
+        cdns cdns_ctx;
+        int nb_read = 0;
+
+        (void)remove(index_multi_block_idx);
+        ret = cdns_ctx.open_mapped(index_multi_block_in) && cdns_ctx.use_block_index(index_multi_block_idx, &err);
+        if (!ret || cdns_ctx.block_index.size() != (size_t)nb_blocks) {
+            TEST_LOG("Could not build the index of %s, err: %d\n", index_multi_block_in, err);
+            ret = false;
+        }
+
+        for (size_t i = 1; ret && i < cdns_ctx.block_index.size(); i++) {
+            if (cdns_ctx.block_index[i].offset != cdns_ctx.block_index[i - 1].offset + cdns_ctx.block_index[i - 1].length ||
+                cdns_ctx.block_index[i].block_start_us != cdns_ctx.block_index[0].block_start_us) {
+                TEST_LOG("Unexpected index entry %zu\n", i);
+                ret = false;
+            }
+        }
+
+        while (ret && nb_read <= (int)target) {
+            ret = cdns_ctx.open_block(&err);
+            nb_read++;
+        }
+
+        if (ret) {
+            FILE* F_out = cnds_file_open(text_index_seq_out, "w");
+
+            ret = (F_out != NULL);
+            for (size_t q = 0; ret && q < cdns_ctx.block.queries.size(); q++) {
+                CdnsTest::SubmitQuery(&cdns_ctx, q, F_out);
+            }
+            if (F_out != NULL) {
+                fclose(F_out);
+            }
+        }
+    }
+
+    if (ret) {
+        /* Load the saved index, and jump directly to the target block */
+        cdns cdns_ctx;
+
+        ret = cdns_ctx.open_mapped(index_multi_block_in) && cdns_ctx.load_block_index(index_multi_block_idx) &&
+            cdns_ctx.block_index.size() == (size_t)nb_blocks && cdns_ctx.open_block_at(target, &err);
+
+        if (!ret) {
+            TEST_LOG("Could not open block %zu using index, err: %d\n", target, err);
+        }
+        else {
+            FILE* F_out = cnds_file_open(text_index_at_out, "w");
+
+            ret = (F_out != NULL);
+            for (size_t q = 0; ret && q < cdns_ctx.block.queries.size(); q++) {
+                CdnsTest::SubmitQuery(&cdns_ctx, q, F_out);
+            }
+            if (F_out != NULL) {
+                fclose(F_out);
+            }
+        }
+
+        if (ret) {
+            ret = CdnsTest::FileCompare(text_index_at_out, text_index_seq_out);
+        }
+
+        /* The next block follows, then the end of the file */
+        if (ret && (!cdns_ctx.open_block(&err) || !cdns_ctx.is_last_block() ||
+            cdns_ctx.open_block(&err) || err != CBOR_END_OF_ARRAY)) {
+            TEST_LOG("Unexpected sequence after block %zu, err: %d\n", target, err);
+            ret = false;
+        }
+    }
+
+    if (ret) {
+        /* The index does not match a different file */
+        cdns cdns_ctx;
+
+        if (!cdns_ctx.open(cdns_in) || cdns_ctx.load_block_index(index_multi_block_idx)) {
+            TEST_LOG("Index of %s accepted for %s\n", index_multi_block_in, cdns_in);
+            ret = false;
+        }
+    }
+
+    if (ret) {
+        /* Same blocks in an indefinite array, which does not give the number of
+         * blocks. An index announcing more blocks than the file has bytes is rejected. */
+        cdns cdns_ctx;
+        FILE* F = NULL;
+
+        ret = cdns_ctx.open_mapped(index_multi_block_in) && cdns_ctx.build_block_index(&err) &&
+            cdns_ctx.block_index.size() == (size_t)nb_blocks;
+        if (ret) {
+            size_t first = (size_t)cdns_ctx.block_index[0].offset;
+            size_t last = (size_t)(cdns_ctx.block_index.back().offset + cdns_ctx.block_index.back().length);
+            uint8_t const undef_head = 0x9f;
+            uint8_t const undef_end = 0xff;
+
+            F = cnds_file_open(index_undef_block_in, "wb");
+            ret = (F != NULL) &&
+                fwrite(cdns_ctx.buf, 1, first - 1, F) == first - 1 &&
+                fwrite(&undef_head, 1, 1, F) == 1 &&
+                fwrite(cdns_ctx.buf + first, 1, last - first, F) == last - first &&
+                fwrite(&undef_end, 1, 1, F) == 1 &&
+                fwrite(cdns_ctx.buf + last, 1, cdns_ctx.buf_read - last, F) == cdns_ctx.buf_read - last;
+            if (F != NULL) {
+                fclose(F);
+            }
+        }
+        if (!ret) {
+            TEST_LOG("Could not create: %s\n", index_undef_block_in);
+        }
+    }
+
+    if (ret) {
+        cdns cdns_ctx;
+
+        (void)remove(index_undef_block_idx);
+        ret = cdns_ctx.open_mapped(index_undef_block_in) && cdns_ctx.use_block_index(index_undef_block_idx, &err) &&
+            cdns_ctx.block_index.size() == (size_t)nb_blocks;
+        if (!ret) {
+            TEST_LOG("Could not index %s, err: %d\n", index_undef_block_in, err);
+        }
+        else {
+            FILE* F = cnds_file_open(index_undef_block_idx, "w");
+
+            ret = (F != NULL) &&
+                fprintf(F, "CDNS-BLOCK-INDEX 1 %zu %zu\n", cdns_ctx.buf_read, ((size_t)1) << 60) > 0;
+            if (F != NULL) {
+                fclose(F);
+            }
+        }
+        if (ret) {
+            cdns cdns_bad;
+
+            if (!cdns_bad.open_mapped(index_undef_block_in) || cdns_bad.load_block_index(index_undef_block_idx) ||
+                cdns_bad.block_index.size() != 0) {
+                TEST_LOG("Index announcing 2^60 blocks accepted for %s\n", index_undef_block_in);
+                ret = false;
+            }
+        }
+    }
+
+    return ret;
+}
+
+CdnsTestTimeRange::CdnsTestTimeRange()
+{
+}
+
+CdnsTestTimeRange::~CdnsTestTimeRange()
+{
+}
+
+bool CdnsTestTimeRange::DoTest()
+{
+    int const nb_blocks = 6;
+    uint32_t const time_step_sec = 60;
+    bool ret = CdnsTest::MakeMultiBlockFile(cdns_in, time_multi_block_in, nb_blocks, time_step_sec);
+    uint64_t base_us = 0;
+    uint64_t t0 = 0;
+    uint64_t t1 = 0;
+    size_t nb_expected = 0;
+    int err = 0;
+
+    if (!ret) {
+        TEST_LOG("Could not create: %s\n", time_multi_block_in);
+    }
+    else {
+        /* Count the queries in range by reading all blocks */
+        cdns cdns_ctx;
+        int nb_read = 0;
+
+        ret = cdns_ctx.open_mapped(time_multi_block_in);
+        while (ret && cdns_ctx.open_block(&err)) {
+            if (nb_read == 0) {
+                base_us = cdns_ctx.block.block_start_us;
+                t0 = base_us + 90000000ull;
+                t1 = base_us + 200000000ull;
+            }
+            else if (cdns_ctx.block.block_start_us != base_us + nb_read * time_step_sec * 1000000ull) {
+                TEST_LOG("Unexpected start time for block %d\n", nb_read);
+                ret = false;
+            }
+            for (size_t q = 0; q < cdns_ctx.block.queries.size(); q++) {
+                uint64_t q_time = cdns_ctx.block.block_start_us + cdns_ctx.block.queries[q].time_offset_usec;
+
+                if (q_time >= t0 && q_time < t1) {
+                    nb_expected++;
+                }
+            }
+            nb_read++;
+        }
+        if (ret && (nb_read != nb_blocks || err != CBOR_END_OF_ARRAY)) {
+            TEST_LOG("Read %d blocks out of %d, err: %d\n", nb_read, nb_blocks, err);
+            ret = false;
+        }
+    }
+
+    if (ret) {
+        /* Only the blocks starting at 60, 120 and 180 seconds overlap [90, 200) */
+        cdns cdns_ctx;
+        cdns_time_range range(&cdns_ctx, t0, t1);
+        size_t nb_found = 0;
+        int nb_read = 0;
+
+        ret = cdns_ctx.open_mapped(time_multi_block_in);
+        while (ret && range.next_block(&err)) {
+            nb_read++;
+            if (cdns_ctx.block.block_start_us != base_us + nb_read * time_step_sec * 1000000ull) {
+                TEST_LOG("Unexpected block in range, start: %" PRIu64 "\n", cdns_ctx.block.block_start_us);
+                ret = false;
+            }
+            for (size_t q = 0; q < cdns_ctx.block.queries.size(); q++) {
+                if (range.is_query_in_range(q)) {
+                    nb_found++;
+                }
+            }
+        }
+        if (ret && (nb_read != 3 || err != CBOR_END_OF_ARRAY || nb_found != nb_expected)) {
+            TEST_LOG("Range returns %d blocks, %zu queries instead of %zu, err: %d\n", nb_read, nb_found, nb_expected, err);
+            ret = false;
+        }
+    }
+
+    for (int layout = 0; ret && layout < 2; layout++) {
+        /* Same range with the columnar and compact layouts, which leave the queries empty */
+        cdns cdns_ctx;
+        cdns_time_range range(&cdns_ctx, t0, t1);
+        size_t nb_found = 0;
+        int nb_read = 0;
+
+        ret = cdns_ctx.open_mapped(time_multi_block_in) &&
+            ((layout == 0) ? cdns_ctx.enable_columns() : cdns_ctx.enable_compact());
+        while (ret && range.next_block(&err)) {
+            size_t nb_queries = (layout == 0) ? cdns_ctx.block.query_columns.size() : cdns_ctx.block.compact_queries.size();
+
+            nb_read++;
+            for (size_t q = 0; q < nb_queries; q++) {
+                if (range.is_query_in_range(q)) {
+                    nb_found++;
+                }
+            }
+            if (range.is_query_in_range(nb_queries)) {
+                TEST_LOG("Query %zu past the end of block is in range\n", nb_queries);
+                ret = false;
+            }
+        }
+        if (ret && (nb_read != 3 || err != CBOR_END_OF_ARRAY || nb_found != nb_expected)) {
+            TEST_LOG("Range (layout %d) returns %d blocks, %zu queries instead of %zu, err: %d\n", layout, nb_read, nb_found, nb_expected, err);
+            ret = false;
+        }
+    }
+
+    if (ret) {
+        /* Times before the first block and after the last block */
+        cdns cdns_ctx;
+
+        ret = cdns_ctx.open_mapped(time_multi_block_in) &&
+            cdns_ctx.seek_time(0, &err) && cdns_ctx.open_block(&err) &&
+            cdns_ctx.block.block_start_us == base_us &&
+            cdns_ctx.seek_time(UINT64_MAX, &err) && cdns_ctx.open_block(&err) &&
+            cdns_ctx.is_last_block() && !cdns_ctx.open_block(&err) && err == CBOR_END_OF_ARRAY;
+        if (!ret) {
+            TEST_LOG("Seek time at file limits fails, err: %d\n", err);
+        }
+    }
+
+    if (ret) {
+        /* Time stamps with seconds past 2^31 and past 2^32 */
+        uint8_t const t31[] = { 0xa1, 0x01, 0x82, 0x1a, 0x80, 0x00, 0x00, 0x00, 0x07 };
+        uint8_t const t32[] = { 0xa1, 0x01, 0x82, 0x1b, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x05, 0x07 };
+        cdns_block_preamble_old p31;
+        cdns_block_preamble_old p32;
+
+        ret = p31.parse(t31, t31 + sizeof(t31), &err) == t31 + sizeof(t31) &&
+            p31.earliest_time_sec == 0x80000000ll && p31.earliest_time_usec == 7 &&
+            p32.parse(t32, t32 + sizeof(t32), &err) == t32 + sizeof(t32) &&
+            p32.earliest_time_sec == 0x100000005ll && p32.earliest_time_usec == 7;
+        if (!ret) {
+            TEST_LOG("Large time stamps are not preserved, err: %d\n", err);
+        }
+    }
+
+    return ret;
+}
+
+CdnsTestParallel::CdnsTestParallel()
+{
+}
+
+CdnsTestParallel::~CdnsTestParallel()
+{
+}
+
+bool CdnsTestParallel::DoTest()
+{
+    char const* test_in[2] = { cbor_in, cdns_in };
+    char const* test_out[2] = { text_parallel_out, text_parallel_rfc_out };
+    char const* test_ref[2] = { text_ref, text_ref_rfc };
+    int const nb_blocks = 11;
+    bool ret = true;
+    int err = 0;
+
+    for (int i = 0; ret && i < 2; i++) {
+        cdns cdns_ctx;
+
+        ret = cdns_ctx.open(test_in[i]) && cdns_ctx.enable_parallel(3, &err);
+
+        if (!ret) {
+            TEST_LOG("Could not open in parallel mode: %s, err: %d\n", test_in[i], err);
+        }
+        else {
+            ret = CdnsTest::DoTestCtx(&cdns_ctx, test_out[i], test_ref[i]);
+        }
+    }
+
+    if (ret) {
+        ret = CdnsTest::MakeMultiBlockFile(cdns_in, parallel_multi_block_in, nb_blocks, 1);
+        if (!ret) {
+            TEST_LOG("Could not create: %s\n", parallel_multi_block_in);
+        }
+    }
+
+    /* More blocks than queue slots, read sequentially then in parallel.
+     * The blocks must be delivered in file order. */
+    for (int i = 0; ret && i < 2; i++) {
+        cdns cdns_ctx;
+        int nb_read = 0;
+        uint64_t previous_start = 0;
+        FILE* F_out = NULL;
+
+        ret = cdns_ctx.open_mapped(parallel_multi_block_in) && (i == 0 || cdns_ctx.enable_parallel(2, &err));
+        if (ret) {
+            F_out = cnds_file_open((i == 0) ? text_parallel_seq_out : text_parallel_multi_out, "w");
+            ret = (F_out != NULL);
+        }
+
+        while (ret && cdns_ctx.open_block(&err)) {
+            nb_read++;
+            if (cdns_ctx.block.block_start_us <= previous_start) {
+                TEST_LOG("Block %d delivered out of order\n", nb_read);
+                ret = false;
+            }
+            previous_start = cdns_ctx.block.block_start_us;
+            for (size_t q = 0; q < cdns_ctx.block.queries.size(); q++) {
+                CdnsTest::SubmitQuery(&cdns_ctx, q, F_out);
+            }
+        }
+
+        if (F_out != NULL) {
+            fclose(F_out);
+        }
+
+        if (ret && (err != CBOR_END_OF_ARRAY || nb_read != nb_blocks)) {
+            TEST_LOG("Read %d blocks out of %d, err: %d\n", nb_read, nb_blocks, err);
+            ret = false;
+        }
+    }
+
+    if (ret) {
+        ret = CdnsTest::FileCompare(text_parallel_multi_out, text_parallel_seq_out);
+    }
+
+    if (ret) {
+        /* Jumping to another block restarts the workers from there */
+        cdns cdns_ctx;
+        uint64_t first_start = 0;
+        int nb_read = 0;
+
+        ret = cdns_ctx.open_mapped(parallel_multi_block_in) && cdns_ctx.enable_parallel(4, &err) &&
+            cdns_ctx.open_block(&err);
+        if (ret) {
+            first_start = cdns_ctx.block.block_start_us;
+            ret = cdns_ctx.open_block_at(8, &err) && cdns_ctx.block.block_start_us == first_start + 8000000ull;
+        }
+        while (ret && cdns_ctx.open_block(&err)) {
+            nb_read++;
+        }
+        if (!ret || err != CBOR_END_OF_ARRAY || nb_read != 2) {
+            TEST_LOG("Parallel seek fails, %d blocks read after seek, err: %d\n", nb_read, err);
+            ret = false;
+        }
+    }
+
+    return ret;
+}
+
+CdnsTestReuse::CdnsTestReuse()
+{
+}
+
+CdnsTestReuse::~CdnsTestReuse()
+{
+}
+
+bool CdnsTestReuse::DoTest()
+{
+    char const* test_in[2] = { cbor_in, gold_in };
+    char const* test_out[2] = { text_reuse_out, text_reuse_gold_out };
+    char const* test_ref[2] = { text_ref, text_ref_gold };
+    bool ret = true;
+    int err = 0;
+
+    /* Parse a block into the arena left over from a larger block of
+     * another file. The results shall not be affected, and the arena
+     * shall not grow. */
+    for (int i = 0; ret && i < 2; i++) {
+        cdns cdns_large;
+        cdns cdns_ctx;
+
+        ret = cdns_large.open(cdns_in) && cdns_large.open_block(&err) && cdns_ctx.open(test_in[i]);
+        if (!ret) {
+            TEST_LOG("Could not open %s and %s, err: %d\n", cdns_in, test_in[i], err);
+        }
+        else {
+            size_t capacity;
+
+            /* Releasing the block merges the arena into a single chunk */
+            cdns_large.block.release();
+            capacity = cdns_large.block.arena->capacity();
+
+            cdns_ctx.block.swap(&cdns_large.block);
+            /* Only the storage is carried over, not the block start time */
+            cdns_ctx.block.preamble.clear();
+            ret = CdnsTest::DoTestCtx(&cdns_ctx, test_out[i], test_ref[i]);
+            if (ret && cdns_ctx.block.arena->capacity() != capacity) {
+                TEST_LOG("Query storage not reused for %s\n", test_in[i]);
+                ret = false;
+            }
+        }
+    }
+
+    if (ret) {
+        /* Parsing similar blocks does not reallocate the storage, and
+         * the names point directly into the mapped file. The arena chunks
+         * used by the first block are merged when the second is parsed,
+         * and the storage stays the same after that. */
+        int const nb_blocks = 4;
+        cdns cdns_ctx;
+        cdns_query const* queries = NULL;
+        size_t capacity = 0;
+        int nb_read = 0;
+
+        ret = CdnsTest::MakeMultiBlockFile(cdns_in, text_reuse_out, nb_blocks, 0) && cdns_ctx.open_mapped(text_reuse_out);
+        while (ret && cdns_ctx.open_block(&err)) {
+            uint8_t const* name = NULL;
+
+            nb_read++;
+            if (cdns_ctx.block.queries.size() == 0 || cdns_ctx.block.tables.name_rdata.size() == 0) {
+                ret = false;
+            }
+            else {
+                name = cdns_ctx.block.tables.name_rdata[0].v;
+                if (nb_read <= 2) {
+                    queries = &cdns_ctx.block.queries[0];
+                    capacity = cdns_ctx.block.arena->capacity();
+                }
+                ret = (queries == &cdns_ctx.block.queries[0] &&
+                    capacity == cdns_ctx.block.arena->capacity() &&
+                    name >= cdns_ctx.buf && name < cdns_ctx.buf + cdns_ctx.buf_read);
+            }
+        }
+
+        if (!ret || nb_read != nb_blocks) {
+            TEST_LOG("Block storage not reused, %d blocks read, err: %d\n", nb_read, err);
+            ret = false;
+        }
+    }
+
+    return ret;
+}
+
+CdnsTestColumns::CdnsTestColumns()
+{
+}
+
+CdnsTestColumns::~CdnsTestColumns()
+{
+}
+
+static bool CdnsTestColumnsCompare(cdnsBlock* rows, cdnsBlock* columns)
+{
+    cdns_query_columns* qc = &columns->query_columns;
+    cdns_query_signature_columns* sc = &columns->tables.q_sig_columns;
+    bool ret = (qc->size() == rows->queries.size() && columns->queries.size() == 0 &&
+        sc->size() == rows->tables.q_sigs.size() && columns->tables.q_sigs.size() == 0);
+
+    for (size_t i = 0; ret && i < rows->queries.size(); i++) {
+        cdns_query const* q = &rows->queries[i];
+
+        ret = qc->time_offset_usec[i] == q->time_offset_usec &&
+            qc->client_address_index[i] == q->client_address_index &&
+            qc->client_port[i] == q->client_port &&
+            qc->transaction_id[i] == q->transaction_id &&
+            qc->query_signature_index[i] == q->query_signature_index &&
+            qc->client_hoplimit[i] == q->client_hoplimit &&
+            qc->delay_useconds[i] == q->delay_useconds &&
+            qc->query_name_index[i] == q->query_name_index &&
+            qc->query_size[i] == q->query_size &&
+            qc->response_size[i] == q->response_size &&
+            qc->rpd_is_present[i] == (uint8_t)q->rpd.is_present &&
+            qc->rpd_bailiwick_index[i] == q->rpd.bailiwick_index &&
+            qc->rpd_processing_flags[i] == q->rpd.processing_flags &&
+            qc->q_extended_is_filled[i] == (uint8_t)q->q_extended.is_filled &&
+            qc->q_extended_question_index[i] == q->q_extended.question_index &&
+            qc->q_extended_answer_index[i] == q->q_extended.answer_index &&
+            qc->q_extended_authority_index[i] == q->q_extended.authority_index &&
+            qc->q_extended_additional_index[i] == q->q_extended.additional_index &&
+            qc->r_extended_is_filled[i] == (uint8_t)q->r_extended.is_filled &&
+            qc->r_extended_question_index[i] == q->r_extended.question_index &&
+            qc->r_extended_answer_index[i] == q->r_extended.answer_index &&
+            qc->r_extended_authority_index[i] == q->r_extended.authority_index &&
+            qc->r_extended_additional_index[i] == q->r_extended.additional_index;
+    }
+
+    for (size_t i = 0; ret && i < rows->tables.q_sigs.size(); i++) {
+        cdns_query_signature const* q_sig = &rows->tables.q_sigs[i];
+
+        ret = sc->server_address_index[i] == q_sig->server_address_index &&
+            sc->server_port[i] == q_sig->server_port &&
+            sc->qr_transport_flags[i] == q_sig->qr_transport_flags &&
+            sc->qr_type[i] == q_sig->qr_type &&
+            sc->qr_sig_flags[i] == q_sig->qr_sig_flags &&
+            sc->query_opcode[i] == q_sig->query_opcode &&
+            sc->qr_dns_flags[i] == q_sig->qr_dns_flags &&
+            sc->query_rcode[i] == q_sig->query_rcode &&
+            sc->query_classtype_index[i] == q_sig->query_classtype_index &&
+            sc->query_qd_count[i] == q_sig->query_qd_count &&
+            sc->query_an_count[i] == q_sig->query_an_count &&
+            sc->query_ar_count[i] == q_sig->query_ar_count &&
+            sc->query_ns_count[i] == q_sig->query_ns_count &&
+            sc->edns_version[i] == q_sig->edns_version &&
+            sc->udp_buf_size[i] == q_sig->udp_buf_size &&
+            sc->opt_rdata_index[i] == q_sig->opt_rdata_index &&
+            sc->response_rcode[i] == q_sig->response_rcode;
+    }
+
+    return ret;
+}
+
+bool CdnsTestColumns::DoTest()
+{
+    char const* test_in[3] = { cbor_in, cdns_in, gold_in };
+    bool ret = true;
+
+    /* The columns shall hold the same values as the arrays of records */
+    for (int i = 0; ret && i < 3; i++) {
+        cdns cdns_rows;
+        cdns cdns_columns;
+        int err = 0;
+        int nb_blocks = 0;
+
+        ret = cdns_rows.open(test_in[i]) && cdns_columns.open(test_in[i]) && cdns_columns.enable_columns();
+        while (ret) {
+            int err_columns = 0;
+            bool ret_rows = cdns_rows.open_block(&err);
+            bool ret_columns = cdns_columns.open_block(&err_columns);
+
+            if (ret_rows != ret_columns || err != err_columns) {
+                ret = false;
+            }
+            else if (!ret_rows) {
+                break;
+            }
+            else {
+                nb_blocks++;
+                ret = CdnsTestColumnsCompare(&cdns_rows.block, &cdns_columns.block);
+            }
+        }
+
+        if (!ret || err != CBOR_END_OF_ARRAY || nb_blocks == 0) {
+            TEST_LOG("Columns differ from records for %s, block %d, err: %d\n", test_in[i], nb_blocks, err);
+            ret = false;
+        }
+        else if (cdns_columns.enable_columns()) {
+            TEST_LOG("Columnar mode enabled after reading blocks of %s\n", test_in[i]);
+            ret = false;
+        }
+    }
+
+    return ret;
+}
+
+CdnsTestCompact::CdnsTestCompact()
+{
+}
+
+CdnsTestCompact::~CdnsTestCompact()
+{
+}
+
+static bool CdnsTestCompactIndex(bool is_present, uint32_t v, int ref)
+{
+    return (is_present) ? (ref >= 0 && v == (uint32_t)ref) : (ref < 0);
+}
+
+static bool CdnsTestCompactExtended(cdns_qr_extended const* x, cdns_qr_extended const* ref)
+{
+    return x->is_filled == ref->is_filled && x->question_index == ref->question_index &&
+        x->answer_index == ref->answer_index && x->authority_index == ref->authority_index &&
+        x->additional_index == ref->additional_index;
+}
+
+static bool CdnsTestCompactCompare(cdnsBlock* rows, cdnsBlock* compact)
+{
+    cdns_query_compact_table* qt = &compact->compact_queries;
+    cdns_query_signature_compact_table* st = &compact->tables.compact_q_sigs;
+    bool ret = (qt->size() == rows->queries.size() && compact->queries.size() == 0 &&
+        st->size() == rows->tables.q_sigs.size() && compact->tables.q_sigs.size() == 0);
+
+    for (size_t i = 0; ret && i < rows->queries.size(); i++) {
+        cdns_query const* q = &rows->queries[i];
+        cdns_query_compact const* c = &qt->records[i];
+        bool has_extension = q->rpd.is_present || q->q_extended.is_filled || q->r_extended.is_filled;
+
+        ret = c->time_offset_usec == q->time_offset_usec &&
+            CdnsTestCompactIndex(c->is_present(CDNS_QUERY_HAS_CLIENT_ADDRESS), c->client_address_index, q->client_address_index) &&
+            CdnsTestCompactIndex(c->is_present(CDNS_QUERY_HAS_SIGNATURE), c->query_signature_index, q->query_signature_index) &&
+            CdnsTestCompactIndex(c->is_present(CDNS_QUERY_HAS_NAME), c->query_name_index, q->query_name_index) &&
+            c->delay_useconds == q->delay_useconds &&
+            c->client_port == q->client_port &&
+            c->transaction_id == q->transaction_id &&
+            c->query_size == q->query_size &&
+            c->response_size == q->response_size &&
+            c->client_hoplimit == q->client_hoplimit &&
+            c->is_present(CDNS_QUERY_HAS_EXTENSION) == has_extension;
+        if (ret && has_extension) {
+            cdns_query_extension const* x = NULL;
+
+            ret = c->extension_index < qt->extensions.size();
+            if (ret) {
+                x = &qt->extensions[c->extension_index];
+                ret = x->rpd.is_present == q->rpd.is_present &&
+                    x->rpd.bailiwick_index == q->rpd.bailiwick_index &&
+                    x->rpd.processing_flags == q->rpd.processing_flags &&
+                    CdnsTestCompactExtended(&x->q_extended, &q->q_extended) &&
+                    CdnsTestCompactExtended(&x->r_extended, &q->r_extended);
+            }
+        }
+    }
+
+    for (size_t i = 0; ret && i < rows->tables.q_sigs.size(); i++) {
+        cdns_query_signature const* q_sig = &rows->tables.q_sigs[i];
+        cdns_query_signature_compact const* c = &st->records[i];
+
+        ret = CdnsTestCompactIndex(c->is_present(CDNS_QUERY_SIGNATURE_HAS_SERVER_ADDRESS), c->server_address_index, q_sig->server_address_index) &&
+            CdnsTestCompactIndex(c->is_present(CDNS_QUERY_SIGNATURE_HAS_CLASSTYPE), c->query_classtype_index, q_sig->query_classtype_index) &&
+            CdnsTestCompactIndex(c->is_present(CDNS_QUERY_SIGNATURE_HAS_OPT_RDATA), c->opt_rdata_index, q_sig->opt_rdata_index) &&
+            CdnsTestCompactIndex(c->is_present(CDNS_QUERY_SIGNATURE_HAS_EDNS_VERSION), c->edns_version, q_sig->edns_version) &&
+            c->server_port == q_sig->server_port &&
+            c->qr_transport_flags == q_sig->qr_transport_flags &&
+            c->qr_type == q_sig->qr_type &&
+            c->qr_sig_flags == q_sig->qr_sig_flags &&
+            c->query_opcode == q_sig->query_opcode &&
+            c->qr_dns_flags == q_sig->qr_dns_flags &&
+            c->query_rcode == q_sig->query_rcode &&
+            c->query_qd_count == q_sig->query_qd_count &&
+            c->query_an_count == q_sig->query_an_count &&
+            c->query_ar_count == q_sig->query_ar_count &&
+            c->query_ns_count == q_sig->query_ns_count &&
+            c->udp_buf_size == q_sig->udp_buf_size &&
+            c->response_rcode == q_sig->response_rcode;
+    }
+
+    return ret;
+}
+
+bool CdnsTestCompact::DoTest()
+{
+    char const* test_in[3] = { cbor_in, cdns_in, gold_in };
+    bool ret = true;
+
+    if (2 * sizeof(cdns_query_compact) > sizeof(cdns_query) ||
+        2 * sizeof(cdns_query_signature_compact) > sizeof(cdns_query_signature)) {
+        TEST_LOG("Compact records are too large, %d and %d bytes\n",
+            (int)sizeof(cdns_query_compact), (int)sizeof(cdns_query_signature_compact));
+        ret = false;
+    }
+
+    /* The compact records shall hold the same values as the full records */
+    for (int i = 0; ret && i < 3; i++) {
+        cdns cdns_rows;
+        cdns cdns_compact;
+        int err = 0;
+        int nb_blocks = 0;
+
+        ret = cdns_rows.open(test_in[i]) && cdns_compact.open(test_in[i]) && cdns_compact.enable_compact();
+        while (ret) {
+            int err_compact = 0;
+            bool ret_rows = cdns_rows.open_block(&err);
+            bool ret_compact = cdns_compact.open_block(&err_compact);
+
+            if (ret_rows != ret_compact || err != err_compact) {
+                ret = false;
+            }
+            else if (!ret_rows) {
+                break;
+            }
+            else {
+                nb_blocks++;
+                ret = CdnsTestCompactCompare(&cdns_rows.block, &cdns_compact.block);
+            }
+        }
+
+        if (!ret || err != CBOR_END_OF_ARRAY || nb_blocks == 0) {
+            TEST_LOG("Compact records differ for %s, block %d, err: %d\n", test_in[i], nb_blocks, err);
+            ret = false;
+        }
+    }
+
+    return ret;
+}
+
+CdnsTestProjection::CdnsTestProjection()
+{
+}
+
+CdnsTestProjection::~CdnsTestProjection()
+{
+}
+
+#define CDNS_TEST_PROJECTION (CDNS_PROJECT_QUERIES | CDNS_PROJECT_Q_SIGS | CDNS_PROJECT_NAME_RDATA | CDNS_PROJECT_CLASS_IDS)
+
+/* Compare a block parsed with CDNS_TEST_PROJECTION to the same block fully parsed */
+static bool CdnsTestProjectionCompare(cdnsBlock* full, cdnsBlock* proj)
+{
+    bool ret = proj->projection == CDNS_TEST_PROJECTION &&
+        proj->tables.addresses.size() == 0 &&
+        proj->tables.question_list.size() == 0 &&
+        proj->tables.qrr.size() == 0 &&
+        proj->tables.rr_list.size() == 0 &&
+        proj->tables.rrs.size() == 0 &&
+        proj->address_events.size() == 0 &&
+        proj->tables.name_rdata.size() == full->tables.name_rdata.size() &&
+        proj->tables.class_ids.size() == full->tables.class_ids.size() &&
+        proj->tables.q_sigs.size() == full->tables.q_sigs.size() &&
+        proj->queries.size() == full->queries.size();
+
+    for (size_t i = 0; ret && i < full->queries.size(); i++) {
+        cdns_query* q = &full->queries[i];
+        cdns_query* p = &proj->queries[i];
+
+        ret = p->time_offset_usec == q->time_offset_usec &&
+            p->query_name_index == q->query_name_index &&
+            p->query_signature_index == q->query_signature_index &&
+            p->client_address_index == q->client_address_index &&
+            !p->q_extended.is_filled && !p->r_extended.is_filled &&
+            p->q_extended.question_index == -1 && p->r_extended.answer_index == -1 &&
+            !p->rpd.is_present;
+    }
+
+    return ret;
+}
+
+bool CdnsTestProjection::DoTest()
+{
+    char const* test_in[3] = { cbor_in, cdns_in, gold_in };
+    int const nb_blocks = 6;
+    int nb_rrs = 0;
+    bool ret = true;
+
+    /* The skipped tables are left empty, the other content is unchanged */
+    for (int i = 0; ret && i < 3; i++) {
+        cdns cdns_full;
+        cdns cdns_proj;
+        int err = 0;
+        int nb_read = 0;
+
+        ret = cdns_full.open(test_in[i]) && cdns_proj.open(test_in[i]);
+        while (ret) {
+            int err_proj = 0;
+            bool ret_full = cdns_full.open_block(&err);
+            bool ret_proj = cdns_proj.open_block(&err_proj, CDNS_TEST_PROJECTION);
+
+            if (ret_full != ret_proj || err != err_proj) {
+                ret = false;
+            }
+            else if (!ret_full) {
+                break;
+            }
+            else {
+                nb_read++;
+                nb_rrs += (int)cdns_full.block.tables.rrs.size();
+                ret = CdnsTestProjectionCompare(&cdns_full.block, &cdns_proj.block);
+            }
+        }
+
+        if (!ret || err != CBOR_END_OF_ARRAY || nb_read == 0) {
+            TEST_LOG("Projected blocks differ for %s, block %d, err: %d\n", test_in[i], nb_read, err);
+            ret = false;
+        }
+    }
+
+    if (ret && nb_rrs == 0) {
+        TEST_LOG("%s", "No RR found in the test files\n");
+        ret = false;
+    }
+
+    if (ret) {
+        ret = CdnsTest::MakeMultiBlockFile(cdns_in, projection_multi_block_in, nb_blocks, 1);
+        if (!ret) {
+            TEST_LOG("Could not create: %s\n", projection_multi_block_in);
+        }
+    }
+
+    /* The mask changes at every block. Blocks parsed ahead of time in
+     * prefetch or parallel mode are parsed again with the new mask, except
+     * in streaming mode where the prefetched block keeps the previous mask. */
+    for (int mode = 0; ret && mode < 4; mode++) {
+        cdns cdns_full;
+        cdns cdns_proj;
+        int err = 0;
+        int nb_read = 0;
+
+        ret = cdns_full.open(projection_multi_block_in) &&
+            ((mode == 3) ? cdns_proj.open_stream(projection_multi_block_in) : cdns_proj.open(projection_multi_block_in)) &&
+            (mode != 1 || cdns_proj.enable_prefetch()) && (mode != 2 || cdns_proj.enable_parallel(2, &err)) &&
+            (mode != 3 || cdns_proj.enable_prefetch());
+        while (ret && cdns_full.open_block(&err)) {
+            uint32_t mask = (nb_read & 1) ? CDNS_PROJECT_ALL : CDNS_TEST_PROJECTION;
+
+            ret = cdns_proj.open_block(&err, mask) && (mode == 3 || cdns_proj.block.projection == mask);
+            if (ret && cdns_proj.block.projection == CDNS_PROJECT_ALL) {
+                ret = cdns_proj.block.queries.size() == cdns_full.block.queries.size() &&
+                    cdns_proj.block.tables.rrs.size() == cdns_full.block.tables.rrs.size() &&
+                    cdns_proj.block.address_events.size() == cdns_full.block.address_events.size();
+            }
+            else if (ret) {
+                ret = CdnsTestProjectionCompare(&cdns_full.block, &cdns_proj.block);
+            }
+            nb_read++;
+        }
+
+        if (!ret || nb_read != nb_blocks) {
+            TEST_LOG("Projection fails in mode %d, block %d, err: %d\n", mode, nb_read, err);
+            ret = false;
+        }
+    }
+
+    return ret;
+}
+
+CdnsTestLazy::CdnsTestLazy()
+{
+}
+
+CdnsTestLazy::~CdnsTestLazy()
+{
+}
+
+static bool CdnsTestLazyCompare(cdnsBlock* full, cdnsBlock* lazy)
+{
+    bool ret = lazy->tables.addresses.size() == full->tables.addresses.size() &&
+        lazy->tables.class_ids.size() == full->tables.class_ids.size() &&
+        lazy->tables.name_rdata.size() == full->tables.name_rdata.size() &&
+        lazy->tables.q_sigs.size() == full->tables.q_sigs.size() &&
+        lazy->tables.question_list.size() == full->tables.question_list.size() &&
+        lazy->tables.qrr.size() == full->tables.qrr.size() &&
+        lazy->tables.rr_list.size() == full->tables.rr_list.size() &&
+        lazy->tables.rrs.size() == full->tables.rrs.size() &&
+        lazy->address_events.size() == full->address_events.size() &&
+        lazy->queries.size() == full->queries.size();
+
+    for (size_t i = 0; ret && i < full->tables.name_rdata.size(); i++) {
+        ret = lazy->tables.name_rdata[i].l == full->tables.name_rdata[i].l &&
+            memcmp(lazy->tables.name_rdata[i].v, full->tables.name_rdata[i].v, full->tables.name_rdata[i].l) == 0;
+    }
+
+    for (size_t i = 0; ret && i < full->queries.size(); i++) {
+        cdns_query* q = &full->queries[i];
+        cdns_query* p = &lazy->queries[i];
+
+        ret = p->time_offset_usec == q->time_offset_usec &&
+            p->query_name_index == q->query_name_index &&
+            p->query_signature_index == q->query_signature_index &&
+            p->q_extended.question_index == q->q_extended.question_index &&
+            p->r_extended.answer_index == q->r_extended.answer_index;
+    }
+
+    return ret;
+}
+
+bool CdnsTestLazy::DoTest()
+{
+    char const* test_in[3] = { cbor_in, cdns_in, gold_in };
+    bool ret = true;
+
+    /* Each part is only decoded by materialize, once. In streaming mode, the
+     * parts are copied, because the buffer moves before they are decoded. */
+    for (int i = 0; ret && i < 6; i++) {
+        cdns cdns_full;
+        cdns cdns_lazy;
+        bool is_stream = (i >= 3);
+        int err = 0;
+        int nb_read = 0;
+
+        ret = cdns_full.open(test_in[i % 3]) &&
+            ((is_stream) ? cdns_lazy.open_stream(test_in[i % 3]) : cdns_lazy.open(test_in[i % 3])) &&
+            cdns_lazy.enable_lazy() && (!is_stream || cdns_lazy.enable_prefetch());
+        while (ret) {
+            int err_lazy = 0;
+            bool ret_full = cdns_full.open_block(&err);
+            bool ret_lazy = cdns_lazy.open_block(&err_lazy);
+
+            if (ret_full != ret_lazy || err != err_lazy) {
+                ret = false;
+            }
+            else if (!ret_full) {
+                break;
+            }
+            else {
+                cdnsBlock* b = &cdns_lazy.block;
+
+                nb_read++;
+                ret = !b->is_materialized(CDNS_PROJECT_QUERIES) && b->queries.size() == 0 && b->tables.rrs.size() == 0 &&
+                    b->materialize(CDNS_PROJECT_QUERIES | CDNS_PROJECT_NAME_RDATA, &err_lazy) &&
+                    b->is_materialized(CDNS_PROJECT_QUERIES) && b->queries.size() == cdns_full.block.queries.size() &&
+                    b->tables.rrs.size() == 0 &&
+                    b->materialize(CDNS_PROJECT_ALL, &err_lazy) && b->materialize(CDNS_PROJECT_ALL, &err_lazy) &&
+                    b->is_materialized(CDNS_PROJECT_ALL) &&
+                    CdnsTestLazyCompare(&cdns_full.block, b);
+            }
+        }
+
+        if (!ret || err != CBOR_END_OF_ARRAY || nb_read == 0) {
+            TEST_LOG("Lazy blocks differ for %s%s, block %d, err: %d\n", test_in[i % 3], (is_stream) ? " (stream)" : "", nb_read, err);
+            ret = false;
+        }
+    }
+
+    return ret;
+}
+
+CdnsTestVisitor::CdnsTestVisitor()
+{
+}
+
+CdnsTestVisitor::~CdnsTestVisitor()
+{
+}
+
+/* Print the queries as CdnsTest::DoTest does, and check the batches */
+class CdnsTestVisitorPrinter : public cdns_visitor
+{
+public:
+    CdnsTestVisitorPrinter(cdns* cdns_ctx, FILE* F) :
+        cdns_ctx(cdns_ctx),
+        F(F),
+        nb_tables(0),
+        nb_queries(0),
+        nb_blocks(0),
+        is_wrong(false)
+    {
+    }
+
+    void on_table(cdnsBlock* block, uint32_t table) override
+    {
+        if (block != &cdns_ctx->block || (table & ~(uint32_t)0xff) != 0) {
+            is_wrong = true;
+        }
+        nb_tables++;
+    }
+
+    void on_queries(cdnsBlock* block, cdns_resolved_query const* queries, size_t nb) override
+    {
+        if (block != &cdns_ctx->block || nb == 0 || nb > CDNS_VISIT_BATCH || block->queries.size() != 0) {
+            is_wrong = true;
+        }
+        for (size_t i = 0; i < nb; i++) {
+            CdnsTest::SubmitResolvedQuery(cdns_ctx, &queries[i], F);
+        }
+        nb_queries += nb;
+    }
+
+    void on_block_end(cdnsBlock* block) override
+    {
+        if (block != &cdns_ctx->block || block->queries.size() != 0 || !block->statistics.is_filled) {
+            is_wrong = true;
+        }
+        nb_blocks++;
+    }
+
+    cdns* cdns_ctx;
+    FILE* F;
+    int nb_tables;
+    size_t nb_queries;
+    int nb_blocks;
+    bool is_wrong;
+};
+
+/* Copy the file, moving the queries before the tables in the first block,
+ * so that the visitor has to wait for the tables. */
+static bool CdnsTestVisitorReorder(char const* file_in, std::vector<uint8_t>* out)
+{
+    bool ret = false;
+    cdns cdns_ctx;
+
+    if (cdns_ctx.open(file_in)) {
+        uint8_t const* in = cdns_ctx.buf;
+        uint8_t const* in_max = in + cdns_ctx.buf_read;
+        uint8_t const* items[17];
+        int64_t keys[16];
+        int64_t val;
+        int64_t nb_items = 0;
+        int nb = 0;
+        int err = 0;
+
+        /* Outer array, file type, file preamble, block array, block map */
+        in = cbor_get_number(in, in_max, &val);
+        if (in != NULL) {
+            in = cbor_skip(in, in_max, &err);
+        }
+        if (in != NULL) {
+            in = cbor_skip(in, in_max, &err);
+        }
+        if (in != NULL) {
+            in = cbor_get_number(in, in_max, &val);
+        }
+        if (in != NULL && CBOR_CLASS(*in) == CBOR_T_MAP) {
+            in = cbor_get_number(in, in_max, &nb_items);
+        }
+        else {
+            in = NULL;
+        }
+        if (in != NULL) {
+            out->assign(cdns_ctx.buf, in);
+            while (in != NULL && in < in_max && nb < 16 &&
+                ((nb_items == CBOR_END_OF_ARRAY) ? (*in != CBOR_END_MARK) : (nb < nb_items))) {
+                items[nb] = in;
+                in = cbor_get_number(in, in_max, &keys[nb]);
+                if (in != NULL) {
+                    in = cbor_skip(in, in_max, &err);
+                }
+                nb++;
+            }
+            items[nb] = in;
+            for (int pass = 0; in != NULL && pass < 2; pass++) {
+                for (int i = 0; i < nb; i++) {
+                    if ((keys[i] == 3) == (pass == 0)) {
+                        out->insert(out->end(), items[i], items[i + 1]);
+                        ret |= (keys[i] == 2 && pass == 1);
+                    }
+                }
+            }
+            if (in != NULL) {
+                out->insert(out->end(), in, in_max);
+            }
+            else {
+                ret = false;
+            }
+        }
+    }
+
+    return ret;
+}
+
+bool CdnsTestVisitor::DoTest()
+{
+    char const* test_in[3] = { cbor_in, cdns_in, gold_in };
+    char const* test_ref[3] = { text_ref, text_ref_rfc, text_ref_gold };
+    bool ret = true;
+
+    /* The output must match that of the block parser, with and without
+     * streaming. The visitor is not available in prefetch mode. */
+    for (int i = 0; ret && i < 6; i++) {
+        cdns cdns_ctx;
+        bool is_stream = (i >= 3);
+        int err = 0;
+        FILE* F_out = NULL;
+
+        ret = ((is_stream) ? cdns_ctx.open_stream(test_in[i % 3]) : cdns_ctx.open(test_in[i % 3])) &&
+            cdns_ctx.read_preamble(&err);
+        if (ret) {
+            F_out = cnds_file_open(text_visitor_out, "w");
+            ret = (F_out != NULL);
+        }
+        if (ret) {
+            CdnsTestVisitorPrinter printer(&cdns_ctx, F_out);
+            int nb_read = 0;
+
+            CdnsTest::SubmitPreamble(F_out, &cdns_ctx);
+            fprintf(F_out, "Block start: %ld.%06ld\n",
+                (long)cdns_ctx.block.preamble.earliest_time_sec, (long)cdns_ctx.block.preamble.earliest_time_usec);
+            while (cdns_ctx.visit_block(&printer, &err)) {
+                nb_read++;
+            }
+            (void)fclose(F_out);
+
+            ret = err == CBOR_END_OF_ARRAY && nb_read > 0 && printer.nb_blocks == nb_read &&
+                printer.nb_tables > 0 && printer.nb_queries > 0 && !printer.is_wrong &&
+                CdnsTest::FileCompare(text_visitor_out, test_ref[i % 3]);
+            if (!ret) {
+                TEST_LOG("Visitor fails for %s%s, block %d, err: %d\n", test_in[i % 3], (is_stream) ? " (stream)" : "", nb_read, err);
+            }
+        }
+    }
+
+    if (ret) {
+        std::vector<uint8_t> reordered;
+        cdns cdns_ctx;
+        FILE* F_out = NULL;
+        int err = 0;
+
+        ret = CdnsTestVisitorReorder(cdns_in, &reordered) &&
+            cdns_ctx.open_buffer(reordered.data(), reordered.size()) && cdns_ctx.read_preamble(&err) &&
+            (F_out = cnds_file_open(text_visitor_out, "w")) != NULL;
+        if (ret) {
+            CdnsTestVisitorPrinter printer(&cdns_ctx, F_out);
+
+            CdnsTest::SubmitPreamble(F_out, &cdns_ctx);
+            fprintf(F_out, "Block start: %ld.%06ld\n",
+                (long)cdns_ctx.block.preamble.earliest_time_sec, (long)cdns_ctx.block.preamble.earliest_time_usec);
+            ret = cdns_ctx.visit_block(&printer, &err) && printer.nb_queries > 0 && !printer.is_wrong;
+            (void)fclose(F_out);
+            ret &= CdnsTest::FileCompare(text_visitor_out, text_ref_rfc);
+        }
+        if (!ret) {
+            TEST_LOG("Visitor fails with queries before the tables, err: %d\n", err);
+        }
+    }
+
+    if (ret) {
+        cdns cdns_ctx;
+        CdnsTestVisitorPrinter printer(&cdns_ctx, NULL);
+        int err = 0;
+
+        ret = cdns_ctx.open(cdns_in) && cdns_ctx.enable_prefetch() &&
+            !cdns_ctx.visit_block(&printer, &err) && err == CBOR_NOT_IMPLEMENTED;
+        if (!ret) {
+            TEST_LOG("Visitor accepted in prefetch mode, err: %d\n", err);
+        }
+    }
+
+    return ret;
+}
+
+CdnsTestIterator::CdnsTestIterator()
+{
+}
+
+CdnsTestIterator::~CdnsTestIterator()
+{
+}
+
+static bool CdnsTestIteratorView(cbor_bytes_view const* flat_view, cbor_arena_vector<cbor_bytes_view> const* table, int index, int index_offset)
+{
+    bool ret;
+
+    if (index >= index_offset && (size_t)(index - index_offset) < table->size()) {
+        cbor_bytes_view const* v = &(*table)[(size_t)(index - index_offset)];
+
+        ret = flat_view->l == v->l && (v->l == 0 || memcmp(flat_view->v, v->v, v->l) == 0);
+    }
+    else {
+        ret = flat_view->l == 0;
+    }
+
+    return ret;
+}
+
+/* Join the query by hand, as in SubmitQuery, and compare with the record */
+static bool CdnsTestIteratorCompare(cdns* cdns_ctx, size_t query_index, cdns_flat_query const* flat)
+{
+    cdns_query* q = &cdns_ctx->block.queries[query_index];
+    cdnsBlockTables* tables = &cdns_ctx->block.tables;
+    int index_offset = cdns_ctx->index_offset;
+    bool ret = flat->time_us == cdns_ctx->block.block_start_us + q->time_offset_usec &&
+        flat->query_size == q->query_size && flat->response_size == q->response_size &&
+        flat->client_port == q->client_port && flat->query->transaction_id == q->transaction_id &&
+        CdnsTestIteratorView(&flat->query_name, &tables->name_rdata, q->query_name_index, index_offset) &&
+        CdnsTestIteratorView(&flat->client_address, &tables->addresses, q->client_address_index, index_offset);
+
+    if (ret && q->query_signature_index >= index_offset && (size_t)(q->query_signature_index - index_offset) < tables->q_sigs.size()) {
+        cdns_query_signature* q_sig = &tables->q_sigs[(size_t)(q->query_signature_index - index_offset)];
+
+        ret = flat->q_sig != NULL && flat->opcode == q_sig->query_opcode && flat->query_rcode == q_sig->query_rcode &&
+            flat->response_rcode == q_sig->response_rcode && flat->qr_sig_flags == q_sig->qr_sig_flags &&
+            flat->qr_dns_flags == q_sig->qr_dns_flags && flat->server_port == q_sig->server_port &&
+            flat->transport == (int)q_sig->transport_protocol() && flat->ip_protocol == (int)q_sig->ip_protocol() &&
+            CdnsTestIteratorView(&flat->server_address, &tables->addresses, q_sig->server_address_index, index_offset);
+        if (ret && q_sig->query_classtype_index >= index_offset &&
+            (size_t)(q_sig->query_classtype_index - index_offset) < tables->class_ids.size()) {
+            cdns_class_id* class_id = &tables->class_ids[(size_t)(q_sig->query_classtype_index - index_offset)];
+
+            ret = flat->rr_type == class_id->rr_type && flat->rr_class == class_id->rr_class;
+        }
+        else if (ret) {
+            ret = flat->rr_type == -1 && flat->rr_class == -1;
+        }
+    }
+    else if (ret) {
+        ret = flat->q_sig == NULL && flat->opcode == -1 && flat->rr_type == -1 && flat->server_address.l == 0;
+    }
+
+    return ret;
+}
+
+bool CdnsTestIterator::DoTest()
+{
+    char const* test_in[3] = { iterator_multi_block_in, cbor_in, gold_in };
+    bool ret = CdnsTest::MakeMultiBlockFile(cdns_in, iterator_multi_block_in, 3, 60);
+
+    if (!ret) {
+        TEST_LOG("Cannot create %s\n", iterator_multi_block_in);
+    }
+
+    /* Sequential, prefetch and lazy modes, against the block parser */
+    for (int i = 0; ret && i < 9; i++) {
+        int mode = i / 3;
+        cdns cdns_ref;
+        cdns cdns_it;
+        cdns_query_iterator iterator(&cdns_it);
+        cdns_flat_query flat;
+        int err = 0;
+        int err_it = 0;
+        size_t nb_queries = 0;
+
+        ret = cdns_ref.open(test_in[i % 3]) && cdns_it.open(test_in[i % 3]) &&
+            (mode != 1 || cdns_it.enable_prefetch()) && (mode != 2 || cdns_it.enable_lazy());
+        while (ret && cdns_ref.open_block(&err)) {
+            for (size_t q = 0; ret && q < cdns_ref.block.queries.size(); q++) {
+                ret = iterator.next(&flat, &err_it) && CdnsTestIteratorCompare(&cdns_ref, q, &flat);
+                nb_queries++;
+            }
+        }
+
+        if (!ret || err != CBOR_END_OF_ARRAY || iterator.next(&flat, &err_it) || err_it != CBOR_END_OF_ARRAY || nb_queries == 0) {
+            TEST_LOG("Iterator fails for %s in mode %d, query %zu, err: %d, %d\n", test_in[i % 3], mode, nb_queries, err, err_it);
+            ret = false;
+        }
+    }
+
+    if (ret) {
+        cdns cdns_ctx;
+        cdns_query_iterator iterator(&cdns_ctx);
+        cdns_flat_query flat;
+        int err = 0;
+
+        ret = cdns_ctx.open(cdns_in) && cdns_ctx.enable_columns() &&
+            !iterator.next(&flat, &err) && err == CBOR_NOT_IMPLEMENTED;
+        if (!ret) {
+            TEST_LOG("Iterator accepted the columnar layout, err: %d\n", err);
+        }
+    }
+
+    return ret;
+}
+
+CdnsTestListTable::CdnsTestListTable()
+{
+}
+
+CdnsTestListTable::~CdnsTestListTable()
+{
+}
+
+static bool CdnsTestListTableCheck(cdns_list_table const* lists)
+{
+    bool ret = (lists->offsets.size() == 0) ? (lists->items.size() == 0) :
+        (lists->offsets[0] == 0 && lists->offsets[lists->offsets.size() - 1] == lists->items.size());
+
+    for (size_t i = 1; ret && i < lists->offsets.size(); i++) {
+        ret = lists->offsets[i] >= lists->offsets[i - 1];
+    }
+
+    return ret;
+}
+
+static bool CdnsTestListTableWalk(cdnsBlock* block, cdns_qr_extended const* ext, size_t* nb_walked)
+{
+    cdns_list_view<cdns_question> questions = block->tables.get_questions(ext->question_index);
+    cdns_list_view<cdns_rr_field> sections[3] = {
+        block->tables.get_rrs(ext->answer_index),
+        block->tables.get_rrs(ext->authority_index),
+        block->tables.get_rrs(ext->additional_index) };
+    bool ret = true;
+
+    for (size_t i = 0; ret && i < questions.size(); i++) {
+        ret = questions.at(i) != NULL;
+        (*nb_walked)++;
+    }
+    for (int s = 0; ret && s < 3; s++) {
+        for (size_t i = 0; ret && i < sections[s].size(); i++) {
+            ret = sections[s].at(i) != NULL;
+            (*nb_walked)++;
+        }
+    }
+
+    return ret;
+}
+
+bool CdnsTestListTable::DoTest()
+{
+    uint8_t definite[] = { 0x83, 0x82, 0x01, 0x02, 0x80, 0x81, 0x03 };
+    uint8_t indefinite[] = { 0x9f, 0x9f, 0x01, 0x02, 0xff, 0x80, 0x81, 0x18, 0x64, 0xff };
+    uint8_t truncated[] = { 0x81, 0x82, 0x01 };
+    uint8_t not_array[] = { 0x81, 0xa0 };
+    uint8_t no_end[] = { 0x81, 0x9f, 0x01 };
+    uint8_t* bad[3] = { truncated, not_array, no_end };
+    size_t bad_length[3] = { sizeof(truncated), sizeof(not_array), sizeof(no_end) };
+    char const* test_in[2] = { cbor_in, cdns_in };
+    bool ret = true;
+
+    /* Lists [[1, 2], [], [3]] and [[1, 2], [], [100]] */
+    for (int i = 0; ret && i < 2; i++) {
+        cdns_list_table lists;
+        uint8_t const* in = (i == 0) ? definite : indefinite;
+        size_t length = (i == 0) ? sizeof(definite) : sizeof(indefinite);
+        int err = 0;
+
+        ret = lists.parse(in, in + length, &err) == in + length && CdnsTestListTableCheck(&lists) &&
+            lists.size() == 3 && lists.list_size(0) == 2 && lists.list_size(1) == 0 && lists.list_size(2) == 1 &&
+            lists.list_items(0)[0] == 1 && lists.list_items(0)[1] == 2 && lists.list_items(2)[0] == ((i == 0) ? 3 : 100);
+        if (!ret) {
+            TEST_LOG("List table %d not parsed correctly, err: %d\n", i, err);
+        }
+    }
+
+    for (int i = 0; ret && i < 3; i++) {
+        cdns_list_table lists;
+        int err = 0;
+
+        ret = lists.parse(bad[i], bad[i] + bad_length[i], &err) == NULL && err != 0;
+        if (!ret) {
+            TEST_LOG("Malformed list table %d accepted\n", i);
+        }
+    }
+
+    /* Walk the questions and RRs of all the queries */
+    for (int i = 0; ret && i < 2; i++) {
+        cdns cdns_ctx;
+        int err = 0;
+        size_t nb_walked = 0;
+
+        ret = cdns_ctx.open(test_in[i]);
+        while (ret && cdns_ctx.open_block(&err)) {
+            cdnsBlock* block = &cdns_ctx.block;
+
+            ret = CdnsTestListTableCheck(&block->tables.rr_list) && CdnsTestListTableCheck(&block->tables.question_list);
+            for (size_t q = 0; ret && q < block->queries.size(); q++) {
+                ret = CdnsTestListTableWalk(block, &block->queries[q].q_extended, &nb_walked) &&
+                    CdnsTestListTableWalk(block, &block->queries[q].r_extended, &nb_walked);
+            }
+        }
+
+        if (!ret || err != CBOR_END_OF_ARRAY || nb_walked == 0) {
+            TEST_LOG("Cannot walk the lists of %s, err: %d\n", test_in[i], err);
+            ret = false;
+        }
+    }
+
+    return ret;
+}
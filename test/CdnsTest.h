@@ -30,10 +30,12 @@ public:
     CdnsTest();
     ~CdnsTest();
 
-    static void NamePrint(uint8_t* q_name, size_t q_name_length, FILE* F);
+    static void NamePrint(uint8_t const* q_name, size_t q_name_length, FILE* F);
 
     static void SubmitQuery(cdns* cdns_ctx, size_t query_index, FILE* F);
 
+    static void SubmitResolvedQuery(cdns* cdns_ctx, cdns_resolved_query const* resolved, FILE* F);
+
     static void SubmitPreamble(FILE* F_out, cdns* cdns_ctx);
     static void SubmitStorageParameter(FILE* F_out, cdnsStorageParameter* storage);
     static void SubmitCollectionParameters(FILE* F_out, cdnsCollectionParameters* collection);
@@ -41,6 +43,9 @@ public:
     static bool FileCompare(char const* file_out, char const* file_ref);
 
     bool DoTest(char const* test_in, char const* test_out, char const* test_ref);
+    static bool DoTestCtx(cdns* cdns_ctx, char const* test_out, char const* test_ref);
+
+    static bool MakeMultiBlockFile(char const* file_in, char const* file_out, int nb_blocks, uint32_t time_step_sec);
 
     static void  PrintIntVector(FILE* F_out, std::vector<int>* v_int);
     static void  PrintTextVector(FILE* F_out, std::vector<cbor_text>* v_int);
@@ -104,5 +109,141 @@ public:
     bool DoTest() override;
 };
 
+class CdnsTestMapped : public cdns_test_class
+{
+public:
+    CdnsTestMapped();
+    ~CdnsTestMapped();
+
+    bool DoTest() override;
+};
+class CdnsTestStream : public cdns_test_class
+{
+public:
+    CdnsTestStream();
+    ~CdnsTestStream();
+
+    bool DoTest() override;
+};
+class CdnsTestCompressed : public cdns_test_class
+{
+public:
+    CdnsTestCompressed();
+    ~CdnsTestCompressed();
+
+    bool DoTest() override;
+};
+class CdnsTestBuffer : public cdns_test_class
+{
+public:
+    CdnsTestBuffer();
+    ~CdnsTestBuffer();
+
+    bool DoTest() override;
+};
+class CdnsTestFd : public cdns_test_class
+{
+public:
+    CdnsTestFd();
+    ~CdnsTestFd();
+
+    bool DoTest() override;
+};
+class CdnsTestPrefetch : public cdns_test_class
+{
+public:
+    CdnsTestPrefetch();
+    ~CdnsTestPrefetch();
+
+    bool DoTest() override;
+};
+class CdnsTestBlockIndex : public cdns_test_class
+{
+public:
+    CdnsTestBlockIndex();
+    ~CdnsTestBlockIndex();
+
+    bool DoTest() override;
+};
+class CdnsTestTimeRange : public cdns_test_class
+{
+public:
+    CdnsTestTimeRange();
+    ~CdnsTestTimeRange();
+
+    bool DoTest() override;
+};
+class CdnsTestParallel : public cdns_test_class
+{
+public:
+    CdnsTestParallel();
+    ~CdnsTestParallel();
+
+    bool DoTest() override;
+};
+class CdnsTestReuse : public cdns_test_class
+{
+public:
+    CdnsTestReuse();
+    ~CdnsTestReuse();
+
+    bool DoTest() override;
+};
+class CdnsTestColumns : public cdns_test_class
+{
+public:
+    CdnsTestColumns();
+    ~CdnsTestColumns();
+
+    bool DoTest() override;
+};
+class CdnsTestCompact : public cdns_test_class
+{
+public:
+    CdnsTestCompact();
+    ~CdnsTestCompact();
+
+    bool DoTest() override;
+};
+class CdnsTestProjection : public cdns_test_class
+{
+public:
+    CdnsTestProjection();
+    ~CdnsTestProjection();
+
+    bool DoTest() override;
+};
+class CdnsTestLazy : public cdns_test_class
+{
+public:
+    CdnsTestLazy();
+    ~CdnsTestLazy();
+
+    bool DoTest() override;
+};
+class CdnsTestVisitor : public cdns_test_class
+{
+public:
+    CdnsTestVisitor();
+    ~CdnsTestVisitor();
+
+    bool DoTest() override;
+};
+class CdnsTestIterator : public cdns_test_class
+{
+public:
+    CdnsTestIterator();
+    ~CdnsTestIterator();
+
+    bool DoTest() override;
+};
+class CdnsTestListTable : public cdns_test_class
+{
+public:
+    CdnsTestListTable();
+    ~CdnsTestListTable();
+
+    bool DoTest() override;
+};
 
 #endif
\ No newline at end of file
@@ -16,6 +16,24 @@ enum test_list_enum {
     test_enum_cdns_dump,
     test_enum_cdns_rfc_dump,
     test_enum_gold_dump,
+    test_enum_cdns_mapped,
+    test_enum_cdns_stream,
+    test_enum_cdns_compressed,
+    test_enum_cdns_buffer,
+    test_enum_cdns_fd,
+    test_enum_cdns_prefetch,
+    test_enum_cdns_block_index,
+    test_enum_cdns_time_range,
+    test_enum_cdns_parallel,
+    test_enum_cdns_reuse,
+    test_enum_cdns_columns,
+    test_enum_cdns_compact,
+    test_enum_cdns_projection,
+    test_enum_cdns_lazy,
+    test_enum_cbor_scan,
+    test_enum_cdns_visitor,
+    test_enum_cdns_iterator,
+    test_enum_cdns_list_table,
     test_enum_max_number
 };
 
@@ -51,6 +69,42 @@ char const * cdns_test_class::GetTestName(int number)
         return("cdns_rfc_dump");
     case test_enum_gold_dump:
         return("gold_dump");
+    case test_enum_cdns_mapped:
+        return("cdns_mapped");
+    case test_enum_cdns_stream:
+        return("cdns_stream");
+    case test_enum_cdns_compressed:
+        return("cdns_compressed");
+    case test_enum_cdns_buffer:
+        return("cdns_buffer");
+    case test_enum_cdns_fd:
+        return("cdns_fd");
+    case test_enum_cdns_prefetch:
+        return("cdns_prefetch");
+    case test_enum_cdns_block_index:
+        return("cdns_block_index");
+    case test_enum_cdns_time_range:
+        return("cdns_time_range");
+    case test_enum_cdns_parallel:
+        return("cdns_parallel");
+    case test_enum_cdns_reuse:
+        return("cdns_reuse");
+    case test_enum_cdns_columns:
+        return("cdns_columns");
+    case test_enum_cdns_compact:
+        return("cdns_compact");
+    case test_enum_cdns_projection:
+        return("cdns_projection");
+    case test_enum_cdns_lazy:
+        return("cdns_lazy");
+    case test_enum_cbor_scan:
+        return("cbor_scan");
+    case test_enum_cdns_visitor:
+        return("cdns_visitor");
+    case test_enum_cdns_iterator:
+        return("cdns_iterator");
+    case test_enum_cdns_list_table:
+        return("cdns_list_table");
     default:
         break;
     }
@@ -102,6 +156,60 @@ cdns_test_class * cdns_test_class::TestByNumber(int number)
     case test_enum_gold_dump:
         test = new CdnsGoldDumpTest();
         break;
+    case test_enum_cdns_mapped:
+        test = new CdnsTestMapped();
+        break;
+    case test_enum_cdns_stream:
+        test = new CdnsTestStream();
+        break;
+    case test_enum_cdns_compressed:
+        test = new CdnsTestCompressed();
+        break;
+    case test_enum_cdns_buffer:
+        test = new CdnsTestBuffer();
+        break;
+    case test_enum_cdns_fd:
+        test = new CdnsTestFd();
+        break;
+    case test_enum_cdns_prefetch:
+        test = new CdnsTestPrefetch();
+        break;
+    case test_enum_cdns_block_index:
+        test = new CdnsTestBlockIndex();
+        break;
+    case test_enum_cdns_time_range:
+        test = new CdnsTestTimeRange();
+        break;
+    case test_enum_cdns_parallel:
+        test = new CdnsTestParallel();
+        break;
+    case test_enum_cdns_reuse:
+        test = new CdnsTestReuse();
+        break;
+    case test_enum_cdns_columns:
+        test = new CdnsTestColumns();
+        break;
+    case test_enum_cdns_compact:
+        test = new CdnsTestCompact();
+        break;
+    case test_enum_cdns_projection:
+        test = new CdnsTestProjection();
+        break;
+    case test_enum_cdns_lazy:
+        test = new CdnsTestLazy();
+        break;
+    case test_enum_cbor_scan:
+        test = new CborScanTest();
+        break;
+    case test_enum_cdns_visitor:
+        test = new CdnsTestVisitor();
+        break;
+    case test_enum_cdns_iterator:
+        test = new CdnsTestIterator();
+        break;
+    case test_enum_cdns_list_table:
+        test = new CdnsTestListTable();
+        break;
     default:
         break;
     }